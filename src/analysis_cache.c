@@ -0,0 +1,365 @@
+#include "analysis_cache.h"
+#include "core.h"
+#include "disassembler.h"
+#include "log.h"
+#include "profiler.h"
+#include "sds.h"
+#include "sha1.h"
+#include "stb_ds.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CODE_LENGTH (EMULATOR_MEMORY_SIZE - PROG_BASE)
+#define HEADER_SIZE 5
+
+typedef struct CacheReader {
+	uint8_t *data;
+	size_t length;
+	size_t at;
+	bool failed; // Ran out of data or found something that doesn't fit the ROM
+} CacheReader;
+
+static void put16(uint8_t **out, uint16_t value) {
+	arrput(*out, value & 0xFF);
+	arrput(*out, value >> 8);
+}
+
+static uint8_t get8(CacheReader *reader) {
+	if (reader->at + 1 > reader->length) {
+		reader->failed = true;
+		return 0;
+	}
+	return reader->data[reader->at++];
+}
+
+static uint16_t get16(CacheReader *reader) {
+	uint8_t low = get8(reader);
+	return low | get8(reader) << 8;
+}
+
+// $EO8_CACHE, or eo8 in the user's cache directory. Setting EO8_CACHE to
+// nothing turns the cache off.
+sds analysis_cache_directory(void) {
+	char *directory = getenv("EO8_CACHE");
+	if (directory) {
+		return *directory ? sdsnew(directory) : NULL;
+	}
+	char *cache_home = getenv("XDG_CACHE_HOME");
+	if (cache_home && *cache_home) {
+		return sdscatfmt(sdsempty(), "%s/eo8", cache_home);
+	}
+	char *home = getenv("HOME");
+	if (home && *home) {
+		return sdscatfmt(sdsempty(), "%s/.cache/eo8", home);
+	}
+	return NULL;
+}
+
+static sds cache_path(EmulatorState *emulator) {
+	uint8_t digest[SHA1_SIZE];
+	char hex[SHA1_HEX_SIZE];
+	sha1(emulator->rom, emulator->rom_size, digest);
+	sha1_hex(digest, hex);
+	return sdscatfmt(sdsempty(), "%s/%s.eo8a", emulator->analysis_cache, hex);
+}
+
+// Creates `path` and any directories above it that are missing
+static bool make_directories(sds path) {
+	for (char *slash = strchr(path + 1, '/');; slash = strchr(slash + 1, '/')) {
+		if (slash) {
+			*slash = '\0';
+		}
+		bool made = mkdir(path, 0755) == 0 || errno == EEXIST;
+		if (slash) {
+			*slash = '/';
+		}
+		if (!made || !slash) {
+			return made;
+		}
+	}
+}
+
+// Rebuilds the disassembly from its blocks, checking they cover the code
+// exactly once between them
+static void get_disassembly(CacheReader *reader, Disassembly *disassembly, uint8_t *code) {
+	disassembly->base = PROG_BASE;
+	disassembly->addressbook = calloc(CODE_LENGTH, sizeof(AddressLookup));
+	disassembly->abook_length = CODE_LENGTH;
+
+	uint16_t iblocks = get16(reader);
+	for (uint16_t i = 0; i < iblocks && !reader->failed; ++i) {
+		uint16_t address = get16(reader);
+		uint16_t length = get16(reader);
+		if (!length || address + length * 2 > CODE_LENGTH) {
+			reader->failed = true;
+			break;
+		}
+
+		InstructionBlock block = { 0 };
+		for (uint16_t j = 0; j < length; ++j) {
+			uint16_t ip = address + j * 2;
+			AddressLookup *lookup = &disassembly->addressbook[ip];
+			if (lookup[0].type != ADDR_UNKNOWN || lookup[1].type != ADDR_UNKNOWN) {
+				reader->failed = true;
+				break;
+			}
+			size_t index = disassembly->iblock_length;
+			lookup[0] = (AddressLookup){ index, j, ADDR_INSTRUCTION };
+			lookup[1] = (AddressLookup){ index, j, ADDR_INST_HALF };
+
+			DisassembledInstruction disasm = {
+				.instruction = bytes2inst(code + ip),
+				.address = ip,
+			};
+			arrput(block.instructions, disasm);
+			block.length++;
+		}
+		arrput(disassembly->instruction_blocks, block);
+		disassembly->iblock_length++;
+	}
+
+	uint16_t dblocks = get16(reader);
+	size_t end = 0;
+	for (uint16_t i = 0; i < dblocks && !reader->failed; ++i) {
+		uint16_t address = get16(reader);
+		uint16_t length = get16(reader);
+		if (!length || address < end || address + length > CODE_LENGTH) {
+			reader->failed = true;
+			break;
+		}
+		for (size_t ip = address; ip < address + length && !reader->failed; ++ip) {
+			reader->failed = disassembly->addressbook[ip].type != ADDR_UNKNOWN;
+			disassembly->addressbook[ip].type = ADDR_DATA;
+		}
+		DataBlock block = { code + address, length, address };
+		arrput(disassembly->data_blocks, block);
+		disassembly->dblock_length++;
+		end = address + length;
+	}
+
+	for (size_t ip = 0; ip < CODE_LENGTH && !reader->failed; ++ip) {
+		reader->failed = disassembly->addressbook[ip].type == ADDR_UNKNOWN;
+	}
+
+	uint16_t targets = get16(reader);
+	for (uint16_t i = 0; i < targets && !reader->failed; ++i) {
+		uint16_t target = get16(reader);
+		if (target >= CODE_LENGTH ||
+		    disassembly->addressbook[target].type != ADDR_INSTRUCTION) {
+			reader->failed = true;
+			break;
+		}
+		arrput(disassembly->jump_table_targets, target);
+	}
+}
+
+// Installs the cached analysis of the ROM, returning false if there's none or
+// it doesn't fit the ROM, in which case nothing changes
+bool analysis_cache_load(EmulatorState *emulator) {
+	if (!emulator->analysis_cache || !emulator->rom) {
+		return false;
+	}
+
+	sds path = cache_path(emulator);
+	FILE *file = fopen(path, "rb");
+	if (!file) {
+		sdsfree(path); // Not seen this ROM before
+		return false;
+	}
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	rewind(file);
+	uint8_t *data = malloc(size > 0 ? size : 1);
+	bool read = size > 0 && fread(data, 1, size, file) == (size_t)size;
+	fclose(file);
+
+	CacheReader reader = { data, read ? size : 0, HEADER_SIZE, !read || size < HEADER_SIZE };
+	if (!reader.failed && (memcmp(data, ANALYSIS_CACHE_MAGIC, 4) != 0 ||
+			       data[4] != ANALYSIS_CACHE_VERSION)) {
+		reader.failed = true;
+	}
+	if (!reader.failed && get16(&reader) != emulator->rom_size) {
+		reader.failed = true;
+	}
+
+	Disassembly disassembly = { 0 };
+	uint16_t *runtime_targets = NULL;
+	uint8_t heat[EMULATOR_MEMORY_SIZE] = { 0 };
+	uint8_t *code = emulator->memory + PROG_BASE;
+	if (!reader.failed) {
+		get_disassembly(&reader, &disassembly, code);
+		disassembly.rom_length = emulator->rom_size;
+	}
+
+	uint16_t targets = get16(&reader);
+	for (uint16_t i = 0; i < targets && !reader.failed; ++i) {
+		uint16_t target = get16(&reader);
+		reader.failed = target >= CODE_LENGTH;
+		arrput(runtime_targets, target);
+	}
+
+	uint16_t hot = get16(&reader);
+	for (uint16_t i = 0; i < hot && !reader.failed; ++i) {
+		uint16_t address = get16(&reader);
+		uint8_t value = get8(&reader);
+		reader.failed |= address >= EMULATOR_MEMORY_SIZE;
+		if (!reader.failed) {
+			heat[address] = value;
+		}
+	}
+
+	if (reader.failed || reader.at != reader.length) {
+		log_warn(LOG_CORE, "Ignoring analysis cache %s, as it doesn't fit the ROM", path);
+		free_disassembly(&disassembly);
+		arrfree(runtime_targets);
+		free(data);
+		sdsfree(path);
+		return false;
+	}
+
+	DebugState *debug_state = &emulator->debug_state;
+	debug_state->disassembly = disassembly;
+	for (size_t i = 0; i < (size_t)arrlen(runtime_targets); ++i) {
+		debug_state->jump_targets_seen[PROG_BASE + runtime_targets[i]] = true;
+	}
+	memcpy(debug_state->cached_heat, heat, sizeof(heat));
+	debug_state->cached_jump_targets = arrlen(runtime_targets);
+	debug_state->analysis_cached = true;
+	log_info(LOG_CORE, "Loaded analysis cache %s (%zu runtime jump targets)", path,
+		 (size_t)arrlen(runtime_targets));
+
+	arrfree(runtime_targets);
+	free(data);
+	sdsfree(path);
+	return true;
+}
+
+static void put_disassembly(uint8_t **out, Disassembly *disassembly) {
+	put16(out, disassembly->iblock_length);
+	for (size_t i = 0; i < disassembly->iblock_length; ++i) {
+		InstructionBlock *block = &disassembly->instruction_blocks[i];
+		put16(out, block->instructions[0].address);
+		put16(out, block->length);
+	}
+	put16(out, disassembly->dblock_length);
+	for (size_t i = 0; i < disassembly->dblock_length; ++i) {
+		put16(out, disassembly->data_blocks[i].address);
+		put16(out, disassembly->data_blocks[i].length);
+	}
+	put16(out, arrlen(disassembly->jump_table_targets));
+	for (size_t i = 0; i < (size_t)arrlen(disassembly->jump_table_targets); ++i) {
+		put16(out, disassembly->jump_table_targets[i]);
+	}
+}
+
+// Writes what's known about the ROM so far, if it's more than the cache has.
+// Call before the emulator's state is thrown away.
+void analysis_cache_save(EmulatorState *emulator) {
+	if (!emulator->analysis_cache || !emulator->rom) {
+		return;
+	}
+
+	DebugState *debug_state = &emulator->debug_state;
+	uint16_t *targets = NULL;
+	for (size_t addr = PROG_BASE; addr < EMULATOR_MEMORY_SIZE; ++addr) {
+		if (debug_state->jump_targets_seen[addr]) {
+			arrput(targets, addr - PROG_BASE);
+		}
+	}
+	uint64_t max_count = max_execution_count(debug_state);
+	if (debug_state->analysis_cached && !max_count &&
+	    (size_t)arrlen(targets) == debug_state->cached_jump_targets) {
+		arrfree(targets);
+		return;
+	}
+
+	// The live disassembly follows code as the ROM rewrites it, so what's cached is found from
+	// the ROM as loaded instead. Until anything runs, the two are the same.
+	Disassembly *disassembly = &debug_state->disassembly;
+	Disassembly pristine = { 0 };
+	uint8_t *code = NULL;
+	if (emulator->cycle_count || arrlen(targets)) {
+		code = calloc(CODE_LENGTH, 1);
+		memcpy(code, emulator->rom, emulator->rom_size);
+		pristine = disassemble_rd(code, CODE_LENGTH, emulator->rom_size, PROG_BASE, 0);
+		for (size_t i = 0; i < (size_t)arrlen(targets); ++i) {
+			if (pristine.addressbook[targets[i]].type != ADDR_INSTRUCTION) {
+				disassemble_rd_update(&pristine, code, CODE_LENGTH, targets[i]);
+			}
+		}
+		disassembly = &pristine;
+	}
+
+	uint8_t *out = NULL;
+	arrsetlen(out, HEADER_SIZE);
+	memcpy(out, ANALYSIS_CACHE_MAGIC, 4);
+	out[4] = ANALYSIS_CACHE_VERSION;
+	put16(&out, emulator->rom_size);
+	put_disassembly(&out, disassembly);
+	put16(&out, arrlen(targets));
+	for (size_t i = 0; i < (size_t)arrlen(targets); ++i) {
+		put16(&out, targets[i]);
+	}
+
+	// Heat is relative to the hottest instruction, keeping anything that ran at all above zero.
+	// Without a new profile the last one's kept.
+	uint8_t *heat = debug_state->cached_heat;
+	uint8_t profiled[EMULATOR_MEMORY_SIZE] = { 0 };
+	if (max_count) {
+		for (size_t addr = 0; addr < EMULATOR_MEMORY_SIZE; ++addr) {
+			uint64_t count = debug_state->execution_counts[addr];
+			if (count) {
+				double scaled = (double)(count - 1) / max_count * 254;
+				profiled[addr] = 1 + (uint8_t)scaled;
+			}
+		}
+		heat = profiled;
+	}
+	size_t hot = 0;
+	for (size_t addr = 0; addr < EMULATOR_MEMORY_SIZE; ++addr) {
+		hot += heat[addr] != 0;
+	}
+	put16(&out, hot);
+	for (size_t addr = 0; addr < EMULATOR_MEMORY_SIZE; ++addr) {
+		if (heat[addr]) {
+			put16(&out, addr);
+			arrput(out, heat[addr]);
+		}
+	}
+
+	// Written next to the cache file and renamed over it, so a crash or another instance
+	// never leaves half a file behind
+	sds path = cache_path(emulator);
+	sds temporary = sdscatprintf(sdsempty(), "%s.%ld.tmp", path, (long)getpid());
+	FILE *file = make_directories(emulator->analysis_cache) ? fopen(temporary, "wb") : NULL;
+	bool written = file && fwrite(out, 1, arrlen(out), file) == (size_t)arrlen(out);
+	if (file && fclose(file) != 0) {
+		written = false;
+	}
+	if (written && rename(temporary, path) == 0) {
+		log_debug(LOG_CORE, "Saved analysis cache %s", path);
+		debug_state->analysis_cached = true;
+		debug_state->cached_jump_targets = arrlen(targets);
+	} else {
+		log_warn(LOG_CORE, "Failed to write analysis cache %s", path);
+		if (file) {
+			remove(temporary);
+		}
+	}
+
+	sdsfree(temporary);
+	sdsfree(path);
+	arrfree(out);
+	if (code) {
+		free_disassembly(&pristine);
+		free(code);
+	}
+	arrfree(targets);
+}
@@ -0,0 +1,36 @@
+#ifndef ANALYSIS_CACHE_H
+#define ANALYSIS_CACHE_H
+
+#include "core.h"
+#include "sds.h"
+
+#include <stdbool.h>
+
+// What's worked out about a ROM that only depends on its contents, kept on disk
+// under the ROM's SHA-1 so restarts and resets start warm: the recursive
+// descent disassembly with its statically resolved jump tables, the JMP V0
+// targets only found by running the ROM, and how hot each instruction was in
+// the last profiled run. The control-flow graph and decompilation are built
+// from the disassembly, so they come along with it.
+//
+// A cache file is (all values little endian, counts before each list):
+//
+//   u8  magic[4], version   ANALYSIS_CACHE_MAGIC, ANALYSIS_CACHE_VERSION
+//   u16 rom size
+//   u16 address, length     Per instruction block, in disassembly order
+//   u16 address, length     Per data block
+//   u16 address             Per statically resolved jump table target
+//   u16 address             Per jump target found at runtime
+//   u16 address, u8 heat    Per instruction run in the last profiled run
+//
+// with addresses relative to PROG_BASE like the disassembly's. Instructions are
+// decoded from the ROM again rather than stored.
+
+#define ANALYSIS_CACHE_MAGIC "EO8A"
+#define ANALYSIS_CACHE_VERSION 2 // Bump when the disassembler finds different code
+
+sds analysis_cache_directory(void);
+bool analysis_cache_load(EmulatorState *emulator);
+void analysis_cache_save(EmulatorState *emulator);
+
+#endif // !ANALYSIS_CACHE_H
@@ -0,0 +1,562 @@
+#include "analyze.h"
+#include "core.h"
+#include "disassembler.h"
+#include "instructions.h"
+#include "output.h"
+#include "sha1.h"
+
+#include "sds.h"
+#include "stb_ds.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ANALYZE_MAX_THREADS 64
+
+static const char *ROM_EXTENSIONS[] = { ".ch8", ".c8", ".sc8", ".xo8" };
+
+static const struct {
+	uint32_t flag;
+	const char *name;
+} QUIRK_NAMES[] = {
+	{ CONFIG_CHIP8_VF_RESET, "vf_reset" },
+	{ CONFIG_CHIP8_MEMORY, "memory" },
+	{ CONFIG_CHIP8_SHIFTING, "shifting" },
+	{ CONFIG_CHIP8_JUMPING, "jumping" },
+};
+
+static const struct {
+	uint32_t flag;
+	const char *name;
+} EXTENSION_NAMES[] = {
+	{ ANALYZE_SCHIP, "schip" },
+	{ ANALYZE_XO_CHIP, "xo-chip" },
+};
+
+// Where I may point, as absolute addresses
+typedef struct PointerRange {
+	bool known;
+	uint16_t low;
+	uint16_t high;
+} PointerRange;
+
+// SUPER-CHIP and XO-CHIP opcodes, which CHIP-8 decodes as SYS, DRW with no
+// rows or not at all
+static uint32_t extension_of(Chip8Instruction instruction) {
+	uint16_t raw = instruction.raw;
+	switch (raw >> 12) {
+	case 0x0:
+		if ((raw & 0xFFF0) == 0x00C0 && (raw & 0xF) != 0) {
+			return ANALYZE_SCHIP; // Scroll down
+		} else if (raw >= 0x00FB && raw <= 0x00FF) {
+			return ANALYZE_SCHIP; // Scroll sideways, exit, resolution
+		} else if ((raw & 0xFFF0) == 0x00D0 && (raw & 0xF) != 0) {
+			return ANALYZE_XO_CHIP; // Scroll up
+		}
+		return 0;
+	case 0x5:
+		return (raw & 0xF) == 0x2 || (raw & 0xF) == 0x3 ? ANALYZE_XO_CHIP : 0; // Ranges
+	case 0xD:
+		return (raw & 0xF) == 0 ? ANALYZE_SCHIP : 0; // 16x16 sprites
+	case 0xF:
+		switch (raw & 0xFF) {
+		case 0x30: // Big font
+		case 0x75: // Flags
+		case 0x85:
+			return ANALYZE_SCHIP;
+		case 0x00: // Long LD I
+		case 0x02: // Audio pattern
+			return (raw & 0x0F00) == 0 ? ANALYZE_XO_CHIP : 0;
+		case 0x01: // Planes
+		case 0x3A: // Pitch
+			return ANALYZE_XO_CHIP;
+		default:
+			return 0;
+		}
+	default:
+		return 0;
+	}
+}
+
+static bool ends_run(Chip8InstructionType type, Chip8Instruction instruction) {
+	return type == CHIP8_JMP_ADDR || type == CHIP8_RET || type == CHIP8_JMP_V0_ADDR ||
+	       instruction.raw == 0x00FD;
+}
+
+static bool is_skip(Chip8InstructionType type) {
+	switch (type) {
+	case CHIP8_SE_VX_BYTE:
+	case CHIP8_SNE_VX_BYTE:
+	case CHIP8_SE_VX_VY:
+	case CHIP8_SNE_VX_VY:
+	case CHIP8_SKP_VX:
+	case CHIP8_SKNP_VX:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Whether VF's value before the instruction matters to it, counting Vx and Vy
+// for both shifting quirks and Vx for both jumping ones
+static bool reads_vf(Chip8InstructionType type, Chip8Instruction instruction) {
+	bool x = instruction.rformat.rx == 0xF;
+	bool y = instruction.rformat.ry == 0xF;
+	switch (type) {
+	case CHIP8_SE_VX_BYTE:
+	case CHIP8_SNE_VX_BYTE:
+	case CHIP8_ADD_VX_BYTE:
+	case CHIP8_SKP_VX:
+	case CHIP8_SKNP_VX:
+	case CHIP8_LD_DT_VX:
+	case CHIP8_LD_ST_VX:
+	case CHIP8_ADD_I_VX:
+	case CHIP8_LD_F_VX:
+	case CHIP8_LD_B_VX:
+	case CHIP8_LD_I_VX:
+	case CHIP8_JMP_V0_ADDR:
+		return x;
+	case CHIP8_LD_VX_VY:
+		return y;
+	case CHIP8_SE_VX_VY:
+	case CHIP8_SNE_VX_VY:
+	case CHIP8_OR_VX_VY:
+	case CHIP8_AND_VX_VY:
+	case CHIP8_XOR_VX_VY:
+	case CHIP8_ADD_VX_VY:
+	case CHIP8_SUB_VX_VY:
+	case CHIP8_SUBN_VX_VY:
+	case CHIP8_SHR_VX:
+	case CHIP8_SHL_VX:
+	case CHIP8_DRW_VX_VY_NIBBLE:
+		return x || y;
+	default:
+		return false;
+	}
+}
+
+// Whether the instruction leaves VF with a value that doesn't depend on the
+// vf_reset quirk
+static bool overwrites_vf(Chip8InstructionType type, Chip8Instruction instruction) {
+	switch (type) {
+	case CHIP8_ADD_VX_VY:
+	case CHIP8_SUB_VX_VY:
+	case CHIP8_SUBN_VX_VY:
+	case CHIP8_SHR_VX:
+	case CHIP8_SHL_VX:
+	case CHIP8_DRW_VX_VY_NIBBLE:
+		return true;
+	case CHIP8_LD_VX_BYTE:
+	case CHIP8_LD_VX_VY:
+	case CHIP8_RND_VX_BYTE:
+	case CHIP8_LD_VX_DT:
+	case CHIP8_LD_VX_K:
+	case CHIP8_LD_VX_I:
+		return instruction.rformat.rx == 0xF;
+	default:
+		return false;
+	}
+}
+
+static PointerRange pointer_range(uint32_t low, uint32_t high) {
+	return (PointerRange){ true, low, high > EMULATOR_ADDR_MASK ? EMULATOR_ADDR_MASK : high };
+}
+
+// Either of two states, for instructions a skip may or may not have run
+static PointerRange join(PointerRange a, PointerRange b) {
+	if (!a.known || !b.known) {
+		return (PointerRange){ .known = false };
+	}
+	return pointer_range(a.low < b.low ? a.low : b.low, a.high > b.high ? a.high : b.high);
+}
+
+static bool writes_code(Disassembly *disassembly, PointerRange i, uint32_t bytes) {
+	for (uint32_t address = i.low; address <= i.high + bytes - 1; ++address) {
+		size_t offset = address - disassembly->base;
+		if (address < disassembly->base || offset >= disassembly->abook_length) {
+			continue;
+		}
+		AddressType type = disassembly->addressbook[offset].type;
+		if (type == ADDR_INSTRUCTION || type == ADDR_INST_HALF) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Follows I through straight-line code, run by run, for stores into code and
+// for reads of I that come after LD [I] or LD Vx, [I] left it somewhere that
+// depends on the memory quirk. VF is followed the same way, for reads of the
+// flag an OR, AND or XOR left, which depends on the vf_reset quirk.
+static void scan_runs(RomAnalysis *analysis, Disassembly *disassembly) {
+	for (size_t b = 0; b < disassembly->iblock_length; ++b) {
+		InstructionBlock *block = &disassembly->instruction_blocks[b];
+		PointerRange i = { .known = false };
+		bool moved_by_memory = false; // Since the last LD I
+		bool vf_from_logic = false; // Since VF was last overwritten
+		bool skipped = false; // The previous instruction may skip this one
+		for (size_t n = 0; n < block->length; ++n) {
+			DisassembledInstruction *disasm = &block->instructions[n];
+			if (n > 0 && disasm->address != block->instructions[n - 1].address + 2) {
+				i.known = moved_by_memory = vf_from_logic = skipped = false;
+			}
+
+			Chip8Instruction instruction = disasm->instruction;
+			Chip8InstructionType type = instruction_type(instruction);
+			uint8_t x = instruction.iformat.reg;
+			PointerRange after = i;
+			bool reads_i = false;
+			switch (type) {
+			case CHIP8_LD_I_ADDR:
+				after = pointer_range(instruction.aformat.addr,
+						      instruction.aformat.addr);
+				break;
+			case CHIP8_ADD_I_VX:
+				reads_i = true;
+				after = i.known ? pointer_range(i.low, i.high + 0xFF) : i;
+				break;
+			case CHIP8_LD_F_VX:
+				after = pointer_range(FONT_BASE_ADDR, FONT_BASE_ADDR + 5 * 16 - 1);
+				break;
+			case CHIP8_DRW_VX_VY_NIBBLE:
+				reads_i = true;
+				break;
+			case CHIP8_LD_B_VX:
+				reads_i = true;
+				analysis->self_modifying |=
+					i.known && writes_code(disassembly, i, 3);
+				break;
+			case CHIP8_LD_I_VX:
+			case CHIP8_LD_VX_I:
+				reads_i = true;
+				if (type == CHIP8_LD_I_VX) {
+					analysis->self_modifying |=
+						i.known && writes_code(disassembly, i, x + 1);
+				}
+				// Where I is left is up to the quirk, so either
+				after = i.known ? pointer_range(i.low, i.high + x + 1) : i;
+				break;
+			case CHIP8_CALL_ADDR:
+				after.known = false;
+				break;
+			default:
+				break;
+			}
+
+			if (reads_i && moved_by_memory) {
+				analysis->quirks |= CONFIG_CHIP8_MEMORY;
+			}
+			if (type == CHIP8_LD_I_VX || type == CHIP8_LD_VX_I) {
+				moved_by_memory = true;
+			} else if (type == CHIP8_LD_I_ADDR || type == CHIP8_LD_F_VX ||
+				   type == CHIP8_CALL_ADDR) {
+				moved_by_memory &= skipped;
+			}
+			i = skipped ? join(i, after) : after;
+
+			if (vf_from_logic && reads_vf(type, instruction)) {
+				analysis->quirks |= CONFIG_CHIP8_VF_RESET;
+			}
+			if (type == CHIP8_OR_VX_VY || type == CHIP8_AND_VX_VY ||
+			    type == CHIP8_XOR_VX_VY) {
+				vf_from_logic = true;
+			} else if (overwrites_vf(type, instruction) || type == CHIP8_CALL_ADDR) {
+				vf_from_logic &= skipped;
+			}
+
+			skipped = is_skip(type);
+			if (ends_run(type, instruction)) {
+				i.known = moved_by_memory = vf_from_logic = skipped = false;
+			}
+		}
+	}
+}
+
+static uint32_t quirks_of(Chip8InstructionType type, Chip8Instruction instruction) {
+	switch (type) {
+	case CHIP8_SHR_VX:
+	case CHIP8_SHL_VX:
+		// Shifting Vy into Vx only differs from shifting Vx in place if they differ
+		return instruction.rformat.rx != instruction.rformat.ry ? CONFIG_CHIP8_SHIFTING : 0;
+	case CHIP8_JMP_V0_ADDR:
+		// Bxnn adds Vx rather than V0, the same register when x is 0
+		return instruction.iformat.reg != 0 ? CONFIG_CHIP8_JUMPING : 0;
+	default:
+		return 0;
+	}
+}
+
+void analyze_rom(RomAnalysis *analysis, uint8_t *rom, size_t size) {
+	analysis->size = size;
+	sha1(rom, size, analysis->sha1);
+
+	// Zero-padded to whole instructions, the way the emulator loads it
+	uint8_t code[EMULATOR_MAX_ROM_SIZE] = { 0 };
+	analysis->truncated = size > EMULATOR_MAX_ROM_SIZE;
+	size_t length = analysis->truncated ? EMULATOR_MAX_ROM_SIZE : size;
+	memcpy(code, rom, length);
+	length += length % 2;
+
+	Disassembly disassembly = disassemble_rd(code, length, length, PROG_BASE, 0);
+	for (size_t b = 0; b < disassembly.iblock_length; ++b) {
+		InstructionBlock *block = &disassembly.instruction_blocks[b];
+		for (size_t n = 0; n < block->length; ++n) {
+			Chip8Instruction instruction = block->instructions[n].instruction;
+			Chip8InstructionType type = instruction_type(instruction);
+			analysis->mix[type]++;
+			analysis->jump_v0 += type == CHIP8_JMP_V0_ADDR;
+			analysis->quirks |= quirks_of(type, instruction);
+			analysis->extensions |= extension_of(instruction);
+		}
+		analysis->instructions += block->length;
+	}
+	for (size_t d = 0; d < disassembly.dblock_length; ++d) {
+		analysis->data_bytes += disassembly.data_blocks[d].length;
+	}
+	analysis->jump_table_targets = arrlen(disassembly.jump_table_targets);
+	scan_runs(analysis, &disassembly);
+	free_disassembly(&disassembly);
+}
+
+static bool is_rom_name(const char *name) {
+	const char *extension = strrchr(name, '.');
+	if (extension == NULL) {
+		return false;
+	}
+	for (size_t i = 0; i < ARRAY_SIZE(ROM_EXTENSIONS); ++i) {
+		if (strcasecmp(extension, ROM_EXTENSIONS[i]) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Every ROM under `directory` into `paths`. Symbolic links to ROMs count, but
+// links to directories aren't followed, so there's no going round in circles.
+// Subdirectories that can't be opened are skipped with a warning.
+static bool find_roms(const char *directory, char ***paths) {
+	DIR *dir = opendir(directory);
+	if (dir == NULL) {
+		fprintf(stderr, "[!] Failed to open directory %s\n", directory);
+		return false;
+	}
+
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (entry->d_name[0] == '.') {
+			continue; // Hidden, or the directory itself and its parent
+		}
+		sds path = sdscatfmt(sdsempty(), "%s/%s", directory, entry->d_name);
+		struct stat info;
+		if (lstat(path, &info) == 0 && S_ISDIR(info.st_mode)) {
+			find_roms(path, paths);
+		} else if (stat(path, &info) == 0 && S_ISREG(info.st_mode) &&
+			   is_rom_name(entry->d_name)) {
+			arrput(*paths, strdup(path));
+		}
+		sdsfree(path);
+	}
+	closedir(dir);
+	return true;
+}
+
+static uint8_t *load_file(const char *path, size_t *size) {
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) {
+		return NULL;
+	}
+	fseek(file, 0, SEEK_END);
+	long length = ftell(file);
+	rewind(file);
+	uint8_t *data = length >= 0 ? malloc(length + 1) : NULL;
+	if (data != NULL && fread(data, 1, length, file) != (size_t)length) {
+		free(data);
+		data = NULL;
+	}
+	fclose(file);
+	*size = length;
+	return data;
+}
+
+typedef struct AnalyzeJob {
+	RomAnalysis *results;
+	size_t count;
+	atomic_size_t next;
+} AnalyzeJob;
+
+// Takes ROMs one at a time until there are none left, so that a few big ones
+// don't hold up the rest
+static void *analyze_worker(void *arg) {
+	AnalyzeJob *job = arg;
+	for (;;) {
+		size_t index = atomic_fetch_add(&job->next, 1);
+		if (index >= job->count) {
+			break;
+		}
+		RomAnalysis *analysis = &job->results[index];
+		size_t size;
+		uint8_t *rom = load_file(analysis->path, &size);
+		if (rom == NULL) {
+			analysis->failed = true;
+			continue;
+		}
+		analyze_rom(analysis, rom, size);
+		free(rom);
+	}
+	return NULL;
+}
+
+static void write_analysis(Output *output, RomAnalysis *analysis) {
+	output_str(output, "{\"path\":");
+	output_json_string(output, analysis->path);
+	if (analysis->failed) {
+		output_str(output, ",\"error\":\"unreadable\"}\n");
+		return;
+	}
+
+	char hash[SHA1_HEX_SIZE];
+	sha1_hex(analysis->sha1, hash);
+	output_str(output, ",\"sha1\":\"");
+	output_str(output, hash);
+	output_str(output, "\",\"size\":");
+	output_dec(output, analysis->size);
+	if (analysis->truncated) {
+		output_str(output, ",\"truncated\":true");
+	}
+	output_str(output, ",\"instructions\":");
+	output_dec(output, analysis->instructions);
+	output_str(output, ",\"data_bytes\":");
+	output_dec(output, analysis->data_bytes);
+
+	output_str(output, ",\"mix\":{");
+	bool first = true;
+	for (int type = 0; type <= CHIP8_UNKNOWN; ++type) {
+		if (analysis->mix[type] > 0) {
+			output_str(output, first ? "\"" : ",\"");
+			output_str(output, instruction_form(type));
+			output_str(output, "\":");
+			output_dec(output, analysis->mix[type]);
+			first = false;
+		}
+	}
+
+	output_str(output, "},\"jmp_v0\":");
+	output_dec(output, analysis->jump_v0);
+	output_str(output, ",\"jmp_v0_targets\":");
+	output_dec(output, analysis->jump_table_targets);
+	output_str(output, ",\"self_modifying\":");
+	output_str(output, analysis->self_modifying ? "true" : "false");
+
+	output_str(output, ",\"quirks\":[");
+	first = true;
+	for (size_t q = 0; q < ARRAY_SIZE(QUIRK_NAMES); ++q) {
+		if (analysis->quirks & QUIRK_NAMES[q].flag) {
+			output_str(output, first ? "\"" : ",\"");
+			output_str(output, QUIRK_NAMES[q].name);
+			output_char(output, '"');
+			first = false;
+		}
+	}
+	output_str(output, "],\"extensions\":[");
+	first = true;
+	for (size_t e = 0; e < ARRAY_SIZE(EXTENSION_NAMES); ++e) {
+		if (analysis->extensions & EXTENSION_NAMES[e].flag) {
+			output_str(output, first ? "\"" : ",\"");
+			output_str(output, EXTENSION_NAMES[e].name);
+			output_char(output, '"');
+			first = false;
+		}
+	}
+	output_str(output, "]}\n");
+}
+
+static int compare_paths(const void *a, const void *b) {
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Analyses every ROM under `directory` on `threads` threads (0 for one per
+// core), writing the index as JSON lines
+bool analyze_directory(const char *directory, const char *index_path, int threads) {
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	char **paths = NULL;
+	if (!find_roms(directory, &paths)) {
+		return false;
+	}
+	if (arrlen(paths) > 1) { // NULL without any, which qsort() mustn't see
+		qsort(paths, arrlen(paths), sizeof(char *), compare_paths);
+	}
+
+	int fd = open(index_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "[!] Failed to open %s\n", index_path);
+		for (size_t p = 0; p < (size_t)arrlen(paths); ++p) {
+			free(paths[p]);
+		}
+		arrfree(paths);
+		return false;
+	}
+
+	AnalyzeJob job = { .results = calloc(arrlen(paths), sizeof(RomAnalysis)),
+			   .count = arrlen(paths) };
+	atomic_init(&job.next, 0);
+	for (size_t p = 0; p < job.count; ++p) {
+		job.results[p].path = paths[p];
+	}
+
+	if (threads <= 0) {
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	threads = threads < 1 ? 1 : threads > ANALYZE_MAX_THREADS ? ANALYZE_MAX_THREADS : threads;
+	threads = (size_t)threads > job.count ? (int)job.count : threads;
+	pthread_t workers[ANALYZE_MAX_THREADS];
+	int started = 0;
+	for (; started < threads; ++started) {
+		if (pthread_create(&workers[started], NULL, analyze_worker, &job) != 0) {
+			break;
+		}
+	}
+	if (started == 0) {
+		analyze_worker(&job); // Then on this thread alone
+	}
+	for (int t = 0; t < started; ++t) {
+		pthread_join(workers[t], NULL);
+	}
+
+	Output *output = malloc(sizeof(Output));
+	output_open_fd(output, fd);
+	size_t failed = 0;
+	for (size_t p = 0; p < job.count; ++p) {
+		write_analysis(output, &job.results[p]);
+		failed += job.results[p].failed;
+		free(paths[p]);
+	}
+	bool written = output_flush(output);
+	free(output);
+	close(fd);
+	free(job.results);
+	arrfree(paths);
+
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	if (!written) {
+		fprintf(stderr, "[!] Failed to write %s\n", index_path);
+		return false;
+	}
+	printf("Indexed %zu ROMs (%zu unreadable) on %d threads in %.3fs\n", job.count, failed,
+	       started > 0 ? started : 1, seconds);
+	return true;
+}
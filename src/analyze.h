@@ -0,0 +1,45 @@
+#ifndef ANALYZE_H
+#define ANALYZE_H
+
+#include "instructions.h"
+#include "sha1.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Static analysis of whole directories of ROMs, for indexing collections.
+// ROMs are disassembled by recursive descent on a pool of threads, and each
+// becomes a JSON line in the index, in path order.
+//
+// Everything is found without running the ROMs, so like the value-set
+// analysis it's best effort. Quirks and extensions are what the reachable
+// code uses, not what it necessarily relies on, but for vf_reset, which is
+// only reported where VF is read after an OR, AND or XOR in the same run.
+// Self-modifying code is only seen where the block writing it sets I to a
+// constant first.
+
+#define ANALYZE_SCHIP 0b1
+#define ANALYZE_XO_CHIP 0b10
+
+typedef struct RomAnalysis {
+	char *path;
+	bool failed; // Couldn't be read
+	size_t size;
+	bool truncated; // Longer than fits in memory, so only the start is disassembled
+	uint8_t sha1[SHA1_SIZE];
+
+	uint32_t instructions; // Reachable from the entry point
+	uint32_t mix[CHIP8_UNKNOWN + 1];
+	uint32_t data_bytes;
+	uint32_t jump_v0; // JMP V0 instructions
+	uint32_t jump_table_targets; // Their targets resolved statically
+	bool self_modifying;
+	uint32_t quirks; // CONFIG_CHIP8_* whose setting changes what the code does
+	uint32_t extensions; // ANALYZE_*
+} RomAnalysis;
+
+void analyze_rom(RomAnalysis *analysis, uint8_t *rom, size_t size);
+bool analyze_directory(const char *directory, const char *index_path, int threads);
+
+#endif // !ANALYZE_H
@@ -69,7 +69,7 @@ Chip8Instruction parse_line(char *line, size_t line_num, char **out_label) {
 	// NOTE: Could be switched out for nested switch statements,
 	// but the number of keywords is tiny that I doubt there'll
 	// be many benfits over simple strncmp.
-	Chip8Instruction instruction;
+	Chip8Instruction instruction = { 0 }; // Stays 0 for labels and unknown opcodes
 	if (strncmp("CLS", opcode, opcode_len) == 0) {
 		instruction = INST_CLS;
 	} else if (strncmp("RET", opcode, opcode_len) == 0) {
@@ -214,7 +214,12 @@ Chip8Instruction parse_line(char *line, size_t line_num, char **out_label) {
 // than this current lexerless parsing. Would likely make it
 // more robust.
 uint8_t *assemble(char *source_filename) {
-	// TODO: Debugging symbols
+	return assemble_with_lines(source_filename, NULL);
+}
+
+// Also fills `lines` (an stb_ds array, if not NULL) with each instruction's
+// address and source line
+uint8_t *assemble_with_lines(char *source_filename, SourceLine **lines) {
 	bool valid = true;
 
 	uint8_t *data = NULL;
@@ -231,6 +236,11 @@ uint8_t *assemble(char *source_filename) {
 	} *to_patch = NULL;
 
 	FILE *source = fopen(source_filename, "r");
+	if (!source) {
+		fprintf(stderr, "[!] Failed to open %s\n", source_filename);
+		shfree(labels);
+		return NULL;
+	}
 	char line[MAX_LINE_LENGTH];
 	size_t line_num = 0;
 	uint8_t byte = 0;
@@ -325,6 +335,10 @@ uint8_t *assemble(char *source_filename) {
 				valid = false;
 			}
 		} else {
+			if (lines) {
+				SourceLine source_line = { PROG_BASE + arrlen(data), line_num };
+				arrput(*lines, source_line);
+			}
 			arrput(data, (instruction.raw & 0xff00) >> 8);
 			arrput(data, instruction.raw & 0xff);
 			last_processed_label = false;
@@ -359,6 +373,10 @@ uint8_t *assemble(char *source_filename) {
 	hmfree(to_patch);
 
 	if (!valid) {
+		arrfree(data);
+		if (lines) {
+			arrfree(*lines);
+		}
 		return NULL;
 	}
 
@@ -3,6 +3,13 @@
 
 #include <stdint.h>
 
+// Where each assembled instruction came from, for debuggers
+typedef struct SourceLine {
+	uint16_t address;
+	uint32_t line; // 1-based
+} SourceLine;
+
 uint8_t *assemble(char *source_filename);
+uint8_t *assemble_with_lines(char *source_filename, SourceLine **lines);
 
 #endif // !ASSEMBLER_H
@@ -0,0 +1,241 @@
+#include "call_graph.h"
+#include "sds.h"
+#include "stb_ds.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Opens the root frame, which covers everything outside subroutines. Resuming
+// after call_graph_settle() keeps the totals so far.
+void call_graph_begin(CallGraph *graph, uint64_t cycle) {
+	if (!graph->length) {
+		graph->nodes[CALL_GRAPH_ROOT] = (CallNode){
+			.parent = CALL_GRAPH_NONE,
+			.first_child = CALL_GRAPH_NONE,
+			.next_sibling = CALL_GRAPH_NONE,
+			.calls = 1,
+		};
+		graph->length = 1;
+	}
+	graph->frames[0] = (CallFrame){ CALL_GRAPH_ROOT, cycle, 0 };
+	graph->depth = 1;
+}
+
+// Finds or adds the node for calling `entry` from `parent`
+static int16_t child_node(CallGraph *graph, int16_t parent, uint16_t entry) {
+	int16_t last = CALL_GRAPH_NONE;
+	for (int16_t child = graph->nodes[parent].first_child; child != CALL_GRAPH_NONE;
+	     child = graph->nodes[child].next_sibling) {
+		if (graph->nodes[child].entry == entry) {
+			return child;
+		}
+		last = child;
+	}
+	if (graph->length == CALL_GRAPH_MAX_NODES) {
+		return CALL_GRAPH_NONE;
+	}
+
+	int16_t child = graph->length++;
+	graph->nodes[child] = (CallNode){
+		.entry = entry,
+		.parent = parent,
+		.first_child = CALL_GRAPH_NONE,
+		.next_sibling = CALL_GRAPH_NONE,
+	};
+	if (last == CALL_GRAPH_NONE) {
+		graph->nodes[parent].first_child = child;
+	} else {
+		graph->nodes[last].next_sibling = child;
+	}
+	return child;
+}
+
+// Call after a CALL, with the cycle count including it
+void call_graph_enter(CallGraph *graph, uint16_t entry, uint64_t cycle) {
+	if (!graph->depth) {
+		call_graph_begin(graph, cycle);
+	}
+	if (graph->depth == CALL_GRAPH_MAX_DEPTH) {
+		graph->overflow++;
+		graph->dropped_calls++;
+		return;
+	}
+
+	// Without a node, the callee's cycles stay with the caller
+	CallFrame *caller = &graph->frames[graph->depth - 1];
+	int16_t node = caller->node == CALL_GRAPH_NONE ?
+			       CALL_GRAPH_NONE :
+			       child_node(graph, caller->node, entry);
+	if (node == CALL_GRAPH_NONE) {
+		graph->dropped_calls++;
+	} else {
+		graph->nodes[node].calls++;
+	}
+	graph->frames[graph->depth++] = (CallFrame){ node, cycle, 0 };
+}
+
+// Call after a RET, with the cycle count including it
+void call_graph_leave(CallGraph *graph, uint64_t cycle) {
+	if (graph->overflow) {
+		graph->overflow--;
+		return;
+	}
+	if (graph->depth <= 1) {
+		return; // Returning from a call made before profiling started
+	}
+
+	CallFrame *frame = &graph->frames[--graph->depth];
+	uint64_t elapsed = cycle - frame->start_cycle;
+	if (frame->node != CALL_GRAPH_NONE) {
+		CallNode *node = &graph->nodes[frame->node];
+		node->inclusive_cycles += elapsed;
+		node->exclusive_cycles += elapsed - frame->child_cycles;
+		graph->frames[graph->depth - 1].child_cycles += elapsed;
+	}
+}
+
+// Closes every open call
+static void call_graph_unwind(CallGraph *graph, uint64_t cycle) {
+	graph->overflow = 0;
+	while (graph->depth > 1) {
+		call_graph_leave(graph, cycle);
+	}
+}
+
+// Closes every open call and the root, so the totals cover everything up to
+// `cycle`. Used when profiling stops, and on copies of the graph about to be
+// reported on.
+void call_graph_settle(CallGraph *graph, uint64_t cycle) {
+	if (!graph->depth) {
+		return;
+	}
+	call_graph_unwind(graph, cycle);
+
+	CallNode *root = &graph->nodes[CALL_GRAPH_ROOT];
+	uint64_t elapsed = cycle - graph->frames[0].start_cycle;
+	root->inclusive_cycles += elapsed;
+	root->exclusive_cycles += elapsed - graph->frames[0].child_cycles;
+	graph->depth = 0;
+}
+
+typedef struct SubroutineTotals {
+	uint64_t inclusive_cycles;
+	uint64_t exclusive_cycles;
+	uint64_t calls;
+	uint16_t entry;
+} SubroutineTotals;
+
+static int compare_inclusive_cycles(const void *a, const void *b) {
+	uint64_t cycles_a = ((SubroutineTotals *)a)->inclusive_cycles;
+	uint64_t cycles_b = ((SubroutineTotals *)b)->inclusive_cycles;
+	return cycles_a < cycles_b ? 1 : cycles_a > cycles_b ? -1 : 0;
+}
+
+// Whether a node's subroutine is already on the path above it (recursion)
+static bool is_recursive(CallGraph *graph, int16_t node) {
+	for (int16_t parent = graph->nodes[node].parent; parent > CALL_GRAPH_ROOT;
+	     parent = graph->nodes[parent].parent) {
+		if (graph->nodes[parent].entry == graph->nodes[node].entry) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Totals per subroutine over every path it was called from
+sds call_graph2str(CallGraph *graph, uint64_t cycle) {
+	CallGraph *settled = malloc(sizeof(CallGraph));
+	memcpy(settled, graph, sizeof(CallGraph));
+	call_graph_settle(settled, cycle);
+	if (!settled->length) {
+		free(settled);
+		return sdsnew("No subroutine calls profiled\n");
+	}
+
+	SubroutineTotals *subroutines = NULL;
+	int index[1 << 12];
+	memset(index, -1, sizeof(index));
+	for (int i = CALL_GRAPH_ROOT + 1; i < settled->length; ++i) {
+		CallNode *node = &settled->nodes[i];
+		uint16_t entry = node->entry & 0xFFF;
+		if (index[entry] < 0) {
+			index[entry] = arrlen(subroutines);
+			SubroutineTotals totals = { .entry = entry };
+			arrput(subroutines, totals);
+		}
+
+		SubroutineTotals *totals = &subroutines[index[entry]];
+		totals->calls += node->calls;
+		totals->exclusive_cycles += node->exclusive_cycles;
+		if (!is_recursive(settled, i)) {
+			totals->inclusive_cycles += node->inclusive_cycles;
+		}
+	}
+	if (arrlen(subroutines) > 1) { // NULL without any, which qsort() mustn't see
+		qsort(subroutines, arrlen(subroutines), sizeof(SubroutineTotals),
+		      compare_inclusive_cycles);
+	}
+
+	CallNode *root = &settled->nodes[CALL_GRAPH_ROOT];
+	uint64_t total = root->inclusive_cycles ? root->inclusive_cycles : 1;
+	sds out = sdscatprintf(sdsempty(),
+			       "Cycles profiled: %" PRIu64 "\n\n"
+			       "     Calls       Inclusive       Exclusive  Subroutine\n"
+			       "%10s  %10" PRIu64 " %3.0f%%  %10" PRIu64 " %3.0f%%  main\n",
+			       root->inclusive_cycles, "-", root->inclusive_cycles, 100.0,
+			       root->exclusive_cycles, 100.0 * root->exclusive_cycles / total);
+	for (size_t i = 0; i < (size_t)arrlen(subroutines); ++i) {
+		SubroutineTotals *totals = &subroutines[i];
+		out = sdscatprintf(out,
+				   "%10" PRIu64 "  %10" PRIu64 " %3.0f%%  %10" PRIu64
+				   " %3.0f%%  sub_0x%03hx\n",
+				   totals->calls, totals->inclusive_cycles,
+				   100.0 * totals->inclusive_cycles / total,
+				   totals->exclusive_cycles,
+				   100.0 * totals->exclusive_cycles / total, totals->entry);
+	}
+	if (settled->dropped_calls) {
+		out = sdscatprintf(out,
+				   "\n%" PRIu64 " calls were too deep or past the node limit, and "
+				   "are counted in their callers\n",
+				   settled->dropped_calls);
+	}
+
+	arrfree(subroutines);
+	free(settled);
+	return out;
+}
+
+// One line per call path with its exclusive cycles, e.g.
+// "main;sub_0x2a0;sub_0x31c 1234", as read by flame graph tools
+sds call_graph2collapsed(CallGraph *graph, uint64_t cycle) {
+	CallGraph *settled = malloc(sizeof(CallGraph));
+	memcpy(settled, graph, sizeof(CallGraph));
+	call_graph_settle(settled, cycle);
+
+	sds out = sdsempty();
+	for (int i = 0; i < settled->length; ++i) {
+		if (!settled->nodes[i].exclusive_cycles) {
+			continue;
+		}
+
+		int16_t path[CALL_GRAPH_MAX_DEPTH];
+		int length = 0;
+		for (int16_t node = i; node > CALL_GRAPH_ROOT && length < CALL_GRAPH_MAX_DEPTH;
+		     node = settled->nodes[node].parent) {
+			path[length++] = node;
+		}
+
+		out = sdscat(out, "main");
+		while (length--) {
+			out = sdscatprintf(out, ";sub_0x%03hx", settled->nodes[path[length]].entry);
+		}
+		out = sdscatprintf(out, " %" PRIu64 "\n", settled->nodes[i].exclusive_cycles);
+	}
+
+	free(settled);
+	return out;
+}
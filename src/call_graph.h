@@ -0,0 +1,52 @@
+#ifndef CALL_GRAPH_H
+#define CALL_GRAPH_H
+
+#include "sds.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Shadow call stack built from CALL/RET while profiling. Every distinct call
+// path gets a node, with the cycles spent inside it (inclusive) and in its own
+// code (exclusive). Everything lives in fixed-size arrays so a copy of the
+// graph in an emulator snapshot is self-contained.
+
+#define CALL_GRAPH_MAX_NODES 1024
+#define CALL_GRAPH_MAX_DEPTH 32
+#define CALL_GRAPH_ROOT 0
+#define CALL_GRAPH_NONE -1
+
+typedef struct CallNode {
+	uint16_t entry; // Subroutine address, unused for the root
+	int16_t parent;
+	int16_t first_child;
+	int16_t next_sibling;
+	uint64_t calls;
+	uint64_t inclusive_cycles;
+	uint64_t exclusive_cycles;
+} CallNode;
+
+typedef struct CallFrame {
+	int16_t node;
+	uint64_t start_cycle;
+	uint64_t child_cycles; // Inclusive cycles of calls that have returned
+} CallFrame;
+
+typedef struct CallGraph {
+	CallNode nodes[CALL_GRAPH_MAX_NODES];
+	int length; // 0 until call_graph_begin()
+	CallFrame frames[CALL_GRAPH_MAX_DEPTH];
+	int depth; // 0 while settled
+	int overflow; // Calls past CALL_GRAPH_MAX_DEPTH that haven't returned yet
+	uint64_t dropped_calls; // Calls too deep or with no room for a new node
+} CallGraph;
+
+void call_graph_begin(CallGraph *graph, uint64_t cycle);
+void call_graph_enter(CallGraph *graph, uint16_t entry, uint64_t cycle);
+void call_graph_leave(CallGraph *graph, uint64_t cycle);
+void call_graph_settle(CallGraph *graph, uint64_t cycle);
+
+sds call_graph2str(CallGraph *graph, uint64_t cycle);
+sds call_graph2collapsed(CallGraph *graph, uint64_t cycle);
+
+#endif // !CALL_GRAPH_H
@@ -0,0 +1,841 @@
+#include "cfg.h"
+#include "disassembler.h"
+#include "instructions.h"
+#include "json.h"
+#include "sds.h"
+#include "value_set.h"
+
+#include "stb_ds.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *edge_names[] = {
+	[CFG_FALLTHROUGH] = "fallthrough", [CFG_JUMP] = "jump",
+	[CFG_SKIP] = "skip",		   [CFG_CALL] = "call",
+	[CFG_RETURN] = "return",	   [CFG_JUMP_TABLE] = "table",
+};
+
+static bool is_skip(Chip8InstructionType type) {
+	switch (type) {
+	case CHIP8_SE_VX_BYTE:
+	case CHIP8_SNE_VX_BYTE:
+	case CHIP8_SE_VX_VY:
+	case CHIP8_SNE_VX_VY:
+	case CHIP8_SKP_VX:
+	case CHIP8_SKNP_VX:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Whether a basic block must end after an instruction of this type
+static bool ends_block(Chip8InstructionType type) {
+	switch (type) {
+	case CHIP8_RET:
+	case CHIP8_JMP_ADDR:
+	case CHIP8_CALL_ADDR:
+	case CHIP8_JMP_V0_ADDR:
+	case CHIP8_UNKNOWN:
+		return true;
+	default:
+		return is_skip(type);
+	}
+}
+
+static void mark_leader(Disassembly *disassembly, bool *leaders, size_t addr) {
+	if (addr < disassembly->abook_length) {
+		leaders[addr] = true;
+	}
+}
+
+// Every address control can reach other than by falling through from the
+// previous instruction. Blocks also end after control flow instructions and
+// where one instruction block runs into another, see cfg_build().
+static bool *find_leaders(Disassembly *disassembly) {
+	uint16_t base = disassembly->base;
+	bool *leaders = calloc(disassembly->abook_length + 1, sizeof(bool));
+	for (size_t i = 0; i < disassembly->iblock_length; ++i) {
+		InstructionBlock *block = &disassembly->instruction_blocks[i];
+		mark_leader(disassembly, leaders, block->instructions[0].address);
+
+		for (size_t j = 0; j < block->length; ++j) {
+			Chip8Instruction instruction = block->instructions[j].instruction;
+			size_t addr = block->instructions[j].address;
+			Chip8InstructionType type = instruction_type(instruction);
+
+			if ((type == CHIP8_JMP_ADDR || type == CHIP8_CALL_ADDR) &&
+			    instruction.aformat.addr >= base) {
+				mark_leader(disassembly, leaders, instruction.aformat.addr - base);
+			}
+			if (is_skip(type)) {
+				mark_leader(disassembly, leaders, addr + 4);
+			}
+		}
+	}
+	for (size_t i = 0; i < (size_t)arrlen(disassembly->jump_table_targets); ++i) {
+		mark_leader(disassembly, leaders, disassembly->jump_table_targets[i]);
+	}
+	return leaders;
+}
+
+static DisassembledInstruction *node_instructions(ControlFlowGraph *cfg, CfgNode *node) {
+	return cfg->disassembly->instruction_blocks[node->block].instructions + node->first;
+}
+
+static Chip8Instruction last_instruction(ControlFlowGraph *cfg, CfgNode *node) {
+	return node_instructions(cfg, node)[node->length - 1].instruction;
+}
+
+// Node starting exactly at `address` (relative to the base), or CFG_NONE
+static int32_t node_starting_at(ControlFlowGraph *cfg, size_t address) {
+	int32_t node = address <= UINT16_MAX ? cfg_node_at(cfg, address) : CFG_NONE;
+	return node != CFG_NONE && cfg->nodes[node].address == address ? node : CFG_NONE;
+}
+
+static void add_edge(ControlFlowGraph *cfg, int32_t from, size_t to, CfgEdgeType type) {
+	int32_t target = node_starting_at(cfg, to);
+	if (target != CFG_NONE) {
+		CfgEdge edge = { from, target, type };
+		arrput(cfg->edges, edge);
+	}
+}
+
+static void add_edges(ControlFlowGraph *cfg, int32_t from, uint8_t *code, size_t length) {
+	CfgNode *node = &cfg->nodes[from];
+	DisassembledInstruction *instructions = node_instructions(cfg, node);
+	Chip8Instruction last = instructions[node->length - 1].instruction;
+	size_t addr = instructions[node->length - 1].address;
+	uint16_t base = cfg->disassembly->base;
+	size_t target = last.aformat.addr - base;
+
+	Chip8InstructionType type = instruction_type(last);
+	switch (type) {
+	case CHIP8_RET:
+	case CHIP8_UNKNOWN:
+		break;
+	case CHIP8_JMP_ADDR:
+		add_edge(cfg, from, target, CFG_JUMP);
+		break;
+	case CHIP8_CALL_ADDR:
+		add_edge(cfg, from, target, CFG_CALL);
+		add_edge(cfg, from, addr + 2, CFG_RETURN);
+		break;
+	case CHIP8_JMP_V0_ADDR: {
+		// The block starts at the last entry point before the jump, just like
+		// the disassembler's own analysis
+		size_t rom_length = cfg->disassembly->rom_length;
+		rom_length = rom_length < length ? rom_length : length;
+		uint16_t *targets =
+			resolve_jump_table(instructions, node->length, code, rom_length, base);
+		for (size_t i = 0; i < (size_t)arrlen(targets); ++i) {
+			add_edge(cfg, from, targets[i] - base, CFG_JUMP_TABLE);
+		}
+		arrfree(targets);
+		break;
+	}
+	default:
+		add_edge(cfg, from, addr + 2, CFG_FALLTHROUGH);
+		if (is_skip(type)) {
+			add_edge(cfg, from, addr + 4, CFG_SKIP);
+		}
+		break;
+	}
+}
+
+// Successors (or predecessors) of each node in compressed rows: those of node n
+// are targets[offsets[n]] to targets[offsets[n + 1] - 1]. Calls are left out, and
+// a virtual root after the last node leads to every subroutine.
+typedef struct Adjacency {
+	int32_t *offsets;
+	int32_t *targets;
+} Adjacency;
+
+static Adjacency adjacency(ControlFlowGraph *cfg, bool reverse) {
+	int32_t root = arrlen(cfg->nodes);
+	CfgEdge *edges = NULL;
+	for (size_t i = 0; i < (size_t)arrlen(cfg->edges); ++i) {
+		if (cfg->edges[i].type != CFG_CALL) {
+			arrput(edges, cfg->edges[i]);
+		}
+	}
+	for (size_t i = 0; i < (size_t)arrlen(cfg->functions); ++i) {
+		CfgEdge edge = { root, cfg->functions[i], CFG_CALL };
+		arrput(edges, edge);
+	}
+
+	size_t count = root + 1;
+	Adjacency adjacency = {
+		calloc(count + 1, sizeof(int32_t)),
+		malloc((arrlen(edges) + 1) * sizeof(int32_t)),
+	};
+	for (size_t i = 0; i < (size_t)arrlen(edges); ++i) {
+		adjacency.offsets[(reverse ? edges[i].to : edges[i].from) + 1]++;
+	}
+	for (size_t i = 0; i < count; ++i) {
+		adjacency.offsets[i + 1] += adjacency.offsets[i];
+	}
+	int32_t *fill = malloc((count + 1) * sizeof(int32_t));
+	memcpy(fill, adjacency.offsets, (count + 1) * sizeof(int32_t));
+	for (size_t i = 0; i < (size_t)arrlen(edges); ++i) {
+		CfgEdge *edge = &edges[i];
+		int32_t from = reverse ? edge->to : edge->from;
+		adjacency.targets[fill[from]++] = reverse ? edge->from : edge->to;
+	}
+	free(fill);
+	arrfree(edges);
+	return adjacency;
+}
+
+static void free_adjacency(Adjacency *adjacency) {
+	free(adjacency->offsets);
+	free(adjacency->targets);
+}
+
+// Lengauer-Tarjan with path compression, O(E log N). The DFS and the
+// compression are iterative, since a large ROM can nest thousands of blocks.
+typedef struct Dominators {
+	int32_t *dfnum; // Preorder number, -1 if unreachable
+	int32_t *vertex; // Node by preorder number
+	int32_t *parent;
+	int32_t *semi; // As a preorder number
+	int32_t *ancestor;
+	int32_t *best;
+	int32_t *samedom;
+	int32_t *bucket; // Linked through bucket_next, by semidominator node
+	int32_t *bucket_next;
+	int32_t *path;
+} Dominators;
+
+// Node with the lowest semidominator on the forest path above `v`
+static int32_t eval(Dominators *d, int32_t v) {
+	size_t depth = 0;
+	for (int32_t x = v; d->ancestor[d->ancestor[x]] != CFG_NONE; x = d->ancestor[x]) {
+		d->path[depth++] = x;
+	}
+	while (depth--) {
+		int32_t x = d->path[depth];
+		int32_t a = d->ancestor[x];
+		int32_t b = d->best[a];
+		d->ancestor[x] = d->ancestor[a];
+		if (d->semi[b] < d->semi[d->best[x]]) {
+			d->best[x] = b;
+		}
+	}
+	return d->best[v];
+}
+
+// Numbers the nodes reached from `start` in DFS preorder, `path` doubling as the
+// stack of nodes and bucket_next as the next successor to visit from each
+static void number_from(Dominators *d, Adjacency *successors, int32_t start, int32_t parent,
+			int32_t *visited) {
+	size_t depth = 0;
+	d->dfnum[start] = *visited;
+	d->vertex[(*visited)++] = start;
+	d->parent[start] = parent;
+	d->path[depth++] = start;
+	d->bucket_next[start] = successors->offsets[start];
+	while (depth) {
+		int32_t n = d->path[depth - 1];
+		if (d->bucket_next[n] == successors->offsets[n + 1]) {
+			depth--;
+			continue;
+		}
+		int32_t s = successors->targets[d->bucket_next[n]++];
+		if (d->dfnum[s] == CFG_NONE) {
+			d->dfnum[s] = *visited;
+			d->vertex[(*visited)++] = s;
+			d->parent[s] = n;
+			d->bucket_next[s] = successors->offsets[s];
+			d->path[depth++] = s;
+		}
+	}
+}
+
+// Immediate dominators of the nodes and the virtual root, which has none. Code
+// no subroutine reaches hangs off the root too, entered where nothing leads to
+// it or else at its lowest address.
+static int32_t *compute_dominators(ControlFlowGraph *cfg, Adjacency *successors,
+				   Adjacency *predecessors) {
+	int32_t root = arrlen(cfg->nodes);
+	size_t count = root + 1;
+	int32_t *idom = malloc(count * sizeof(int32_t));
+	memset(idom, 0xFF, count * sizeof(int32_t));
+	Dominators d;
+	int32_t **arrays[] = { &d.dfnum,    &d.vertex,	&d.parent, &d.semi,	   &d.ancestor,
+			       &d.best,	    &d.samedom, &d.bucket, &d.bucket_next, &d.path };
+	for (size_t i = 0; i < sizeof(arrays) / sizeof(arrays[0]); ++i) {
+		*arrays[i] = malloc(count * sizeof(int32_t));
+		memset(*arrays[i], 0xFF, count * sizeof(int32_t)); // All CFG_NONE
+	}
+
+	int32_t visited = 0;
+	number_from(&d, successors, root, CFG_NONE, &visited);
+	for (int32_t n = 0; n < root; ++n) {
+		bool entered = predecessors->offsets[n] == predecessors->offsets[n + 1];
+		if (d.dfnum[n] == CFG_NONE && entered) {
+			number_from(&d, successors, n, root, &visited);
+		}
+	}
+	for (int32_t n = 0; n < root; ++n) {
+		if (d.dfnum[n] == CFG_NONE) {
+			number_from(&d, successors, n, root, &visited);
+		}
+	}
+	memset(d.bucket_next, 0xFF, count * sizeof(int32_t));
+
+	for (int32_t i = visited - 1; i > 0; --i) {
+		int32_t n = d.vertex[i];
+		int32_t p = d.parent[n];
+		int32_t s = d.dfnum[p];
+		for (int32_t j = predecessors->offsets[n]; j < predecessors->offsets[n + 1]; ++j) {
+			int32_t v = predecessors->targets[j];
+			if (d.dfnum[v] == CFG_NONE) {
+				continue;
+			}
+			int32_t candidate = d.dfnum[v];
+			if (candidate > d.dfnum[n]) {
+				candidate = d.semi[eval(&d, v)];
+			}
+			s = candidate < s ? candidate : s;
+		}
+		d.semi[n] = s;
+		int32_t semi_node = d.vertex[s];
+		d.bucket_next[n] = d.bucket[semi_node];
+		d.bucket[semi_node] = n;
+
+		d.ancestor[n] = p;
+		d.best[n] = n;
+		for (int32_t v = d.bucket[p]; v != CFG_NONE; v = d.bucket_next[v]) {
+			int32_t y = eval(&d, v);
+			if (d.semi[y] == d.semi[v]) {
+				idom[v] = p;
+			} else {
+				d.samedom[v] = y;
+			}
+		}
+		d.bucket[p] = CFG_NONE;
+	}
+	for (int32_t i = 1; i < visited; ++i) {
+		int32_t n = d.vertex[i];
+		if (d.samedom[n] != CFG_NONE) {
+			idom[n] = idom[d.samedom[n]];
+		}
+	}
+
+	for (size_t i = 0; i < sizeof(arrays) / sizeof(arrays[0]); ++i) {
+		free(*arrays[i]);
+	}
+	return idom;
+}
+
+// Numbers the dominator tree in DFS order, so dominance is an interval check,
+// and keeps the immediate dominators of the nodes under the virtual root
+static void number_dominator_tree(ControlFlowGraph *cfg, int32_t *idom) {
+	int32_t root = arrlen(cfg->nodes);
+	size_t count = root + 1;
+	int32_t *first_child = malloc(count * sizeof(int32_t));
+	int32_t *next_sibling = malloc(count * sizeof(int32_t));
+	memset(first_child, 0xFF, count * sizeof(int32_t));
+	for (int32_t i = root; i-- > 0;) {
+		if (idom[i] != CFG_NONE) {
+			next_sibling[i] = first_child[idom[i]];
+			first_child[idom[i]] = i;
+		}
+		cfg->nodes[i].idom = idom[i] == root ? CFG_NONE : idom[i];
+	}
+
+	int32_t order = 0;
+	int32_t *stack = malloc(count * sizeof(int32_t));
+	size_t depth = 0;
+	stack[depth++] = root;
+	while (depth) {
+		int32_t n = stack[depth - 1];
+		int32_t child = first_child[n];
+		if (child == CFG_NONE) {
+			if (n != root) {
+				cfg->nodes[n].dom_post = order++;
+			}
+			depth--;
+			continue;
+		}
+		first_child[n] = next_sibling[child];
+		cfg->nodes[child].dom_pre = order++;
+		stack[depth++] = child;
+	}
+
+	free(stack);
+	free(first_child);
+	free(next_sibling);
+}
+
+// Whether the instruction may change Vx
+static bool writes_register(Chip8Instruction instruction, uint8_t x) {
+	uint8_t rx = instruction.rformat.rx;
+	switch (instruction_type(instruction)) {
+	case CHIP8_LD_VX_BYTE:
+	case CHIP8_ADD_VX_BYTE:
+	case CHIP8_RND_VX_BYTE:
+	case CHIP8_LD_VX_DT:
+	case CHIP8_LD_VX_K:
+		return rx == x;
+	case CHIP8_LD_VX_VY:
+	case CHIP8_OR_VX_VY:
+	case CHIP8_AND_VX_VY:
+	case CHIP8_XOR_VX_VY:
+	case CHIP8_ADD_VX_VY:
+	case CHIP8_SUB_VX_VY:
+	case CHIP8_SHR_VX:
+	case CHIP8_SUBN_VX_VY:
+	case CHIP8_SHL_VX:
+		return rx == x || x == 0xF;
+	case CHIP8_DRW_VX_VY_NIBBLE:
+		return x == 0xF;
+	case CHIP8_LD_VX_I:
+		return x <= rx;
+	case CHIP8_CALL_ADDR:
+	case CHIP8_SYS_ADDR:
+	case CHIP8_UNKNOWN:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static int compare_nodes(const void *a, const void *b) {
+	return *(const int32_t *)a - *(const int32_t *)b;
+}
+
+static bool in_loop(CfgLoop *loop, int32_t node) {
+	return bsearch(&node, loop->nodes, arrlen(loop->nodes), sizeof(int32_t), compare_nodes);
+}
+
+// Iterations of a loop that counts Vx from a constant with ADD Vx, step until SE Vx, limit
+// (or SNE) exits, or -1 if it isn't shaped like that
+static int trip_count(ControlFlowGraph *cfg, CfgLoop *loop, Adjacency *successors,
+		      Adjacency *predecessors) {
+	// The one way into the loop sets the counter's initial value
+	int32_t header = loop->header;
+	int32_t preheader = CFG_NONE;
+	for (int32_t i = predecessors->offsets[header]; i < predecessors->offsets[header + 1];
+	     ++i) {
+		int32_t p = predecessors->targets[i];
+		if (in_loop(loop, p)) {
+			continue;
+		} else if (preheader != CFG_NONE || p == arrlen(cfg->nodes)) {
+			return -1;
+		}
+		preheader = p;
+	}
+	if (preheader == CFG_NONE) {
+		return -1;
+	}
+
+	for (size_t i = 0; i < (size_t)arrlen(loop->nodes); ++i) {
+		int32_t test = loop->nodes[i];
+		Chip8Instruction compare = last_instruction(cfg, &cfg->nodes[test]);
+		Chip8InstructionType type = instruction_type(compare);
+		if (type != CHIP8_SE_VX_BYTE && type != CHIP8_SNE_VX_BYTE) {
+			continue;
+		}
+
+		// Only counted if it exits once the counter reaches the limit. Its
+		// edges are the fall-through, then the skip.
+		int32_t first_edge = successors->offsets[test];
+		if (successors->offsets[test + 1] - first_edge != 2) {
+			continue;
+		}
+		bool stays = in_loop(loop, successors->targets[first_edge]);
+		bool skip_stays = in_loop(loop, successors->targets[first_edge + 1]);
+		if (stays == skip_stays || skip_stays == (type == CHIP8_SE_VX_BYTE)) {
+			continue;
+		}
+
+		uint8_t x = compare.rformat.rx;
+		int32_t step_node = CFG_NONE;
+		Chip8Instruction step = { 0 };
+		bool counted = true;
+		for (size_t j = 0; j < (size_t)arrlen(loop->nodes) && counted; ++j) {
+			CfgNode *node = &cfg->nodes[loop->nodes[j]];
+			DisassembledInstruction *instructions = node_instructions(cfg, node);
+			for (size_t k = 0; k < node->length && counted; ++k) {
+				if (!writes_register(instructions[k].instruction, x)) {
+					continue;
+				}
+				counted = step_node == CFG_NONE &&
+					  instruction_type(instructions[k].instruction) ==
+						  CHIP8_ADD_VX_BYTE;
+				step_node = loop->nodes[j];
+				step = instructions[k].instruction;
+			}
+		}
+		if (!counted || step_node == CFG_NONE || !step.iformat.imm) {
+			continue;
+		}
+
+		int init = -1;
+		CfgNode *node = &cfg->nodes[preheader];
+		DisassembledInstruction *instructions = node_instructions(cfg, node);
+		for (size_t k = node->length; k-- > 0;) {
+			if (writes_register(instructions[k].instruction, x)) {
+				bool constant = instruction_type(instructions[k].instruction) ==
+						CHIP8_LD_VX_BYTE;
+				init = constant ? instructions[k].instruction.iformat.imm : -1;
+				break;
+			}
+		}
+		if (init < 0) {
+			continue;
+		}
+
+		// The test sees the counter before its first step unless the step
+		// always runs first
+		int first = cfg_dominates(cfg, step_node, test) ? 1 : 0;
+		for (int n = first; n <= 256; ++n) {
+			if (((init + n * step.iformat.imm) & 0xFF) == compare.iformat.imm) {
+				return n;
+			}
+		}
+	}
+	return -1;
+}
+
+// Loops that only wait on timers or keys, or spin in place
+static bool is_idle(ControlFlowGraph *cfg, CfgLoop *loop) {
+	for (size_t i = 0; i < (size_t)arrlen(loop->nodes); ++i) {
+		CfgNode *node = &cfg->nodes[loop->nodes[i]];
+		DisassembledInstruction *instructions = node_instructions(cfg, node);
+		for (size_t j = 0; j < node->length; ++j) {
+			Chip8InstructionType type = instruction_type(instructions[j].instruction);
+			if (type != CHIP8_LD_VX_DT && type != CHIP8_JMP_ADDR && !is_skip(type)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+static int compare_loops(const void *a, const void *b) {
+	const CfgLoop *x = a;
+	const CfgLoop *y = b;
+	if (arrlen(x->nodes) != arrlen(y->nodes)) {
+		return arrlen(x->nodes) < arrlen(y->nodes) ? 1 : -1;
+	}
+	return x->header - y->header;
+}
+
+static int compare_back_edges(const void *a, const void *b) {
+	const CfgEdge *x = a;
+	const CfgEdge *y = b;
+	return x->to != y->to ? x->to - y->to : x->from - y->from;
+}
+
+static void find_loops(ControlFlowGraph *cfg, Adjacency *successors, Adjacency *predecessors) {
+	// Back edges go to a node that dominates their source. Recursion isn't a
+	// loop, so calls don't count. All back edges to one header make one loop,
+	// so they're grouped by header.
+	CfgEdge *back_edges = NULL;
+	for (size_t i = 0; i < (size_t)arrlen(cfg->edges); ++i) {
+		CfgEdge *edge = &cfg->edges[i];
+		if (edge->type != CFG_CALL && cfg_dominates(cfg, edge->to, edge->from)) {
+			arrput(back_edges, cfg->edges[i]);
+		}
+	}
+	if (!back_edges) {
+		return; // qsort() mustn't see NULL
+	}
+	qsort(back_edges, arrlen(back_edges), sizeof(CfgEdge), compare_back_edges);
+
+	size_t count = arrlen(cfg->nodes);
+	int32_t *seen = malloc(count * sizeof(int32_t)); // Loop whose body a node was added to
+	int32_t *worklist = NULL;
+	memset(seen, 0xFF, count * sizeof(int32_t));
+	for (size_t i = 0; i < (size_t)arrlen(back_edges); ++i) {
+		CfgEdge *edge = &back_edges[i];
+		int32_t index = arrlen(cfg->loops) - 1;
+		if (!i || edge->to != back_edges[i - 1].to) {
+			CfgLoop loop = { .header = edge->to, .parent = CFG_NONE, .trip_count = -1 };
+			arrput(loop.nodes, edge->to);
+			arrput(cfg->loops, loop);
+			seen[edge->to] = ++index;
+		}
+		CfgLoop *loop = &cfg->loops[index];
+		arrput(loop->latches, edge->from);
+
+		// The body is everything that reaches the latch without passing
+		// through the header
+		arrput(worklist, edge->from);
+		while (arrlen(worklist)) {
+			int32_t n = arrpop(worklist);
+			if (n == (int32_t)count || seen[n] == index ||
+			    !cfg_dominates(cfg, loop->header, n)) {
+				continue;
+			}
+			seen[n] = index;
+			arrput(loop->nodes, n);
+			for (int32_t j = predecessors->offsets[n]; j < predecessors->offsets[n + 1];
+			     ++j) {
+				arrput(worklist, predecessors->targets[j]);
+			}
+		}
+	}
+	arrfree(back_edges);
+	arrfree(worklist);
+	free(seen);
+
+	// Each loop strictly contains those nested in it, so going from the
+	// largest down leaves every node with its innermost loop, and a header's
+	// loop just before its own is the enclosing one
+	size_t loops = arrlen(cfg->loops);
+	qsort(cfg->loops, loops, sizeof(CfgLoop), compare_loops);
+	for (size_t i = 0; i < loops; ++i) {
+		CfgLoop *loop = &cfg->loops[i];
+		qsort(loop->nodes, arrlen(loop->nodes), sizeof(int32_t), compare_nodes);
+		loop->parent = cfg->nodes[loop->header].loop;
+		for (size_t j = 0; j < (size_t)arrlen(loop->nodes); ++j) {
+			cfg->nodes[loop->nodes[j]].loop = i;
+		}
+	}
+	for (size_t i = 0; i < loops; ++i) {
+		cfg->loops[i].trip_count = trip_count(cfg, &cfg->loops[i], successors,
+							   predecessors);
+		cfg->loops[i].idle = is_idle(cfg, &cfg->loops[i]);
+	}
+}
+
+ControlFlowGraph cfg_build(Disassembly *disassembly, uint8_t *code, size_t length) {
+	ControlFlowGraph cfg = { .disassembly = disassembly, .entry = CFG_NONE };
+
+	// Walking the address book rather than the blocks keeps the nodes in
+	// address order
+	bool *leaders = find_leaders(disassembly);
+	CfgNode *node = NULL;
+	for (size_t addr = 0; addr < disassembly->abook_length; ++addr) {
+		AddressLookup *lookup = &disassembly->addressbook[addr];
+		if (lookup->type != ADDR_INSTRUCTION) {
+			continue;
+		}
+		bool split = !node || leaders[addr] || node->block != lookup->block_offset ||
+			     node->address + node->length * 2 != addr ||
+			     ends_block(instruction_type(last_instruction(&cfg, node)));
+		if (split) {
+			CfgNode next = {
+				.block = lookup->block_offset,
+				.first = lookup->array_offset,
+				.address = addr,
+				.idom = CFG_NONE,
+				.loop = CFG_NONE,
+				.dom_pre = CFG_NONE,
+				.dom_post = CFG_NONE,
+			};
+			arrput(cfg.nodes, next);
+		}
+		node = &arrlast(cfg.nodes);
+		node->length++;
+	}
+	free(leaders);
+
+	for (size_t i = 0; i < (size_t)arrlen(cfg.nodes); ++i) {
+		add_edges(&cfg, i, code, length);
+	}
+	cfg.entry = node_starting_at(&cfg, 0);
+	if (cfg.entry == CFG_NONE) {
+		return cfg;
+	}
+
+	// Subroutines in address order, after the ROM's entry
+	bool *called = calloc(arrlen(cfg.nodes), sizeof(bool));
+	for (size_t i = 0; i < (size_t)arrlen(cfg.edges); ++i) {
+		if (cfg.edges[i].type == CFG_CALL) {
+			called[cfg.edges[i].to] = true;
+		}
+	}
+	arrput(cfg.functions, cfg.entry);
+	for (size_t i = 0; i < (size_t)arrlen(cfg.nodes); ++i) {
+		if (called[i] && (int32_t)i != cfg.entry) {
+			arrput(cfg.functions, i);
+		}
+	}
+	free(called);
+
+	Adjacency successors = adjacency(&cfg, false);
+	Adjacency predecessors = adjacency(&cfg, true);
+	int32_t *idom = compute_dominators(&cfg, &successors, &predecessors);
+	number_dominator_tree(&cfg, idom);
+	free(idom);
+	find_loops(&cfg, &successors, &predecessors);
+	free_adjacency(&successors);
+	free_adjacency(&predecessors);
+	return cfg;
+}
+
+// Node holding the instruction at `address` (relative to the base), or CFG_NONE
+int32_t cfg_node_at(ControlFlowGraph *cfg, uint16_t address) {
+	size_t low = 0;
+	size_t high = arrlen(cfg->nodes);
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+		if (cfg->nodes[middle].address <= address) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	if (!low) {
+		return CFG_NONE;
+	}
+	CfgNode *node = &cfg->nodes[low - 1];
+	return address < node->address + node->length * 2 ? (int32_t)low - 1 : CFG_NONE;
+}
+
+// Whether every path from the entry to `node` goes through `dominator`
+bool cfg_dominates(ControlFlowGraph *cfg, int32_t dominator, int32_t node) {
+	CfgNode *a = &cfg->nodes[dominator];
+	CfgNode *b = &cfg->nodes[node];
+	return a->dom_pre != CFG_NONE && b->dom_pre != CFG_NONE && a->dom_pre <= b->dom_pre &&
+	       b->dom_post <= a->dom_post;
+}
+
+// Whether `node` is in `loop` or a loop nested in it
+bool cfg_in_loop(ControlFlowGraph *cfg, int32_t loop, int32_t node) {
+	for (int32_t l = cfg->nodes[node].loop; l != CFG_NONE; l = cfg->loops[l].parent) {
+		if (l == loop) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static sds cat_loop_summary(sds out, CfgLoop *loop) {
+	if (loop->trip_count >= 0) {
+		out = sdscatprintf(out, ", %d trips", loop->trip_count);
+	}
+	if (loop->idle) {
+		out = sdscat(out, ", idle");
+	}
+	return out;
+}
+
+// Graphviz source with the instructions of each block, loop headers drawn double
+sds cfg2dot(ControlFlowGraph *cfg) {
+	uint16_t base = cfg->disassembly->base;
+	sds out = sdsnew("digraph cfg {\n\tnode [shape=box, fontname=\"monospace\"];\n");
+	for (size_t i = 0; i < (size_t)arrlen(cfg->nodes); ++i) {
+		CfgNode *node = &cfg->nodes[i];
+		// A header's innermost loop is always the one it heads
+		bool header = node->loop != CFG_NONE && cfg->loops[node->loop].header == (int32_t)i;
+		out = sdscatprintf(out, "\tn%zu [label=\"0x%03x", i, node->address + base);
+		if (header) {
+			out = sdscatprintf(out, " (loop %d", node->loop);
+			out = cat_loop_summary(out, &cfg->loops[node->loop]);
+			out = sdscat(out, ")");
+		}
+		out = sdscat(out, "\\l");
+
+		DisassembledInstruction *instructions = node_instructions(cfg, node);
+		for (size_t j = 0; j < node->length; ++j) {
+			char text[INST_TEXT_SIZE];
+			inst2text(instructions[j].instruction, text);
+			out = sdscatprintf(out, "    %s\\l", text);
+		}
+		out = sdscat(out, "\"");
+		if (header) {
+			out = sdscat(out, ", peripheries=2");
+		}
+		if ((int32_t)i == cfg->entry) {
+			out = sdscat(out, ", style=bold");
+		}
+		out = sdscat(out, "];\n");
+	}
+
+	for (size_t i = 0; i < (size_t)arrlen(cfg->edges); ++i) {
+		CfgEdge *edge = &cfg->edges[i];
+		out = sdscatprintf(out, "\tn%d -> n%d", edge->from, edge->to);
+		switch (edge->type) {
+		case CFG_SKIP:
+		case CFG_JUMP_TABLE:
+			out = sdscatprintf(out, " [label=\"%s\"]", edge_names[edge->type]);
+			break;
+		case CFG_CALL:
+			out = sdscat(out, " [style=dashed]");
+			break;
+		case CFG_RETURN:
+			out = sdscat(out, " [style=dotted]");
+			break;
+		default:
+			break;
+		}
+		out = sdscat(out, ";\n");
+	}
+	return sdscat(out, "}\n");
+}
+
+static sds cat_node_list(sds out, int32_t *nodes) {
+	out = sdscat(out, "[");
+	for (size_t i = 0; i < (size_t)arrlen(nodes); ++i) {
+		out = sdscatprintf(out, "%s%d", i ? ", " : "", nodes[i]);
+	}
+	return sdscat(out, "]");
+}
+
+// A node or loop index, null for CFG_NONE
+static sds cat_index(sds out, int32_t index) {
+	return index == CFG_NONE ? sdscat(out, "null") : sdscatprintf(out, "%d", index);
+}
+
+// One object with the nodes, edges and loops, referring to nodes and loops by index
+sds cfg2json(ControlFlowGraph *cfg) {
+	uint16_t base = cfg->disassembly->base;
+	sds out = cat_index(sdsnew("{\"entry\": "), cfg->entry);
+	out = cat_node_list(sdscat(out, ",\n\"functions\": "), cfg->functions);
+	out = sdscat(out, ",\n\"nodes\": [");
+	for (size_t i = 0; i < (size_t)arrlen(cfg->nodes); ++i) {
+		CfgNode *node = &cfg->nodes[i];
+		out = sdscatprintf(out, "%s\n  {\"id\": %zu, \"address\": %u, \"length\": %zu",
+				   i ? "," : "", i, node->address + base, node->length);
+		out = cat_index(sdscat(out, ", \"idom\": "), node->idom);
+		out = cat_index(sdscat(out, ", \"loop\": "), node->loop);
+		out = sdscat(out, ", \"instructions\": [");
+
+		DisassembledInstruction *instructions = node_instructions(cfg, node);
+		for (size_t j = 0; j < node->length; ++j) {
+			char text[INST_TEXT_SIZE];
+			out = sdscat(out, j ? ", " : "");
+			out = json_cat_string(out, inst2text(instructions[j].instruction, text));
+		}
+		out = sdscat(out, "]}");
+	}
+
+	out = sdscat(out, "\n],\n\"edges\": [");
+	for (size_t i = 0; i < (size_t)arrlen(cfg->edges); ++i) {
+		CfgEdge *edge = &cfg->edges[i];
+		out = sdscatprintf(out, "%s\n  {\"from\": %d, \"to\": %d, \"type\": \"%s\"}",
+				   i ? "," : "", edge->from, edge->to, edge_names[edge->type]);
+	}
+
+	out = sdscat(out, "\n],\n\"loops\": [");
+	for (size_t i = 0; i < (size_t)arrlen(cfg->loops); ++i) {
+		CfgLoop *loop = &cfg->loops[i];
+		out = sdscatprintf(out, "%s\n  {\"header\": %d", i ? "," : "", loop->header);
+		out = cat_index(sdscat(out, ", \"parent\": "), loop->parent);
+		out = cat_node_list(sdscat(out, ", \"nodes\": "), loop->nodes);
+		out = cat_node_list(sdscat(out, ", \"latches\": "), loop->latches);
+		out = cat_index(sdscat(out, ", \"trip_count\": "), loop->trip_count);
+		out = sdscatprintf(out, ", \"idle\": %s}", loop->idle ? "true" : "false");
+	}
+	return sdscat(out, "\n]}\n");
+}
+
+void free_cfg(ControlFlowGraph *cfg) {
+	for (size_t i = 0; i < (size_t)arrlen(cfg->loops); ++i) {
+		arrfree(cfg->loops[i].nodes);
+		arrfree(cfg->loops[i].latches);
+	}
+	arrfree(cfg->loops);
+	arrfree(cfg->functions);
+	arrfree(cfg->edges);
+	arrfree(cfg->nodes);
+}
@@ -0,0 +1,77 @@
+#ifndef CFG_H
+#define CFG_H
+
+#include "disassembler.h"
+#include "sds.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Control-flow graph over the disassembler's instruction blocks. Blocks are
+// split into basic blocks wherever control can enter or leave, and every edge
+// is typed by the instruction that takes it. A CALL has an edge into the
+// subroutine and one to the instruction after it, which is where RET lands, so
+// RET itself ends a path.
+//
+// Dominators are computed per subroutine with Lengauer-Tarjan, from the ROM's
+// entry and every CALL target over all edges but calls. Natural loops are found
+// from the back edges to blocks that dominate their source. Code shared between
+// subroutines has no dominator, and neither has code only reached through
+// unresolved jumps where it's entered.
+
+#define CFG_NONE -1
+
+typedef enum CfgEdgeType {
+	CFG_FALLTHROUGH,
+	CFG_JUMP,
+	CFG_SKIP, // Taken when the skip's condition holds
+	CFG_CALL,
+	CFG_RETURN, // From a CALL to the instruction RET comes back to
+	CFG_JUMP_TABLE, // A JMP V0 target resolved by value-set analysis
+} CfgEdgeType;
+
+typedef struct CfgEdge {
+	int32_t from;
+	int32_t to;
+	CfgEdgeType type;
+} CfgEdge;
+
+typedef struct CfgNode {
+	size_t block; // Instruction block holding the basic block
+	size_t first; // Index of its first instruction in that block
+	size_t length;
+	uint16_t address; // Of the first instruction, relative to the base like the disassembly
+	int32_t idom; // Immediate dominator, CFG_NONE for subroutine entries and the like
+	int32_t loop; // Innermost loop containing it, CFG_NONE if none
+	int32_t dom_pre; // Dominator tree DFS numbering, for cfg_dominates()
+	int32_t dom_post;
+} CfgNode;
+
+typedef struct CfgLoop {
+	int32_t header;
+	int32_t parent; // Enclosing loop, CFG_NONE if outermost
+	int32_t *nodes; // stb_ds array, header included
+	int32_t *latches; // stb_ds array of the nodes with back edges to the header
+	int trip_count; // Iterations of a counted loop, -1 if unknown
+	bool idle; // Only polls timers or keys, e.g. waiting for the delay timer
+} CfgLoop;
+
+typedef struct ControlFlowGraph {
+	Disassembly *disassembly;
+	CfgNode *nodes; // stb_ds array, in address order
+	CfgEdge *edges; // stb_ds array, grouped by source node
+	CfgLoop *loops; // stb_ds array, outermost first
+	int32_t *functions; // stb_ds array of subroutine entries, the ROM's entry first
+	int32_t entry;
+} ControlFlowGraph;
+
+ControlFlowGraph cfg_build(Disassembly *disassembly, uint8_t *code, size_t length);
+int32_t cfg_node_at(ControlFlowGraph *cfg, uint16_t address);
+bool cfg_dominates(ControlFlowGraph *cfg, int32_t dominator, int32_t node);
+bool cfg_in_loop(ControlFlowGraph *cfg, int32_t loop, int32_t node);
+sds cfg2dot(ControlFlowGraph *cfg);
+sds cfg2json(ControlFlowGraph *cfg);
+void free_cfg(ControlFlowGraph *cfg);
+
+#endif // !CFG_H
@@ -28,7 +28,7 @@ static uint8_t *read_rom(char *rom_path, size_t *out_size) {
 	file_size += file_size % 2; // align to 2 bytes
 
 	uint8_t *buffer;
-	buffer = malloc(file_size);
+	buffer = calloc(file_size, 1); // Zeroes the padding
 	fread(buffer, sizeof(*buffer), file_size, rom);
 
 	fclose(rom);
@@ -0,0 +1,4323 @@
+#include "compiler.h"
+#include "common.h"
+#include "core.h"
+#include "instructions.h"
+
+#include "stb_ds.h"
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REGISTERS 17 // V0-VF, then I, before the virtual registers
+#define REG_V0 0
+#define REG_VF 0xF
+#define REG_I 16
+#define NO_REG -1
+#define NO_BLOCK -1
+#define NO_SYMBOL -1
+#define ALLOCATABLE 0x7FFF // V0-VE, as VF holds flags
+#define SCRATCH 0x3 // V0 and V1, which spilled values are loaded into
+#define ALL_PHYSICAL 0x1FFFF
+#define MIN_FREE_REGISTERS 6 // Left to locals when globals are given registers
+#define LATTICE_TOP -2 // Not known yet
+#define LATTICE_BOTTOM -1 // Not constant
+#define MAX_PASSES 8 // Of optimisations, each enabling more of the others
+
+typedef enum TokenKind {
+	TOK_EOF,
+	TOK_IDENT,
+	TOK_NUMBER,
+	TOK_STRING,
+	TOK_PUNCT,
+} TokenKind;
+
+typedef struct Token {
+	TokenKind kind;
+	const char *start;
+	int length;
+	int value; // Of a number
+	uint32_t line;
+} Token;
+
+// Where the lexer is, to come back to a for loop's step after its body
+typedef struct LexerState {
+	const char *at;
+	uint32_t line;
+	Token token;
+	Token next;
+} LexerState;
+
+typedef enum ExprKind {
+	EXPR_NUMBER,
+	EXPR_REGISTER, // Physical or virtual register `value`
+	EXPR_ADDRESS, // Of data symbol `value`
+	EXPR_I,
+	EXPR_UNARY,
+	EXPR_BINARY,
+	EXPR_RAND,
+	EXPR_DELAY,
+	EXPR_WAIT_KEY,
+	EXPR_KEY_PRESSED, // key_pressed(left)
+	EXPR_FONT, // font(left)
+	EXPR_DRAW, // draw(left, right, value)
+} ExprKind;
+
+typedef enum Operator {
+	BIN_ADD,
+	BIN_SUB,
+	BIN_MUL,
+	BIN_DIV,
+	BIN_MOD,
+	BIN_SHL,
+	BIN_SHR,
+	BIN_AND,
+	BIN_OR,
+	BIN_XOR,
+	BIN_EQ, // Comparisons from here on
+	BIN_NE,
+	BIN_LT,
+	BIN_LE,
+	BIN_GT,
+	BIN_GE,
+	BIN_LAND,
+	BIN_LOR,
+	UN_NEG,
+	UN_NOT,
+	UN_LNOT,
+} Operator;
+
+static const struct {
+	const char *text;
+	Operator op;
+	int precedence;
+} binary_operators[] = {
+	{ "||", BIN_LOR, 1 }, { "&&", BIN_LAND, 2 }, { "|", BIN_OR, 3 },   { "^", BIN_XOR, 4 },
+	{ "&", BIN_AND, 5 },  { "==", BIN_EQ, 6 },   { "!=", BIN_NE, 6 },  { "<", BIN_LT, 7 },
+	{ "<=", BIN_LE, 7 },  { ">", BIN_GT, 7 },    { ">=", BIN_GE, 7 },  { "<<", BIN_SHL, 8 },
+	{ ">>", BIN_SHR, 8 }, { "+", BIN_ADD, 9 },   { "-", BIN_SUB, 9 },  { "*", BIN_MUL, 10 },
+	{ "/", BIN_DIV, 10 }, { "%", BIN_MOD, 10 },
+};
+
+static const struct {
+	const char *text;
+	Operator op;
+} compound_assignments[] = {
+	{ "+=", BIN_ADD }, { "-=", BIN_SUB }, { "&=", BIN_AND },  { "|=", BIN_OR },
+	{ "^=", BIN_XOR }, { "<<=", BIN_SHL }, { ">>=", BIN_SHR },
+};
+
+// Operands swapped, as in a < b being b > a
+static const Operator mirrored[] = {
+	[BIN_EQ] = BIN_EQ, [BIN_NE] = BIN_NE, [BIN_LT] = BIN_GT,
+	[BIN_LE] = BIN_GE, [BIN_GT] = BIN_LT, [BIN_GE] = BIN_LE,
+};
+
+typedef struct Expr {
+	ExprKind kind;
+	Operator op;
+	int32_t left;
+	int32_t right;
+	int32_t value; // The number, register, data symbol or sprite height
+	uint32_t line;
+} Expr;
+
+typedef enum OpKind {
+	IR_LOAD, // dst = imm
+	IR_COPY, // dst = a
+	IR_ADD_IMM, // dst += imm, leaving VF alone
+	IR_ALU, // dst = dst <alu> a, with VF as the flag
+	IR_RAND, // dst = rand() & imm
+	IR_GET_DELAY,
+	IR_WAIT_KEY,
+	IR_SET_DELAY, // delay = a
+	IR_SET_SOUND,
+	IR_SET_I, // i = the address of data `symbol` + imm, or imm if there's none
+	IR_ADD_I, // i += a
+	IR_FONT, // i = font(a)
+	IR_DRAW, // draw(a, b, imm), with VF set on collisions
+	IR_BCD, // bcd(a)
+	IR_SAVE, // save(V<imm>)
+	IR_RESTORE, // load(V<imm>)
+	IR_CLS,
+	IR_CALL, // Of function `symbol`
+	IR_RAW, // The instruction in imm, touching no registers
+} OpKind;
+
+// The low nibble of the 8xyN instruction
+typedef enum Alu {
+	ALU_OR = 0x1,
+	ALU_AND = 0x2,
+	ALU_XOR = 0x3,
+	ALU_ADD = 0x4,
+	ALU_SUB = 0x5,
+	ALU_SHR = 0x6,
+	ALU_SUBN = 0x7,
+	ALU_SHL = 0xE,
+} Alu;
+
+typedef struct Op {
+	OpKind kind;
+	Alu alu;
+	int32_t dst;
+	int32_t a;
+	int32_t b;
+	int32_t imm;
+	int32_t symbol;
+	int known; // Constant `a` of an ALU op holds, LATTICE_BOTTOM if not constant
+	uint32_t line;
+} Op;
+
+typedef enum ConditionKind {
+	COND_EQ,
+	COND_NE,
+	COND_KEY,
+	COND_NO_KEY,
+} ConditionKind;
+
+static const ConditionKind negated_conditions[] = {
+	[COND_EQ] = COND_NE,
+	[COND_NE] = COND_EQ,
+	[COND_KEY] = COND_NO_KEY,
+	[COND_NO_KEY] = COND_KEY,
+};
+
+typedef struct Condition {
+	ConditionKind kind;
+	int32_t a;
+	int32_t b; // NO_REG to compare with imm
+	int imm;
+} Condition;
+
+typedef enum TermKind {
+	TERM_JUMP,
+	TERM_BRANCH,
+	TERM_RETURN, // Halts in main()
+	TERM_TAIL_CALL, // Of function `target`
+	TERM_JUMP_OUT, // jump(target)
+	TERM_JUMP_V0, // jump(target + v0)
+} TermKind;
+
+typedef enum RelocKind {
+	RELOC_NONE,
+	RELOC_BLOCK, // Of the function being emitted
+	RELOC_FUNCTION,
+	RELOC_DATA, // Plus offset
+	RELOC_SELF,
+} RelocKind;
+
+typedef struct MachineInstr {
+	Chip8Instruction instruction;
+	RelocKind reloc;
+	int32_t target;
+	int32_t offset;
+} MachineInstr;
+
+// What I holds, where it's known to be an address or data symbol plus a constant
+typedef struct Pointer {
+	bool known;
+	int32_t symbol; // NO_SYMBOL for an address
+	int32_t offset;
+} Pointer;
+
+typedef struct Block {
+	Op *ops; // stb_ds array
+	TermKind term;
+	Condition condition;
+	int32_t next[2]; // Taken when the condition holds and not, just the first for a jump
+	int32_t target;
+	uint32_t line;
+	bool reachable;
+	int32_t preds;
+	uint64_t *live_out; // Set of registers live on leaving it
+	Pointer i_in; // On entering it
+	int loop_depth;
+
+	// Filled once registers are allocated
+	MachineInstr *code; // stb_ds array, without the terminator
+	Condition skip; // The condition on physical registers
+	int32_t inlined[2]; // A successor emitted as the instruction after the skip
+	bool placed;
+	uint16_t address;
+} Block;
+
+typedef struct Register {
+	const char *name; // Of its variable, NULL for temporaries
+	int32_t colour; // Physical register, NO_REG if spilled
+	bool spilled;
+	int32_t home; // Data symbol holding it when spilled
+	int32_t offset;
+	bool constant; // Spilled, but only ever set to `value`, so loaded with LD Vx, byte
+	uint8_t value;
+	int accesses; // Weighed by the depth of the loops they're in
+	bool unspillable; // Accessed where I couldn't be set back afterwards
+} Register;
+
+typedef struct Label {
+	char *name;
+	int32_t block;
+	bool defined;
+	uint32_t line;
+} Label;
+
+typedef struct Function {
+	char *name;
+	uint32_t line; // Of its definition, or of the first call until then
+	bool defined;
+	bool reachable;
+	bool analysed; // Its clobbers are final
+	bool spills; // V0 and V1 are kept for spilled values
+	int visit;
+	Block *blocks; // stb_ds array, the entry first
+	Register *registers; // stb_ds array, physical ones first
+	Label *labels; // stb_ds array
+	int32_t *globals; // stb_ds array, its register standing for each global, NO_REG if unused
+	uint32_t clobbers; // Physical registers (and I) it may change, callees' included
+	uint32_t reads; // Physical registers (and I) it may read before changing, callees' included
+	bool sets_i; // As its source says, rather than only moving it with spill code
+	int32_t spill_slots; // Data symbol holding its spilled values, NO_SYMBOL if none
+	int32_t *layout; // stb_ds array of its blocks in emission order
+	MachineInstr *code; // stb_ds array, once laid out
+	uint16_t address;
+	uint16_t size;
+} Function;
+
+typedef struct Global {
+	char *name;
+	int value; // Initial
+	int32_t reg; // Physical register it's kept in, NO_REG if in memory
+	int32_t offset; // In the memory globals' data
+} Global;
+
+typedef struct Data {
+	char *name; // NULL for spilled values
+	uint8_t *bytes; // stb_ds array of its initial contents
+	int size;
+	bool reserved; // Has no initial contents, so goes after the ROM's end
+	uint16_t address;
+} Data;
+
+typedef struct Local {
+	char *name;
+	int32_t reg;
+} Local;
+
+// Where break and continue go, NO_BLOCK for continue in a switch
+typedef struct Jumps {
+	int32_t break_to;
+	int32_t continue_to;
+	bool is_switch;
+	int32_t *cases; // stb_ds array of case values for a switch, blocks in case_blocks
+	int32_t *case_blocks;
+	int32_t default_block;
+} Jumps;
+
+typedef struct Compiler Compiler;
+
+// Emits a block's instructions, leaving out loads of what's there already
+typedef struct Emitter {
+	Compiler *c;
+	Function *f;
+	Block *block;
+	int values[16]; // Constant in each of V0-VF since the block's start, -1 if not known
+	Pointer i;
+	bool i_moved; // By spill code or a deferred LD I, so must be set before it's next read
+	int32_t holds[2]; // Spilled register V0 and V1 are a copy of, NO_REG if none
+} Emitter;
+
+// How a block leaves, once laid out
+typedef struct Exit {
+	MachineInstr instrs[3];
+	int count;
+	int32_t targets[2]; // Blocks jumped to
+	int target_count;
+	bool falls; // Into the next block
+} Exit;
+
+typedef struct Compiler {
+	const char *source;
+	const char *at;
+	uint32_t line;
+	Token token;
+	Token next;
+	bool failed;
+
+	Expr *exprs; // stb_ds array, for the statement being lowered
+	Function *functions; // stb_ds array
+	Global *globals; // stb_ds array
+	Data *data; // stb_ds array
+	int32_t memory_globals; // Data symbol holding globals not in registers
+	uint32_t pinned; // Registers named in the source, or holding globals
+	int32_t *order; // stb_ds array of the functions reachable from main(), callees first
+	bool finding_reads; // Liveness as callers see it, with nothing used on returning
+
+	// Lowering state
+	int32_t function;
+	int32_t block; // Being appended to, NO_BLOCK when unreachable
+	uint32_t statement_line;
+	Local *locals; // stb_ds array, innermost scope last
+	Jumps *jumps; // stb_ds array, innermost last
+} Compiler;
+
+// Reports the first error only, stopping parsing rather than report the
+// errors following from it
+static void error(Compiler *c, uint32_t line, const char *format, ...) {
+	if (c->failed) {
+		return;
+	}
+	fprintf(stderr, "[!] Line %u: ", line);
+	va_list args;
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+	fprintf(stderr, "\n");
+
+	c->failed = true;
+	c->at = "";
+	c->token.kind = TOK_EOF;
+	c->next.kind = TOK_EOF;
+}
+
+static const char *punctuation[] = {
+	"<<=", ">>=", "==", "!=", "<=", ">=", "&&", "||", "<<",
+	">>",  "+=",  "-=", "&=", "|=", "^=", "++", "--",
+};
+
+static Token lex(Compiler *c) {
+	for (;;) {
+		if (*c->at == '\n') {
+			++c->line;
+			++c->at;
+		} else if (isspace((unsigned char)*c->at)) {
+			++c->at;
+		} else if (c->at[0] == '/' && c->at[1] == '/') {
+			while (*c->at && *c->at != '\n') {
+				++c->at;
+			}
+		} else if (c->at[0] == '/' && c->at[1] == '*') {
+			c->at += 2;
+			while (*c->at && !(c->at[0] == '*' && c->at[1] == '/')) {
+				c->line += *c->at++ == '\n';
+			}
+			c->at += *c->at ? 2 : 0;
+		} else {
+			break;
+		}
+	}
+
+	Token token = { .start = c->at, .line = c->line };
+	const char *at = c->at;
+	if (!*at) {
+		token.kind = TOK_EOF;
+		return token;
+	}
+	if (isalpha((unsigned char)*at) || *at == '_') {
+		while (isalnum((unsigned char)*at) || *at == '_') {
+			++at;
+		}
+		token.kind = TOK_IDENT;
+	} else if (isdigit((unsigned char)*at)) {
+		char *end;
+		if (at[0] == '0' && (at[1] == 'b' || at[1] == 'B')) {
+			token.value = strtol(at + 2, &end, 2);
+		} else {
+			token.value = strtol(at, &end, 0);
+		}
+		at = end;
+		if (isalnum((unsigned char)*at) || *at == '_') {
+			c->at = at;
+			error(c, token.line, "Invalid number");
+			return c->token;
+		}
+		token.kind = TOK_NUMBER;
+	} else if (*at == '"') {
+		do {
+			++at;
+		} while (*at && *at != '"' && *at != '\n');
+		if (*at != '"') {
+			error(c, token.line, "Unterminated string");
+			return c->token;
+		}
+		++at;
+		token.kind = TOK_STRING;
+	} else {
+		token.kind = TOK_PUNCT;
+		++at;
+		for (size_t i = 0; i < ARRAY_SIZE(punctuation); ++i) {
+			size_t length = strlen(punctuation[i]);
+			if (strncmp(c->at, punctuation[i], length) == 0) {
+				at = c->at + length;
+				break;
+			}
+		}
+	}
+	token.length = at - c->at;
+	c->at = at;
+	return token;
+}
+
+static void advance(Compiler *c) {
+	c->token = c->next;
+	if (!c->failed) {
+		c->next = lex(c);
+	}
+}
+
+static bool token_is(Token *token, const char *text) {
+	return (token->kind == TOK_IDENT || token->kind == TOK_PUNCT) &&
+	       token->length == (int)strlen(text) &&
+	       strncmp(token->start, text, token->length) == 0;
+}
+
+static bool is(Compiler *c, const char *text) {
+	return token_is(&c->token, text);
+}
+
+static bool accept(Compiler *c, const char *text) {
+	if (!is(c, text)) {
+		return false;
+	}
+	advance(c);
+	return true;
+}
+
+static void expect(Compiler *c, const char *text) {
+	if (!accept(c, text)) {
+		error(c, c->token.line, "Expected '%s' before '%.*s'", text, c->token.length,
+		      c->token.start);
+	}
+}
+
+static char *token_text(Token *token) {
+	char *text = malloc(token->length + 1);
+	memcpy(text, token->start, token->length);
+	text[token->length] = '\0';
+	return text;
+}
+
+static char *expect_name(Compiler *c) {
+	if (c->token.kind != TOK_IDENT) {
+		error(c, c->token.line, "Expected a name before '%.*s'", c->token.length,
+		      c->token.start);
+		return NULL;
+	}
+	char *name = token_text(&c->token);
+	advance(c);
+	return name;
+}
+
+static LexerState save_lexer(Compiler *c) {
+	LexerState state = { c->at, c->line, c->token, c->next };
+	return state;
+}
+
+static void restore_lexer(Compiler *c, LexerState state) {
+	if (c->failed) {
+		return;
+	}
+	c->at = state.at;
+	c->line = state.line;
+	c->token = state.token;
+	c->next = state.next;
+}
+
+// V0-VF as v0-vf, or NO_REG
+static int32_t register_named(Token *token) {
+	if (token->kind != TOK_IDENT || token->length != 2 || tolower(token->start[0]) != 'v' ||
+	    !isxdigit((unsigned char)token->start[1])) {
+		return NO_REG;
+	}
+	char digit = tolower(token->start[1]);
+	return isdigit((unsigned char)digit) ? digit - '0' : digit - 'a' + 10;
+}
+
+static const char *keywords[] = {
+	"void", "int",	  "byte", "if",	  "else",  "while", "do",    "for",
+	"break", "continue", "return", "goto", "switch", "case", "default", "i",
+	"delay", "sound",
+};
+
+static bool is_reserved(Token *token) {
+	for (size_t i = 0; i < ARRAY_SIZE(keywords); ++i) {
+		if (token_is(token, keywords[i])) {
+			return true;
+		}
+	}
+	return register_named(token) != NO_REG;
+}
+
+static Function *current(Compiler *c) {
+	return &c->functions[c->function];
+}
+
+static int32_t find_function(Compiler *c, Token *name) {
+	for (int32_t f = 0; f < arrlen(c->functions); ++f) {
+		if (token_is(name, c->functions[f].name)) {
+			return f;
+		}
+	}
+	Function function = { .name = token_text(name), .line = name->line,
+			      .spill_slots = NO_SYMBOL };
+	arrput(c->functions, function);
+	return arrlen(c->functions) - 1;
+}
+
+static int32_t new_register(Compiler *c, const char *name) {
+	Register reg = { .name = name, .colour = NO_REG, .home = NO_SYMBOL };
+	arrput(current(c)->registers, reg);
+	return arrlen(current(c)->registers) - 1;
+}
+
+static int32_t temp(Compiler *c) {
+	return new_register(c, NULL);
+}
+
+// The function's register standing for the global, made on first use
+static int32_t global_register(Compiler *c, int32_t global) {
+	Function *f = current(c);
+	while (arrlen(f->globals) <= global) {
+		arrput(f->globals, NO_REG);
+	}
+	if (f->globals[global] == NO_REG) {
+		int32_t reg = new_register(c, c->globals[global].name);
+		current(c)->globals[global] = reg;
+	}
+	return current(c)->globals[global];
+}
+
+static int32_t new_expr(Compiler *c, ExprKind kind, int32_t value) {
+	Expr e = { kind, 0, NO_REG, NO_REG, value, c->token.line };
+	arrput(c->exprs, e);
+	return arrlen(c->exprs) - 1;
+}
+
+static int32_t parse_expression(Compiler *c);
+
+// A name in an expression: a variable, register, data symbol or builtin
+static int32_t parse_name(Compiler *c) {
+	Token name = c->token;
+	advance(c);
+	int32_t reg = register_named(&name);
+	if (reg != NO_REG) {
+		c->pinned |= 1u << reg;
+		return new_expr(c, EXPR_REGISTER, reg);
+	}
+	if (token_is(&name, "i")) {
+		return new_expr(c, EXPR_I, 0);
+	}
+	if (token_is(&name, "delay")) {
+		return new_expr(c, EXPR_DELAY, 0);
+	}
+
+	if (accept(c, "(")) {
+		int32_t index;
+		if (token_is(&name, "rand")) {
+			index = new_expr(c, EXPR_RAND, 0);
+		} else if (token_is(&name, "wait_key")) {
+			index = new_expr(c, EXPR_WAIT_KEY, 0);
+		} else if (token_is(&name, "key_pressed") || token_is(&name, "font")) {
+			int32_t argument = parse_expression(c);
+			ExprKind kind = token_is(&name, "font") ? EXPR_FONT : EXPR_KEY_PRESSED;
+			index = new_expr(c, kind, 0);
+			c->exprs[index].left = argument;
+		} else if (token_is(&name, "draw")) {
+			int32_t x = parse_expression(c);
+			expect(c, ",");
+			int32_t y = parse_expression(c);
+			expect(c, ",");
+			int height = c->token.value;
+			if (c->token.kind != TOK_NUMBER || height < 0 || height > 15) {
+				error(c, c->token.line,
+				      "A sprite's height must be a number up to 15");
+			}
+			advance(c);
+			index = new_expr(c, EXPR_DRAW, height);
+			c->exprs[index].left = x;
+			c->exprs[index].right = y;
+		} else {
+			error(c, name.line, "'%.*s' doesn't return a value", name.length,
+			      name.start);
+			return new_expr(c, EXPR_NUMBER, 0);
+		}
+		expect(c, ")");
+		return index;
+	}
+
+	for (int32_t l = arrlen(c->locals); l-- > 0;) {
+		if (token_is(&name, c->locals[l].name)) {
+			return new_expr(c, EXPR_REGISTER, c->locals[l].reg);
+		}
+	}
+	for (int32_t g = 0; g < arrlen(c->globals); ++g) {
+		if (token_is(&name, c->globals[g].name)) {
+			return new_expr(c, EXPR_REGISTER, global_register(c, g));
+		}
+	}
+	for (int32_t d = 0; d < arrlen(c->data); ++d) {
+		if (c->data[d].name && token_is(&name, c->data[d].name)) {
+			return new_expr(c, EXPR_ADDRESS, d);
+		}
+	}
+	error(c, name.line, "Unknown name '%.*s'", name.length, name.start);
+	return new_expr(c, EXPR_NUMBER, 0);
+}
+
+static int32_t parse_primary(Compiler *c) {
+	if (c->token.kind == TOK_NUMBER) {
+		int32_t index = new_expr(c, EXPR_NUMBER, c->token.value);
+		advance(c);
+		return index;
+	}
+	if (c->token.kind == TOK_IDENT && !is(c, "sound")) {
+		return parse_name(c);
+	}
+	if (accept(c, "(")) {
+		int32_t index = parse_expression(c);
+		expect(c, ")");
+		return index;
+	}
+	error(c, c->token.line, "Expected an expression before '%.*s'", c->token.length,
+	      c->token.start);
+	return new_expr(c, EXPR_NUMBER, 0);
+}
+
+static int32_t parse_unary(Compiler *c) {
+	Operator op;
+	if (accept(c, "-")) {
+		op = UN_NEG;
+	} else if (accept(c, "~")) {
+		op = UN_NOT;
+	} else if (accept(c, "!")) {
+		op = UN_LNOT;
+	} else if (accept(c, "+")) {
+		return parse_unary(c);
+	} else {
+		return parse_primary(c);
+	}
+	int32_t operand = parse_unary(c);
+	int32_t index = new_expr(c, EXPR_UNARY, 0);
+	c->exprs[index].op = op;
+	c->exprs[index].left = operand;
+	return index;
+}
+
+static int32_t new_binary(Compiler *c, Operator op, int32_t left, int32_t right) {
+	int32_t index = new_expr(c, EXPR_BINARY, 0);
+	c->exprs[index].op = op;
+	c->exprs[index].left = left;
+	c->exprs[index].right = right;
+	c->exprs[index].line = c->exprs[left].line;
+	return index;
+}
+
+// Precedence climbing, with C's precedences
+static int32_t parse_binary(Compiler *c, int precedence) {
+	int32_t left = parse_unary(c);
+	for (;;) {
+		size_t i = 0;
+		while (i < ARRAY_SIZE(binary_operators) &&
+		       (c->token.kind != TOK_PUNCT || !is(c, binary_operators[i].text))) {
+			++i;
+		}
+		if (i == ARRAY_SIZE(binary_operators) ||
+		    binary_operators[i].precedence < precedence) {
+			return left;
+		}
+		advance(c);
+		int32_t right = parse_binary(c, binary_operators[i].precedence + 1);
+		left = new_binary(c, binary_operators[i].op, left, right);
+	}
+}
+
+static int32_t parse_expression(Compiler *c) {
+	return parse_binary(c, 1);
+}
+
+static bool is_comparison(Operator op) {
+	return op >= BIN_EQ && op <= BIN_GE;
+}
+
+// Evaluates the expression if it's constant, with arithmetic wrapping at
+// `mask`. Addresses of data aren't known until the end.
+static bool constant(Compiler *c, int32_t index, int mask, int *value) {
+	Expr *e = &c->exprs[index];
+	int left, right;
+	switch (e->kind) {
+	case EXPR_NUMBER:
+		*value = e->value & mask;
+		return true;
+	case EXPR_UNARY:
+		if (!constant(c, e->left, mask, &left)) {
+			return false;
+		}
+		*value = e->op == UN_NEG ? -left & mask : e->op == UN_NOT ? ~left & mask : !left;
+		return true;
+	case EXPR_BINARY:
+		break;
+	default:
+		return false;
+	}
+
+	if (!constant(c, e->left, mask, &left)) {
+		return false;
+	}
+	if (e->op == BIN_LAND || e->op == BIN_LOR) {
+		// The right isn't evaluated when the left decides it
+		if ((e->op == BIN_LAND) != (left != 0)) {
+			*value = left != 0;
+			return true;
+		}
+		if (!constant(c, e->right, mask, &right)) {
+			return false;
+		}
+		*value = right != 0;
+		return true;
+	}
+	if (!constant(c, e->right, mask, &right)) {
+		return false;
+	}
+	switch (e->op) {
+	case BIN_ADD:
+		*value = (left + right) & mask;
+		return true;
+	case BIN_SUB:
+		*value = (left - right) & mask;
+		return true;
+	case BIN_MUL:
+		*value = (left * right) & mask;
+		return true;
+	case BIN_DIV:
+	case BIN_MOD:
+		if (!right) {
+			return false;
+		}
+		*value = e->op == BIN_DIV ? left / right : left % right;
+		return true;
+	case BIN_SHL:
+		*value = right >= 16 ? 0 : (left << right) & mask;
+		return true;
+	case BIN_SHR:
+		*value = right >= 16 ? 0 : left >> right;
+		return true;
+	case BIN_AND:
+		*value = left & right;
+		return true;
+	case BIN_OR:
+		*value = left | right;
+		return true;
+	case BIN_XOR:
+		*value = left ^ right;
+		return true;
+	case BIN_EQ:
+		*value = left == right;
+		return true;
+	case BIN_NE:
+		*value = left != right;
+		return true;
+	case BIN_LT:
+		*value = left < right;
+		return true;
+	case BIN_LE:
+		*value = left <= right;
+		return true;
+	case BIN_GT:
+		*value = left > right;
+		return true;
+	case BIN_GE:
+		*value = left >= right;
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool reads(Compiler *c, int32_t index, int32_t reg) {
+	if (index == NO_REG) {
+		return false;
+	}
+	Expr *e = &c->exprs[index];
+	if (e->kind == EXPR_REGISTER) {
+		return e->value == reg;
+	}
+	return reads(c, e->left, reg) || reads(c, e->right, reg);
+}
+
+// Whether evaluating it needs no instructions setting VF
+static bool is_leaf(Compiler *c, int32_t index) {
+	int value;
+	ExprKind kind = c->exprs[index].kind;
+	return constant(c, index, 0xFF, &value) || kind == EXPR_REGISTER || kind == EXPR_RAND ||
+	       kind == EXPR_DELAY || kind == EXPR_WAIT_KEY;
+}
+
+static bool is_register(Compiler *c, int32_t index, int32_t reg) {
+	return c->exprs[index].kind == EXPR_REGISTER && c->exprs[index].value == reg;
+}
+
+static bool is_boolean(Compiler *c, int32_t index) {
+	Expr *e = &c->exprs[index];
+	return (e->kind == EXPR_BINARY && (is_comparison(e->op) || e->op >= BIN_LAND)) ||
+	       (e->kind == EXPR_UNARY && e->op == UN_LNOT) || e->kind == EXPR_KEY_PRESSED ||
+	       e->kind == EXPR_DRAW;
+}
+
+static int32_t new_block(Compiler *c) {
+	Block block = { .term = TERM_RETURN, .next = { NO_BLOCK, NO_BLOCK },
+			.inlined = { NO_BLOCK, NO_BLOCK }, .line = c->statement_line };
+	arrput(current(c)->blocks, block);
+	return arrlen(current(c)->blocks) - 1;
+}
+
+static Block *block_at(Compiler *c) {
+	if (c->block == NO_BLOCK) {
+		c->block = new_block(c); // Unreachable, and removed later
+	}
+	return &current(c)->blocks[c->block];
+}
+
+static void emit(Compiler *c, Op op) {
+	op.line = c->statement_line;
+	op.known = LATTICE_BOTTOM;
+	arrput(block_at(c)->ops, op);
+}
+
+static void emit_load(Compiler *c, int32_t dst, int value) {
+	emit(c, (Op){ .kind = IR_LOAD, .dst = dst, .imm = value & 0xFF });
+}
+
+static void emit_copy(Compiler *c, int32_t dst, int32_t a) {
+	if (dst != a) {
+		emit(c, (Op){ .kind = IR_COPY, .dst = dst, .a = a });
+	}
+}
+
+static void emit_alu(Compiler *c, Alu alu, int32_t dst, int32_t a) {
+	emit(c, (Op){ .kind = IR_ALU, .alu = alu, .dst = dst, .a = a });
+}
+
+static void end_jump(Compiler *c, int32_t target) {
+	if (c->block != NO_BLOCK) {
+		Block *block = block_at(c);
+		block->term = TERM_JUMP;
+		block->next[0] = target;
+		block->line = c->statement_line;
+		c->block = NO_BLOCK;
+	}
+}
+
+static void end_branch(Compiler *c, Condition condition, int32_t taken, int32_t not_taken) {
+	Block *block = block_at(c);
+	block->term = TERM_BRANCH;
+	block->condition = condition;
+	block->next[0] = taken;
+	block->next[1] = not_taken;
+	block->line = c->statement_line;
+	c->block = NO_BLOCK;
+}
+
+static void end_function_block(Compiler *c, TermKind term, int32_t target) {
+	Block *block = block_at(c);
+	block->term = term;
+	block->target = target;
+	block->line = c->statement_line;
+	c->block = NO_BLOCK;
+}
+
+// Continues into the block, falling through from the current one
+static void start_block(Compiler *c, int32_t block) {
+	end_jump(c, block);
+	c->block = block;
+}
+
+static void lower_into(Compiler *c, int32_t index, int32_t dst);
+static void lower_condition(Compiler *c, int32_t index, int32_t taken, int32_t not_taken);
+
+static int32_t lower_value(Compiler *c, int32_t index) {
+	if (c->exprs[index].kind == EXPR_REGISTER) {
+		return c->exprs[index].value;
+	}
+	int32_t reg = temp(c);
+	lower_into(c, index, reg);
+	return reg;
+}
+
+// A value that's still there once `later` is evaluated, which may set VF
+static int32_t lower_operand(Compiler *c, int32_t index, int32_t later) {
+	int32_t reg = lower_value(c, index);
+	if (reg == REG_VF && !is_leaf(c, later)) {
+		int32_t copy = temp(c);
+		emit_copy(c, copy, reg);
+		return copy;
+	}
+	return reg;
+}
+
+// Both operands, with a VF one of them reads kept from evaluating the other
+static void lower_operands(Compiler *c, int32_t left, int32_t right, int32_t *left_reg,
+			   int32_t *right_reg) {
+	if (reads(c, right, REG_VF) && !is_leaf(c, left)) {
+		*right_reg = lower_operand(c, right, left);
+		*left_reg = lower_value(c, left);
+	} else {
+		*left_reg = lower_operand(c, left, right);
+		*right_reg = lower_value(c, right);
+	}
+}
+
+// A right operand to evaluate before the left goes into the destination, as
+// that would overwrite a VF it reads
+static int32_t lower_right_first(Compiler *c, int32_t left, int32_t right) {
+	if (reads(c, right, REG_VF) && !is_leaf(c, left)) {
+		return lower_operand(c, right, left);
+	}
+	return NO_REG;
+}
+
+static int32_t constant_register(Compiler *c, int value) {
+	int32_t reg = temp(c);
+	emit_load(c, reg, value);
+	return reg;
+}
+
+static void lower_draw(Compiler *c, Expr *e) {
+	int32_t height = e->value;
+	int32_t x, y;
+	lower_operands(c, e->left, e->right, &x, &y);
+	emit(c, (Op){ .kind = IR_DRAW, .a = x, .b = y, .imm = height });
+}
+
+// dst = 1 if the condition holds, else 0
+static void lower_boolean(Compiler *c, int32_t index, int32_t dst) {
+	int32_t result = reads(c, index, dst) ? temp(c) : dst;
+	emit_load(c, result, 0);
+	int32_t set = new_block(c);
+	int32_t join = new_block(c);
+	lower_condition(c, index, set, join);
+	c->block = set;
+	emit_load(c, result, 1);
+	start_block(c, join);
+	emit_copy(c, dst, result);
+}
+
+static int log2_exact(int value) {
+	for (int bit = 0; bit < 8; ++bit) {
+		if (value == 1 << bit) {
+			return bit;
+		}
+	}
+	return -1;
+}
+
+// By shifts and adds, a constant having few bits set
+static void lower_multiply(Compiler *c, int32_t left, int factor, int32_t dst) {
+	if (factor == 0) {
+		emit_load(c, dst, 0);
+		return;
+	}
+	int32_t operand = NO_REG;
+	if (factor & (factor - 1)) {
+		operand = lower_value(c, left);
+		if (operand == dst || operand == REG_VF) {
+			int32_t copy = temp(c);
+			emit_copy(c, copy, operand);
+			operand = copy;
+		}
+		emit_copy(c, dst, operand);
+	} else {
+		lower_into(c, left, dst);
+	}
+	int top = 7;
+	while (!(factor & (1 << top))) {
+		--top;
+	}
+	for (int bit = top - 1; bit >= 0; --bit) {
+		emit_alu(c, ALU_SHL, dst, dst);
+		if (factor & (1 << bit)) {
+			emit_alu(c, ALU_ADD, dst, operand);
+		}
+	}
+}
+
+static void lower_shift(Compiler *c, int32_t left, int amount, Alu alu, int32_t dst) {
+	if (amount >= 8) {
+		emit_load(c, dst, 0);
+		return;
+	}
+	lower_into(c, left, dst);
+	for (int i = 0; i < amount; ++i) {
+		emit_alu(c, alu, dst, dst);
+	}
+}
+
+static void lower_binary(Compiler *c, int32_t index, int32_t dst) {
+	Expr e = c->exprs[index];
+	int left_value, right_value;
+	bool left_constant = constant(c, e.left, 0xFF, &left_value);
+	bool right_constant = constant(c, e.right, 0xFF, &right_value);
+	if (is_comparison(e.op) || e.op >= BIN_LAND) {
+		lower_boolean(c, index, dst);
+		return;
+	}
+
+	bool commutative = e.op == BIN_ADD || e.op == BIN_MUL || e.op == BIN_AND ||
+			   e.op == BIN_OR || e.op == BIN_XOR;
+	if (commutative && left_constant) {
+		int32_t swap = e.left;
+		e.left = e.right;
+		e.right = swap;
+		right_value = left_value;
+		right_constant = true;
+	}
+
+	switch (e.op) {
+	case BIN_MUL:
+	case BIN_DIV:
+	case BIN_MOD:
+	case BIN_SHL:
+	case BIN_SHR:
+		if (!right_constant) {
+			error(c, e.line, "Only multiplying, dividing and shifting by a constant is "
+					 "supported");
+			return;
+		}
+		if (e.op == BIN_MUL) {
+			lower_multiply(c, e.left, right_value, dst);
+		} else if (e.op == BIN_SHL || e.op == BIN_SHR) {
+			Alu shift = e.op == BIN_SHL ? ALU_SHL : ALU_SHR;
+			lower_shift(c, e.left, right_value, shift, dst);
+		} else if (log2_exact(right_value) < 0) {
+			error(c, e.line, "Only dividing by a power of two is supported");
+		} else if (e.op == BIN_DIV) {
+			lower_shift(c, e.left, log2_exact(right_value), ALU_SHR, dst);
+		} else {
+			int32_t mask = constant_register(c, right_value - 1);
+			lower_into(c, e.left, dst);
+			emit_alu(c, ALU_AND, dst, mask);
+		}
+		return;
+	case BIN_ADD:
+	case BIN_SUB:
+		// ADD Vx, byte leaves VF alone
+		if (right_constant) {
+			lower_into(c, e.left, dst);
+			int amount = e.op == BIN_ADD ? right_value : -right_value;
+			if (amount & 0xFF) {
+				emit(c,
+				     (Op){ .kind = IR_ADD_IMM, .dst = dst, .imm = amount & 0xFF });
+			}
+			return;
+		}
+		break;
+	case BIN_AND:
+		if (right_constant && c->exprs[e.left].kind == EXPR_RAND) {
+			emit(c, (Op){ .kind = IR_RAND, .dst = dst, .imm = right_value });
+			return;
+		}
+		if (right_constant && right_value == 0xFF) {
+			lower_into(c, e.left, dst);
+			return;
+		}
+		break;
+	case BIN_OR:
+	case BIN_XOR:
+		if (right_constant && right_value == 0) {
+			lower_into(c, e.left, dst);
+			return;
+		}
+		break;
+	default:
+		break;
+	}
+
+	static const Alu alus[] = {
+		[BIN_ADD] = ALU_ADD, [BIN_SUB] = ALU_SUB, [BIN_AND] = ALU_AND,
+		[BIN_OR] = ALU_OR,   [BIN_XOR] = ALU_XOR,
+	};
+	Alu alu = alus[e.op];
+	if (!is_register(c, e.left, dst) && reads(c, e.right, dst)) {
+		// Evaluating the left into dst would lose what the right reads
+		if (commutative && !reads(c, e.left, dst)) {
+			int32_t swap = e.left;
+			e.left = e.right;
+			e.right = swap;
+		} else if (e.op == BIN_SUB && !reads(c, e.left, dst)) {
+			lower_into(c, e.right, dst);
+			emit_alu(c, ALU_SUBN, dst, lower_value(c, e.left));
+			return;
+		} else {
+			int32_t result = temp(c);
+			lower_binary(c, index, result);
+			emit_copy(c, dst, result);
+			return;
+		}
+	}
+	int32_t right = lower_right_first(c, e.left, e.right);
+	lower_into(c, e.left, dst);
+	emit_alu(c, alu, dst, right != NO_REG ? right : lower_value(c, e.right));
+}
+
+static void lower_into(Compiler *c, int32_t index, int32_t dst) {
+	Expr e = c->exprs[index];
+	int value;
+	if (constant(c, index, 0xFF, &value)) {
+		emit_load(c, dst, value);
+		return;
+	}
+	switch (e.kind) {
+	case EXPR_REGISTER:
+		emit_copy(c, dst, e.value);
+		return;
+	case EXPR_RAND:
+		emit(c, (Op){ .kind = IR_RAND, .dst = dst, .imm = 0xFF });
+		return;
+	case EXPR_DELAY:
+		emit(c, (Op){ .kind = IR_GET_DELAY, .dst = dst });
+		return;
+	case EXPR_WAIT_KEY:
+		emit(c, (Op){ .kind = IR_WAIT_KEY, .dst = dst });
+		return;
+	case EXPR_DRAW:
+		lower_draw(c, &e);
+		emit_copy(c, dst, REG_VF);
+		return;
+	case EXPR_KEY_PRESSED:
+		lower_boolean(c, index, dst);
+		return;
+	case EXPR_UNARY:
+		if (e.op == UN_LNOT) {
+			lower_boolean(c, index, dst);
+		} else if (e.op == UN_NEG) {
+			// dst = 0 - dst
+			lower_into(c, e.left, dst);
+			emit_alu(c, ALU_SUBN, dst, constant_register(c, 0));
+		} else {
+			lower_into(c, e.left, dst);
+			emit_alu(c, ALU_XOR, dst, constant_register(c, 0xFF));
+		}
+		return;
+	case EXPR_BINARY:
+		lower_binary(c, index, dst);
+		return;
+	default:
+		error(c, e.line, "Addresses can only be assigned to i");
+		return;
+	}
+}
+
+// Assigns a register, through a temporary if evaluating it would set VF first
+static void lower_assignment(Compiler *c, int32_t dst, int32_t index) {
+	if (dst == REG_VF && !is_leaf(c, index)) {
+		int32_t result = temp(c);
+		lower_into(c, index, result);
+		emit_copy(c, dst, result);
+		return;
+	}
+	lower_into(c, index, dst);
+}
+
+static void branch(Compiler *c, ConditionKind kind, int32_t a, int32_t b, int imm, int32_t taken,
+		   int32_t not_taken) {
+	Condition condition = { kind, a, b, imm };
+	end_branch(c, condition, taken, not_taken);
+}
+
+// Branches on left >= right, through the flag of SUB or SUBN
+static void lower_at_least(Compiler *c, int32_t left, int32_t right, int32_t taken,
+			   int32_t not_taken) {
+	int value;
+	if (constant(c, right, 0xFF, &value)) {
+		if (value == 0) {
+			lower_value(c, left); // For its effects
+			end_jump(c, taken);
+			return;
+		}
+		int32_t operand = lower_value(c, left);
+		if (value == 1) {
+			branch(c, COND_NE, operand, NO_REG, 0, taken, not_taken);
+			return;
+		}
+		if (value == 0xFF) {
+			branch(c, COND_EQ, operand, NO_REG, 0xFF, taken, not_taken);
+			return;
+		}
+		int32_t difference = constant_register(c, value);
+		emit_alu(c, ALU_SUBN, difference, operand);
+	} else {
+		int32_t difference = temp(c);
+		int32_t operand = lower_right_first(c, left, right);
+		lower_into(c, left, difference);
+		emit_alu(c, ALU_SUB, difference,
+			 operand != NO_REG ? operand : lower_value(c, right));
+	}
+	branch(c, COND_EQ, REG_VF, NO_REG, 1, taken, not_taken);
+}
+
+static void lower_comparison(Compiler *c, Expr e, int32_t taken, int32_t not_taken) {
+	int value;
+	if (constant(c, e.left, 0xFF, &value)) {
+		int32_t swap = e.left;
+		e.left = e.right;
+		e.right = swap;
+		e.op = mirrored[e.op];
+	}
+	bool right_constant = constant(c, e.right, 0xFF, &value);
+
+	if (e.op == BIN_EQ || e.op == BIN_NE) {
+		if (e.op == BIN_NE) {
+			int32_t swap = taken;
+			taken = not_taken;
+			not_taken = swap;
+		}
+		if (right_constant && (value == 0 || value == 1) && is_boolean(c, e.left)) {
+			if (value == 0) {
+				lower_condition(c, e.left, not_taken, taken);
+			} else {
+				lower_condition(c, e.left, taken, not_taken);
+			}
+			return;
+		}
+		if (right_constant && c->exprs[e.left].kind == EXPR_DRAW) {
+			lower_draw(c, &c->exprs[e.left]);
+			branch(c, COND_EQ, REG_VF, NO_REG, value, taken, not_taken);
+			return;
+		}
+		if (right_constant) {
+			branch(c, COND_EQ, lower_value(c, e.left), NO_REG, value, taken, not_taken);
+			return;
+		}
+		int32_t left, right;
+		lower_operands(c, e.left, e.right, &left, &right);
+		branch(c, COND_EQ, left, right, 0, taken, not_taken);
+		return;
+	}
+
+	// Everything else in terms of >=
+	if (right_constant && (e.op == BIN_GT || e.op == BIN_LE)) {
+		if (value == 0xFF) {
+			lower_value(c, e.left);
+			end_jump(c, e.op == BIN_LE ? taken : not_taken);
+			return;
+		}
+		e.right = new_expr(c, EXPR_NUMBER, value + 1);
+		e.op = e.op == BIN_GT ? BIN_GE : BIN_LT;
+	}
+	switch (e.op) {
+	case BIN_GE:
+		lower_at_least(c, e.left, e.right, taken, not_taken);
+		break;
+	case BIN_LT:
+		lower_at_least(c, e.left, e.right, not_taken, taken);
+		break;
+	case BIN_LE:
+		lower_at_least(c, e.right, e.left, taken, not_taken);
+		break;
+	default:
+		lower_at_least(c, e.right, e.left, not_taken, taken);
+		break;
+	}
+}
+
+// Ends the current block branching on the expression
+static void lower_condition(Compiler *c, int32_t index, int32_t taken, int32_t not_taken) {
+	Expr e = c->exprs[index];
+	int value;
+	if (constant(c, index, 0xFF, &value)) {
+		end_jump(c, value ? taken : not_taken);
+		return;
+	}
+	if (e.kind == EXPR_UNARY && e.op == UN_LNOT) {
+		lower_condition(c, e.left, not_taken, taken);
+		return;
+	}
+	if (e.kind == EXPR_KEY_PRESSED) {
+		branch(c, COND_KEY, lower_value(c, e.left), NO_REG, 0, taken, not_taken);
+		return;
+	}
+	if (e.kind == EXPR_DRAW) {
+		lower_draw(c, &e);
+		branch(c, COND_EQ, REG_VF, NO_REG, 1, taken, not_taken);
+		return;
+	}
+	if (e.kind != EXPR_BINARY || (!is_comparison(e.op) && e.op < BIN_LAND)) {
+		branch(c, COND_NE, lower_value(c, index), NO_REG, 0, taken, not_taken);
+		return;
+	}
+
+	if (e.op == BIN_LAND || e.op == BIN_LOR) {
+		int32_t right = new_block(c);
+		if (e.op == BIN_LAND) {
+			lower_condition(c, e.left, right, not_taken);
+		} else {
+			lower_condition(c, e.left, taken, right);
+		}
+		c->block = right;
+		lower_condition(c, e.right, taken, not_taken);
+		return;
+	}
+	lower_comparison(c, e, taken, not_taken);
+}
+
+static bool is_address(Compiler *c, int32_t index) {
+	Expr *e = &c->exprs[index];
+	return e->kind == EXPR_ADDRESS || e->kind == EXPR_FONT || e->kind == EXPR_I ||
+	       e->kind == EXPR_NUMBER ||
+	       (e->kind == EXPR_BINARY && e->op == BIN_ADD && is_address(c, e->left));
+}
+
+static void lower_add_i(Compiler *c, int32_t index) {
+	int value;
+	if (!constant(c, index, 0xFF, &value) || value) {
+		emit(c, (Op){ .kind = IR_ADD_I, .a = lower_value(c, index) });
+	}
+}
+
+// i = a constant address, data, font(v) or i, plus any bytes
+static void lower_address(Compiler *c, int32_t index) {
+	Expr e = c->exprs[index];
+	int value;
+	if (constant(c, index, 0xFFF, &value)) {
+		emit(c, (Op){ .kind = IR_SET_I, .imm = value, .symbol = NO_SYMBOL });
+		return;
+	}
+	switch (e.kind) {
+	case EXPR_ADDRESS:
+		emit(c, (Op){ .kind = IR_SET_I, .symbol = e.value });
+		return;
+	case EXPR_FONT:
+		emit(c, (Op){ .kind = IR_FONT, .a = lower_value(c, e.left) });
+		return;
+	case EXPR_I:
+		return;
+	case EXPR_BINARY:
+		if (e.op != BIN_ADD) {
+			break;
+		}
+		if (!is_address(c, e.left) && is_address(c, e.right)) {
+			int32_t swap = e.left;
+			e.left = e.right;
+			e.right = swap;
+		}
+		if (c->exprs[e.left].kind == EXPR_ADDRESS && constant(c, e.right, 0xFFF, &value)) {
+			emit(c, (Op){ .kind = IR_SET_I, .imm = value,
+				      .symbol = c->exprs[e.left].value });
+			return;
+		}
+		if (!is_address(c, e.left)) {
+			break;
+		}
+		lower_address(c, e.left);
+		lower_add_i(c, e.right);
+		return;
+	default:
+		break;
+	}
+	error(c, e.line, "Expected an address, font(v) or i, plus bytes");
+}
+
+// The instruction forms of the disassembly, as inst2text() writes them. In
+// operands, x and y are registers, k a byte, n an address and z a nibble.
+static const struct {
+	const char *mnemonic;
+	const char *operands;
+	uint16_t opcode;
+} asm_forms[] = {
+	{ "CLS", "", 0x00E0 },	     { "RET", "", 0x00EE },	   { "SYS", "n", 0x0000 },
+	{ "JMP", "n", 0x1000 },	     { "CALL", "n", 0x2000 },	   { "SE", "x,k", 0x3000 },
+	{ "SNE", "x,k", 0x4000 },    { "SE", "x,y", 0x5000 },	   { "LD", "x,k", 0x6000 },
+	{ "ADD", "x,k", 0x7000 },    { "LD", "x,y", 0x8000 },	   { "OR", "x,y", 0x8001 },
+	{ "AND", "x,y", 0x8002 },    { "XOR", "x,y", 0x8003 },	   { "ADD", "x,y", 0x8004 },
+	{ "SUB", "x,y", 0x8005 },    { "SHR", "x,y", 0x8006 },	   { "SUBN", "x,y", 0x8007 },
+	{ "SHL", "x,y", 0x800E },    { "SNE", "x,y", 0x9000 },	   { "LD", "I,n", 0xA000 },
+	{ "JMP", "V0,n", 0xB000 },   { "RND", "x,k", 0xC000 },	   { "DRW", "x,y,z", 0xD000 },
+	{ "SKP", "x", 0xE09E },	     { "SKNP", "x", 0xE0A1 },	   { "LD", "x,DT", 0xF007 },
+	{ "LD", "x,K", 0xF00A },     { "LD", "DT,x", 0xF015 },	   { "LD", "ST,x", 0xF018 },
+	{ "ADD", "I,x", 0xF01E },    { "LD", "F,x", 0xF029 },	   { "LD", "B,x", 0xF033 },
+	{ "LD", "[I],x", 0xF055 },   { "LD", "x,[I]", 0xF065 },
+};
+
+static const char *skip_spaces(const char *text) {
+	while (*text == ' ' || *text == '\t') {
+		++text;
+	}
+	return text;
+}
+
+static bool match_operands(const char *text, const char *pattern, uint16_t *opcode) {
+	for (const char *p = pattern; *p; ++p) {
+		text = skip_spaces(text);
+		char *end;
+		long value;
+		switch (*p) {
+		case 'x':
+		case 'y':
+			if (toupper(*text) != 'V' || !isxdigit((unsigned char)text[1])) {
+				return false;
+			}
+			value = isdigit((unsigned char)text[1]) ? text[1] - '0'
+								: toupper(text[1]) - 'A' + 10;
+			*opcode |= value << (*p == 'x' ? 8 : 4);
+			text += 2;
+			break;
+		case 'k':
+		case 'n':
+		case 'z':
+			value = strtol(text, &end, 0);
+			if (end == text || value < 0 ||
+			    value > (*p == 'k' ? 0xFF : *p == 'n' ? 0xFFF : 0xF)) {
+				return false;
+			}
+			*opcode |= value;
+			text = end;
+			break;
+		default:
+			if (toupper((unsigned char)*text) != *p) {
+				return false;
+			}
+			++text;
+			break;
+		}
+	}
+	return *skip_spaces(text) == '\0';
+}
+
+// An instruction in the disassembly's syntax, or a raw opcode like 0x5123
+static bool parse_asm(const char *text, Chip8Instruction *instruction) {
+	text = skip_spaces(text);
+	char *end;
+	long raw = strtol(text, &end, 16);
+	if (text[0] == '0' && (text[1] == 'x' || text[1] == 'X') && end != text &&
+	    !*skip_spaces(end) && raw <= 0xFFFF) {
+		instruction->raw = raw;
+		return true;
+	}
+	size_t length = strcspn(text, " \t");
+	for (size_t i = 0; i < ARRAY_SIZE(asm_forms); ++i) {
+		uint16_t opcode = asm_forms[i].opcode;
+		if (strlen(asm_forms[i].mnemonic) == length &&
+		    strncasecmp(text, asm_forms[i].mnemonic, length) == 0 &&
+		    match_operands(text + length, asm_forms[i].operands, &opcode)) {
+			instruction->raw = opcode;
+			return true;
+		}
+	}
+	return false;
+}
+
+static void pin(Compiler *c, int32_t reg) {
+	if (reg < REGISTERS) {
+		c->pinned |= 1u << reg;
+	}
+}
+
+// asm("...") as the equivalent operation on physical registers
+static void lower_asm(Compiler *c, const char *text, uint32_t line) {
+	Chip8Instruction instruction;
+	if (!parse_asm(text, &instruction)) {
+		error(c, line, "Unknown instruction '%s'", text);
+		return;
+	}
+	uint8_t x = instruction.rformat.rx;
+	uint8_t y = instruction.rformat.ry;
+	uint8_t byte = instruction.iformat.imm;
+	Op op = { .dst = x, .a = y, .symbol = NO_SYMBOL };
+	switch (instruction_type(instruction)) {
+	case CHIP8_CLS:
+		op.kind = IR_CLS;
+		break;
+	case CHIP8_RET:
+	case CHIP8_JMP_ADDR:
+	case CHIP8_CALL_ADDR:
+	case CHIP8_SE_VX_BYTE:
+	case CHIP8_SNE_VX_BYTE:
+	case CHIP8_SE_VX_VY:
+	case CHIP8_SNE_VX_VY:
+	case CHIP8_JMP_V0_ADDR:
+	case CHIP8_SKP_VX:
+	case CHIP8_SKNP_VX:
+		error(c, line, "asm() can't change the flow of control, use C for '%s'", text);
+		return;
+	case CHIP8_LD_VX_BYTE:
+		op.kind = IR_LOAD;
+		op.imm = byte;
+		break;
+	case CHIP8_ADD_VX_BYTE:
+		op.kind = IR_ADD_IMM;
+		op.imm = byte;
+		break;
+	case CHIP8_LD_VX_VY:
+		op.kind = IR_COPY;
+		break;
+	case CHIP8_OR_VX_VY:
+	case CHIP8_AND_VX_VY:
+	case CHIP8_XOR_VX_VY:
+	case CHIP8_ADD_VX_VY:
+	case CHIP8_SUB_VX_VY:
+	case CHIP8_SUBN_VX_VY:
+		op.kind = IR_ALU;
+		op.alu = instruction.rformat.imm;
+		break;
+	case CHIP8_SHR_VX:
+	case CHIP8_SHL_VX:
+		// As the quirk has it, Vx = Vy shifted
+		emit_copy(c, x, y);
+		op.kind = IR_ALU;
+		op.alu = instruction.rformat.imm;
+		op.a = x;
+		break;
+	case CHIP8_LD_I_ADDR:
+		op.kind = IR_SET_I;
+		op.imm = instruction.aformat.addr;
+		break;
+	case CHIP8_RND_VX_BYTE:
+		op.kind = IR_RAND;
+		op.imm = byte;
+		break;
+	case CHIP8_DRW_VX_VY_NIBBLE:
+		op = (Op){ .kind = IR_DRAW, .a = x, .b = y, .imm = instruction.rformat.imm };
+		break;
+	case CHIP8_LD_VX_DT:
+		op.kind = IR_GET_DELAY;
+		break;
+	case CHIP8_LD_VX_K:
+		op.kind = IR_WAIT_KEY;
+		break;
+	case CHIP8_LD_DT_VX:
+	case CHIP8_LD_ST_VX:
+	case CHIP8_ADD_I_VX:
+	case CHIP8_LD_F_VX:
+	case CHIP8_LD_B_VX: {
+		static const OpKind kinds[] = {
+			[CHIP8_LD_DT_VX] = IR_SET_DELAY, [CHIP8_LD_ST_VX] = IR_SET_SOUND,
+			[CHIP8_ADD_I_VX] = IR_ADD_I,	 [CHIP8_LD_F_VX] = IR_FONT,
+			[CHIP8_LD_B_VX] = IR_BCD,
+		};
+		op = (Op){ .kind = kinds[instruction_type(instruction)], .a = x };
+		break;
+	}
+	case CHIP8_LD_I_VX:
+	case CHIP8_LD_VX_I:
+		op = (Op){ .kind = instruction_type(instruction) == CHIP8_LD_I_VX ? IR_SAVE
+										  : IR_RESTORE,
+			   .imm = x };
+		c->pinned |= (2u << x) - 1;
+		break;
+	default:
+		op = (Op){ .kind = IR_RAW, .imm = instruction.raw };
+		emit(c, op);
+		return;
+	}
+	if (op.kind != IR_SAVE && op.kind != IR_RESTORE && op.kind != IR_SET_I) {
+		pin(c, op.dst);
+		pin(c, op.a);
+		pin(c, op.b);
+	}
+	emit(c, op);
+}
+
+static void parse_statement(Compiler *c);
+
+static int32_t parse_constant(Compiler *c, int mask) {
+	int32_t index = parse_expression(c);
+	int value = 0;
+	if (!constant(c, index, mask, &value)) {
+		error(c, c->exprs[index].line, "Expected a constant");
+	}
+	return value;
+}
+
+static int32_t parse_register_argument(Compiler *c) {
+	int32_t reg = register_named(&c->token);
+	if (reg == NO_REG) {
+		error(c, c->token.line, "Expected a register before '%.*s'", c->token.length,
+		      c->token.start);
+		return 0;
+	}
+	advance(c);
+	return reg;
+}
+
+// Statements that are just a call
+static void parse_call(Compiler *c) {
+	Token name = c->token;
+	advance(c);
+	expect(c, "(");
+	if (token_is(&name, "cls")) {
+		emit(c, (Op){ .kind = IR_CLS });
+	} else if (token_is(&name, "bcd")) {
+		emit(c, (Op){ .kind = IR_BCD, .a = lower_value(c, parse_expression(c)) });
+	} else if (token_is(&name, "save") || token_is(&name, "load")) {
+		int32_t last = parse_register_argument(c);
+		c->pinned |= (2u << last) - 1;
+		emit(c, (Op){ .kind = token_is(&name, "save") ? IR_SAVE : IR_RESTORE,
+			      .imm = last });
+	} else if (token_is(&name, "asm")) {
+		if (c->token.kind != TOK_STRING) {
+			error(c, c->token.line, "Expected an instruction in quotes");
+			return;
+		}
+		char *text = token_text(&c->token);
+		text[strlen(text) - 1] = '\0';
+		lower_asm(c, text + 1, c->token.line);
+		free(text);
+		advance(c);
+	} else if (token_is(&name, "jump")) {
+		int32_t index = parse_expression(c);
+		Expr *e = &c->exprs[index];
+		int value;
+		if (constant(c, index, 0xFFF, &value)) {
+			end_function_block(c, TERM_JUMP_OUT, value);
+		} else if (e->kind == EXPR_BINARY && e->op == BIN_ADD &&
+			   constant(c, e->left, 0xFFF, &value)) {
+			lower_assignment(c, REG_V0, e->right);
+			c->pinned |= 1u << REG_V0;
+			end_function_block(c, TERM_JUMP_V0, value);
+		} else {
+			error(c, e->line, "Expected jump(address) or jump(address + v0)");
+		}
+	} else {
+		if (c->token.kind != TOK_PUNCT || !is(c, ")")) {
+			error(c, c->token.line, "Functions don't take arguments");
+			return;
+		}
+		int32_t callee = find_function(c, &name);
+		emit(c, (Op){ .kind = IR_CALL, .symbol = callee });
+	}
+	expect(c, ")");
+}
+
+static bool is_builtin_value(Token *name) {
+	return token_is(name, "draw") || token_is(name, "wait_key") || token_is(name, "rand") ||
+	       token_is(name, "key_pressed") || token_is(name, "font");
+}
+
+static int32_t parse_lvalue(Compiler *c) {
+	Token target = c->token;
+	int32_t lvalue = parse_primary(c);
+	if (c->exprs[lvalue].kind != EXPR_REGISTER) {
+		error(c, target.line, "Can't assign to '%.*s'", target.length, target.start);
+		return NO_REG;
+	}
+	return lvalue;
+}
+
+// An assignment, increment or call, without the semicolon
+static void parse_simple_statement(Compiler *c) {
+	Token target = c->token;
+	if (target.kind == TOK_IDENT && token_is(&c->next, "(")) {
+		if (is_builtin_value(&target)) {
+			lower_value(c, parse_expression(c)); // For its effects
+		} else {
+			parse_call(c);
+		}
+		return;
+	}
+	if (is(c, "++") || is(c, "--")) {
+		int step = is(c, "++") ? 1 : 0xFF;
+		advance(c);
+		int32_t lvalue = parse_lvalue(c);
+		if (lvalue != NO_REG) {
+			emit(c, (Op){ .kind = IR_ADD_IMM, .dst = c->exprs[lvalue].value,
+				      .imm = step });
+		}
+		return;
+	}
+	if (target.kind != TOK_IDENT) {
+		error(c, target.line, "Expected a statement before '%.*s'", target.length,
+		      target.start);
+		return;
+	}
+	if (token_is(&target, "i")) {
+		advance(c);
+		if (accept(c, "+=")) {
+			lower_add_i(c, parse_expression(c));
+		} else {
+			expect(c, "=");
+			lower_address(c, parse_expression(c));
+		}
+		return;
+	}
+	if (token_is(&target, "delay") || token_is(&target, "sound")) {
+		advance(c);
+		expect(c, "=");
+		int32_t value = lower_value(c, parse_expression(c));
+		emit(c, (Op){ .kind = token_is(&target, "delay") ? IR_SET_DELAY : IR_SET_SOUND,
+			      .a = value });
+		return;
+	}
+
+	int32_t lvalue = parse_lvalue(c);
+	if (lvalue == NO_REG) {
+		return;
+	}
+	int32_t reg = c->exprs[lvalue].value;
+	if (is(c, "++") || is(c, "--")) {
+		int step = is(c, "++") ? 1 : 0xFF;
+		advance(c);
+		emit(c, (Op){ .kind = IR_ADD_IMM, .dst = reg, .imm = step });
+		return;
+	}
+	if (accept(c, "=")) {
+		lower_assignment(c, reg, parse_expression(c));
+		return;
+	}
+	for (size_t i = 0; i < ARRAY_SIZE(compound_assignments); ++i) {
+		if (accept(c, compound_assignments[i].text)) {
+			int32_t right = parse_expression(c);
+			int32_t index = new_binary(c, compound_assignments[i].op, lvalue, right);
+			lower_assignment(c, reg, index);
+			return;
+		}
+	}
+	error(c, c->token.line, "Expected an assignment before '%.*s'", c->token.length,
+	      c->token.start);
+}
+
+static bool is_type(Compiler *c) {
+	return is(c, "int") || is(c, "byte");
+}
+
+static void parse_local(Compiler *c) {
+	advance(c);
+	do {
+		Token name = c->token;
+		if (is_reserved(&name)) {
+			error(c, name.line, "'%.*s' is reserved", name.length, name.start);
+			return;
+		}
+		char *text = expect_name(c);
+		if (!text) {
+			return;
+		}
+		int32_t reg = new_register(c, text);
+		Local local = { text, reg };
+		if (accept(c, "=")) {
+			lower_assignment(c, reg, parse_expression(c));
+		}
+		arrput(c->locals, local);
+	} while (accept(c, ","));
+}
+
+// Forgets the locals declared since the scope began
+static void end_scope(Compiler *c, int32_t scope) {
+	for (int32_t l = scope; l < arrlen(c->locals); ++l) {
+		current(c)->registers[c->locals[l].reg].name = NULL;
+		free(c->locals[l].name);
+	}
+	arrsetlen(c->locals, scope);
+}
+
+static Label *find_label(Compiler *c, Token *name) {
+	Function *f = current(c);
+	for (int32_t l = 0; l < arrlen(f->labels); ++l) {
+		if (token_is(name, f->labels[l].name)) {
+			return &f->labels[l];
+		}
+	}
+	Label label = { token_text(name), new_block(c), false, name->line };
+	arrput(current(c)->labels, label);
+	return &arrlast(current(c)->labels);
+}
+
+static Jumps *innermost_jumps(Compiler *c, bool loop) {
+	for (int32_t j = arrlen(c->jumps); j-- > 0;) {
+		if (!loop || !c->jumps[j].is_switch) {
+			return &c->jumps[j];
+		}
+	}
+	return NULL;
+}
+
+static void parse_loop_body(Compiler *c, int32_t break_to, int32_t continue_to) {
+	Jumps jumps = { break_to, continue_to, false, NULL, NULL, NO_BLOCK };
+	arrput(c->jumps, jumps);
+	parse_statement(c);
+	arrpop(c->jumps);
+}
+
+static void parse_if(Compiler *c) {
+	expect(c, "(");
+	int32_t condition = parse_expression(c);
+	expect(c, ")");
+	int32_t then_block = new_block(c);
+	int32_t else_block = new_block(c);
+	lower_condition(c, condition, then_block, else_block);
+	c->block = then_block;
+	parse_statement(c);
+	if (accept(c, "else")) {
+		int32_t join = new_block(c);
+		end_jump(c, join);
+		c->block = else_block;
+		parse_statement(c);
+		start_block(c, join);
+	} else {
+		start_block(c, else_block);
+	}
+}
+
+// Tested before the first iteration and then at the bottom, so each one takes
+// a skip and a jump back
+static void parse_while(Compiler *c) {
+	expect(c, "(");
+	int32_t condition = parse_expression(c);
+	expect(c, ")");
+	int32_t body = new_block(c);
+	int32_t latch = new_block(c);
+	int32_t exit = new_block(c);
+	lower_condition(c, condition, body, exit);
+	c->block = body;
+	parse_loop_body(c, exit, latch);
+	start_block(c, latch);
+	c->statement_line = c->exprs[condition].line;
+	lower_condition(c, condition, body, exit);
+	c->block = exit;
+}
+
+static void parse_do(Compiler *c) {
+	int32_t body = new_block(c);
+	int32_t latch = new_block(c);
+	int32_t exit = new_block(c);
+	start_block(c, body);
+	parse_loop_body(c, exit, latch);
+	expect(c, "while");
+	expect(c, "(");
+	start_block(c, latch);
+	lower_condition(c, parse_expression(c), body, exit);
+	expect(c, ")");
+	expect(c, ";");
+	c->block = exit;
+}
+
+static void skip_to_closing_paren(Compiler *c) {
+	int depth = 0;
+	while (c->token.kind != TOK_EOF && (depth || !is(c, ")"))) {
+		depth += is(c, "(") - is(c, ")");
+		advance(c);
+	}
+}
+
+// The step is parsed after the body, coming back to it in the source
+static void parse_for(Compiler *c) {
+	int32_t scope = arrlen(c->locals);
+	expect(c, "(");
+	if (is_type(c)) {
+		parse_local(c);
+	} else if (!is(c, ";")) {
+		parse_simple_statement(c);
+	}
+	expect(c, ";");
+	int32_t condition = NO_REG;
+	if (!is(c, ";")) {
+		condition = parse_expression(c);
+	}
+	expect(c, ";");
+	LexerState step = save_lexer(c);
+	skip_to_closing_paren(c);
+	expect(c, ")");
+
+	int32_t body = new_block(c);
+	int32_t latch = new_block(c);
+	int32_t exit = new_block(c);
+	if (condition == NO_REG) {
+		start_block(c, body);
+	} else {
+		lower_condition(c, condition, body, exit);
+		c->block = body;
+	}
+	parse_loop_body(c, exit, latch);
+
+	LexerState end = save_lexer(c);
+	uint32_t line = c->statement_line;
+	restore_lexer(c, step);
+	start_block(c, latch);
+	c->statement_line = step.token.line;
+	if (!is(c, ")")) {
+		parse_simple_statement(c);
+	}
+	if (condition == NO_REG) {
+		end_jump(c, body);
+	} else {
+		lower_condition(c, condition, body, exit);
+	}
+	restore_lexer(c, end);
+	c->statement_line = line;
+	c->block = exit;
+	end_scope(c, scope);
+}
+
+// A chain of comparisons, built after the cases
+static void parse_switch(Compiler *c) {
+	expect(c, "(");
+	int32_t index = parse_expression(c);
+	expect(c, ")");
+	int32_t value = lower_value(c, index);
+	if (c->exprs[index].kind == EXPR_REGISTER) {
+		// The cases may change it before falling through, but not before dispatch
+		int32_t copy = temp(c);
+		emit_copy(c, copy, value);
+		value = copy;
+	}
+	int32_t dispatch = new_block(c);
+	int32_t exit = new_block(c);
+	end_jump(c, dispatch);
+
+	Jumps jumps = { exit, NO_BLOCK, true, NULL, NULL, NO_BLOCK };
+	arrput(c->jumps, jumps);
+	parse_statement(c);
+	start_block(c, exit);
+	Jumps cases = arrpop(c->jumps);
+
+	c->block = dispatch;
+	for (int32_t i = 0; i < arrlen(cases.cases); ++i) {
+		int32_t next = new_block(c);
+		branch(c, COND_EQ, value, NO_REG, cases.cases[i], cases.case_blocks[i], next);
+		c->block = next;
+	}
+	end_jump(c, cases.default_block != NO_BLOCK ? cases.default_block : exit);
+	c->block = exit;
+	arrfree(cases.cases);
+	arrfree(cases.case_blocks);
+}
+
+static void parse_case(Compiler *c, bool is_default) {
+	Jumps *jumps = arrlen(c->jumps) ? &arrlast(c->jumps) : NULL;
+	uint32_t line = c->token.line;
+	int value = 0;
+	if (!is_default) {
+		value = parse_constant(c, 0xFF);
+	}
+	expect(c, ":");
+	if (!jumps || !jumps->is_switch) {
+		error(c, line, "%s outside of a switch", is_default ? "default" : "case");
+		return;
+	}
+	int32_t block = new_block(c);
+	start_block(c, block);
+	jumps = &arrlast(c->jumps);
+	if (is_default) {
+		jumps->default_block = block;
+		return;
+	}
+	for (int32_t i = 0; i < arrlen(jumps->cases); ++i) {
+		if (jumps->cases[i] == value) {
+			error(c, line, "Duplicate case %d", value);
+		}
+	}
+	arrput(jumps->cases, value);
+	arrput(jumps->case_blocks, block);
+}
+
+static void parse_statement(Compiler *c) {
+	int32_t exprs = arrlen(c->exprs);
+	c->statement_line = c->token.line;
+	if (accept(c, "{")) {
+		int32_t scope = arrlen(c->locals);
+		while (c->token.kind != TOK_EOF && !is(c, "}")) {
+			parse_statement(c);
+		}
+		expect(c, "}");
+		end_scope(c, scope);
+	} else if (accept(c, ";")) {
+	} else if (accept(c, "if")) {
+		parse_if(c);
+	} else if (accept(c, "while")) {
+		parse_while(c);
+	} else if (accept(c, "do")) {
+		parse_do(c);
+	} else if (accept(c, "for")) {
+		parse_for(c);
+	} else if (accept(c, "switch")) {
+		parse_switch(c);
+	} else if (accept(c, "case")) {
+		parse_case(c, false);
+	} else if (accept(c, "default")) {
+		parse_case(c, true);
+	} else if (is(c, "break") || is(c, "continue")) {
+		bool is_break = is(c, "break");
+		uint32_t line = c->token.line;
+		advance(c);
+		expect(c, ";");
+		Jumps *jumps = innermost_jumps(c, !is_break);
+		if (!jumps) {
+			error(c, line, "%s outside of a loop", is_break ? "break" : "continue");
+		} else {
+			end_jump(c, is_break ? jumps->break_to : jumps->continue_to);
+		}
+	} else if (accept(c, "return")) {
+		expect(c, ";");
+		end_function_block(c, TERM_RETURN, 0);
+	} else if (accept(c, "goto")) {
+		Token name = c->token;
+		char *text = expect_name(c);
+		if (text) {
+			free(text);
+			end_jump(c, find_label(c, &name)->block);
+		}
+		expect(c, ";");
+	} else if (c->token.kind == TOK_IDENT && token_is(&c->next, ":") &&
+		   !is_reserved(&c->token)) {
+		Label *label = find_label(c, &c->token);
+		if (label->defined) {
+			error(c, c->token.line, "Duplicate label '%s'", label->name);
+		}
+		label->defined = true;
+		start_block(c, label->block);
+		advance(c);
+		advance(c);
+	} else if (is_type(c)) {
+		parse_local(c);
+		expect(c, ";");
+	} else {
+		parse_simple_statement(c);
+		expect(c, ";");
+	}
+	arrsetlen(c->exprs, exprs);
+}
+
+static void parse_function(Compiler *c) {
+	Token name = c->token;
+	if (name.kind != TOK_IDENT || is_reserved(&name)) {
+		error(c, name.line, "Expected a function name before '%.*s'", name.length,
+		      name.start);
+		return;
+	}
+	advance(c);
+	expect(c, "(");
+	accept(c, "void");
+	expect(c, ")");
+
+	c->function = find_function(c, &name);
+	Function *f = current(c);
+	if (f->defined) {
+		error(c, name.line, "Duplicate function '%s'", f->name);
+		return;
+	}
+	f->defined = true;
+	f->line = name.line;
+	Register physical = { .colour = NO_REG, .home = NO_SYMBOL };
+	for (int32_t reg = 0; reg < REGISTERS; ++reg) {
+		physical.colour = reg;
+		arrput(f->registers, physical);
+	}
+
+	c->statement_line = name.line;
+	c->block = new_block(c);
+	expect(c, "{");
+	while (c->token.kind != TOK_EOF && !is(c, "}")) {
+		parse_statement(c);
+	}
+	c->statement_line = c->token.line;
+	expect(c, "}");
+	if (c->block != NO_BLOCK) {
+		end_function_block(c, TERM_RETURN, 0);
+	}
+
+	f = current(c);
+	for (int32_t l = 0; l < arrlen(f->labels); ++l) {
+		if (!f->labels[l].defined) {
+			error(c, f->labels[l].line, "Unknown label '%s'", f->labels[l].name);
+		}
+	}
+	end_scope(c, 0);
+}
+
+static int32_t add_data(Compiler *c, char *name, bool reserved) {
+	Data data = { .name = name, .reserved = reserved };
+	arrput(c->data, data);
+	return arrlen(c->data) - 1;
+}
+
+// byte name[] = { ... }; or byte name[size];
+static void parse_array(Compiler *c, char *name) {
+	int size = -1;
+	if (!is(c, "]")) {
+		size = parse_constant(c, 0xFFF);
+	}
+	expect(c, "]");
+	int32_t data = add_data(c, name, !is(c, "="));
+	if (accept(c, "=")) {
+		expect(c, "{");
+		while (c->token.kind != TOK_EOF && !is(c, "}")) {
+			uint8_t byte = parse_constant(c, 0xFF);
+			arrput(c->data[data].bytes, byte);
+			if (!accept(c, ",")) {
+				break;
+			}
+		}
+		expect(c, "}");
+	}
+	int length = arrlen(c->data[data].bytes);
+	if (size < 0) {
+		size = length;
+	} else if (length > size) {
+		error(c, c->token.line, "Too many bytes for '%s'", name);
+	}
+	c->data[data].size = size;
+}
+
+static void parse_global(Compiler *c) {
+	bool byte = is(c, "byte");
+	advance(c);
+	do {
+		Token name = c->token;
+		if (is_reserved(&name)) {
+			error(c, name.line, "'%.*s' is reserved", name.length, name.start);
+			return;
+		}
+		char *text = expect_name(c);
+		if (!text) {
+			return;
+		}
+		if (accept(c, "[")) {
+			if (!byte) {
+				error(c, name.line, "Arrays are of bytes");
+			}
+			parse_array(c, text);
+			continue;
+		}
+		Global global = { .name = text, .reg = NO_REG };
+		if (accept(c, "=")) {
+			global.value = parse_constant(c, 0xFF);
+		}
+		arrput(c->globals, global);
+	} while (accept(c, ","));
+	expect(c, ";");
+	arrsetlen(c->exprs, 0);
+}
+
+static void parse_program(Compiler *c) {
+	c->next = lex(c);
+	advance(c);
+	while (c->token.kind != TOK_EOF) {
+		if (accept(c, "void")) {
+			parse_function(c);
+		} else if (is_type(c)) {
+			parse_global(c);
+		} else {
+			error(c, c->token.line, "Expected a function or declaration before '%.*s'",
+			      c->token.length, c->token.start);
+		}
+	}
+}
+
+static bool is_main(Function *f) {
+	return strcmp(f->name, "main") == 0;
+}
+
+static int32_t set_words(Function *f) {
+	return (arrlen(f->registers) + 63) / 64;
+}
+
+static uint64_t *new_set(Function *f) {
+	return calloc(set_words(f), sizeof(uint64_t));
+}
+
+static void set_add(uint64_t *set, int32_t reg) {
+	set[reg / 64] |= 1ull << (reg % 64);
+}
+
+static bool set_has(uint64_t *set, int32_t reg) {
+	return set[reg / 64] >> (reg % 64) & 1;
+}
+
+static void set_physical(uint64_t *set, uint32_t registers) {
+	for (int32_t reg = 0; reg < REGISTERS; ++reg) {
+		if (registers >> reg & 1) {
+			set_add(set, reg);
+		}
+	}
+}
+
+static uint32_t clobbers_of(Compiler *c, int32_t function) {
+	Function *f = &c->functions[function];
+	return f->analysed ? f->clobbers : ALL_PHYSICAL; // Unknown within a recursive cycle
+}
+
+static uint32_t reads_of(Compiler *c, int32_t function) {
+	Function *f = &c->functions[function];
+	return f->analysed || function == c->function ? f->reads : c->pinned | 1u << REG_I;
+}
+
+static bool sets_i_of(Compiler *c, int32_t function) {
+	Function *f = &c->functions[function];
+	return f->analysed || function == c->function ? f->sets_i : true;
+}
+
+// Whether calling the function leaves I elsewhere than the caller had it, to
+// be set back by the caller before it's next read
+static bool moves_i(Compiler *c, int32_t function) {
+	return !sets_i_of(c, function) && clobbers_of(c, function) >> REG_I & 1;
+}
+
+static bool is_memory_global(Compiler *c, Function *f, int32_t reg) {
+	return reg >= REGISTERS && f->registers[reg].spilled &&
+	       f->registers[reg].home == c->memory_globals;
+}
+
+static void set_memory_globals(Compiler *c, Function *f, uint64_t *set) {
+	for (int32_t g = 0; g < arrlen(f->globals); ++g) {
+		if (f->globals[g] != NO_REG && is_memory_global(c, f, f->globals[g])) {
+			set_add(set, f->globals[g]);
+		}
+	}
+}
+
+// What the code called or returned to may read
+static void set_shared(Compiler *c, Function *f, uint64_t *set) {
+	set_physical(set, c->pinned | (f->sets_i ? 1u << REG_I : 0));
+	set_memory_globals(c, f, set);
+}
+
+static void op_uses(Compiler *c, Function *f, Op *op, uint64_t *set) {
+	switch (op->kind) {
+	case IR_ADD_IMM:
+		set_add(set, op->dst);
+		break;
+	case IR_ALU:
+		set_add(set, op->dst);
+		set_add(set, op->a);
+		break;
+	case IR_COPY:
+	case IR_SET_DELAY:
+	case IR_SET_SOUND:
+	case IR_FONT:
+		set_add(set, op->a);
+		break;
+	case IR_ADD_I:
+	case IR_BCD:
+		set_add(set, op->a);
+		set_add(set, REG_I);
+		break;
+	case IR_DRAW:
+		set_add(set, op->a);
+		set_add(set, op->b);
+		set_add(set, REG_I);
+		break;
+	case IR_SAVE:
+		set_physical(set, ((2u << op->imm) - 1) | 1u << REG_I);
+		break;
+	case IR_RESTORE:
+		set_add(set, REG_I);
+		break;
+	case IR_CALL:
+		set_physical(set, reads_of(c, op->symbol));
+		set_memory_globals(c, f, set);
+		break;
+	default:
+		break;
+	}
+}
+
+static void op_defs(Compiler *c, Function *f, Op *op, uint64_t *set) {
+	switch (op->kind) {
+	case IR_LOAD:
+	case IR_COPY:
+	case IR_ADD_IMM:
+	case IR_RAND:
+	case IR_GET_DELAY:
+	case IR_WAIT_KEY:
+		set_add(set, op->dst);
+		break;
+	case IR_ALU:
+		set_add(set, op->dst);
+		set_add(set, REG_VF);
+		break;
+	case IR_SET_I:
+	case IR_ADD_I:
+	case IR_FONT:
+	case IR_SAVE:
+		set_add(set, REG_I);
+		break;
+	case IR_RESTORE:
+		set_physical(set, ((2u << op->imm) - 1) | 1u << REG_I);
+		break;
+	case IR_DRAW:
+		set_add(set, REG_VF);
+		break;
+	case IR_CALL: // Where it only moves I, I is set back rather than defined
+		set_physical(set, clobbers_of(c, op->symbol) &
+					  ~(moves_i(c, op->symbol) ? 1u << REG_I : 0));
+		set_memory_globals(c, f, set);
+		break;
+	default:
+		break;
+	}
+}
+
+static void terminator_uses(Compiler *c, Function *f, Block *block, uint64_t *set) {
+	switch (block->term) {
+	case TERM_BRANCH:
+		set_add(set, block->condition.a);
+		if (block->condition.b != NO_REG) {
+			set_add(set, block->condition.b);
+		}
+		break;
+	case TERM_RETURN:
+		if (!is_main(f) && !c->finding_reads) {
+			set_shared(c, f, set);
+		}
+		break;
+	case TERM_TAIL_CALL:
+		if (c->finding_reads) {
+			set_physical(set, reads_of(c, block->target));
+		} else {
+			set_shared(c, f, set);
+		}
+		break;
+	case TERM_JUMP_OUT:
+	case TERM_JUMP_V0:
+		set_physical(set, ALL_PHYSICAL);
+		set_memory_globals(c, f, set);
+		break;
+	default:
+		break;
+	}
+}
+
+static int successors(Block *block) {
+	return block->term == TERM_BRANCH ? 2 : block->term == TERM_JUMP ? 1 : 0;
+}
+
+// Live before the op, from live after it
+static void step_back(Compiler *c, Function *f, Op *op, uint64_t *live, uint64_t *scratch) {
+	int32_t words = set_words(f);
+	memset(scratch, 0, words * sizeof(uint64_t));
+	op_defs(c, f, op, scratch);
+	for (int32_t w = 0; w < words; ++w) {
+		live[w] &= ~scratch[w];
+	}
+	memset(scratch, 0, words * sizeof(uint64_t));
+	op_uses(c, f, op, scratch);
+	for (int32_t w = 0; w < words; ++w) {
+		live[w] |= scratch[w];
+	}
+}
+
+// Live at the block's end, before its terminator
+static void live_at_end(Compiler *c, Function *f, Block *block, uint64_t *live) {
+	memcpy(live, block->live_out, set_words(f) * sizeof(uint64_t));
+	terminator_uses(c, f, block, live);
+}
+
+static void compute_liveness(Compiler *c, Function *f) {
+	int32_t words = set_words(f);
+	int32_t blocks = arrlen(f->blocks);
+	uint64_t **live_in = calloc(blocks, sizeof(uint64_t *));
+	for (int32_t b = 0; b < blocks; ++b) {
+		free(f->blocks[b].live_out);
+		f->blocks[b].live_out = new_set(f);
+		live_in[b] = new_set(f);
+	}
+	uint64_t *live = new_set(f);
+	uint64_t *scratch = new_set(f);
+
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (int32_t b = blocks; b-- > 0;) {
+			Block *block = &f->blocks[b];
+			if (!block->reachable) {
+				continue;
+			}
+			for (int s = 0; s < successors(block); ++s) {
+				for (int32_t w = 0; w < words; ++w) {
+					block->live_out[w] |= live_in[block->next[s]][w];
+				}
+			}
+			live_at_end(c, f, block, live);
+			for (int32_t o = arrlen(block->ops); o-- > 0;) {
+				step_back(c, f, &block->ops[o], live, scratch);
+			}
+			if (memcmp(live, live_in[b], words * sizeof(uint64_t)) != 0) {
+				memcpy(live_in[b], live, words * sizeof(uint64_t));
+				changed = true;
+			}
+		}
+	}
+
+	for (int32_t b = 0; b < blocks; ++b) {
+		free(live_in[b]);
+	}
+	free(live_in);
+	free(live);
+	free(scratch);
+}
+
+static void mark_reachable(Function *f, int32_t block) {
+	Block *b = &f->blocks[block];
+	++b->preds;
+	if (b->reachable) {
+		return;
+	}
+	b->reachable = true;
+	for (int s = 0; s < successors(b); ++s) {
+		mark_reachable(f, b->next[s]);
+	}
+}
+
+static void find_reachable(Function *f) {
+	for (int32_t b = 0; b < arrlen(f->blocks); ++b) {
+		f->blocks[b].reachable = false;
+		f->blocks[b].preds = 0;
+	}
+	mark_reachable(f, 0);
+	for (int32_t b = 0; b < arrlen(f->blocks); ++b) {
+		if (!f->blocks[b].reachable) {
+			arrsetlen(f->blocks[b].ops, 0);
+		}
+	}
+}
+
+// Past empty blocks that just jump elsewhere
+static int32_t thread_jumps(Function *f, int32_t target) {
+	for (int32_t steps = 0; steps < arrlen(f->blocks); ++steps) {
+		Block *block = &f->blocks[target];
+		if (arrlen(block->ops) || block->term != TERM_JUMP) {
+			break;
+		}
+		target = block->next[0];
+	}
+	return target;
+}
+
+static bool simplify_cfg(Function *f) {
+	bool changed = false;
+	find_reachable(f);
+	for (int32_t b = 0; b < arrlen(f->blocks); ++b) {
+		Block *block = &f->blocks[b];
+		if (!block->reachable) {
+			continue;
+		}
+		for (int s = 0; s < successors(block); ++s) {
+			int32_t target = thread_jumps(f, block->next[s]);
+			changed |= target != block->next[s];
+			block->next[s] = target;
+		}
+		if (block->term == TERM_BRANCH && block->next[0] == block->next[1]) {
+			block->term = TERM_JUMP;
+			changed = true;
+		}
+	}
+	find_reachable(f);
+
+	// Blocks only jumped to from one other continue it
+	for (int32_t b = 0; b < arrlen(f->blocks); ++b) {
+		Block *block = &f->blocks[b];
+		while (block->reachable && block->term == TERM_JUMP && block->next[0] != b &&
+		       block->next[0] != 0 && f->blocks[block->next[0]].preds == 1) {
+			Block *next = &f->blocks[block->next[0]];
+			for (int32_t o = 0; o < arrlen(next->ops); ++o) {
+				arrput(block->ops, next->ops[o]);
+			}
+			block->term = next->term;
+			block->condition = next->condition;
+			block->next[0] = next->next[0];
+			block->next[1] = next->next[1];
+			block->target = next->target;
+			block->line = next->line;
+			next->reachable = false;
+			arrsetlen(next->ops, 0);
+			changed = true;
+		}
+	}
+	find_reachable(f);
+	return changed;
+}
+
+static int meet(int a, int b) {
+	return a == LATTICE_TOP ? b : b == LATTICE_TOP || a == b ? a : LATTICE_BOTTOM;
+}
+
+// The result of an ALU op on constants, with its flag as the quirks have it
+static int evaluate_alu(Alu alu, int x, int y, int *flag) {
+	*flag = 0;
+	switch (alu) {
+	case ALU_OR:
+		return x | y;
+	case ALU_AND:
+		return x & y;
+	case ALU_XOR:
+		return x ^ y;
+	case ALU_ADD:
+		*flag = x + y > 0xFF;
+		return (x + y) & 0xFF;
+	case ALU_SUB:
+		*flag = x >= y;
+		return (x - y) & 0xFF;
+	case ALU_SUBN:
+		*flag = y >= x;
+		return (y - x) & 0xFF;
+	case ALU_SHR:
+		*flag = y & 1;
+		return y >> 1;
+	default:
+		*flag = y >> 7;
+		return (y << 1) & 0xFF;
+	}
+}
+
+static void transfer(Compiler *c, Function *f, Op *op, int *values, uint64_t *scratch) {
+	int x = values[op->dst];
+	int y = values[op->a];
+	switch (op->kind) {
+	case IR_LOAD:
+		values[op->dst] = op->imm;
+		return;
+	case IR_COPY:
+		values[op->dst] = y;
+		return;
+	case IR_ADD_IMM:
+		values[op->dst] = x < 0 ? x : (x + op->imm) & 0xFF;
+		return;
+	case IR_ALU:
+		if (x == LATTICE_BOTTOM || y == LATTICE_BOTTOM) {
+			values[op->dst] = values[REG_VF] = LATTICE_BOTTOM;
+		} else if (x == LATTICE_TOP || y == LATTICE_TOP) {
+			values[op->dst] = values[REG_VF] = LATTICE_TOP;
+		} else {
+			int flag;
+			values[op->dst] = evaluate_alu(op->alu, x, y, &flag);
+			values[REG_VF] = flag;
+		}
+		return;
+	default:
+		break;
+	}
+	memset(scratch, 0, set_words(f) * sizeof(uint64_t));
+	op_defs(c, f, op, scratch);
+	for (int32_t reg = 0; reg < arrlen(f->registers); ++reg) {
+		if (set_has(scratch, reg)) {
+			values[reg] = LATTICE_BOTTOM;
+		}
+	}
+}
+
+// Whether the branch is taken, or -1 if that isn't known
+static int evaluate_condition(Condition *condition, int *values) {
+	if (condition->kind == COND_KEY || condition->kind == COND_NO_KEY) {
+		return -1;
+	}
+	bool equal;
+	if (condition->a == condition->b) {
+		equal = true;
+	} else {
+		int x = values[condition->a];
+		int y = condition->b == NO_REG ? condition->imm : values[condition->b];
+		if (x < 0 || y < 0) {
+			return -1;
+		}
+		equal = x == y;
+	}
+	return equal == (condition->kind == COND_EQ);
+}
+
+// Rewrites the op for what's known of its operands
+static void fold_op(Block *block, int32_t o, int *values) {
+	Op *op = &block->ops[o];
+	int x = values[op->dst];
+	int y = values[op->a];
+	if (op->kind == IR_COPY && y >= 0) {
+		*op = (Op){ .kind = IR_LOAD, .dst = op->dst, .imm = y, .known = LATTICE_BOTTOM,
+			    .line = op->line };
+	} else if (op->kind == IR_ADD_IMM && x >= 0) {
+		*op = (Op){ .kind = IR_LOAD, .dst = op->dst, .imm = (x + op->imm) & 0xFF,
+			    .known = LATTICE_BOTTOM, .line = op->line };
+	} else if (op->kind == IR_ALU && x >= 0 && y >= 0) {
+		int flag;
+		int result = evaluate_alu(op->alu, x, y, &flag);
+		Op load = { .kind = IR_LOAD, .dst = REG_VF, .imm = flag, .known = LATTICE_BOTTOM,
+			    .line = op->line };
+		if (op->dst != REG_VF) {
+			arrins(block->ops, o + 1, load);
+			load.dst = block->ops[o].dst;
+			load.imm = result;
+		}
+		block->ops[o] = load;
+	} else if (op->kind == IR_ALU) {
+		op->known = y >= 0 ? y : LATTICE_BOTTOM;
+	}
+}
+
+// Sparse conditional constant propagation over registers, following only the
+// edges that may be taken
+static bool propagate_constants(Compiler *c, Function *f) {
+	int32_t blocks = arrlen(f->blocks);
+	int32_t registers = arrlen(f->registers);
+	int *in = malloc(blocks * registers * sizeof(int));
+	int *values = malloc(registers * sizeof(int));
+	bool *executable = calloc(blocks, sizeof(bool));
+	uint64_t *scratch = new_set(f);
+	int32_t *worklist = NULL;
+	for (int32_t i = 0; i < blocks * registers; ++i) {
+		in[i] = i < registers ? LATTICE_BOTTOM : LATTICE_TOP;
+	}
+	executable[0] = true;
+	arrput(worklist, 0);
+
+	while (arrlen(worklist)) {
+		int32_t b = arrpop(worklist);
+		Block *block = &f->blocks[b];
+		memcpy(values, &in[b * registers], registers * sizeof(int));
+		for (int32_t o = 0; o < arrlen(block->ops); ++o) {
+			transfer(c, f, &block->ops[o], values, scratch);
+		}
+		int taken = block->term == TERM_BRANCH
+				    ? evaluate_condition(&block->condition, values)
+				    : 1;
+		for (int s = 0; s < successors(block); ++s) {
+			if (taken == (s == 0 ? 0 : 1)) {
+				continue;
+			}
+			int32_t next = block->next[s];
+			bool changed = !executable[next];
+			executable[next] = true;
+			for (int32_t reg = 0; reg < registers; ++reg) {
+				int value = meet(in[next * registers + reg], values[reg]);
+				changed |= value != in[next * registers + reg];
+				in[next * registers + reg] = value;
+			}
+			if (changed) {
+				arrput(worklist, next);
+			}
+		}
+	}
+
+	bool changed = false;
+	for (int32_t b = 0; b < blocks; ++b) {
+		Block *block = &f->blocks[b];
+		if (!block->reachable) {
+			continue;
+		}
+		if (!executable[b]) {
+			// Only reached through branches that are never taken
+			block->reachable = false;
+			arrsetlen(block->ops, 0);
+			changed = true;
+			continue;
+		}
+		memcpy(values, &in[b * registers], registers * sizeof(int));
+		for (int32_t o = 0; o < arrlen(block->ops); ++o) {
+			int32_t count = arrlen(block->ops);
+			Op before = block->ops[o];
+			fold_op(block, o, values);
+			changed |= count != arrlen(block->ops) || before.kind != block->ops[o].kind;
+			transfer(c, f, &block->ops[o], values, scratch);
+		}
+		if (block->term != TERM_BRANCH) {
+			continue;
+		}
+		Condition *condition = &block->condition;
+		if (condition->b != NO_REG && values[condition->a] >= 0 &&
+		    values[condition->b] < 0) {
+			condition->imm = values[condition->a];
+			condition->a = condition->b;
+			condition->b = NO_REG;
+			changed = true;
+		}
+		if (condition->b != NO_REG && values[condition->b] >= 0 &&
+		    condition->a != condition->b) {
+			condition->imm = values[condition->b];
+			condition->b = NO_REG;
+			changed = true;
+		}
+		int taken = evaluate_condition(condition, values);
+		if (taken >= 0) {
+			block->term = TERM_JUMP;
+			block->next[0] = block->next[taken ? 0 : 1];
+			changed = true;
+		}
+	}
+
+	free(in);
+	free(values);
+	free(executable);
+	free(scratch);
+	arrfree(worklist);
+	return changed;
+}
+
+static bool is_removable(Op *op) {
+	switch (op->kind) {
+	case IR_LOAD:
+	case IR_COPY:
+	case IR_ADD_IMM:
+	case IR_ALU:
+	case IR_RAND:
+	case IR_GET_DELAY:
+	case IR_SET_I:
+	case IR_ADD_I:
+	case IR_FONT:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool is_nop(Op *op) {
+	return (op->kind == IR_COPY && op->dst == op->a) || (op->kind == IR_ADD_IMM && !op->imm);
+}
+
+// An ALU op on a constant with its flag unread, as a cheaper op or none at all
+static void reduce_strength(Op *op) {
+	if (op->kind != IR_ALU || op->known == LATTICE_BOTTOM || op->dst == REG_VF) {
+		return;
+	}
+	int value = op->known;
+	Op reduced = { .kind = IR_ADD_IMM, .dst = op->dst, .known = LATTICE_BOTTOM,
+		       .line = op->line };
+	switch (op->alu) {
+	case ALU_ADD:
+		reduced.imm = value;
+		break;
+	case ALU_SUB:
+		reduced.imm = -value & 0xFF;
+		break;
+	case ALU_OR:
+	case ALU_XOR:
+	case ALU_AND:
+		if (value == (op->alu == ALU_AND ? 0xFF : 0)) {
+			reduced.imm = 0;
+		} else if (value == (op->alu == ALU_AND ? 0 : 0xFF) && op->alu != ALU_XOR) {
+			reduced.kind = IR_LOAD;
+			reduced.imm = value;
+		} else {
+			return;
+		}
+		break;
+	default:
+		return;
+	}
+	*op = reduced;
+}
+
+static bool eliminate_dead_code(Compiler *c, Function *f) {
+	compute_liveness(c, f);
+	int32_t words = set_words(f);
+	uint64_t *live = new_set(f);
+	uint64_t *defs = new_set(f);
+	uint64_t *scratch = new_set(f);
+	bool changed = false;
+	for (int32_t b = 0; b < arrlen(f->blocks); ++b) {
+		Block *block = &f->blocks[b];
+		if (!block->reachable) {
+			continue;
+		}
+		live_at_end(c, f, block, live);
+		for (int32_t o = arrlen(block->ops); o-- > 0;) {
+			Op *op = &block->ops[o];
+			if (!set_has(live, REG_VF)) {
+				OpKind kind = op->kind;
+				reduce_strength(op);
+				changed |= kind != op->kind;
+			}
+			memset(defs, 0, words * sizeof(uint64_t));
+			op_defs(c, f, op, defs);
+			bool used = false;
+			for (int32_t w = 0; w < words; ++w) {
+				used |= (defs[w] & live[w]) != 0;
+			}
+			if (is_nop(op) || (is_removable(op) && !used)) {
+				arrdel(block->ops, o);
+				changed = true;
+				continue;
+			}
+			step_back(c, f, op, live, scratch);
+		}
+	}
+	free(live);
+	free(defs);
+	free(scratch);
+	return changed;
+}
+
+// A call just before returning jumps instead, for the callee to return for both
+static void find_tail_calls(Function *f) {
+	if (is_main(f)) {
+		return;
+	}
+	for (int32_t b = 0; b < arrlen(f->blocks); ++b) {
+		Block *block = &f->blocks[b];
+		if (block->reachable && block->term == TERM_RETURN && arrlen(block->ops) &&
+		    arrlast(block->ops).kind == IR_CALL) {
+			block->term = TERM_TAIL_CALL;
+			block->target = arrpop(block->ops).symbol;
+		}
+	}
+}
+
+static void optimise(Compiler *c, Function *f) {
+	bool changed = true;
+	for (int pass = 0; changed && pass < MAX_PASSES; ++pass) {
+		changed = simplify_cfg(f);
+		changed |= propagate_constants(c, f);
+		changed |= eliminate_dead_code(c, f);
+	}
+	find_tail_calls(f);
+	simplify_cfg(f);
+}
+
+// Callees before their callers, as far as recursion allows
+static void order_functions(Compiler *c, int32_t function) {
+	Function *f = &c->functions[function];
+	if (f->reachable) {
+		return;
+	}
+	f->reachable = true;
+	if (!f->defined) {
+		error(c, f->line, "Unknown function '%s'", f->name);
+		return;
+	}
+	for (int32_t b = 0; b < arrlen(f->blocks); ++b) {
+		for (int32_t o = 0; o < arrlen(f->blocks[b].ops); ++o) {
+			if (f->blocks[b].ops[o].kind == IR_CALL) {
+				order_functions(c, f->blocks[b].ops[o].symbol);
+			}
+		}
+	}
+	arrput(c->order, function);
+}
+
+static int count_bits(uint32_t bits) {
+	int count = 0;
+	for (; bits; bits &= bits - 1) {
+		++count;
+	}
+	return count;
+}
+
+static int32_t highest_bit(uint32_t bits) {
+	int32_t bit = -1;
+	for (; bits; bits >>= 1) {
+		++bit;
+	}
+	return bit;
+}
+
+// Globals that reachable functions use get registers named nowhere in the
+// source while enough are left for values, and the rest live in memory
+static void place_globals(Compiler *c) {
+	bool *used = calloc(arrlen(c->globals) + 1, sizeof(bool));
+	for (int32_t i = 0; i < arrlen(c->order); ++i) {
+		Function *f = &c->functions[c->order[i]];
+		for (int32_t g = 0; g < arrlen(f->globals); ++g) {
+			used[g] |= f->globals[g] != NO_REG;
+		}
+	}
+	uint32_t free_registers = ALLOCATABLE & ~c->pinned;
+	for (int32_t g = 0; g < arrlen(c->globals); ++g) {
+		Global *global = &c->globals[g];
+		if (!used[g]) {
+			continue;
+		}
+		if (count_bits(free_registers) > MIN_FREE_REGISTERS) {
+			global->reg = highest_bit(free_registers);
+			free_registers &= ~(1u << global->reg);
+			c->pinned |= 1u << global->reg;
+			continue;
+		}
+		if (c->memory_globals == NO_SYMBOL) {
+			c->memory_globals = add_data(c, NULL, false);
+		}
+		Data *data = &c->data[c->memory_globals];
+		global->offset = data->size++;
+		arrput(data->bytes, global->value);
+	}
+	free(used);
+}
+
+static void rename_register(Function *f, int32_t from, int32_t to) {
+	for (int32_t b = 0; b < arrlen(f->blocks); ++b) {
+		Block *block = &f->blocks[b];
+		for (int32_t o = 0; o < arrlen(block->ops); ++o) {
+			Op *op = &block->ops[o];
+			op->dst = op->dst == from ? to : op->dst;
+			op->a = op->a == from ? to : op->a;
+			op->b = op->b == from ? to : op->b;
+		}
+		if (block->term == TERM_BRANCH) {
+			Condition *condition = &block->condition;
+			condition->a = condition->a == from ? to : condition->a;
+			condition->b = condition->b == from ? to : condition->b;
+		}
+	}
+}
+
+// Stands each global's register in for the one it was given, or spills it to
+// its place in memory
+static void alias_globals(Compiler *c, Function *f) {
+	for (int32_t g = 0; g < arrlen(f->globals); ++g) {
+		int32_t reg = f->globals[g];
+		Global *global = &c->globals[g];
+		if (reg == NO_REG) {
+			continue;
+		}
+		if (global->reg != NO_REG) {
+			rename_register(f, reg, global->reg);
+			continue;
+		}
+		Register *r = &f->registers[reg];
+		r->spilled = true;
+		r->home = c->memory_globals;
+		r->offset = global->offset;
+		r->name = global->name;
+		f->spills = true;
+	}
+}
+
+static bool uses_i(Compiler *c, Op *op) {
+	switch (op->kind) {
+	case IR_ADD_I:
+	case IR_DRAW:
+	case IR_BCD:
+	case IR_SAVE:
+	case IR_RESTORE:
+		return true;
+	case IR_CALL:
+		return reads_of(c, op->symbol) >> REG_I & 1;
+	default:
+		return false;
+	}
+}
+
+static bool defines_i(Compiler *c, Op *op) {
+	switch (op->kind) {
+	case IR_SET_I:
+	case IR_ADD_I:
+	case IR_FONT:
+	case IR_SAVE:
+	case IR_RESTORE:
+		return true;
+	case IR_CALL:
+		return sets_i_of(c, op->symbol);
+	default:
+		return false;
+	}
+}
+
+// Where LD [I] and LD Vx, [I] leave I depends on the memory quirk: past the
+// registers on the VIP, at x + 1 as emulated here. Neither is relied on.
+static Pointer pointer_after(Compiler *c, Op *op, Pointer i) {
+	switch (op->kind) {
+	case IR_SET_I:
+		return (Pointer){ true, op->symbol, op->imm };
+	default:
+		i.known &= !defines_i(c, op);
+		return i;
+	}
+}
+
+static bool same_pointer(Pointer a, Pointer b) {
+	return a.known == b.known && (!a.known || (a.symbol == b.symbol && a.offset == b.offset));
+}
+
+// What I holds entering each block, so that it can be set back after spill code
+static void track_i(Compiler *c, Function *f) {
+	bool *reached = calloc(arrlen(f->blocks), sizeof(bool));
+	f->blocks[0].i_in = (Pointer){ .known = false };
+	reached[0] = true;
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (int32_t b = 0; b < arrlen(f->blocks); ++b) {
+			Block *block = &f->blocks[b];
+			if (!block->reachable || !reached[b]) {
+				continue;
+			}
+			Pointer i = block->i_in;
+			for (int32_t o = 0; o < arrlen(block->ops); ++o) {
+				i = pointer_after(c, &block->ops[o], i);
+			}
+			for (int s = 0; s < successors(block); ++s) {
+				Block *next = &f->blocks[block->next[s]];
+				if (!reached[block->next[s]]) {
+					reached[block->next[s]] = true;
+					next->i_in = i;
+					changed = true;
+				} else if (next->i_in.known && !same_pointer(next->i_in, i)) {
+					next->i_in.known = false;
+					changed = true;
+				}
+			}
+		}
+	}
+	free(reached);
+}
+
+// Whether I is live after each of the block's ops
+static bool *i_live_after(Compiler *c, Function *f, Block *block) {
+	uint64_t *live = new_set(f);
+	uint64_t *scratch = new_set(f);
+	bool *after = malloc((arrlen(block->ops) + 1) * sizeof(bool));
+	live_at_end(c, f, block, live);
+	for (int32_t o = arrlen(block->ops); o-- > 0;) {
+		after[o] = set_has(live, REG_I);
+		step_back(c, f, &block->ops[o], live, scratch);
+	}
+	free(live);
+	free(scratch);
+	return after;
+}
+
+// The registers the op reads, in the order spilled ones are loaded
+static int read_operands(Op *op, int32_t *regs) {
+	int count = 0;
+	switch (op->kind) {
+	case IR_ADD_IMM:
+	case IR_ALU:
+		regs[count++] = op->dst;
+		if (op->kind == IR_ALU && op->a != op->dst) {
+			regs[count++] = op->a;
+		}
+		break;
+	case IR_COPY:
+	case IR_SET_DELAY:
+	case IR_SET_SOUND:
+	case IR_ADD_I:
+	case IR_FONT:
+	case IR_BCD:
+		regs[count++] = op->a;
+		break;
+	case IR_DRAW:
+		regs[count++] = op->a;
+		if (op->b != op->a) {
+			regs[count++] = op->b;
+		}
+		break;
+	default:
+		break;
+	}
+	return count;
+}
+
+static int32_t written_operand(Op *op) {
+	switch (op->kind) {
+	case IR_LOAD:
+	case IR_COPY:
+	case IR_ADD_IMM:
+	case IR_ALU:
+	case IR_RAND:
+	case IR_GET_DELAY:
+	case IR_WAIT_KEY:
+		return op->dst;
+	default:
+		return NO_REG;
+	}
+}
+
+// Whether what each op writes is read afterwards, as ops kept for their flags
+// or effects needn't store a spilled result
+static bool *written_live_after(Compiler *c, Function *f, Block *block) {
+	uint64_t *live = new_set(f);
+	uint64_t *scratch = new_set(f);
+	bool *after = malloc((arrlen(block->ops) + 1) * sizeof(bool));
+	live_at_end(c, f, block, live);
+	for (int32_t o = arrlen(block->ops); o-- > 0;) {
+		int32_t written = written_operand(&block->ops[o]);
+		after[o] = written != NO_REG && set_has(live, written);
+		step_back(c, f, &block->ops[o], live, scratch);
+	}
+	free(live);
+	free(scratch);
+	return after;
+}
+
+static int condition_operands(Condition *condition, int32_t *regs) {
+	regs[0] = condition->a;
+	regs[1] = condition->b;
+	return condition->b == NO_REG || condition->b == condition->a ? 1 : 2;
+}
+
+static void mark_unspillable(Compiler *c, Function *f, int32_t reg, uint32_t line) {
+	if (reg < REGISTERS) {
+		return;
+	}
+	if (is_memory_global(c, f, reg)) {
+		error(c, line,
+		      "'%s' is in memory, but i isn't known to set it back after reaching it",
+		      f->registers[reg].name);
+	}
+	f->registers[reg].unspillable = true;
+}
+
+// Values reached where I is needed afterwards but isn't known, so can't be
+// loaded or stored through it
+static void find_unspillable(Compiler *c, Function *f) {
+	compute_liveness(c, f);
+	track_i(c, f);
+	for (int32_t b = 0; b < arrlen(f->blocks); ++b) {
+		Block *block = &f->blocks[b];
+		if (!block->reachable) {
+			continue;
+		}
+		bool *after = i_live_after(c, f, block);
+		Pointer i = block->i_in;
+		int32_t regs[2];
+		for (int32_t o = 0; o < arrlen(block->ops); ++o) {
+			Op *op = &block->ops[o];
+			Pointer next = pointer_after(c, op, i);
+			if (!i.known && (uses_i(c, op) || (after[o] && !defines_i(c, op)))) {
+				int count = read_operands(op, regs);
+				for (int r = 0; r < count; ++r) {
+					mark_unspillable(c, f, regs[r], op->line);
+				}
+			}
+			if (!next.known && after[o]) {
+				mark_unspillable(c, f, written_operand(op), op->line);
+			}
+			if (!i.known && after[o] && op->kind == IR_CALL &&
+			    moves_i(c, op->symbol)) {
+				error(c, op->line,
+				      "Calling '%s' moves i, which isn't known to set it back",
+				      c->functions[op->symbol].name);
+			}
+			i = next;
+		}
+		if (block->term == TERM_BRANCH && !i.known && set_has(block->live_out, REG_I)) {
+			int count = condition_operands(&block->condition, regs);
+			for (int r = 0; r < count; ++r) {
+				mark_unspillable(c, f, regs[r], block->line);
+			}
+		}
+		free(after);
+	}
+}
+
+static void interfere(uint64_t *adjacent, int32_t words, int32_t a, int32_t b) {
+	if (a != b && (a >= REGISTERS || b >= REGISTERS)) {
+		set_add(&adjacent[a * words], b);
+		set_add(&adjacent[b * words], a);
+	}
+}
+
+static void count_access(Function *f, Block *block, int32_t reg) {
+	if (reg >= REGISTERS) {
+		int depth = block->loop_depth < 4 ? block->loop_depth : 4;
+		f->registers[reg].accesses += 1 << 3 * depth;
+	}
+}
+
+// Interference between registers live at once, from where each is written
+static uint64_t *build_interference(Compiler *c, Function *f, int32_t **moves) {
+	int32_t registers = arrlen(f->registers);
+	int32_t words = set_words(f);
+	uint64_t *adjacent = calloc(registers * words, sizeof(uint64_t));
+	uint64_t *live = new_set(f);
+	uint64_t *defs = new_set(f);
+	uint64_t *scratch = new_set(f);
+	for (int32_t reg = REGISTERS; reg < registers; ++reg) {
+		f->registers[reg].accesses = 0;
+	}
+
+	for (int32_t b = 0; b < arrlen(f->blocks); ++b) {
+		Block *block = &f->blocks[b];
+		if (!block->reachable) {
+			continue;
+		}
+		int32_t regs[2];
+		if (block->term == TERM_BRANCH) {
+			int count = condition_operands(&block->condition, regs);
+			for (int r = 0; r < count; ++r) {
+				count_access(f, block, regs[r]);
+			}
+		}
+		live_at_end(c, f, block, live);
+		for (int32_t o = arrlen(block->ops); o-- > 0;) {
+			Op *op = &block->ops[o];
+			memset(defs, 0, words * sizeof(uint64_t));
+			op_defs(c, f, op, defs);
+			for (int32_t def = 0; def < registers; ++def) {
+				if (!set_has(defs, def)) {
+					continue;
+				}
+				for (int32_t reg = 0; reg < registers; ++reg) {
+					// A copy's source and destination can share a register
+					if (set_has(live, reg) &&
+					    !(op->kind == IR_COPY && reg == op->a)) {
+						interfere(adjacent, words, def, reg);
+					}
+				}
+			}
+			int count = read_operands(op, regs);
+			for (int r = 0; r < count; ++r) {
+				count_access(f, block, regs[r]);
+			}
+			count_access(f, block, written_operand(op));
+			if (op->kind == IR_COPY) {
+				arrput(*moves, op->dst);
+				arrput(*moves, op->a);
+			}
+			step_back(c, f, op, live, scratch);
+		}
+	}
+	free(live);
+	free(defs);
+	free(scratch);
+	return adjacent;
+}
+
+// Whether the register is only ever loaded with the same constant
+static bool always_constant(Function *f, int32_t reg, uint8_t *value) {
+	bool set = false;
+	for (int32_t b = 0; b < arrlen(f->blocks); ++b) {
+		for (int32_t o = 0; o < arrlen(f->blocks[b].ops); ++o) {
+			Op *op = &f->blocks[b].ops[o];
+			if (written_operand(op) != reg) {
+				continue;
+			}
+			if (op->kind != IR_LOAD || (set && op->imm != *value)) {
+				return false;
+			}
+			*value = op->imm;
+			set = true;
+		}
+	}
+	return set;
+}
+
+static void spill(Compiler *c, Function *f, int32_t reg) {
+	Register *r = &f->registers[reg];
+	r->spilled = true;
+	f->spills = true;
+	if (always_constant(f, reg, &r->value)) {
+		r->constant = true;
+		return;
+	}
+	if (f->spill_slots == NO_SYMBOL) {
+		f->spill_slots = add_data(c, NULL, true);
+	}
+	r->home = f->spill_slots;
+	r->offset = c->data[f->spill_slots].size++;
+}
+
+// Colours the virtual registers by Chaitin-Briggs: those with fewer neighbours
+// than colours are taken out first, the least used of the rest once none are
+// left, and colours are given in reverse, optimistically. Returns false if it
+// had to spill some to memory, to try again without them.
+static bool colour_registers(Compiler *c, Function *f) {
+	compute_liveness(c, f);
+	int32_t *moves = NULL; // Pairs of registers copied between
+	uint64_t *adjacent = build_interference(c, f, &moves);
+	int32_t registers = arrlen(f->registers);
+	int32_t words = set_words(f);
+	// VF too, for values not live across anything setting flags, like the
+	// difference a comparison's flag is taken from
+	uint32_t allowed = (ALLOCATABLE | 1u << REG_VF) & ~(f->spills ? SCRATCH : 0);
+	int colours = count_bits(allowed);
+
+	bool *removed = calloc(registers, sizeof(bool));
+	int *degree = calloc(registers, sizeof(int));
+	int32_t *stack = NULL;
+	int32_t remaining = 0;
+	for (int32_t reg = REGISTERS; reg < registers; ++reg) {
+		Register *r = &f->registers[reg];
+		removed[reg] = r->spilled || !r->accesses;
+		remaining += !removed[reg];
+	}
+	for (int32_t reg = REGISTERS; reg < registers; ++reg) {
+		for (int32_t other = 0; !removed[reg] && other < registers; ++other) {
+			if (set_has(&adjacent[reg * words], other) &&
+			    (other < REGISTERS ? allowed >> other & 1 : !removed[other])) {
+				++degree[reg];
+			}
+		}
+	}
+
+	for (; remaining; --remaining) {
+		int32_t chosen = NO_REG;
+		for (int32_t reg = REGISTERS; reg < registers && chosen == NO_REG; ++reg) {
+			if (!removed[reg] && degree[reg] < colours) {
+				chosen = reg;
+			}
+		}
+		if (chosen == NO_REG) {
+			// The least used for how many it's in the way of, to spill if need be
+			for (int32_t reg = REGISTERS; reg < registers; ++reg) {
+				Register *r = &f->registers[reg];
+				if (removed[reg] || r->unspillable) {
+					continue;
+				}
+				Register *best = chosen != NO_REG ? &f->registers[chosen] : NULL;
+				if (!best || r->accesses * degree[chosen] <
+						     best->accesses * degree[reg]) {
+					chosen = reg;
+				}
+			}
+		}
+		for (int32_t reg = REGISTERS; reg < registers && chosen == NO_REG; ++reg) {
+			if (!removed[reg]) {
+				chosen = reg;
+			}
+		}
+		removed[chosen] = true;
+		arrput(stack, chosen);
+		for (int32_t other = REGISTERS; other < registers; ++other) {
+			if (!removed[other] && set_has(&adjacent[other * words], chosen)) {
+				--degree[other];
+			}
+		}
+	}
+
+	bool spilled = false;
+	uint32_t used = 0;
+	while (arrlen(stack)) {
+		int32_t reg = arrpop(stack);
+		uint32_t available = allowed;
+		for (int32_t other = 0; other < registers; ++other) {
+			if (set_has(&adjacent[reg * words], other) &&
+			    f->registers[other].colour != NO_REG) {
+				available &= ~(1u << f->registers[other].colour);
+			}
+		}
+		if (!available) {
+			if (c->pinned & SCRATCH) {
+				error(c, f->line,
+				      "Too many values are live at once in '%s' to spill any, "
+				      "as v0 and v1 are named",
+				      f->name);
+				break;
+			}
+			if (f->registers[reg].unspillable) {
+				error(c, f->line,
+				      "Too many values are live at once in '%s' where i is needed",
+				      f->name);
+				break;
+			}
+			spill(c, f, reg);
+			spilled = true;
+			continue;
+		}
+
+		// The register of a value it's copied to or from, then one used already
+		int32_t colour = NO_REG;
+		for (int32_t m = 0; m < arrlen(moves) && colour == NO_REG; m += 2) {
+			int32_t other = moves[m] == reg	      ? moves[m + 1]
+					: moves[m + 1] == reg ? moves[m]
+							      : NO_REG;
+			if (other != NO_REG && f->registers[other].colour != NO_REG &&
+			    available >> f->registers[other].colour & 1) {
+				colour = f->registers[other].colour;
+			}
+		}
+		uint32_t preferred = available & ~(1u << REG_VF);
+		if (colour == NO_REG && preferred) {
+			colour = highest_bit(preferred & used ? preferred & used : preferred);
+		} else if (colour == NO_REG) {
+			colour = REG_VF;
+		}
+		f->registers[reg].colour = colour;
+		used |= 1u << colour;
+	}
+
+	if (spilled) {
+		for (int32_t reg = REGISTERS; reg < registers; ++reg) {
+			f->registers[reg].colour = NO_REG;
+		}
+	}
+	free(adjacent);
+	free(removed);
+	free(degree);
+	arrfree(stack);
+	arrfree(moves);
+	return !spilled || c->failed;
+}
+
+static void find_back_edges(Function *f, int32_t b, int *visit, int32_t **edges) {
+	visit[b] = 1;
+	Block *block = &f->blocks[b];
+	for (int s = 0; s < successors(block); ++s) {
+		int32_t next = block->next[s];
+		if (visit[next] == 1) {
+			arrput(*edges, b);
+			arrput(*edges, next);
+		} else if (!visit[next]) {
+			find_back_edges(f, next, visit, edges);
+		}
+	}
+	visit[b] = 2;
+}
+
+// How many loops each block is in, a loop being what reaches the source of a
+// jump back up the depth-first tree without going through its header
+static void find_loop_depths(Function *f) {
+	int32_t blocks = arrlen(f->blocks);
+	int *visit = calloc(blocks, sizeof(int));
+	int32_t *edges = NULL;
+	find_back_edges(f, 0, visit, &edges);
+	bool *in_loop = calloc(blocks, sizeof(bool));
+	int32_t *stack = NULL;
+	for (int32_t header = 0; header < blocks; ++header) {
+		memset(in_loop, 0, blocks * sizeof(bool));
+		in_loop[header] = true;
+		for (int32_t e = 0; e < arrlen(edges); e += 2) {
+			if (edges[e + 1] == header) {
+				arrput(stack, edges[e]);
+			}
+		}
+		if (!arrlen(stack)) {
+			continue;
+		}
+		while (arrlen(stack)) {
+			int32_t b = arrpop(stack);
+			if (in_loop[b]) {
+				continue;
+			}
+			in_loop[b] = true;
+			for (int32_t pred = 0; pred < blocks; ++pred) {
+				Block *block = &f->blocks[pred];
+				for (int s = 0; block->reachable && s < successors(block); ++s) {
+					if (block->next[s] == b) {
+						arrput(stack, pred);
+					}
+				}
+			}
+		}
+		for (int32_t b = 0; b < blocks; ++b) {
+			f->blocks[b].loop_depth += in_loop[b];
+		}
+	}
+	free(visit);
+	free(in_loop);
+	arrfree(edges);
+	arrfree(stack);
+}
+
+static void allocate_registers(Compiler *c, Function *f) {
+	if (f->spills && (c->pinned & SCRATCH)) {
+		error(c, f->line,
+		      "'%s' reaches globals in memory through v0 and v1, which are named",
+		      f->name);
+		return;
+	}
+	find_unspillable(c, f);
+	find_loop_depths(f);
+	while (!c->failed && !colour_registers(c, f)) {
+	}
+}
+
+static MachineInstr plain(Chip8Instruction instruction) {
+	return (MachineInstr){ instruction, RELOC_NONE, 0, 0 };
+}
+
+static MachineInstr relocated(Chip8Instruction instruction, RelocKind reloc, int32_t target,
+			      int32_t offset) {
+	return (MachineInstr){ instruction, reloc, target, offset };
+}
+
+static uint32_t instruction_clobbers(Compiler *c, MachineInstr *instr) {
+	Chip8Instruction instruction = instr->instruction;
+	uint8_t x = instruction.rformat.rx;
+	switch (instruction_type(instruction)) {
+	case CHIP8_LD_VX_BYTE:
+	case CHIP8_ADD_VX_BYTE:
+	case CHIP8_LD_VX_VY:
+	case CHIP8_RND_VX_BYTE:
+	case CHIP8_LD_VX_DT:
+	case CHIP8_LD_VX_K:
+		return 1u << x;
+	case CHIP8_OR_VX_VY:
+	case CHIP8_AND_VX_VY:
+	case CHIP8_XOR_VX_VY:
+	case CHIP8_ADD_VX_VY:
+	case CHIP8_SUB_VX_VY:
+	case CHIP8_SHR_VX:
+	case CHIP8_SUBN_VX_VY:
+	case CHIP8_SHL_VX:
+		return 1u << x | 1u << REG_VF;
+	case CHIP8_DRW_VX_VY_NIBBLE:
+		return 1u << REG_VF;
+	case CHIP8_LD_I_ADDR:
+	case CHIP8_ADD_I_VX:
+	case CHIP8_LD_F_VX:
+	case CHIP8_LD_I_VX:
+		return 1u << REG_I;
+	case CHIP8_LD_VX_I:
+		return ((2u << x) - 1) | 1u << REG_I;
+	case CHIP8_CALL_ADDR:
+		return clobbers_of(c, instr->target);
+	default:
+		return 0;
+	}
+}
+
+// Appends the instruction unless it loads what's known to be there already
+static void put(Emitter *e, MachineInstr instr) {
+	Chip8Instruction instruction = instr.instruction;
+	uint8_t x = instruction.rformat.rx;
+	uint8_t y = instruction.rformat.ry;
+	uint8_t byte = instruction.iformat.imm;
+	switch (instruction_type(instruction)) {
+	case CHIP8_LD_VX_BYTE:
+		if (e->values[x] == byte) {
+			return;
+		}
+		e->values[x] = byte;
+		break;
+	case CHIP8_LD_VX_VY:
+		if (x == y || (e->values[y] >= 0 && e->values[x] == e->values[y])) {
+			return;
+		}
+		e->values[x] = e->values[y];
+		break;
+	case CHIP8_ADD_VX_BYTE:
+		e->values[x] = e->values[x] < 0 ? -1 : (e->values[x] + byte) & 0xFF;
+		break;
+	case CHIP8_OR_VX_VY:
+	case CHIP8_AND_VX_VY:
+	case CHIP8_XOR_VX_VY:
+	case CHIP8_ADD_VX_VY:
+	case CHIP8_SUB_VX_VY:
+	case CHIP8_SHR_VX:
+	case CHIP8_SUBN_VX_VY:
+	case CHIP8_SHL_VX:
+		e->values[x] = e->values[REG_VF] = -1;
+		break;
+	case CHIP8_RND_VX_BYTE:
+	case CHIP8_LD_VX_DT:
+	case CHIP8_LD_VX_K:
+		e->values[x] = -1;
+		break;
+	case CHIP8_DRW_VX_VY_NIBBLE:
+		e->values[REG_VF] = -1;
+		break;
+	case CHIP8_LD_I_ADDR: {
+		bool data = instr.reloc == RELOC_DATA;
+		Pointer i = { true, data ? instr.target : NO_SYMBOL,
+			      data ? instr.offset : instruction.aformat.addr };
+		if (same_pointer(i, e->i)) {
+			return;
+		}
+		e->i = i;
+		break;
+	}
+	case CHIP8_ADD_I_VX:
+	case CHIP8_LD_F_VX:
+		e->i.known = false;
+		break;
+	case CHIP8_LD_VX_I:
+		for (int reg = 0; reg <= x; ++reg) {
+			e->values[reg] = -1;
+		}
+		// Fallthrough
+	case CHIP8_LD_I_VX:
+		e->i.known = false;
+		break;
+	case CHIP8_CALL_ADDR: {
+		uint32_t clobbers = clobbers_of(e->c, instr.target);
+		for (int reg = 0; reg < 16; ++reg) {
+			e->values[reg] = clobbers >> reg & 1 ? -1 : e->values[reg];
+		}
+		e->i.known &= !(clobbers >> REG_I & 1);
+		break;
+	}
+	default:
+		break;
+	}
+	uint32_t clobbers = instruction_clobbers(e->c, &instr);
+	for (int reg = REG_V0; reg < 2; ++reg) {
+		e->holds[reg] = clobbers >> reg & 1 ? NO_REG : e->holds[reg];
+	}
+	arrput(e->block->code, instr);
+}
+
+static void set_i(Emitter *e, Pointer i) {
+	if (i.symbol == NO_SYMBOL) {
+		put(e, plain(INST_LD_I_ADDR(i.offset)));
+	} else {
+		put(e, relocated(INST_LD_I_ADDR(0), RELOC_DATA, i.symbol, i.offset));
+	}
+}
+
+static Pointer home(Register *r, int32_t offset) {
+	return (Pointer){ true, r->home, r->offset + offset };
+}
+
+// Gets the spilled registers `want` into V0 and V1, returning how many
+// instructions it takes, and emitting them unless just counting
+static int fill_scratch(Emitter *e, int32_t *want, bool emit) {
+	Register *regs = e->f->registers;
+	int32_t held[2] = { e->holds[0], e->holds[1] };
+	int cost = 0;
+	if (want[1] != NO_REG && held[1] != want[1]) {
+		Register *reg = &regs[want[1]];
+		if (reg->constant) {
+			cost += 1;
+			if (emit) {
+				put(e, plain(INST_LD_VX_BYTE(1, reg->value)));
+			}
+		} else if (held[0] == want[1]) {
+			cost += 1;
+			if (emit) {
+				put(e, plain(INST_LD_VX_VY(1, 0)));
+			}
+		} else {
+			cost += 2;
+			if (emit) {
+				set_i(e, home(reg, -1));
+				put(e, plain(INST_LD_VX_I(1)));
+				e->i_moved = true;
+			}
+			// Loading V1 loads V0 from the slot before, sometimes the other's
+			Register *other = want[0] != NO_REG ? &regs[want[0]] : NULL;
+			held[0] = other && !other->constant && other->home == reg->home &&
+						  other->offset + 1 == reg->offset
+					  ? want[0]
+					  : NO_REG;
+		}
+		held[1] = want[1];
+	}
+	if (want[0] != NO_REG && held[0] != want[0]) {
+		Register *reg = &regs[want[0]];
+		cost += reg->constant || held[1] == want[0] ? 1 : 2;
+		if (emit && reg->constant) {
+			put(e, plain(INST_LD_VX_BYTE(0, reg->value)));
+		} else if (emit && held[1] == want[0]) {
+			put(e, plain(INST_LD_VX_VY(0, 1)));
+		} else if (emit) {
+			set_i(e, home(reg, 0));
+			put(e, plain(INST_LD_VX_I(0)));
+			e->i_moved = true;
+		}
+	}
+	if (emit) {
+		e->holds[0] = want[0] != NO_REG ? want[0] : e->holds[0];
+		e->holds[1] = want[1] != NO_REG ? want[1] : e->holds[1];
+	}
+	return cost;
+}
+
+// Loads the spilled registers into V0 and V1, whichever way round is
+// cheapest given what they hold already, but for `in_v0` which has to be in
+// V0. Sets `physical` to where each register is.
+static void load_spilled(Emitter *e, int32_t *regs, int count, int32_t *physical, int32_t in_v0) {
+	int32_t spilled[2] = { NO_REG, NO_REG };
+	int loads = 0;
+	for (int r = 0; r < count; ++r) {
+		if (e->f->registers[regs[r]].spilled) {
+			spilled[loads++] = regs[r];
+		}
+	}
+	if (!loads) {
+		for (int r = 0; r < count; ++r) {
+			physical[r] = e->f->registers[regs[r]].colour;
+		}
+		return;
+	}
+	int32_t want[2] = { spilled[0], spilled[1] };
+	int32_t swapped[2] = { spilled[1], spilled[0] };
+	bool pinned = in_v0 != NO_REG && (in_v0 == want[0] || in_v0 == want[1]);
+	if (pinned ? swapped[0] == in_v0
+		   : fill_scratch(e, swapped, false) < fill_scratch(e, want, false)) {
+		want[0] = swapped[0];
+		want[1] = swapped[1];
+	}
+	fill_scratch(e, want, true);
+	for (int r = 0; r < count; ++r) {
+		Register *reg = &e->f->registers[regs[r]];
+		physical[r] = !reg->spilled ? reg->colour : want[0] == regs[r] ? 0 : 1;
+	}
+}
+
+static int32_t physical_of(Emitter *e, int32_t *regs, int32_t *physical, int count, int32_t reg) {
+	for (int r = 0; r < count; ++r) {
+		if (regs[r] == reg) {
+			return physical[r];
+		}
+	}
+	return e->f->registers[reg].colour;
+}
+
+// Sets I back to what the program has in it, if it was moved
+static void restore_i(Emitter *e, Pointer i) {
+	if (e->i_moved) {
+		set_i(e, i);
+		e->i_moved = false;
+	}
+}
+
+// I is only set back when it's read, so spill code between setting and reading
+// it costs a single LD I, and LD I itself is deferred until then
+static void emit_op(Emitter *e, Op *op, Pointer before, bool written_live) {
+	int32_t written = written_operand(op);
+	if (written != NO_REG && e->f->registers[written].constant) {
+		return; // Loaded where it's read instead
+	}
+	int32_t regs[2];
+	int32_t physical[2];
+	int count = read_operands(op, regs);
+	bool store = written != NO_REG && e->f->registers[written].spilled;
+	// Stores are from V0, which ALU ops can be turned around to leave their result in
+	load_spilled(e, regs, count, physical, store && op->kind == IR_ADD_IMM ? written : NO_REG);
+	if (uses_i(e->c, op)) {
+		restore_i(e, before);
+	}
+	uint8_t x = store ? REG_V0 : physical_of(e, regs, physical, count, op->dst);
+	uint8_t y = physical_of(e, regs, physical, count, op->a);
+	uint8_t b = physical_of(e, regs, physical, count, op->b);
+	uint8_t alu = op->alu;
+	if (op->kind == IR_ALU && store && physical_of(e, regs, physical, count, op->dst) == 1 &&
+	    alu != ALU_SHR && alu != ALU_SHL) {
+		// Shifts don't read their destination, and the rest can swap operands
+		if (y == REG_V0) {
+			y = 1;
+			alu = alu == ALU_SUB ? ALU_SUBN : alu == ALU_SUBN ? ALU_SUB : alu;
+		} else {
+			put(e, plain(INST_LD_VX_VY(REG_V0, 1)));
+		}
+	}
+
+	switch (op->kind) {
+	case IR_LOAD:
+		put(e, plain(INST_LD_VX_BYTE(x, op->imm)));
+		break;
+	case IR_COPY:
+		put(e, plain(INST_LD_VX_VY(x, y)));
+		break;
+	case IR_ADD_IMM:
+		put(e, plain(INST_ADD_VX_BYTE(x, op->imm)));
+		break;
+	case IR_ALU:
+		put(e, plain(rformat(0x8, x, y, alu)));
+		break;
+	case IR_RAND:
+		put(e, plain(INST_RND_VX_BYTE(x, op->imm)));
+		break;
+	case IR_GET_DELAY:
+		put(e, plain(INST_LD_VX_DT(x)));
+		break;
+	case IR_WAIT_KEY:
+		put(e, plain(INST_LD_VX_K(x)));
+		break;
+	case IR_SET_DELAY:
+		put(e, plain(INST_LD_DT_VX(y)));
+		break;
+	case IR_SET_SOUND:
+		put(e, plain(INST_LD_ST_VX(y)));
+		break;
+	case IR_SET_I:
+		e->i_moved = true;
+		break;
+	case IR_ADD_I:
+		put(e, plain(INST_ADD_I_VX(y)));
+		break;
+	case IR_FONT:
+		put(e, plain(INST_LD_F_VX(y)));
+		break;
+	case IR_DRAW:
+		put(e, plain(INST_DRW_VX_VY_NIBBLE(y, b, op->imm)));
+		break;
+	case IR_BCD:
+		put(e, plain(INST_LD_B_VX(y)));
+		break;
+	case IR_SAVE:
+		put(e, plain(INST_LD_I_VX(op->imm)));
+		break;
+	case IR_RESTORE:
+		put(e, plain(INST_LD_VX_I(op->imm)));
+		break;
+	case IR_CLS:
+		put(e, plain(INST_CLS));
+		break;
+	case IR_CALL:
+		put(e, relocated(INST_CALL_ADDR(0), RELOC_FUNCTION, op->symbol, 0));
+		e->i_moved |= moves_i(e->c, op->symbol);
+		break;
+	case IR_RAW:
+		put(e, plain((Chip8Instruction){ .raw = op->imm }));
+		break;
+	}
+
+	if (op->kind != IR_SET_I && defines_i(e->c, op)) {
+		e->i_moved = false;
+	}
+	if (store && written_live) {
+		set_i(e, home(&e->f->registers[written], 0));
+		put(e, plain(INST_LD_I_VX(0)));
+		e->i_moved = true;
+		e->holds[0] = written;
+		e->holds[1] = e->holds[1] == written ? NO_REG : e->holds[1];
+	}
+}
+
+// The block's instructions but for its terminator, and the condition it
+// branches on in physical registers
+static void emit_block(Compiler *c, Function *f, Block *block) {
+	Emitter e = { c, f, block, .i = { .known = false }, .holds = { NO_REG, NO_REG } };
+	memset(e.values, -1, sizeof(e.values));
+	bool *written_live = written_live_after(c, f, block);
+	Pointer i = block->i_in;
+	for (int32_t o = 0; o < arrlen(block->ops); ++o) {
+		emit_op(&e, &block->ops[o], i, written_live[o]);
+		i = pointer_after(c, &block->ops[o], i);
+	}
+	free(written_live);
+
+	if (block->term == TERM_BRANCH) {
+		int32_t regs[2];
+		int32_t physical[2];
+		Condition condition = block->condition;
+		int count = condition_operands(&condition, regs);
+		load_spilled(&e, regs, count, physical, NO_REG);
+		condition.a = physical[0];
+		if (condition.b != NO_REG) {
+			condition.b = physical_of(&e, regs, physical, count, condition.b);
+		}
+		block->skip = condition;
+	}
+	uint64_t *live = new_set(f);
+	live_at_end(c, f, block, live);
+	if (set_has(live, REG_I)) {
+		restore_i(&e, i);
+	}
+	free(live);
+}
+
+// How the function's own ops and its callees use I, for calling it while it's
+// compiled. Spill code moving I doesn't count as setting it, as callers set it
+// back, and recursing adds nothing to the rest of the function.
+static void find_i_effects(Compiler *c, Function *f) {
+	bool sets = false;
+	bool reads = false;
+	for (int32_t b = 0; b < arrlen(f->blocks); ++b) {
+		Block *block = &f->blocks[b];
+		for (int32_t o = 0; o < arrlen(block->ops); ++o) {
+			sets |= defines_i(c, &block->ops[o]);
+			reads |= uses_i(c, &block->ops[o]);
+		}
+		if (block->term == TERM_TAIL_CALL) {
+			sets |= sets_i_of(c, block->target);
+			reads |= reads_of(c, block->target) >> REG_I & 1;
+		} else if (block->term == TERM_JUMP_OUT || block->term == TERM_JUMP_V0) {
+			sets = reads = true;
+		}
+	}
+	f->sets_i = sets;
+	f->reads = c->pinned | (reads ? 1u << REG_I : 0);
+}
+
+// The registers calling the function may change, its callees' changes included
+static uint32_t find_clobbers(Compiler *c, Function *f) {
+	uint32_t clobbers = 0;
+	for (int32_t b = 0; b < arrlen(f->blocks); ++b) {
+		Block *block = &f->blocks[b];
+		if (!block->reachable) {
+			continue;
+		}
+		for (int32_t i = 0; i < arrlen(block->code); ++i) {
+			clobbers |= instruction_clobbers(c, &block->code[i]);
+		}
+		if (block->term == TERM_TAIL_CALL) {
+			clobbers |= clobbers_of(c, block->target);
+		} else if (block->term == TERM_JUMP_OUT || block->term == TERM_JUMP_V0) {
+			clobbers |= ALL_PHYSICAL;
+		}
+	}
+	return clobbers;
+}
+
+// The physical registers live on entering the function, but for those only
+// kept for its caller, so that calls needn't keep the rest
+static uint32_t find_reads(Compiler *c, Function *f) {
+	c->finding_reads = true;
+	compute_liveness(c, f);
+	uint64_t *live = new_set(f);
+	uint64_t *scratch = new_set(f);
+	Block *entry = &f->blocks[0];
+	live_at_end(c, f, entry, live);
+	for (int32_t o = arrlen(entry->ops); o-- > 0;) {
+		step_back(c, f, &entry->ops[o], live, scratch);
+	}
+	uint32_t reads = 0;
+	for (int32_t reg = 0; reg < REGISTERS; ++reg) {
+		reads |= set_has(live, reg) ? 1u << reg : 0;
+	}
+	free(live);
+	free(scratch);
+	c->finding_reads = false;
+	compute_liveness(c, f);
+	return reads;
+}
+
+// The instruction ending a block that leaves the function
+static bool terminal_instruction(Function *f, Block *block, MachineInstr *instr) {
+	switch (block->term) {
+	case TERM_RETURN:
+		// main() has nowhere to return to, so halts
+		*instr = is_main(f) ? relocated(INST_JMP_ADDR(0), RELOC_SELF, 0, 0)
+				    : plain(INST_RET);
+		return true;
+	case TERM_TAIL_CALL:
+		*instr = relocated(INST_JMP_ADDR(0), RELOC_FUNCTION, block->target, 0);
+		return true;
+	case TERM_JUMP_OUT:
+		*instr = plain(INST_JMP_ADDR(block->target));
+		return true;
+	case TERM_JUMP_V0:
+		*instr = plain(INST_JMP_V0_ADDR(block->target));
+		return true;
+	default:
+		return false;
+	}
+}
+
+// The block as a single instruction: its terminator, or its only instruction
+// when that's followed by `then`, which sets `continues`
+static bool as_instruction(Function *f, int32_t b, int32_t then, MachineInstr *instr,
+			   bool *continues) {
+	Block *block = &f->blocks[b];
+	*continues = false;
+	if (!arrlen(block->code)) {
+		return terminal_instruction(f, block, instr);
+	}
+	if (arrlen(block->code) == 1 && block->term == TERM_JUMP && block->next[0] == then) {
+		*instr = block->code[0];
+		*continues = true;
+		return true;
+	}
+	return false;
+}
+
+static void add_exit(Exit *exit, MachineInstr instr) {
+	exit->instrs[exit->count++] = instr;
+}
+
+// Going to the block, laid out before `next`
+static void exit_to(Function *f, int32_t target, int32_t next, Exit *exit) {
+	MachineInstr instr;
+	bool continues;
+	if (target == next) {
+		exit->falls = true;
+	} else if (as_instruction(f, target, next, &instr, &continues)) {
+		add_exit(exit, instr);
+		exit->falls = continues;
+	} else {
+		add_exit(exit, relocated(INST_JMP_ADDR(0), RELOC_BLOCK, target, 0));
+		exit->targets[exit->target_count++] = target;
+	}
+}
+
+// The instruction skipping the next one when the condition is `when`
+static MachineInstr skip_instruction(Condition condition, bool when) {
+	if (condition.kind == COND_NE || condition.kind == COND_NO_KEY) {
+		condition.kind = negated_conditions[condition.kind];
+		when = !when;
+	}
+	if (condition.kind == COND_KEY) {
+		return plain(when ? INST_SKP_VX(condition.a) : INST_SKNP_VX(condition.a));
+	}
+	if (condition.b == NO_REG) {
+		return plain(when ? INST_SE_VX_BYTE(condition.a, condition.imm)
+				  : INST_SNE_VX_BYTE(condition.a, condition.imm));
+	}
+	return plain(when ? INST_SE_VX_VY(condition.a, condition.b)
+			  : INST_SNE_VX_VY(condition.a, condition.b));
+}
+
+// A skip over going to `go` on `when`, then going on to `rest`
+static Exit branch_exit(Function *f, Block *block, bool when, int32_t go, int32_t rest,
+			int32_t next) {
+	Exit exit = { .count = 0 };
+	MachineInstr instr;
+	bool continues;
+	add_exit(&exit, skip_instruction(block->skip, !when));
+	if (as_instruction(f, go, rest, &instr, &continues)) {
+		add_exit(&exit, instr);
+	} else {
+		add_exit(&exit, relocated(INST_JMP_ADDR(0), RELOC_BLOCK, go, 0));
+		exit.targets[exit.target_count++] = go;
+	}
+	exit_to(f, rest, next, &exit);
+	return exit;
+}
+
+// How the block leaves, when it's laid out before `next`
+static Exit block_exit(Function *f, int32_t b, int32_t next) {
+	Block *block = &f->blocks[b];
+	Exit exit = { .count = 0 };
+	MachineInstr instr;
+	switch (block->term) {
+	case TERM_JUMP:
+		exit_to(f, block->next[0], next, &exit);
+		return exit;
+	case TERM_BRANCH: {
+		// Whichever way round is shorter, or falls through
+		Exit taken = branch_exit(f, block, true, block->next[0], block->next[1], next);
+		Exit not_taken = branch_exit(f, block, false, block->next[1], block->next[0], next);
+		bool shorter = not_taken.count < taken.count ||
+			       (not_taken.count == taken.count && not_taken.falls && !taken.falls);
+		return shorter ? not_taken : taken;
+	}
+	default:
+		terminal_instruction(f, block, &instr);
+		add_exit(&exit, instr);
+		return exit;
+	}
+}
+
+// Chains blocks to fall through to a successor where they can, then drops the
+// ones left with nothing jumping or falling through to them, as every branch
+// to them copies their instruction
+static void lay_out(Function *f) {
+	for (int32_t b = 0; b < arrlen(f->blocks); ++b) {
+		f->blocks[b].placed = false;
+	}
+	int32_t b = 0;
+	while (b != NO_BLOCK) {
+		Block *block = &f->blocks[b];
+		block->placed = true;
+		arrput(f->layout, b);
+
+		// Rather one that's more than an instruction, as that's best inlined
+		b = NO_BLOCK;
+		for (int pass = 0; pass < 2 && b == NO_BLOCK; ++pass) {
+			for (int s = 0; s < successors(block) && b == NO_BLOCK; ++s) {
+				Block *next = &f->blocks[block->next[s]];
+				if (!next->placed && (pass || arrlen(next->code) > 1 ||
+						      next->term == TERM_BRANCH)) {
+					b = block->next[s];
+				}
+			}
+		}
+		for (int32_t other = 0; other < arrlen(f->blocks) && b == NO_BLOCK; ++other) {
+			if (f->blocks[other].reachable && !f->blocks[other].placed) {
+				b = other;
+			}
+		}
+	}
+
+	int32_t *refs = calloc(arrlen(f->blocks), sizeof(int32_t));
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		int32_t count = arrlen(f->layout);
+		bool *falls = calloc(count + 1, sizeof(bool)); // Into each block laid out
+		memset(refs, 0, arrlen(f->blocks) * sizeof(int32_t));
+		falls[0] = true;
+		for (int32_t p = 0; p < count; ++p) {
+			int32_t next = p + 1 < count ? f->layout[p + 1] : NO_BLOCK;
+			Exit exit = block_exit(f, f->layout[p], next);
+			for (int t = 0; t < exit.target_count; ++t) {
+				++refs[exit.targets[t]];
+			}
+			falls[p + 1] = exit.falls;
+		}
+		for (int32_t p = 1; p < count && !changed; ++p) {
+			if (!falls[p] && !refs[f->layout[p]]) {
+				arrdel(f->layout, p);
+				changed = true;
+			}
+		}
+		free(falls);
+	}
+	free(refs);
+
+	for (int32_t p = 0; p < arrlen(f->layout); ++p) {
+		Block *block = &f->blocks[f->layout[p]];
+		int32_t next = p + 1 < arrlen(f->layout) ? f->layout[p + 1] : NO_BLOCK;
+		block->address = 2 * arrlen(f->code);
+		for (int32_t i = 0; i < arrlen(block->code); ++i) {
+			arrput(f->code, block->code[i]);
+		}
+		Exit exit = block_exit(f, f->layout[p], next);
+		for (int i = 0; i < exit.count; ++i) {
+			arrput(f->code, exit.instrs[i]);
+		}
+	}
+}
+
+static uint16_t resolve(Compiler *c, Function *f, int32_t index) {
+	MachineInstr *instr = &f->code[index];
+	switch (instr->reloc) {
+	case RELOC_BLOCK:
+		return f->address + f->blocks[instr->target].address;
+	case RELOC_FUNCTION:
+		return c->functions[instr->target].address;
+	case RELOC_DATA:
+		return c->data[instr->target].address + instr->offset;
+	case RELOC_SELF:
+		return f->address + 2 * index;
+	default:
+		return instr->instruction.aformat.addr;
+	}
+}
+
+// main() first, then the other functions and data, with room for the rest
+// after the ROM's end
+static uint8_t *link_program(Compiler *c) {
+	int32_t *functions = NULL;
+	for (int32_t i = arrlen(c->order); i-- > 0;) {
+		if (is_main(&c->functions[c->order[i]])) {
+			arrins(functions, 0, c->order[i]);
+		} else {
+			arrput(functions, c->order[i]);
+		}
+	}
+	uint32_t address = PROG_BASE;
+	for (int32_t i = 0; i < arrlen(functions); ++i) {
+		Function *f = &c->functions[functions[i]];
+		f->address = address;
+		address += 2 * arrlen(f->code);
+	}
+	uint32_t end = address; // Of the ROM, before the reserved data
+	for (int pass = 0; pass < 2; ++pass) {
+		for (int32_t d = 0; d < arrlen(c->data); ++d) {
+			if (c->data[d].reserved == pass) {
+				c->data[d].address = address;
+				address += c->data[d].size;
+			}
+		}
+		end = pass ? end : address;
+	}
+	if (address > EMULATOR_MEMORY_SIZE) {
+		error(c, c->line,
+		      "The program needs %u bytes of memory, more than the %u there are",
+		      address - PROG_BASE, EMULATOR_MAX_ROM_SIZE);
+		arrfree(functions);
+		return NULL;
+	}
+
+	uint8_t *rom = NULL;
+	arrsetlen(rom, end - PROG_BASE);
+	memset(rom, 0, end - PROG_BASE);
+	for (int32_t i = 0; i < arrlen(functions); ++i) {
+		Function *f = &c->functions[functions[i]];
+		for (int32_t k = 0; k < arrlen(f->code); ++k) {
+			Chip8Instruction instruction = f->code[k].instruction;
+			if (f->code[k].reloc != RELOC_NONE) {
+				instruction.aformat.addr = resolve(c, f, k);
+			}
+			rom[f->address - PROG_BASE + 2 * k] = instruction.raw >> 8;
+			rom[f->address - PROG_BASE + 2 * k + 1] = instruction.raw & 0xFF;
+		}
+	}
+	for (int32_t d = 0; d < arrlen(c->data); ++d) {
+		if (!c->data[d].reserved && arrlen(c->data[d].bytes)) {
+			memcpy(&rom[c->data[d].address - PROG_BASE], c->data[d].bytes,
+			       arrlen(c->data[d].bytes));
+		}
+	}
+	arrfree(functions);
+	return rom;
+}
+
+static uint8_t *generate(Compiler *c) {
+	int32_t main_function = NO_SYMBOL;
+	for (int32_t f = 0; f < arrlen(c->functions); ++f) {
+		if (is_main(&c->functions[f]) && c->functions[f].defined) {
+			main_function = f;
+		}
+	}
+	if (main_function == NO_SYMBOL) {
+		error(c, c->line, "There's no main()");
+		return NULL;
+	}
+	order_functions(c, main_function);
+	if (c->failed) {
+		return NULL;
+	}
+
+	place_globals(c);
+	Function *f = &c->functions[main_function];
+	for (int32_t g = arrlen(c->globals); g-- > 0;) {
+		if (c->globals[g].reg != NO_REG) {
+			Op load = { .kind = IR_LOAD, .dst = c->globals[g].reg,
+				    .imm = c->globals[g].value & 0xFF, .known = LATTICE_BOTTOM,
+				    .line = f->line };
+			arrins(f->blocks[0].ops, 0, load);
+		}
+	}
+
+	for (int32_t i = 0; i < arrlen(c->order); ++i) {
+		c->function = c->order[i];
+		f = current(c);
+		alias_globals(c, f);
+		find_i_effects(c, f);
+		optimise(c, f);
+		allocate_registers(c, f);
+		if (c->failed) {
+			return NULL;
+		}
+		for (int32_t b = 0; b < arrlen(f->blocks); ++b) {
+			if (f->blocks[b].reachable) {
+				emit_block(c, f, &f->blocks[b]);
+			}
+		}
+		f->clobbers = find_clobbers(c, f);
+		f->reads = find_reads(c, f);
+		f->analysed = true;
+	}
+	for (int32_t i = 0; i < arrlen(c->order); ++i) {
+		lay_out(&c->functions[c->order[i]]);
+	}
+	return link_program(c);
+}
+
+static void free_compiler(Compiler *c) {
+	for (int32_t f = 0; f < arrlen(c->functions); ++f) {
+		Function *function = &c->functions[f];
+		for (int32_t b = 0; b < arrlen(function->blocks); ++b) {
+			arrfree(function->blocks[b].ops);
+			arrfree(function->blocks[b].code);
+			free(function->blocks[b].live_out);
+		}
+		for (int32_t l = 0; l < arrlen(function->labels); ++l) {
+			free(function->labels[l].name);
+		}
+		free(function->name);
+		arrfree(function->blocks);
+		arrfree(function->registers);
+		arrfree(function->labels);
+		arrfree(function->globals);
+		arrfree(function->layout);
+		arrfree(function->code);
+	}
+	for (int32_t g = 0; g < arrlen(c->globals); ++g) {
+		free(c->globals[g].name);
+	}
+	for (int32_t d = 0; d < arrlen(c->data); ++d) {
+		free(c->data[d].name);
+		arrfree(c->data[d].bytes);
+	}
+	for (int32_t l = 0; l < arrlen(c->locals); ++l) {
+		free(c->locals[l].name);
+	}
+	for (int32_t j = 0; j < arrlen(c->jumps); ++j) {
+		arrfree(c->jumps[j].cases);
+		arrfree(c->jumps[j].case_blocks);
+	}
+	arrfree(c->exprs);
+	arrfree(c->functions);
+	arrfree(c->globals);
+	arrfree(c->data);
+	arrfree(c->order);
+	arrfree(c->locals);
+	arrfree(c->jumps);
+}
+
+uint8_t *compile(char *source_filename) {
+	FILE *file = fopen(source_filename, "r");
+	if (!file) {
+		fprintf(stderr, "[!] Failed to open %s\n", source_filename);
+		return NULL;
+	}
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	rewind(file);
+	char *source = malloc(size + 1);
+	size = fread(source, 1, size, file);
+	source[size] = '\0';
+	fclose(file);
+
+	Compiler c = { .source = source, .at = source, .line = 1, .memory_globals = NO_SYMBOL,
+		       .block = NO_BLOCK };
+	parse_program(&c);
+	uint8_t *rom = c.failed ? NULL : generate(&c);
+	if (c.failed) {
+		arrfree(rom);
+	}
+	free_compiler(&c);
+	free(source);
+	return rom;
+}
@@ -0,0 +1,23 @@
+#ifndef COMPILER_H
+#define COMPILER_H
+
+#include <stdint.h>
+
+// Optimising compiler from the C-like language described in the README to a
+// ROM loaded at PROG_BASE, with main() first.
+//
+// Functions are lowered to basic blocks of CHIP-8 shaped operations on virtual
+// registers, then constants are propagated and dead code (mostly flags) is
+// removed. Variables and temporaries are coloured onto V0-VE around the
+// registers named in the source, with VF kept for flags. Ones that don't fit
+// live in memory and are loaded into V0 and V1 around each use, in pairs by a
+// single LD V1, [I] where their slots are adjacent. Callees are allocated
+// first, so callers keep values across a call in registers it leaves alone.
+//
+// Blocks are then laid out to fall through to their likeliest successor, a
+// branch over a single instruction becomes a skip over it, and while loops test
+// at the bottom, so that the code runs as few jumps as possible.
+
+uint8_t *compile(char *source_filename);
+
+#endif // !COMPILER_H
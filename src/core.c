@@ -0,0 +1,949 @@
+#include "analysis_cache.h"
+#include "call_graph.h"
+#include "core.h"
+#include "disassembler.h"
+#include "disassembly_worker.h"
+#include "instructions.h"
+#include "log.h"
+#include "sds.h"
+#include "stb_ds.h"
+#include "superinstructions.h"
+#include "trace.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+const int CYCLES_PER_FRAME[CYCLES_PER_FRAME_COUNT] = {
+	[CPF_7] = 7,	 [CPF_10] = 10,	  [CPF_15] = 15,   [CPF_20] = 20,     [CPF_30] = 30,
+	[CPF_100] = 100, [CPF_200] = 200, [CPF_500] = 500, [CPF_1000] = 1000,
+};
+const char *CYCLES_PER_FRAME_STR[CYCLES_PER_FRAME_COUNT] = {
+	[CPF_7] = "7",	   [CPF_10] = "10",   [CPF_15] = "15",
+	[CPF_20] = "20",   [CPF_30] = "30",   [CPF_100] = "100",
+	[CPF_200] = "200", [CPF_500] = "500", [CPF_1000] = "1000",
+};
+
+static inline void dump_memory(EmulatorState *);
+static inline __attribute__((always_inline)) void
+draw_sprite(EmulatorState *, Chip8Instruction, bool);
+static inline __attribute__((always_inline)) void
+load_registers(EmulatorState *, Chip8Instruction, bool);
+static inline __attribute__((always_inline)) int
+execute_fused(EmulatorState *, FusedPair, Chip8Instruction, Chip8Instruction, bool);
+static inline __attribute__((always_inline)) bool
+execute_instruction(EmulatorState *, Chip8Instruction, bool);
+
+// Credits the instructions that ran since the last fetch, including the second
+// half of a fused pair. DRW waiting for the display doesn't count.
+static inline void count_executions(DebugState *debug_state, uint16_t addr, uint16_t next_addr,
+				    uint64_t executed) {
+	if (executed > 0) {
+		debug_state->execution_counts[addr]++;
+	}
+	if (executed > 1) {
+		debug_state->execution_counts[next_addr]++;
+	}
+}
+
+// Counts an access to each of the `length` bytes from `addr`
+static inline void count_accesses(uint64_t *counts, uint16_t addr, int length) {
+	for (int i = 0; i < length; ++i) {
+		counts[(addr + i) & EMULATOR_ADDR_MASK]++;
+	}
+}
+
+static void end_step(DebugState *debug_state) {
+	if (debug_state->stepping) {
+		debug_state->instruction_breakpoints[debug_state->step_address] =
+			debug_state->step_breakpoint;
+		debug_state->stepping = false;
+	}
+}
+
+// Whether to stop at `addr`, which has a breakpoint. Stopping for any reason
+// ends a step over/out, like it does in GDB.
+static bool breakpoint_hit(EmulatorState *emulator, uint16_t addr) {
+	DebugState *debug_state = &emulator->debug_state;
+	if (debug_state->inst_breakpoint_hit) {
+		return false; // Resuming from this breakpoint
+	}
+
+	bool step_target = debug_state->stepping && addr == debug_state->step_address;
+	bool user_breakpoint = !debug_state->skip_breakpoints &&
+			       (!step_target || debug_state->step_breakpoint);
+	// A recursive call returning to the same address is still too deep
+	bool step_done = step_target && emulator->sp <= debug_state->step_depth;
+	if (!user_breakpoint && !step_done) {
+		return false;
+	}
+
+	end_step(debug_state);
+	return true;
+}
+
+// Body of run_frame(), inlined once per value of `profiling` so the counting
+// compiles away entirely when profiling is off
+static inline __attribute__((always_inline)) bool run_cycles(EmulatorState *emulator,
+							     bool profiling) {
+	DebugState *debug_state = &emulator->debug_state;
+	bool success = true;
+	// What's left of the frame, which breakpoints and stepping may have started
+	int64_t cycles = CYCLES_PER_FRAME[emulator->cycles_per_frame] -
+			 (int64_t)(emulator->cycle_count - emulator->frame_start);
+
+	if (profiling && !debug_state->call_graph.depth) {
+		call_graph_begin(&debug_state->call_graph, emulator->cycle_count);
+	}
+
+	for (int64_t cycle = 0; cycle < cycles; ++cycle) {
+		uint16_t addr = emulator->pc & EMULATOR_ADDR_MASK;
+		uint64_t cycle_count = emulator->cycle_count;
+		Chip8Instruction instruction = fetch_next(emulator, false);
+		if (debug_state->instruction_breakpoints[addr] && breakpoint_hit(emulator, addr)) {
+			debug_state->inst_breakpoint_hit = true;
+			debug_state->debug_mode = true;
+			emulator->pc -= 2;
+			log_info(LOG_CPU, "Hit breakpoint @ 0x%03hx", emulator->pc);
+			break;
+		}
+
+		debug_state->inst_breakpoint_hit = false;
+
+		// Known idioms run in one dispatch, unless the second half has a breakpoint
+		// or has been overwritten (fetch_next() needs to see it first)
+		uint16_t next_addr = emulator->pc & EMULATOR_ADDR_MASK;
+		Chip8Instruction next = opcode_at(emulator->memory, next_addr);
+		FusedPair pair = fused_pair(instruction, next);
+		// Traces record every instruction separately, so fusion is off while tracing
+		if (pair != FUSED_NONE && cycle + 1 < cycles && !emulator->trace &&
+		    !debug_state->instruction_breakpoints[next_addr] &&
+		    !debug_state->memory_modifications[next_addr]) {
+			cycle += execute_fused(emulator, pair, instruction, next, profiling) - 1;
+		} else {
+			if (emulator->trace) {
+				trace_begin(emulator->trace, emulator);
+			}
+			if (!execute_instruction(emulator, instruction, profiling)) {
+				dump_state(emulator);
+				debug_state->debug_mode = true;
+				printf("\n[!] Something went wrong @ 0x%03hx: ", emulator->pc - 2);
+				sds asm_str = inst2str(instruction);
+				printf("%s\n", asm_str);
+				sdsfree(asm_str);
+				success = false;
+				break;
+			}
+			if (emulator->trace) {
+				trace_instruction(emulator->trace, emulator, instruction);
+			}
+		}
+		if (profiling) {
+			count_executions(debug_state, addr, next_addr,
+					 emulator->cycle_count - cycle_count);
+
+			// Fused pairs never start with CALL or RET
+			if (instruction.aformat.opcode == OP_CALL_ADDR) {
+				call_graph_enter(&debug_state->call_graph, instruction.aformat.addr,
+						 emulator->cycle_count);
+			} else if (instruction.raw == OP_RET) {
+				call_graph_leave(&debug_state->call_graph, emulator->cycle_count);
+			}
+		}
+		if (emulator->display_interrupted || debug_state->memory_breakpoint_hit) {
+			break;
+		}
+	}
+
+	if (!(debug_state->inst_breakpoint_hit || debug_state->memory_breakpoint_hit)) {
+		handle_timers(emulator);
+		emulator->frame_start = emulator->cycle_count;
+		if (emulator->trace) {
+			trace_frame(emulator->trace);
+		}
+	}
+
+	update_disassembly(emulator);
+
+	return success;
+}
+
+// Resumes until `addr` is reached with at most `depth` return addresses stacked
+static void run_to_return(EmulatorState *emulator, uint16_t addr, uint8_t depth) {
+	DebugState *debug_state = &emulator->debug_state;
+	addr &= EMULATOR_ADDR_MASK;
+	end_step(debug_state);
+	debug_state->stepping = true;
+	debug_state->step_address = addr;
+	debug_state->step_depth = depth;
+	debug_state->step_breakpoint = debug_state->instruction_breakpoints[addr];
+	debug_state->instruction_breakpoints[addr] = true;
+
+	// Don't stop at a breakpoint on the current instruction straight away
+	debug_state->inst_breakpoint_hit = true;
+	debug_state->debug_mode = false;
+}
+
+// Runs the CALL at the PC until it returns. False, doing nothing, if the PC
+// isn't at a CALL.
+bool step_over(EmulatorState *emulator) {
+	Chip8Instruction instruction = opcode_at(emulator->memory, emulator->pc);
+	if (instruction.aformat.opcode != OP_CALL_ADDR) {
+		return false;
+	}
+	run_to_return(emulator, emulator->pc + 2, emulator->sp);
+	return true;
+}
+
+// Runs until the current subroutine returns. False if not in one.
+bool step_out(EmulatorState *emulator) {
+	if (!emulator->sp) {
+		return false;
+	}
+	run_to_return(emulator, emulator->stack[emulator->sp - 1], emulator->sp - 1);
+	return true;
+}
+
+// Forgets an unfinished step over/out, e.g. when pausing
+void cancel_step(EmulatorState *emulator) {
+	end_step(&emulator->debug_state);
+}
+
+// Runs a single 60 Hz frame's worth of cycles, then ticks the timers
+bool run_frame(EmulatorState *emulator) {
+	if (emulator->debug_state.profiling) {
+		return run_cycles(emulator, true);
+	}
+	return run_cycles(emulator, false);
+}
+
+// Executes the instruction at the PC on its own, ticking the timers if that ends the frame
+bool step_instruction(EmulatorState *emulator, bool trace) {
+	bool success = execute(emulator, fetch_next(emulator, trace));
+	if (emulator->cycle_count - emulator->frame_start >=
+	    (uint64_t)CYCLES_PER_FRAME[emulator->cycles_per_frame]) {
+		handle_timers(emulator);
+		emulator->frame_start = emulator->cycle_count;
+	}
+	update_disassembly(emulator);
+	return success;
+}
+
+// Adds the code the worker found to the disassembly, unless it was replaced since the job was
+// submitted. Only the new code is copied, and the same update goes on to whoever mirrors the
+// disassembly.
+static void merge_jump_targets(EmulatorState *emulator) {
+	DebugState *debug_state = &emulator->debug_state;
+	DisassemblyUpdate update;
+	uint16_t *targets;
+	uint32_t generation;
+	if (!debug_state->worker ||
+	    !disassembly_worker_collect(debug_state->worker, &update, &targets, &generation)) {
+		return;
+	}
+
+	if (generation != debug_state->disassembly_generation) {
+		// Stale, so forget the targets. The next jump to them queues them again.
+		for (size_t i = 0; i < (size_t)arrlen(targets); ++i) {
+			debug_state->jump_targets_seen[PROG_BASE + targets[i]] = false;
+		}
+		free_disassembly_update(&update);
+		arrfree(targets);
+		return;
+	}
+
+	for (size_t i = 0; i < (size_t)arrlen(update.blocks); ++i) {
+		InstructionBlock *block = &update.blocks[i];
+		log_debug(LOG_DISASM, "Disassembled new code @ 0x%03x-0x%03x",
+			  PROG_BASE + block->instructions[0].address,
+			  PROG_BASE + block->instructions[block->length - 1].address + 1);
+	}
+	apply_disassembly_update(&debug_state->disassembly, &update);
+	if (debug_state->disassembly_replaced) {
+		free_disassembly_update(&update);
+	} else {
+		merge_disassembly_updates(&debug_state->disassembly_changes, &update);
+	}
+	arrfree(targets);
+}
+
+static void queue_jump_targets(EmulatorState *emulator) {
+	DebugState *debug_state = &emulator->debug_state;
+	if (!arrlen(debug_state->pending_jump_targets)) {
+		return;
+	}
+
+	if (!debug_state->worker) {
+		debug_state->worker = disassembly_worker_create();
+		if (!debug_state->worker) {
+			arrfree(debug_state->pending_jump_targets);
+			return;
+		}
+	}
+
+	if (disassembly_worker_submit(debug_state->worker, emulator->memory + PROG_BASE,
+				      EMULATOR_MEMORY_SIZE - PROG_BASE, &debug_state->disassembly,
+				      debug_state->pending_jump_targets,
+				      debug_state->disassembly_generation)) {
+		debug_state->pending_jump_targets = NULL;
+	}
+}
+
+// Brings in finished background disassembly and queues any new jump targets.
+// Called between frames.
+void update_disassembly(EmulatorState *emulator) {
+	merge_jump_targets(emulator);
+	queue_jump_targets(emulator);
+}
+
+Chip8Instruction fetch_next(EmulatorState *emulator, bool trace) {
+	static uint16_t prev_inst_addr = 0;
+	uint16_t addr = emulator->pc & EMULATOR_ADDR_MASK;
+
+	DebugState *debug_state = &emulator->debug_state;
+	Disassembly *disassembly = &debug_state->disassembly;
+
+	Chip8Instruction instruction = opcode_at(emulator->memory, addr);
+
+	bool modified = debug_state->memory_modifications[addr];
+	bool disassembled = addr >= disassembly->base &&
+			    addr - disassembly->base < disassembly->abook_length &&
+			    disassembly->addressbook[addr - disassembly->base].type ==
+				    ADDR_INSTRUCTION;
+	if (disassembled && (modified || (addr != prev_inst_addr && trace))) {
+		AddressLookup *lookup = &disassembly->addressbook[addr - disassembly->base];
+		DisassembledInstruction *disasm =
+			&disassembly->instruction_blocks[lookup->block_offset]
+				 .instructions[lookup->array_offset];
+
+		if (modified) {
+			char old_text[INST_TEXT_SIZE];
+			char new_text[INST_TEXT_SIZE];
+			log_debug(LOG_DISASM, "Modified instruction @ 0x%03hx: %s -> %s", addr,
+				  inst2text(disasm->instruction, old_text),
+				  inst2text(instruction, new_text));
+			disasm->instruction = instruction;
+
+			debug_state->memory_modifications[addr] = false;
+			if (!debug_state->disassembly_replaced) {
+				arrput(debug_state->disassembly_changes.rewritten, *disasm);
+			}
+		}
+
+		if (trace && log_enabled(LOG_INFO, LOG_TRACE_CPU)) {
+			sds state = instruction_state2str(emulator, disasm->instruction);
+			sds registers = registers2str(emulator);
+			char text[INST_TEXT_SIZE];
+			log_info(LOG_TRACE_CPU, "[0x%03hX] %04hX => %s\t%s\n    %s", addr,
+				 disasm->instruction.raw, inst2text(disasm->instruction, text),
+				 state, registers);
+			sdsfree(state);
+			sdsfree(registers);
+		}
+	}
+
+	prev_inst_addr = addr;
+	emulator->pc = addr + 2;
+
+	return instruction;
+}
+
+static inline __attribute__((always_inline)) void
+draw_sprite(EmulatorState *emulator, Chip8Instruction instruction, bool profiling) {
+	if (emulator->configuration & CONFIG_CHIP8_DISP_WAIT && !emulator->display_interrupted) {
+		emulator->display_interrupted = true;
+		emulator->pc -= 2;
+		emulator->cycle_count--;
+		return;
+	}
+	bool flag = false;
+	int origin_x = emulator->registers[instruction.rformat.rx] % TARGET_WIDTH;
+	int origin_y = emulator->registers[instruction.rformat.ry] % TARGET_HEIGHT;
+	int max_row = instruction.rformat.imm;
+	int max_col = 8;
+
+	if (emulator->configuration & CONFIG_CHIP8_CLIPPING) {
+		max_row = origin_y + max_row > TARGET_HEIGHT ? TARGET_HEIGHT - origin_y : max_row;
+		max_col = origin_x + max_col > TARGET_WIDTH ? TARGET_WIDTH - origin_x : max_col;
+	}
+
+	for (int row = 0; row < max_row; ++row) {
+		uint8_t byte = memory_at(emulator, emulator->vi + row);
+		// Without clipping, sprites wrap around the edges instead
+		int y = (origin_y + row) & (TARGET_HEIGHT - 1);
+		for (uint8_t col = 0; col < max_col && byte; ++col) {
+			int x = (origin_x + col) & (TARGET_WIDTH - 1);
+			uint8_t state = byte & 0x80;
+			flag |= pixel(emulator, x, y) > 0 && state;
+			pixel(emulator, x, y) ^= state ? PIXEL_COLOUR : 0;
+			byte <<= 1;
+		}
+	}
+	if (profiling) {
+		count_accesses(emulator->debug_state.sprite_reads, emulator->vi, max_row);
+	}
+
+	emulator->registers[0xF] = flag;
+	emulator->display_interrupted = false;
+}
+
+static inline __attribute__((always_inline)) void
+load_registers(EmulatorState *emulator, Chip8Instruction instruction, bool profiling) {
+	DebugState *debug_state = &emulator->debug_state;
+	for (int i = 0; i <= instruction.iformat.reg; ++i) {
+		uint16_t addr = (emulator->vi + i) & EMULATOR_ADDR_MASK;
+		emulator->registers[i] = emulator->memory[addr];
+		if (!debug_state->skip_breakpoints && debug_state->memory_breakpoints[addr]) {
+			debug_state->debug_mode = true;
+			debug_state->memory_breakpoint_hit = true;
+		}
+	}
+	if (profiling) {
+		count_accesses(debug_state->memory_reads, emulator->vi,
+			       instruction.iformat.reg + 1);
+	}
+	if (emulator->configuration & CONFIG_CHIP8_MEMORY) {
+		emulator->vi = instruction.iformat.reg + 1;
+	}
+}
+
+// Executes a pair found by fused_pair(), returning how many instructions ran
+static inline __attribute__((always_inline)) int
+execute_fused(EmulatorState *emulator, FusedPair pair, Chip8Instruction first,
+	      Chip8Instruction second, bool profiling) {
+	uint8_t *registers = emulator->registers;
+
+	switch (pair) {
+	case FUSED_SKIP_JMP: {
+		bool skip;
+		switch (first.aformat.opcode) {
+		case OP_SE_VX_BYTE:
+			skip = registers[first.iformat.reg] == first.iformat.imm;
+			break;
+		case OP_SNE_VX_BYTE:
+			skip = registers[first.iformat.reg] != first.iformat.imm;
+			break;
+		case OP_SE_VX_VY:
+			skip = registers[first.rformat.rx] == registers[first.rformat.ry];
+			break;
+		default:
+			skip = registers[first.rformat.rx] != registers[first.rformat.ry];
+			break;
+		}
+
+		emulator->cycle_count++;
+		if (skip) {
+			emulator->pc += 2;
+			return 1;
+		}
+		emulator->cycle_count++;
+		emulator->pc = second.aformat.addr;
+		return 2;
+	}
+	case FUSED_LD_I_DRW:
+		emulator->cycle_count += 2;
+		emulator->vi = first.aformat.addr;
+		emulator->pc += 2;
+		draw_sprite(emulator, second, profiling);
+		return 2;
+	case FUSED_ADD_I_LD_VX_I:
+		emulator->cycle_count += 2;
+		emulator->vi = (emulator->vi + registers[first.iformat.reg]) & EMULATOR_ADDR_MASK;
+		emulator->pc += 2;
+		load_registers(emulator, second, profiling);
+		return 2;
+	case FUSED_LD_DT_SKIP: {
+		uint8_t value = registers[first.iformat.reg] = emulator->dt;
+		bool equal = value == second.iformat.imm;
+		emulator->cycle_count += 2;
+		emulator->pc += equal == (second.iformat.opcode == OP_SE_VX_BYTE) ? 4 : 2;
+		return 2;
+	}
+	default:
+		return 0;
+	}
+}
+
+// Inlined into run_cycles() once per value of `profiling`, like the helpers it calls, so access
+// counting is only in the copy that runs while profiling
+static inline __attribute__((always_inline)) bool
+execute_instruction(EmulatorState *emulator, Chip8Instruction instruction, bool profiling) {
+	DebugState *debug_state = &emulator->debug_state;
+	emulator->cycle_count++;
+
+	switch (instruction_type(instruction)) {
+	case CHIP8_CLS:
+		memset(emulator->display, 0, sizeof(emulator->display));
+		break;
+	case CHIP8_RET:
+		emulator->sp = (emulator->sp - 1) & EMULATOR_STACK_MASK;
+		emulator->pc = emulator->stack[emulator->sp];
+		break;
+	case CHIP8_SYS_ADDR:
+		// Ignore
+		log_debug(LOG_CPU, "SYS attempt: 0x%04hx", instruction.raw);
+		break;
+	case CHIP8_JMP_ADDR:
+		emulator->pc = instruction.aformat.addr;
+		break;
+	case CHIP8_CALL_ADDR:
+		emulator->stack[emulator->sp] = emulator->pc;
+		emulator->sp = (emulator->sp + 1) & EMULATOR_STACK_MASK;
+		emulator->pc = instruction.aformat.addr;
+		break;
+	case CHIP8_SE_VX_BYTE:
+		if (emulator->registers[instruction.iformat.reg] == instruction.iformat.imm) {
+			emulator->pc += 2;
+		}
+		break;
+	case CHIP8_SNE_VX_BYTE:
+		if (emulator->registers[instruction.iformat.reg] != instruction.iformat.imm) {
+			emulator->pc += 2;
+		}
+		break;
+	case CHIP8_SE_VX_VY:
+		if (emulator->registers[instruction.rformat.rx] ==
+		    emulator->registers[instruction.rformat.ry]) {
+			emulator->pc += 2;
+		}
+		break;
+	case CHIP8_LD_VX_BYTE:
+		emulator->registers[instruction.iformat.reg] = instruction.iformat.imm;
+		break;
+	case CHIP8_ADD_VX_BYTE:
+		emulator->registers[instruction.iformat.reg] += instruction.iformat.imm;
+		break;
+	case CHIP8_LD_VX_VY:
+		emulator->registers[instruction.rformat.rx] =
+			emulator->registers[instruction.rformat.ry];
+		break;
+	case CHIP8_OR_VX_VY:
+		emulator->registers[instruction.rformat.rx] |=
+			emulator->registers[instruction.rformat.ry];
+		if (emulator->configuration & CONFIG_CHIP8_VF_RESET) {
+			emulator->registers[0xF] = 0;
+		}
+		break;
+	case CHIP8_AND_VX_VY:
+		emulator->registers[instruction.rformat.rx] &=
+			emulator->registers[instruction.rformat.ry];
+		if (emulator->configuration & CONFIG_CHIP8_VF_RESET) {
+			emulator->registers[0xF] = 0;
+		}
+		break;
+	case CHIP8_XOR_VX_VY:
+		emulator->registers[instruction.rformat.rx] ^=
+			emulator->registers[instruction.rformat.ry];
+		if (emulator->configuration & CONFIG_CHIP8_VF_RESET) {
+			emulator->registers[0xF] = 0;
+		}
+		break;
+	case CHIP8_ADD_VX_VY: {
+		uint16_t result = emulator->registers[instruction.rformat.rx] +
+				  emulator->registers[instruction.rformat.ry];
+		emulator->registers[instruction.rformat.rx] = (uint8_t)result;
+		emulator->registers[0xF] = (0x100 & result) > 0;
+		break;
+	}
+	case CHIP8_SUB_VX_VY: {
+		bool flag = emulator->registers[instruction.rformat.rx] >=
+			    emulator->registers[instruction.rformat.ry];
+		emulator->registers[instruction.rformat.rx] -=
+			emulator->registers[instruction.rformat.ry];
+		emulator->registers[0xF] = flag;
+		break;
+	}
+	case CHIP8_SHR_VX: {
+		if (emulator->configuration & CONFIG_CHIP8_SHIFTING) {
+			emulator->registers[instruction.rformat.rx] =
+				emulator->registers[instruction.rformat.ry];
+		}
+		bool flag = emulator->registers[instruction.rformat.rx] & 1;
+		emulator->registers[instruction.rformat.rx] >>= 1;
+		emulator->registers[0xF] = flag;
+		break;
+	}
+	case CHIP8_SUBN_VX_VY: {
+		bool flag = emulator->registers[instruction.rformat.ry] >=
+			    emulator->registers[instruction.rformat.rx];
+		emulator->registers[instruction.rformat.rx] =
+			emulator->registers[instruction.rformat.ry] -
+			emulator->registers[instruction.rformat.rx];
+		emulator->registers[0xF] = flag;
+		break;
+	}
+	case CHIP8_SHL_VX: {
+		if (emulator->configuration & CONFIG_CHIP8_SHIFTING) {
+			emulator->registers[instruction.rformat.rx] =
+				emulator->registers[instruction.rformat.ry];
+		}
+		bool flag = (emulator->registers[instruction.rformat.rx] & 0x80) > 0;
+		emulator->registers[instruction.rformat.rx] <<= 1;
+		emulator->registers[0xF] = flag;
+		break;
+	}
+	case CHIP8_SNE_VX_VY:
+		if (emulator->registers[instruction.rformat.rx] !=
+		    emulator->registers[instruction.rformat.ry]) {
+			emulator->pc += 2;
+		}
+		break;
+	case CHIP8_LD_I_ADDR:
+		emulator->vi = instruction.aformat.addr;
+		break;
+	case CHIP8_JMP_V0_ADDR: {
+		if (emulator->configuration & CONFIG_CHIP8_JUMPING) {
+			emulator->pc = instruction.aformat.addr + emulator->registers[0];
+		} else {
+			emulator->pc = instruction.aformat.addr +
+				       emulator->registers[instruction.iformat.reg];
+		}
+		emulator->pc &= EMULATOR_ADDR_MASK;
+
+		// New targets are disassembled in the background between frames
+		uint16_t addr = emulator->pc;
+		Disassembly *disassembly = &debug_state->disassembly;
+		if (addr >= PROG_BASE && !debug_state->jump_targets_seen[addr] &&
+		    disassembly->addressbook[addr - PROG_BASE].type != ADDR_INSTRUCTION) {
+			debug_state->jump_targets_seen[addr] = true;
+			arrput(debug_state->pending_jump_targets, addr - PROG_BASE);
+		}
+		break;
+	}
+	case CHIP8_RND_VX_BYTE:
+		emulator->registers[instruction.iformat.reg] = (rand() % 256) &
+							       instruction.iformat.imm;
+		break;
+	case CHIP8_DRW_VX_VY_NIBBLE:
+		draw_sprite(emulator, instruction, profiling);
+		break;
+	case CHIP8_SKP_VX:
+		if (emulator->keyboard[emulator->registers[instruction.iformat.reg] & 0xF]) {
+			emulator->pc += 2;
+		}
+		break;
+	case CHIP8_SKNP_VX:
+		if (emulator->keyboard[emulator->registers[instruction.iformat.reg] & 0xF] == 0) {
+			emulator->pc += 2;
+		}
+		break;
+	case CHIP8_LD_VX_DT:
+		emulator->registers[instruction.iformat.reg] = emulator->dt;
+		break;
+	case CHIP8_LD_VX_K: {
+		static int8_t key = -1;
+		static bool is_held = false;
+
+		bool is_pressed = false;
+		for (int i = 0; i < sizeof(emulator->keyboard); ++i) {
+			if (emulator->keyboard[i]) {
+				is_pressed = true;
+				key = i;
+				break;
+			}
+		}
+
+		if (is_pressed) {
+			is_held = true;
+		} else if (is_held) {
+			emulator->registers[instruction.iformat.reg] = key;
+			is_held = false;
+			break;
+		}
+
+		emulator->pc -= 2;
+		break;
+	}
+	case CHIP8_LD_DT_VX:
+		emulator->dt = emulator->registers[instruction.iformat.reg];
+		break;
+	case CHIP8_LD_ST_VX:
+		emulator->st = emulator->registers[instruction.iformat.reg];
+		break;
+	case CHIP8_ADD_I_VX:
+		emulator->vi = (emulator->vi + emulator->registers[instruction.iformat.reg]) &
+			       EMULATOR_ADDR_MASK;
+		break;
+	case CHIP8_LD_F_VX:
+		emulator->vi = FONT_BASE_ADDR +
+			       (emulator->registers[instruction.iformat.reg] & 0xF) * 5;
+		break;
+	case CHIP8_LD_B_VX: {
+		uint8_t digit = emulator->registers[instruction.iformat.reg];
+		memory_at(emulator, emulator->vi + 2) = digit % 10;
+		digit /= 10;
+		memory_at(emulator, emulator->vi + 1) = digit % 10;
+		digit /= 10;
+		memory_at(emulator, emulator->vi) = digit % 10;
+		if (profiling) {
+			count_accesses(debug_state->memory_writes, emulator->vi, 3);
+		}
+		break;
+	}
+	case CHIP8_LD_I_VX:
+		debug_state->written_to_memory = true;
+		for (int i = 0; i <= instruction.iformat.reg; ++i) {
+			uint16_t addr = (emulator->vi + i) & EMULATOR_ADDR_MASK;
+			emulator->memory[addr] = emulator->registers[i];
+			debug_state->memory_modifications[addr] = true;
+			if (!debug_state->skip_breakpoints &&
+			    debug_state->memory_breakpoints[addr]) {
+				debug_state->debug_mode = true;
+				debug_state->memory_breakpoint_hit = true;
+			}
+		}
+		if (profiling) {
+			count_accesses(debug_state->memory_writes, emulator->vi,
+				       instruction.iformat.reg + 1);
+		}
+		if (emulator->configuration & CONFIG_CHIP8_MEMORY) {
+			emulator->vi = instruction.iformat.reg + 1;
+		}
+		break;
+	case CHIP8_LD_VX_I:
+		load_registers(emulator, instruction, profiling);
+		break;
+	case CHIP8_UNKNOWN:
+		// TODO: Handle CHIP-48 instructions
+		log_error(LOG_CPU, "Unknown instruction received: 0x%04hx @ 0x%03hx",
+			  instruction.raw, emulator->pc);
+		return false;
+	}
+
+	return true;
+}
+
+// For stepping and other callers outside run_frame(), where the check doesn't matter
+bool execute(EmulatorState *emulator, Chip8Instruction instruction) {
+	return execute_instruction(emulator, instruction, emulator->debug_state.profiling);
+}
+
+void handle_timers(EmulatorState *emulator) {
+	if (emulator->dt > 0) {
+		emulator->dt--;
+	}
+	emulator->sound_active = emulator->st > 0;
+	if (emulator->st > 0) {
+		emulator->st--;
+	}
+}
+
+static void restart(EmulatorState *);
+
+void load_rom(EmulatorState *emulator, uint8_t *rom, size_t rom_size, char *rom_path) {
+	log_info(LOG_CORE, "Loading ROM @ %s", rom_path);
+	analysis_cache_save(emulator);
+	if (emulator->rom) {
+		free(emulator->rom);
+	}
+	if (emulator->rom_path) {
+		free(emulator->rom_path);
+	}
+
+	if (rom_path) {
+		size_t path_len = strlen(rom_path);
+		emulator->rom_path = malloc(path_len);
+		memcpy(emulator->rom_path, rom_path, path_len);
+	} else {
+		emulator->rom_path = NULL;
+	}
+
+	if (rom_size > EMULATOR_MAX_ROM_SIZE) {
+		fprintf(stderr, "[!] ROM is too large (%zu bytes), truncating to %d bytes\n",
+			rom_size, EMULATOR_MAX_ROM_SIZE);
+		rom_size = EMULATOR_MAX_ROM_SIZE;
+	}
+
+	emulator->rom = rom;
+	emulator->rom_size = rom_size;
+
+	restart(emulator);
+}
+
+sds instruction_state2str(EmulatorState *emulator, Chip8Instruction instruction) {
+	switch (instruction_format(instruction_type(instruction))) {
+	case R_FORMAT:
+		return sdscatprintf(sdsempty(), "# V%hX = %02hhx, V%hX = %02hhx",
+				    instruction.rformat.rx,
+				    emulator->registers[instruction.rformat.rx],
+				    instruction.rformat.ry,
+				    emulator->registers[instruction.rformat.ry]);
+	case I_FORMAT:
+		return sdscatprintf(sdsempty(), "# V%hX = %02hhx", instruction.iformat.reg,
+				    emulator->registers[instruction.iformat.reg]);
+	case A_FORMAT:
+	case UNKNOWN_FORMAT:
+		break;
+	}
+	return sdsempty();
+}
+
+void print_instruction_state(EmulatorState *emulator, Chip8Instruction instruction) {
+	sds state = instruction_state2str(emulator, instruction);
+	printf("%s", state);
+	sdsfree(state);
+}
+
+// One-line summary of the registers, for traces
+sds registers2str(EmulatorState *emulator) {
+	sds out = sdsnew("V =");
+	for (int i = 0; i < sizeof(emulator->registers); ++i) {
+		out = sdscatprintf(out, " %02hhx", emulator->registers[i]);
+	}
+	return sdscatprintf(out, "  I = %03hx  SP = %hhx  DT = %02hhx  ST = %02hhx", emulator->vi,
+			    emulator->sp, emulator->dt, emulator->st);
+}
+
+void dump_registers(EmulatorState *emulator) {
+	fprintf(stderr, "===== REGISTERS DUMP ====\n");
+	for (int i = 0; i < sizeof(emulator->registers); ++i) {
+		fprintf(stderr, "V%X = 0x%02hx  ", i, emulator->registers[i]);
+		if ((i + 1) % 4 == 0) {
+			fprintf(stderr, "\n");
+		}
+	}
+	fprintf(stderr, "SP = 0x%02hx  ", emulator->sp);
+	fprintf(stderr, "DT = 0x%02hx  ", emulator->dt);
+	fprintf(stderr, "ST = 0x%02hx\n", emulator->st);
+	fprintf(stderr, "VI = 0x%04hx\n", emulator->vi);
+	fprintf(stderr, "PC = 0x%04hx\n", emulator->pc);
+}
+
+void dump_stack(EmulatorState *emulator) {
+	fprintf(stderr, "\n===== STACK DUMP ====\n");
+	for (int i = 0; i < EMULATOR_STACK_SIZE; ++i) {
+		fprintf(stderr, "[%02hhd] = 0x%03hx  ", i, emulator->stack[i]);
+		if (i == emulator->sp) {
+			printf("<-- SP  ");
+		}
+
+		if ((i + 1) % 2 == 0) {
+			printf("\n");
+		}
+	}
+}
+
+static inline void dump_memory(EmulatorState *emulator) {
+	fprintf(stderr, "\n===== MEMORY DUMP ====\n");
+	if (!emulator->debug_state.latest_memory_dump) {
+		refresh_dump(emulator);
+	}
+	printf("%s\n", emulator->debug_state.latest_memory_dump);
+}
+
+void refresh_dump(EmulatorState *emulator) {
+	DebugState *debug_state = &emulator->debug_state;
+	if (debug_state->written_to_memory || !debug_state->latest_memory_dump) {
+		if (debug_state->latest_memory_dump) {
+			sdsfree(debug_state->latest_memory_dump);
+		}
+		debug_state->latest_memory_dump =
+			hexdump(emulator->memory, EMULATOR_MEMORY_SIZE, 0);
+		debug_state->written_to_memory = false;
+	}
+}
+
+void dump_state(EmulatorState *emulator) {
+	dump_registers(emulator);
+	dump_stack(emulator);
+	// dump_memory(emulator);
+}
+
+void reset_state(EmulatorState *emulator) {
+	analysis_cache_save(emulator);
+	restart(emulator);
+}
+
+// Starts the loaded ROM over, with what's already known about it from the analysis cache
+static void restart(EmulatorState *emulator) {
+	free_disassembly(&emulator->debug_state.disassembly);
+	free_disassembly_update(&emulator->debug_state.disassembly_changes);
+	arrfree(emulator->debug_state.pending_jump_targets);
+	sdsfree(emulator->debug_state.latest_memory_dump);
+
+	char *rom_path = emulator->rom_path;
+	uint8_t *rom = emulator->rom;
+	size_t rom_size = emulator->rom_size;
+	size_t config = emulator->configuration;
+	size_t cycles_per_frame = emulator->cycles_per_frame;
+	DisassemblyWorker *worker = emulator->debug_state.worker;
+	uint32_t generation = emulator->debug_state.disassembly_generation;
+	TraceRecorder *trace = emulator->trace;
+	char *analysis_cache = emulator->analysis_cache;
+	bool profiling = emulator->debug_state.profiling;
+
+	memset(emulator, 0, sizeof(*emulator));
+
+	// Counts start over with the ROM, but profiling stays on
+	emulator->debug_state.profiling = profiling;
+
+	// Cycle counts start over, and the trace carries on from there
+	emulator->trace = trace;
+	if (trace) {
+		trace->last_cycle = 0;
+	}
+
+	// Anything still in flight on the worker belongs to the old ROM
+	emulator->debug_state.worker = worker;
+	emulator->debug_state.disassembly_generation = generation + 1;
+
+	emulator->analysis_cache = analysis_cache;
+	emulator->rom_path = rom_path;
+	emulator->rom = rom;
+	emulator->rom_size = rom_size;
+	emulator->configuration = config;
+	emulator->cycles_per_frame = cycles_per_frame;
+	emulator->pc = PROG_BASE;
+
+	const uint8_t emulator_fonts[80] = {
+		// https://tobiasvl.github.io/blog/write-a-chip-8-emulator/#fx29-font-character
+		0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+		0x20, 0x60, 0x20, 0x20, 0x70, // 1
+		0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+		0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+		0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+		0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+		0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+		0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+		0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+		0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+		0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+		0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+		0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+		0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+		0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+		0xF0, 0x80, 0xF0, 0x80, 0x80, // F
+	};
+
+	memcpy(emulator->memory + FONT_BASE_ADDR, emulator_fonts, sizeof(emulator_fonts));
+
+	memcpy(emulator->memory + PROG_BASE, emulator->rom, emulator->rom_size);
+
+	// The memory dump is only made once it's asked for, by refresh_dump()
+	emulator->debug_state.written_to_memory = false;
+	if (!analysis_cache_load(emulator)) {
+		emulator->debug_state.disassembly =
+			disassemble_rd(emulator->memory + PROG_BASE,
+				       EMULATOR_MEMORY_SIZE - PROG_BASE, emulator->rom_size,
+				       PROG_BASE, 0);
+		analysis_cache_save(emulator);
+	}
+	emulator->debug_state.disassembly_replaced = true;
+}
+
+void free_emulator(EmulatorState *emulator) {
+	analysis_cache_save(emulator);
+	if (emulator->debug_state.worker) {
+		disassembly_worker_free(emulator->debug_state.worker);
+		emulator->debug_state.worker = NULL;
+	}
+	free_disassembly(&emulator->debug_state.disassembly);
+	free_disassembly_update(&emulator->debug_state.disassembly_changes);
+	arrfree(emulator->debug_state.pending_jump_targets);
+	sdsfree(emulator->debug_state.latest_memory_dump);
+	if (emulator->rom) {
+		free(emulator->rom);
+	}
+}
@@ -0,0 +1,195 @@
+#ifndef CORE_H
+#define CORE_H
+
+#include "call_graph.h"
+#include "common.h"
+#include "disassembler.h"
+#include "disassembly_worker.h"
+#include "instructions.h"
+#include "sds.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define EMULATOR_MEMORY_SIZE 4096
+#define EMULATOR_STACK_SIZE 16
+
+// Addresses are 12 bits wide and wrap around like on the original hardware.
+// Masking every guest address keeps accesses in bounds without branching.
+#define EMULATOR_ADDR_MASK (EMULATOR_MEMORY_SIZE - 1)
+#define EMULATOR_STACK_MASK (EMULATOR_STACK_SIZE - 1)
+#define EMULATOR_MAX_ROM_SIZE (EMULATOR_MEMORY_SIZE - PROG_BASE)
+
+#define CONFIG_CHIP8_VF_RESET 0b1
+#define CONFIG_CHIP8_MEMORY 0b10
+#define CONFIG_CHIP8_DISP_WAIT 0b100
+#define CONFIG_CHIP8_CLIPPING 0b1000
+#define CONFIG_CHIP8_SHIFTING 0b10000
+#define CONFIG_CHIP8_JUMPING 0b100000
+
+#define CONFIG_CHIP8 \
+	(CONFIG_CHIP8_VF_RESET | CONFIG_CHIP8_MEMORY | CONFIG_CHIP8_DISP_WAIT | \
+	 CONFIG_CHIP8_CLIPPING | CONFIG_CHIP8_SHIFTING | CONFIG_CHIP8_JUMPING)
+
+#define PIXEL_COLOUR 0xFF97F1CD
+#define pixel(emulator, x, y) (emulator)->display[(y) * TARGET_WIDTH + (x)]
+#define memory_at(emulator, addr) (emulator)->memory[(addr) & EMULATOR_ADDR_MASK]
+// The opcode at `addr` in `memory`, whose second byte wraps to 0x000 at 0xFFF
+#define opcode_at(memory, addr) \
+	((Chip8Instruction){ .raw = (uint16_t)((memory)[(addr) & EMULATOR_ADDR_MASK] << 8 | \
+					       (memory)[((addr) + 1) & EMULATOR_ADDR_MASK]) })
+#define FONT_BASE_ADDR 0x050
+
+#define TARGET_WIDTH 64
+#define TARGET_HEIGHT 32
+
+typedef enum CyclesPerFrameType {
+	CPF_7 = 0,
+	CPF_10,
+	CPF_15,
+	CPF_20,
+	CPF_30,
+	CPF_100,
+	CPF_200,
+	CPF_500,
+	CPF_1000,
+} CyclesPerFrameType;
+#define DEFAULT_CYCLES_PER_FRAME CPF_100
+#define CYCLES_PER_FRAME_COUNT (CPF_1000 + 1)
+
+// TODO: Tidy up breakpoint handling - event based?
+typedef struct DebugState {
+	Disassembly disassembly;
+	sds latest_memory_dump;
+	bool memory_modifications[EMULATOR_MEMORY_SIZE];
+	bool instruction_breakpoints[EMULATOR_MEMORY_SIZE];
+	bool memory_breakpoints[EMULATOR_MEMORY_SIZE];
+
+	// Computed jump targets, waiting to be disassembled in the background
+	bool jump_targets_seen[EMULATOR_MEMORY_SIZE];
+	uint16_t *pending_jump_targets; // stb_ds array
+	DisassemblyWorker *worker; // Started on first use
+
+	// Instructions executed at each address, only counted while profiling
+	uint64_t execution_counts[EMULATOR_MEMORY_SIZE];
+	bool profiling;
+
+	// Per-byte accesses, also only counted while profiling. Reads are by
+	// LD Vx, [I] and sprite reads by DRW; writes are by LD [I], Vx and LD B, Vx.
+	uint64_t memory_reads[EMULATOR_MEMORY_SIZE];
+	uint64_t sprite_reads[EMULATOR_MEMORY_SIZE];
+	uint64_t memory_writes[EMULATOR_MEMORY_SIZE];
+
+	// Shadow call stack, also only tracked while profiling
+	CallGraph call_graph;
+
+	// From the analysis cache (see analysis_cache.h): whether the ROM's in it,
+	// how many of jump_targets_seen it had, and how hot each instruction was
+	// the last time the ROM was profiled, out of 255
+	bool analysis_cached;
+	size_t cached_jump_targets;
+	uint8_t cached_heat[EMULATOR_MEMORY_SIZE];
+
+	bool debug_mode;
+	bool written_to_memory;
+	// Changes to the disassembly since it was last mirrored, taken by whoever mirrors it.
+	// Once it's replaced outright, none are kept until a mirror copies it whole again.
+	bool disassembly_replaced;
+	DisassemblyUpdate disassembly_changes;
+	uint32_t disassembly_generation; // Bumped when it's replaced, to spot stale worker results
+	bool skip_breakpoints;
+	bool inst_breakpoint_hit;
+	bool memory_breakpoint_hit;
+
+	// Step over/out runs at full speed to a temporary breakpoint on the return
+	// address, which only stops once the stack is back down to `step_depth`
+	bool stepping;
+	uint16_t step_address;
+	uint8_t step_depth;
+	bool step_breakpoint; // Whether there's also a user breakpoint there
+} DebugState;
+
+typedef struct EmulatorState {
+	// ROM to be loaded into RAM and executed
+	char *rom_path;
+	uint8_t *rom;
+	size_t rom_size;
+
+	// 0x000 - 0x1FF = Interpreter memory, not for programs
+	// Programs start at 0x200 (512)
+	// Some start at 0x600 (1536) (ETI 660 computer)
+	uint8_t memory[EMULATOR_MEMORY_SIZE];
+
+	// Stores return addresses
+	// Allows for 16 levels of nested subroutines
+	uint16_t stack[EMULATOR_STACK_SIZE];
+
+	// 0-F general purpose registers
+	uint8_t registers[16];
+
+	// Stack pointer
+	uint8_t sp;
+
+	// For memory addresses, lower 12bits used
+	uint16_t vi;
+
+	// Program counter
+	uint16_t pc;
+
+	// Delay timer
+	uint8_t dt;
+
+	// Sound timer
+	uint8_t st;
+
+	// Display pixels
+	uint32_t display[TARGET_WIDTH * TARGET_HEIGHT];
+	bool display_interrupted;
+
+	// Keyboard state, 1 = Pressed
+	uint8_t keyboard[16];
+
+	// CHIP-8 vs SUPER-CHIP/CHIP-48 differences
+	uint8_t configuration;
+
+	CyclesPerFrameType cycles_per_frame;
+	uint64_t cycle_count;
+	uint64_t frame_start; // cycle_count when the timers last ticked
+
+	// Sound timer was running on the last timer tick
+	bool sound_active;
+
+	// Execution trace being recorded, if any (see trace.h). Owned by the caller.
+	struct TraceRecorder *trace;
+
+	// Directory of the analysis cache (see analysis_cache.h), NULL to not use
+	// one. Owned by the caller.
+	char *analysis_cache;
+
+	DebugState debug_state;
+} EmulatorState;
+
+extern const int CYCLES_PER_FRAME[CYCLES_PER_FRAME_COUNT];
+extern const char *CYCLES_PER_FRAME_STR[CYCLES_PER_FRAME_COUNT];
+
+void dump_registers(EmulatorState *);
+void dump_stack(EmulatorState *);
+void dump_state(EmulatorState *);
+void cancel_step(EmulatorState *);
+bool execute(EmulatorState *, Chip8Instruction);
+Chip8Instruction fetch_next(EmulatorState *, bool);
+void free_emulator(EmulatorState *);
+void handle_timers(EmulatorState *);
+void load_rom(EmulatorState *, uint8_t *, size_t, char *);
+sds instruction_state2str(EmulatorState *, Chip8Instruction);
+void print_instruction_state(EmulatorState *, Chip8Instruction);
+sds registers2str(EmulatorState *);
+void refresh_dump(EmulatorState *);
+void reset_state(EmulatorState *);
+bool run_frame(EmulatorState *);
+bool step_out(EmulatorState *);
+bool step_instruction(EmulatorState *, bool);
+bool step_over(EmulatorState *);
+void update_disassembly(EmulatorState *);
+
+#endif // !CORE_H
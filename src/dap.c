@@ -0,0 +1,479 @@
+#include "dap.h"
+#include "assembler.h"
+#include "common.h"
+#include "core.h"
+#include "emulation_thread.h"
+#include "json.h"
+#include "log.h"
+#include "sds.h"
+#include "stb_ds.h"
+
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DAP_THREAD_ID 1
+#define DAP_REGISTERS_REFERENCE 1
+#define DAP_STACK_REFERENCE 2
+
+typedef struct DapSession {
+	int input_fd;
+	int output_fd;
+	uint8_t input[4096];
+	size_t input_start;
+	size_t input_length;
+	int seq;
+
+	EmulationThread *emulation; // NULL until launched
+	bool stop_on_entry;
+	bool running; // Waiting to report the next stop
+	const char *stop_reason;
+
+	// Set when launched from assembly source
+	sds source_path;
+	uint32_t address_lines[EMULATOR_MEMORY_SIZE]; // 0 if not an instruction
+	SourceLine *lines; // stb_ds array, in address and line order
+
+	uint16_t *source_breakpoints; // stb_ds arrays of the addresses set
+	uint16_t *instruction_breakpoints;
+} DapSession;
+
+static bool read_input(DapSession *session, uint8_t *out, size_t length) {
+	while (length) {
+		if (session->input_start == session->input_length) {
+			ssize_t read_length = read(session->input_fd, session->input,
+						   sizeof(session->input));
+			if (read_length <= 0) {
+				return false;
+			}
+			session->input_start = 0;
+			session->input_length = read_length;
+		}
+		size_t available = session->input_length - session->input_start;
+		size_t used = available < length ? available : length;
+		memcpy(out, session->input + session->input_start, used);
+		session->input_start += used;
+		out += used;
+		length -= used;
+	}
+	return true;
+}
+
+// Reads the next Content-Length framed message. NULL once the input ends.
+static JsonValue *read_message(DapSession *session) {
+	for (;;) {
+		size_t content_length = 0;
+		char header[256];
+		size_t length = 0;
+		for (;;) {
+			uint8_t c;
+			if (!read_input(session, &c, 1)) {
+				return NULL;
+			}
+			if (c != '\n') {
+				if (c != '\r' && length + 1 < sizeof(header)) {
+					header[length++] = c;
+				}
+				continue;
+			}
+			if (!length) {
+				break; // Blank line ends the headers
+			}
+			header[length] = '\0';
+			if (strncmp(header, "Content-Length:", 15) == 0) {
+				content_length = strtoul(header + 15, NULL, 10);
+			}
+			length = 0;
+		}
+
+		char *content = malloc(content_length + 1);
+		if (!read_input(session, (uint8_t *)content, content_length)) {
+			free(content);
+			return NULL;
+		}
+		JsonValue *message = json_parse(content, content_length);
+		free(content);
+		if (message) {
+			return message;
+		}
+		fprintf(stderr, "[!] Ignoring a DAP message that isn't valid JSON\n");
+	}
+}
+
+static void send_message(DapSession *session, sds body) {
+	sds message = sdscatprintf(sdsempty(), "Content-Length: %zu\r\n\r\n%s", sdslen(body), body);
+	const char *data = message;
+	size_t length = sdslen(message);
+	while (length) {
+		ssize_t written = write(session->output_fd, data, length);
+		if (written <= 0) {
+			break;
+		}
+		data += written;
+		length -= written;
+	}
+	sdsfree(message);
+}
+
+// `body` is the JSON for the response body, or NULL for none
+static void send_response(DapSession *session, JsonValue *request, bool success,
+			  const char *message, const char *body) {
+	sds out = sdscatprintf(sdsempty(),
+			       "{\"seq\":%d,\"type\":\"response\",\"request_seq\":%d,"
+			       "\"success\":%s,\"command\":",
+			       ++session->seq, (int)json_get_number(request, "seq", 0),
+			       success ? "true" : "false");
+	out = json_cat_string(out, json_get_string(request, "command", ""));
+	if (message) {
+		out = json_cat_string(sdscat(out, ",\"message\":"), message);
+	}
+	if (body) {
+		out = sdscat(sdscat(out, ",\"body\":"), body);
+	}
+	out = sdscat(out, "}");
+	send_message(session, out);
+	sdsfree(out);
+}
+
+static void send_event(DapSession *session, const char *event, const char *body) {
+	sds out = sdscatprintf(sdsempty(), "{\"seq\":%d,\"type\":\"event\",\"event\":\"%s\"",
+			       ++session->seq, event);
+	if (body) {
+		out = sdscat(sdscat(out, ",\"body\":"), body);
+	}
+	out = sdscat(out, "}");
+	send_message(session, out);
+	sdsfree(out);
+}
+
+static void send_command(DapSession *session, EmulatorCommand command) {
+	while (!command_ring_push(&session->emulation->commands, command)) {
+		struct timespec wait = { 0, NANOSECONDS_PER_SECOND / 1000 };
+		nanosleep(&wait, NULL);
+	}
+}
+
+static void send_stopped(DapSession *session, const char *reason) {
+	sds body = sdscatprintf(sdsempty(),
+				"{\"reason\":\"%s\",\"threadId\":%d,\"allThreadsStopped\":true}",
+				reason, DAP_THREAD_ID);
+	send_event(session, "stopped", body);
+	sdsfree(body);
+}
+
+// Starts the emulator paused on `program`, a ROM or assembly source
+static bool launch(DapSession *session, const char *program) {
+	uint8_t *rom;
+	size_t rom_size;
+	size_t length = strlen(program);
+	if (length > 4 && strcmp(program + length - 4, ".asm") == 0) {
+		rom = assemble_with_lines((char *)program, &session->lines);
+		if (!rom) {
+			return false;
+		}
+		// The emulator owns ROMs from malloc(), not stb_ds arrays
+		rom_size = arrlen(rom);
+		uint8_t *copy = malloc(rom_size ? rom_size : 1);
+		memcpy(copy, rom, rom_size);
+		arrfree(rom);
+		rom = copy;
+
+		session->source_path = sdsnew(program);
+		for (size_t i = 0; i < (size_t)arrlen(session->lines); ++i) {
+			SourceLine *line = &session->lines[i];
+			session->address_lines[line->address & EMULATOR_ADDR_MASK] = line->line;
+		}
+	} else {
+		FILE *file = fopen(program, "rb");
+		if (!file) {
+			return false;
+		}
+		fclose(file);
+		rom = read_rom((char *)program, &rom_size);
+	}
+
+	session->emulation = calloc(1, sizeof(EmulationThread));
+	emulation_thread_start(session->emulation, rom, rom_size, (char *)program, true);
+	return true;
+}
+
+// Appends a DAP Source object for `addr`'s source line, if there is one
+static sds cat_location(DapSession *session, sds out, uint16_t addr) {
+	uint32_t line = session->address_lines[addr & EMULATOR_ADDR_MASK];
+	if (!line) {
+		return sdscat(out, "\"line\":0,\"column\":0");
+	}
+	out = sdscat(out, "\"source\":{\"path\":");
+	out = json_cat_string(out, session->source_path);
+	return sdscatprintf(out, "},\"line\":%u,\"column\":1", line);
+}
+
+// Current instruction, then each CALL still waiting for its subroutine to return
+static sds stack_trace(DapSession *session, EmulatorState *emulator) {
+	sds out = sdscat(sdsempty(), "{\"stackFrames\":[");
+	for (int depth = 0; depth <= emulator->sp; ++depth) {
+		uint16_t addr = depth ? emulator->stack[emulator->sp - depth] - 2 : emulator->pc;
+		addr &= EMULATOR_ADDR_MASK;
+		out = sdscatprintf(out,
+				   "%s{\"id\":%d,\"name\":\"0x%03x\","
+				   "\"instructionPointerReference\":\"0x%03x\",",
+				   depth ? "," : "", depth, addr, addr);
+		out = cat_location(session, out, addr);
+		out = sdscat(out, "}");
+	}
+	return sdscatprintf(out, "],\"totalFrames\":%d}", emulator->sp + 1);
+}
+
+static sds cat_variable(sds out, bool first, const char *name, const char *format,
+			unsigned value) {
+	char text[16];
+	snprintf(text, sizeof(text), format, value);
+	return sdscatprintf(out, "%s{\"name\":\"%s\",\"value\":\"%s\",\"variablesReference\":0}",
+			    first ? "" : ",", name, text);
+}
+
+static sds variables(EmulatorState *emulator, int reference) {
+	sds out = sdsnew("{\"variables\":[");
+	if (reference == DAP_REGISTERS_REFERENCE) {
+		for (int i = 0; i < 16; ++i) {
+			char name[4];
+			snprintf(name, sizeof(name), "V%X", i);
+			out = cat_variable(out, i == 0, name, "0x%02x", emulator->registers[i]);
+		}
+		out = cat_variable(out, false, "I", "0x%03x", emulator->vi);
+		out = cat_variable(out, false, "PC", "0x%03x", emulator->pc);
+		out = cat_variable(out, false, "SP", "%u", emulator->sp);
+		out = cat_variable(out, false, "DT", "%u", emulator->dt);
+		out = cat_variable(out, false, "ST", "%u", emulator->st);
+	} else if (reference == DAP_STACK_REFERENCE) {
+		for (int i = 0; i < emulator->sp; ++i) {
+			char name[16];
+			snprintf(name, sizeof(name), "[%d]", i);
+			out = cat_variable(out, i == 0, name, "0x%03x", emulator->stack[i]);
+		}
+	}
+	return sdscat(out, "]}");
+}
+
+// Replaces the addresses in `set` with the breakpoints in `requested`
+static void replace_breakpoints(DapSession *session, uint16_t **set, uint16_t *requested) {
+	for (size_t i = 0; i < (size_t)arrlen(*set); ++i) {
+		send_command(session, (EmulatorCommand){ .type = CMD_SET_INSTRUCTION_BREAKPOINT,
+							 .arg = (*set)[i],
+							 .value = false });
+	}
+	arrsetlen(*set, 0);
+	for (size_t i = 0; i < (size_t)arrlen(requested); ++i) {
+		send_command(session, (EmulatorCommand){ .type = CMD_SET_INSTRUCTION_BREAKPOINT,
+							 .arg = requested[i],
+							 .value = true });
+		arrput(*set, requested[i]);
+	}
+}
+
+// Each breakpoint moves to the first instruction at or after its line
+static sds set_breakpoints(DapSession *session, JsonValue *arguments) {
+	JsonValue *breakpoints = json_get(arguments, "breakpoints");
+	const char *path = json_get_string(json_get(arguments, "source"), "path", "");
+	bool ours = session->source_path && strcmp(path, session->source_path) == 0;
+
+	uint16_t *requested = NULL;
+	sds out = sdsnew("{\"breakpoints\":[");
+	bool listed = breakpoints && breakpoints->type == JSON_ARRAY;
+	size_t count = listed ? arrlen(breakpoints->items) : 0;
+	for (size_t i = 0; i < count; ++i) {
+		uint32_t line = json_get_number(breakpoints->items[i], "line", 0);
+		SourceLine *match = NULL;
+		for (size_t j = 0; ours && j < (size_t)arrlen(session->lines) && !match; ++j) {
+			match = session->lines[j].line >= line ? &session->lines[j] : NULL;
+		}
+		if (match) {
+			arrput(requested, match->address);
+			out = sdscatprintf(out, "%s{\"verified\":true,\"line\":%u}", i ? "," : "",
+					   match->line);
+		} else {
+			out = sdscatprintf(out,
+					   "%s{\"verified\":false,\"line\":%u,"
+					   "\"message\":\"No instruction here\"}",
+					   i ? "," : "", line);
+		}
+	}
+	if (ours) {
+		replace_breakpoints(session, &session->source_breakpoints, requested);
+	}
+	arrfree(requested);
+	return sdscat(out, "]}");
+}
+
+// Breakpoints on addresses, e.g. from a disassembly view
+static sds set_instruction_breakpoints(DapSession *session, JsonValue *arguments) {
+	JsonValue *breakpoints = json_get(arguments, "breakpoints");
+	uint16_t *requested = NULL;
+	sds out = sdsnew("{\"breakpoints\":[");
+	bool listed = breakpoints && breakpoints->type == JSON_ARRAY;
+	size_t count = listed ? arrlen(breakpoints->items) : 0;
+	for (size_t i = 0; i < count; ++i) {
+		JsonValue *breakpoint = breakpoints->items[i];
+		const char *reference = json_get_string(breakpoint, "instructionReference", "");
+		unsigned long addr = strtoul(reference, NULL, 0);
+		addr += (long)json_get_number(breakpoint, "offset", 0);
+		bool valid = addr < EMULATOR_MEMORY_SIZE;
+		if (valid) {
+			arrput(requested, addr);
+		}
+		out = sdscatprintf(out, "%s{\"verified\":%s}", i ? "," : "",
+				   valid ? "true" : "false");
+	}
+	replace_breakpoints(session, &session->instruction_breakpoints, requested);
+	arrfree(requested);
+	return sdscat(out, "]}");
+}
+
+// Starts the emulator towards its next stop, reported as `reason`
+static void resume(DapSession *session, EmulatorCommandType type, const char *reason) {
+	session->stop_reason = reason;
+	session->running = true;
+	send_command(session, (EmulatorCommand){ .type = type, .value = false });
+}
+
+// Returns false once the client disconnects
+static bool handle_request(DapSession *session, JsonValue *request) {
+	const char *command = json_get_string(request, "command", "");
+	JsonValue *arguments = json_get(request, "arguments");
+
+	if (strcmp(command, "initialize") == 0) {
+		send_response(session, request, true, NULL,
+			      "{\"supportsConfigurationDoneRequest\":true,"
+			      "\"supportsInstructionBreakpoints\":true,"
+			      "\"supportsTerminateRequest\":true}");
+		return true;
+	} else if (strcmp(command, "launch") == 0) {
+		const char *program = json_get_string(arguments, "program", NULL);
+		if (session->emulation || !program || !launch(session, program)) {
+			send_response(session, request, false, "Failed to launch the program",
+				      NULL);
+			return true;
+		}
+		session->stop_on_entry = json_get_bool(arguments, "stopOnEntry", false);
+		send_response(session, request, true, NULL, NULL);
+		send_event(session, "initialized", NULL);
+		return true;
+	} else if (strcmp(command, "disconnect") == 0 || strcmp(command, "terminate") == 0) {
+		send_response(session, request, true, NULL, NULL);
+		send_event(session, "terminated", NULL);
+		return false;
+	} else if (!session->emulation) {
+		send_response(session, request, false, "Not launched", NULL);
+		return true;
+	}
+
+	EmulatorState *emulator = emulation_thread_sync(session->emulation);
+	sds body = NULL;
+	if (strcmp(command, "configurationDone") == 0) {
+		send_response(session, request, true, NULL, NULL);
+		if (session->stop_on_entry) {
+			send_stopped(session, "entry");
+		} else {
+			resume(session, CMD_SET_PAUSED, "breakpoint");
+		}
+		return true;
+	} else if (strcmp(command, "setBreakpoints") == 0) {
+		body = set_breakpoints(session, arguments);
+	} else if (strcmp(command, "setInstructionBreakpoints") == 0) {
+		body = set_instruction_breakpoints(session, arguments);
+	} else if (strcmp(command, "threads") == 0) {
+		body = sdscatprintf(sdsempty(), "{\"threads\":[{\"id\":%d,\"name\":\"CHIP-8\"}]}",
+				    DAP_THREAD_ID);
+	} else if (strcmp(command, "stackTrace") == 0) {
+		body = stack_trace(session, emulator);
+	} else if (strcmp(command, "scopes") == 0) {
+		body = sdscatprintf(sdsempty(),
+				    "{\"scopes\":[{\"name\":\"Registers\","
+				    "\"variablesReference\":%d,\"expensive\":false},"
+				    "{\"name\":\"Stack\","
+				    "\"variablesReference\":%d,\"expensive\":false}]}",
+				    DAP_REGISTERS_REFERENCE, DAP_STACK_REFERENCE);
+	} else if (strcmp(command, "variables") == 0) {
+		body = variables(emulator, json_get_number(arguments, "variablesReference", 0));
+	} else if (strcmp(command, "continue") == 0) {
+		resume(session, CMD_SET_PAUSED, "breakpoint");
+		body = sdsnew("{\"allThreadsContinued\":true}");
+	} else if (strcmp(command, "next") == 0) {
+		resume(session, CMD_STEP_OVER, "step");
+	} else if (strcmp(command, "stepIn") == 0) {
+		resume(session, CMD_STEP, "step");
+	} else if (strcmp(command, "stepOut") == 0) {
+		resume(session, CMD_STEP_OUT, "step");
+	} else if (strcmp(command, "pause") == 0) {
+		session->stop_reason = "pause";
+		send_command(session, (EmulatorCommand){ .type = CMD_SET_PAUSED, .value = true });
+	} else {
+		send_response(session, request, false, "Unsupported request", NULL);
+		return true;
+	}
+
+	send_response(session, request, true, NULL, body);
+	sdsfree(body);
+	return true;
+}
+
+// Reports the emulator stopping after a continue or step
+static void check_stopped(DapSession *session) {
+	EmulatorState *emulator = emulation_thread_sync(session->emulation);
+	DebugState *debug_state = &emulator->debug_state;
+	if (!debug_state->debug_mode) {
+		return;
+	}
+
+	session->running = false;
+	uint16_t pc = emulator->pc & EMULATOR_ADDR_MASK;
+	bool at_breakpoint = debug_state->inst_breakpoint_hit &&
+			     debug_state->instruction_breakpoints[pc];
+	send_stopped(session, at_breakpoint ? "breakpoint" : session->stop_reason);
+}
+
+bool dap_serve(void) {
+	DapSession *session = calloc(1, sizeof(DapSession));
+	session->input_fd = STDIN_FILENO;
+	// stdout carries the protocol, so anything else printed goes to stderr
+	session->output_fd = dup(STDOUT_FILENO);
+	dup2(STDERR_FILENO, STDOUT_FILENO);
+
+	bool connected = true;
+	while (connected) {
+		// Poll for stops once a frame while running, otherwise just wait
+		struct pollfd input = { .fd = session->input_fd, .events = POLLIN };
+		bool has_input = session->input_start < session->input_length ||
+				 poll(&input, 1, session->running ? 1000 / TARGET_HZ : -1) > 0;
+		if (has_input) {
+			JsonValue *message = read_message(session);
+			if (!message) {
+				break;
+			}
+			if (strcmp(json_get_string(message, "type", ""), "request") == 0) {
+				connected = handle_request(session, message);
+			}
+			json_free(message);
+		}
+		if (connected && session->running) {
+			check_stopped(session);
+		}
+	}
+
+	if (session->emulation) {
+		emulation_thread_stop(session->emulation);
+		free(session->emulation);
+	}
+	close(session->output_fd);
+	sdsfree(session->source_path);
+	arrfree(session->lines);
+	arrfree(session->source_breakpoints);
+	arrfree(session->instruction_breakpoints);
+	free(session);
+	return true;
+}
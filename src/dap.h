@@ -0,0 +1,16 @@
+#ifndef DAP_H
+#define DAP_H
+
+#include <stdbool.h>
+
+// Debug Adapter Protocol server over stdin/stdout, for debugging ROMs and
+// assembly projects from an editor. The launch request's `program` is either a
+// ROM or an .asm source file, which is assembled with a line map so
+// breakpoints and stack frames refer to source lines.
+//
+// Like the GDB stub, it drives a headless emulation thread through commands
+// and snapshots, so the ROM runs at full speed between stops.
+
+bool dap_serve(void);
+
+#endif // !DAP_H
@@ -0,0 +1,1899 @@
+#include "decompiler.h"
+#include "cfg.h"
+#include "disassembler.h"
+#include "instructions.h"
+#include "sds.h"
+
+#include "stb_ds.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define VARIABLES 17 // V0-VF, then I
+#define VAR_VF 0xF
+#define VAR_I 16
+#define ALL_VARIABLES ((1u << VARIABLES) - 1)
+#define NO_VALUE -1
+
+typedef uint32_t VarSet;
+
+static const char *variable_names[VARIABLES] = {
+	"v0", "v1", "v2", "v3", "v4", "v5", "v6", "v7", "v8",
+	"v9", "va", "vb", "vc", "vd", "ve", "vf", "i",
+};
+
+typedef enum ExprKind {
+	EXPR_CONST,
+	EXPR_READ, // Of an SSA value
+	EXPR_BINARY,
+	EXPR_RAND,
+	EXPR_DELAY,
+	EXPR_WAIT_KEY,
+	EXPR_KEY_PRESSED, // key_pressed(left)
+	EXPR_FONT, // font(left)
+	EXPR_DRAW, // draw(left, right, value)
+} ExprKind;
+
+typedef enum BinaryOp {
+	BIN_ADD,
+	BIN_SUB,
+	BIN_OR,
+	BIN_AND,
+	BIN_XOR,
+	BIN_SHR,
+	BIN_SHL,
+	BIN_EQ, // Comparisons from here on
+	BIN_NE,
+	BIN_LT,
+	BIN_LE,
+	BIN_GT,
+	BIN_GE,
+} BinaryOp;
+
+static const char *operators[] = { "+", "-", "|", "&", "^", ">>", "<<",
+				   "==", "!=", "<", "<=", ">", ">=" };
+static const int precedences[] = { 4, 4, 10, 8, 9, 5, 5, 7, 7, 6, 6, 6, 6 }; // As in C
+static const BinaryOp negations[] = {
+	[BIN_EQ] = BIN_NE, [BIN_NE] = BIN_EQ, [BIN_LT] = BIN_GE,
+	[BIN_LE] = BIN_GT, [BIN_GT] = BIN_LE, [BIN_GE] = BIN_LT,
+};
+
+typedef struct Expr {
+	ExprKind kind;
+	BinaryOp op;
+	bool wide; // Arithmetic on I's 12 bits rather than a byte
+	int32_t left;
+	int32_t right;
+	int32_t value; // The constant, the SSA value read, or the sprite's height
+} Expr;
+
+typedef enum ValueKind {
+	VALUE_ENTRY, // Whatever the variable held when the function was entered
+	VALUE_PHI,
+	VALUE_DEF,
+	VALUE_CLOBBER, // Whatever a subroutine may have left in it
+} ValueKind;
+
+typedef enum Lattice {
+	LATTICE_TOP, // Not known yet
+	LATTICE_CONST,
+	LATTICE_BOTTOM, // Not constant
+} Lattice;
+
+typedef struct Value {
+	ValueKind kind;
+	uint8_t variable;
+	int32_t statement; // Defining it, NO_VALUE for entry values and phis
+	int32_t expr; // Defining it, NO_VALUE if there's none to show
+	int32_t node; // Holding a phi
+	int32_t *operands; // Of a phi by predecessor, stb_ds array
+	int32_t *sources; // Predecessor each operand comes from, CFG_NONE when entering
+	int uses; // By statements, phis and leaving the function
+	int32_t used_by; // Statement of the last use, NO_VALUE if it was implicit
+	bool folded; // Into its one use, rather than assigned
+	Lattice lattice;
+	int constant;
+} Value;
+
+typedef struct Statement {
+	Chip8Instruction instruction;
+	int32_t node;
+	uint16_t address; // Absolute
+	int32_t first_def; // It defines values first_def to first_def + defs - 1
+	int32_t defs;
+	int32_t operand; // A skip's condition, or what's stored or jumped by, NO_VALUE if none
+	bool negated; // The skip is taken when the operand doesn't hold
+} Statement;
+
+// A use that isn't shown, like I by DRW or a register by what comes after
+typedef struct ImplicitUse {
+	int32_t value;
+	int32_t node;
+} ImplicitUse;
+
+typedef struct NodeInfo {
+	int32_t root; // Index of the function it belongs to
+	bool reachable; // Given the constants, or not known not to be
+	int32_t rpo; // Reverse postorder number within the function
+	int32_t forward_preds; // Predecessors other than through back edges
+	bool goto_target; // May be branched to from elsewhere than its immediate dominator
+	bool hoisted; // Placed after the loop it's the only exit of, rather than inside
+	bool labelled; // Some goto does
+	VarSet live_in;
+	VarSet live_out;
+	VarSet defs; // Variables it may write
+	int32_t queued; // Phi placement worklist stamp
+	int32_t *frontier; // Dominance frontier, stb_ds array
+	int32_t *merges; // Nodes placed after it, by RPO: dominator tree children with several
+			 // forward predecessors, and the exits of the loop it heads
+	int32_t first_statement;
+	int32_t statements;
+	int32_t phis[VARIABLES]; // NO_VALUE where there's none
+	int32_t entry[VARIABLES]; // Values of the variables at its start
+	int32_t exit[VARIABLES]; // and at its end
+} NodeInfo;
+
+typedef struct Root {
+	int32_t node;
+	int32_t *members; // stb_ds array of the nodes it dominates, in reverse postorder
+	VarSet modified; // Variables it, or what it calls or jumps to, may write
+	VarSet returns; // Variables live where it may return to
+	bool called;
+} Root;
+
+typedef struct Decompiler {
+	ControlFlowGraph cfg;
+	uint16_t base;
+	NodeInfo *info; // Parallel to the CFG's nodes
+	int32_t *edge_start; // Edges leaving node n are edge_start[n] to edge_start[n + 1] - 1
+	int32_t *pred_start; // Likewise for the sources of the edges entering it, but calls
+	int32_t *preds;
+	Root *roots; // stb_ds array, the ROM's entry first and the rest by address
+
+	// Of the function being decompiled
+	int32_t root;
+	Expr *exprs;
+	Value *values;
+	Statement *statements;
+	ImplicitUse *implicit_uses; // stb_ds array
+
+	DecompiledLine *lines;
+} Decompiler;
+
+// Where control goes at the end of the code being emitted
+typedef struct Context {
+	int32_t follow; // Node reached by falling off the end, CFG_NONE if it mustn't
+	int32_t loop; // Header of the innermost loop, which `continue` goes to
+	int32_t exit; // Node `break` goes to, CFG_NONE if it can't be used
+} Context;
+
+static bool is_skip(Chip8InstructionType type) {
+	switch (type) {
+	case CHIP8_SE_VX_BYTE:
+	case CHIP8_SNE_VX_BYTE:
+	case CHIP8_SE_VX_VY:
+	case CHIP8_SNE_VX_VY:
+	case CHIP8_SKP_VX:
+	case CHIP8_SKNP_VX:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static VarSet registers_upto(uint8_t x) {
+	return (2u << x) - 1;
+}
+
+// Variables an instruction reads and writes. Calls depend on the subroutine, so
+// they're left to the caller.
+static void instruction_variables(Chip8Instruction instruction, VarSet *uses, VarSet *defs) {
+	VarSet x = 1u << instruction.rformat.rx;
+	VarSet y = 1u << instruction.rformat.ry;
+	VarSet i = 1u << VAR_I;
+	VarSet vf = 1u << VAR_VF;
+	*uses = 0;
+	*defs = 0;
+	switch (instruction_type(instruction)) {
+	case CHIP8_SE_VX_BYTE:
+	case CHIP8_SNE_VX_BYTE:
+	case CHIP8_SKP_VX:
+	case CHIP8_SKNP_VX:
+	case CHIP8_LD_DT_VX:
+	case CHIP8_LD_ST_VX:
+		*uses = x;
+		break;
+	case CHIP8_SE_VX_VY:
+	case CHIP8_SNE_VX_VY:
+		*uses = x | y;
+		break;
+	case CHIP8_LD_VX_BYTE:
+	case CHIP8_RND_VX_BYTE:
+	case CHIP8_LD_VX_DT:
+	case CHIP8_LD_VX_K:
+		*defs = x;
+		break;
+	case CHIP8_ADD_VX_BYTE:
+		*uses = x;
+		*defs = x;
+		break;
+	case CHIP8_LD_VX_VY:
+		*uses = y;
+		*defs = x;
+		break;
+	case CHIP8_OR_VX_VY:
+	case CHIP8_AND_VX_VY:
+	case CHIP8_XOR_VX_VY:
+	case CHIP8_ADD_VX_VY:
+	case CHIP8_SUB_VX_VY:
+	case CHIP8_SUBN_VX_VY:
+		*uses = x | y;
+		*defs = x | vf;
+		break;
+	case CHIP8_SHR_VX:
+	case CHIP8_SHL_VX:
+		*uses = y; // Vy is shifted into Vx
+		*defs = x | vf;
+		break;
+	case CHIP8_LD_I_ADDR:
+		*defs = i;
+		break;
+	case CHIP8_ADD_I_VX:
+		*uses = x | i;
+		*defs = i;
+		break;
+	case CHIP8_LD_F_VX:
+		*uses = x;
+		*defs = i;
+		break;
+	case CHIP8_LD_B_VX:
+		*uses = x | i;
+		break;
+	case CHIP8_DRW_VX_VY_NIBBLE:
+		*uses = x | y | i;
+		*defs = vf;
+		break;
+	case CHIP8_LD_I_VX:
+		*uses = registers_upto(instruction.rformat.rx) | i;
+		*defs = i; // The memory quirk moves I
+		break;
+	case CHIP8_LD_VX_I:
+		*uses = i;
+		*defs = registers_upto(instruction.rformat.rx) | i;
+		break;
+	case CHIP8_JMP_V0_ADDR:
+		*uses = 1;
+		break;
+	default:
+		break;
+	}
+}
+
+// Whether the statement does more than compute its values, so others with
+// effects mustn't be moved past it
+static bool statement_has_effects(Statement *statement) {
+	switch (instruction_type(statement->instruction)) {
+	case CHIP8_CLS:
+	case CHIP8_SYS_ADDR:
+	case CHIP8_CALL_ADDR:
+	case CHIP8_RND_VX_BYTE:
+	case CHIP8_DRW_VX_VY_NIBBLE:
+	case CHIP8_LD_VX_DT:
+	case CHIP8_LD_VX_K:
+	case CHIP8_LD_DT_VX:
+	case CHIP8_LD_ST_VX:
+	case CHIP8_LD_B_VX:
+	case CHIP8_LD_I_VX:
+	case CHIP8_LD_VX_I:
+	case CHIP8_UNKNOWN:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static DisassembledInstruction *node_instructions(Decompiler *d, int32_t node) {
+	CfgNode *n = &d->cfg.nodes[node];
+	return d->cfg.disassembly->instruction_blocks[n->block].instructions + n->first;
+}
+
+static DisassembledInstruction *last_instruction(Decompiler *d, int32_t node) {
+	return &node_instructions(d, node)[d->cfg.nodes[node].length - 1];
+}
+
+// Target of the edge of `type` leaving `node`, CFG_NONE if there's none
+static int32_t successor(Decompiler *d, int32_t node, CfgEdgeType type) {
+	for (int32_t e = d->edge_start[node]; e < d->edge_start[node + 1]; ++e) {
+		if (d->cfg.edges[e].type == type) {
+			return d->cfg.edges[e].to;
+		}
+	}
+	return CFG_NONE;
+}
+
+// Variables used by leaving `node` other than to another node: by returning, or
+// by going somewhere the disassembly doesn't know
+static VarSet exit_variables(Decompiler *d, int32_t node) {
+	Chip8InstructionType type = instruction_type(last_instruction(d, node)->instruction);
+	int32_t edges = 0;
+	for (int32_t e = d->edge_start[node]; e < d->edge_start[node + 1]; ++e) {
+		edges += d->cfg.edges[e].type != CFG_CALL;
+	}
+	switch (type) {
+	case CHIP8_RET:
+		return d->roots[d->info[node].root].returns;
+	case CHIP8_UNKNOWN:
+		return ALL_VARIABLES;
+	case CHIP8_JMP_V0_ADDR:
+		return edges ? 0 : ALL_VARIABLES;
+	default:
+		return edges < (is_skip(type) ? 2 : 1) ? ALL_VARIABLES : 0;
+	}
+}
+
+static void index_edges(Decompiler *d) {
+	size_t count = arrlen(d->cfg.nodes);
+	d->edge_start = calloc(count + 1, sizeof(int32_t));
+	d->pred_start = calloc(count + 1, sizeof(int32_t));
+	d->preds = malloc((arrlen(d->cfg.edges) + 1) * sizeof(int32_t));
+	for (size_t i = 0; i < (size_t)arrlen(d->cfg.edges); ++i) {
+		CfgEdge *edge = &d->cfg.edges[i];
+		d->edge_start[edge->from + 1]++;
+		d->pred_start[edge->to + 1] += edge->type != CFG_CALL;
+	}
+	for (size_t i = 0; i < count; ++i) {
+		d->edge_start[i + 1] += d->edge_start[i];
+		d->pred_start[i + 1] += d->pred_start[i];
+	}
+	int32_t *fill = malloc((count + 1) * sizeof(int32_t));
+	memcpy(fill, d->pred_start, (count + 1) * sizeof(int32_t));
+	for (size_t i = 0; i < (size_t)arrlen(d->cfg.edges); ++i) {
+		CfgEdge *edge = &d->cfg.edges[i];
+		if (edge->type != CFG_CALL) {
+			d->preds[fill[edge->to]++] = edge->from;
+		}
+	}
+	free(fill);
+}
+
+static void add_root(Decompiler *d, int32_t node) {
+	Root root = { .node = node };
+	d->info[node].root = arrlen(d->roots);
+	arrput(d->roots, root);
+}
+
+// Functions and the nodes each dominates, in reverse postorder
+static void find_roots(Decompiler *d) {
+	size_t count = arrlen(d->cfg.nodes);
+	for (size_t n = 0; n < count; ++n) {
+		d->info[n].root = CFG_NONE;
+	}
+	if (d->cfg.entry != CFG_NONE) {
+		add_root(d, d->cfg.entry);
+	}
+	for (size_t n = 0; n < count; ++n) {
+		if (d->cfg.nodes[n].idom == CFG_NONE && (int32_t)n != d->cfg.entry) {
+			add_root(d, n);
+		}
+	}
+	for (size_t n = 0; n < count; ++n) {
+		int32_t m = n;
+		while (d->info[m].root == CFG_NONE) {
+			m = d->cfg.nodes[m].idom;
+		}
+		int32_t root = d->info[m].root;
+		for (m = n; d->info[m].root == CFG_NONE; m = d->cfg.nodes[m].idom) {
+			d->info[m].root = root;
+		}
+	}
+	for (size_t i = 0; i < (size_t)arrlen(d->cfg.edges); ++i) {
+		if (d->cfg.edges[i].type == CFG_CALL) {
+			d->roots[d->info[d->cfg.edges[i].to].root].called = true;
+		}
+	}
+
+	bool *visited = calloc(count, sizeof(bool));
+	int32_t *stack = NULL;
+	int32_t *next_edge = malloc(count * sizeof(int32_t));
+	for (size_t r = 0; r < (size_t)arrlen(d->roots); ++r) {
+		int32_t *postorder = NULL;
+		int32_t start = d->roots[r].node;
+		visited[start] = true;
+		next_edge[start] = d->edge_start[start];
+		arrput(stack, start);
+		while (arrlen(stack)) {
+			int32_t n = arrlast(stack);
+			if (next_edge[n] == d->edge_start[n + 1]) {
+				arrput(postorder, n);
+				arrsetlen(stack, arrlen(stack) - 1);
+				continue;
+			}
+			CfgEdge *edge = &d->cfg.edges[next_edge[n]++];
+			int32_t s = edge->to;
+			bool local = edge->type != CFG_CALL && d->info[s].root == (int32_t)r;
+			if (local && !visited[s]) {
+				visited[s] = true;
+				next_edge[s] = d->edge_start[s];
+				arrput(stack, s);
+			}
+		}
+		for (size_t i = arrlen(postorder); i-- > 0;) {
+			d->info[postorder[i]].rpo = arrlen(d->roots[r].members);
+			arrput(d->roots[r].members, postorder[i]);
+		}
+		arrfree(postorder);
+	}
+	arrfree(stack);
+	free(next_edge);
+	free(visited);
+}
+
+// Backwards over the whole ROM, through calls to the subroutines and out of
+// their returns to every caller
+static void compute_liveness(Decompiler *d) {
+	size_t count = arrlen(d->cfg.nodes);
+	for (size_t r = 0; r < (size_t)arrlen(d->roots); ++r) {
+		Root *root = &d->roots[r];
+		root->returns = root->called || root->node == d->cfg.entry ? 0 : ALL_VARIABLES;
+	}
+
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (size_t n = 0; n < count; ++n) {
+			int32_t callee = successor(d, n, CFG_CALL);
+			if (callee != CFG_NONE) {
+				int32_t after = successor(d, n, CFG_RETURN);
+				d->roots[d->info[callee].root].returns |=
+					after != CFG_NONE ? d->info[after].live_in : ALL_VARIABLES;
+			}
+		}
+
+		for (size_t n = count; n-- > 0;) {
+			VarSet live = exit_variables(d, n);
+			for (int32_t e = d->edge_start[n]; e < d->edge_start[n + 1]; ++e) {
+				if (d->cfg.edges[e].type != CFG_CALL) {
+					live |= d->info[d->cfg.edges[e].to].live_in;
+				}
+			}
+			d->info[n].live_out = live;
+
+			DisassembledInstruction *instructions = node_instructions(d, n);
+			for (size_t k = d->cfg.nodes[n].length; k-- > 0;) {
+				Chip8Instruction instruction = instructions[k].instruction;
+				if (instruction_type(instruction) == CHIP8_CALL_ADDR) {
+					int32_t callee = successor(d, n, CFG_CALL);
+					live |= callee != CFG_NONE ? d->info[callee].live_in :
+								     ALL_VARIABLES;
+					continue;
+				}
+				VarSet uses, defs;
+				instruction_variables(instruction, &uses, &defs);
+				live = (live & ~defs) | uses;
+			}
+			if (live != d->info[n].live_in) {
+				d->info[n].live_in = live;
+				changed = true;
+			}
+		}
+	}
+}
+
+// What each function may write, including through what it calls or jumps to
+static void compute_modified(Decompiler *d) {
+	size_t count = arrlen(d->cfg.nodes);
+	for (size_t n = 0; n < count; ++n) {
+		DisassembledInstruction *instructions = node_instructions(d, n);
+		for (size_t k = 0; k < d->cfg.nodes[n].length; ++k) {
+			VarSet uses, defs;
+			instruction_variables(instructions[k].instruction, &uses, &defs);
+			d->info[n].defs |= defs;
+		}
+		d->roots[d->info[n].root].modified |= d->info[n].defs;
+	}
+
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (size_t n = 0; n < count; ++n) {
+			Root *root = &d->roots[d->info[n].root];
+			VarSet modified = root->modified;
+			bool calls = instruction_type(last_instruction(d, n)->instruction) ==
+				     CHIP8_CALL_ADDR;
+			if (calls && successor(d, n, CFG_CALL) == CFG_NONE) {
+				modified = ALL_VARIABLES;
+			}
+			for (int32_t e = d->edge_start[n]; e < d->edge_start[n + 1]; ++e) {
+				int32_t to = d->cfg.edges[e].to;
+				if (d->info[to].root != d->info[n].root) {
+					modified |= d->roots[d->info[to].root].modified;
+				}
+			}
+			changed |= modified != root->modified;
+			root->modified = modified;
+		}
+	}
+
+	for (size_t n = 0; n < count; ++n) {
+		int32_t callee = successor(d, n, CFG_CALL);
+		Chip8Instruction last = last_instruction(d, n)->instruction;
+		if (instruction_type(last) == CHIP8_CALL_ADDR) {
+			d->info[n].defs |= callee != CFG_NONE ?
+						   d->roots[d->info[callee].root].modified :
+						   ALL_VARIABLES;
+		}
+	}
+}
+
+static int32_t new_expr(Decompiler *d, ExprKind kind, int32_t left, int32_t right, int32_t value) {
+	Expr expr = { .kind = kind, .left = left, .right = right, .value = value };
+	arrput(d->exprs, expr);
+	return arrlen(d->exprs) - 1;
+}
+
+static int32_t constant(Decompiler *d, int32_t value) {
+	return new_expr(d, EXPR_CONST, NO_VALUE, NO_VALUE, value);
+}
+
+static int32_t binary(Decompiler *d, BinaryOp op, int32_t left, int32_t right) {
+	int32_t index = new_expr(d, EXPR_BINARY, left, right, 0);
+	d->exprs[index].op = op;
+	return index;
+}
+
+static int32_t new_value(Decompiler *d, ValueKind kind, uint8_t variable, int32_t statement,
+			 int32_t expr) {
+	Value value = {
+		.kind = kind,
+		.variable = variable,
+		.statement = statement,
+		.expr = expr,
+		.used_by = NO_VALUE,
+	};
+	arrput(d->values, value);
+	return arrlen(d->values) - 1;
+}
+
+static void use_implicitly(Decompiler *d, int32_t node, int32_t value) {
+	ImplicitUse use = { value, node };
+	arrput(d->implicit_uses, use);
+}
+
+static void use_all(Decompiler *d, int32_t node, VarSet variables, int32_t *current) {
+	for (uint8_t v = 0; v < VARIABLES; ++v) {
+		if (variables & (1u << v)) {
+			use_implicitly(d, node, current[v]);
+		}
+	}
+}
+
+static int32_t read(Decompiler *d, int32_t *current, uint8_t variable) {
+	return new_expr(d, EXPR_READ, NO_VALUE, NO_VALUE, current[variable]);
+}
+
+static void define(Decompiler *d, int32_t *current, uint8_t variable, int32_t statement,
+		   int32_t expr) {
+	current[variable] = new_value(d, VALUE_DEF, variable, statement, expr);
+	d->statements[statement].defs++;
+}
+
+static void build_statement(Decompiler *d, int32_t node, DisassembledInstruction *instruction,
+			    int32_t *current) {
+	Statement statement = {
+		.instruction = instruction->instruction,
+		.node = node,
+		.address = instruction->address + d->base,
+		.first_def = arrlen(d->values),
+		.operand = NO_VALUE,
+	};
+	int32_t s = arrlen(d->statements);
+	arrput(d->statements, statement);
+
+	Chip8Instruction inst = instruction->instruction;
+	uint8_t x = inst.rformat.rx;
+	uint8_t y = inst.rformat.ry;
+	uint8_t kk = inst.iformat.imm;
+	Chip8InstructionType type = instruction_type(inst);
+	switch (type) {
+	case CHIP8_LD_VX_BYTE:
+		define(d, current, x, s, constant(d, kk));
+		break;
+	case CHIP8_ADD_VX_BYTE:
+		define(d, current, x, s, binary(d, BIN_ADD, read(d, current, x), constant(d, kk)));
+		break;
+	case CHIP8_LD_VX_VY:
+		define(d, current, x, s, read(d, current, y));
+		break;
+	case CHIP8_OR_VX_VY:
+	case CHIP8_AND_VX_VY:
+	case CHIP8_XOR_VX_VY: {
+		BinaryOp op = type == CHIP8_OR_VX_VY ? BIN_OR : type == CHIP8_AND_VX_VY ? BIN_AND :
+											  BIN_XOR;
+		int32_t a = read(d, current, x);
+		define(d, current, x, s, binary(d, op, a, read(d, current, y)));
+		define(d, current, VAR_VF, s, constant(d, 0)); // The VF reset quirk
+		break;
+	}
+	case CHIP8_ADD_VX_VY: {
+		// The carry is written as a comparison that can't overflow a byte
+		int32_t a = read(d, current, x);
+		int32_t b = read(d, current, y);
+		define(d, current, x, s, binary(d, BIN_ADD, a, b));
+		define(d, current, VAR_VF, s,
+		       binary(d, BIN_GT, a, binary(d, BIN_SUB, constant(d, 255), b)));
+		break;
+	}
+	case CHIP8_SUB_VX_VY:
+	case CHIP8_SUBN_VX_VY: {
+		int32_t a = read(d, current, x);
+		int32_t b = read(d, current, y);
+		if (type == CHIP8_SUBN_VX_VY) {
+			int32_t swap = a;
+			a = b;
+			b = swap;
+		}
+		define(d, current, x, s, binary(d, BIN_SUB, a, b));
+		define(d, current, VAR_VF, s, binary(d, BIN_GE, a, b));
+		break;
+	}
+	case CHIP8_SHR_VX:
+	case CHIP8_SHL_VX: {
+		bool left = type == CHIP8_SHL_VX;
+		int32_t b = read(d, current, y);
+		define(d, current, x, s, binary(d, left ? BIN_SHL : BIN_SHR, b, constant(d, 1)));
+		define(d, current, VAR_VF, s,
+		       left ? binary(d, BIN_SHR, b, constant(d, 7)) :
+			      binary(d, BIN_AND, b, constant(d, 1)));
+		break;
+	}
+	case CHIP8_LD_I_ADDR: {
+		int32_t addr = constant(d, inst.aformat.addr);
+		d->exprs[addr].wide = true;
+		define(d, current, VAR_I, s, addr);
+		break;
+	}
+	case CHIP8_RND_VX_BYTE: {
+		int32_t random = new_expr(d, EXPR_RAND, NO_VALUE, NO_VALUE, 0);
+		define(d, current, x, s, binary(d, BIN_AND, random, constant(d, kk)));
+		break;
+	}
+	case CHIP8_DRW_VX_VY_NIBBLE: {
+		int32_t a = read(d, current, x);
+		int32_t draw = new_expr(d, EXPR_DRAW, a, read(d, current, y), inst.rformat.imm);
+		use_implicitly(d, node, current[VAR_I]);
+		define(d, current, VAR_VF, s, draw);
+		break;
+	}
+	case CHIP8_SKP_VX:
+	case CHIP8_SKNP_VX:
+		d->statements[s].operand =
+			new_expr(d, EXPR_KEY_PRESSED, read(d, current, x), NO_VALUE, 0);
+		d->statements[s].negated = type == CHIP8_SKNP_VX;
+		break;
+	case CHIP8_SE_VX_BYTE:
+	case CHIP8_SNE_VX_BYTE:
+	case CHIP8_SE_VX_VY:
+	case CHIP8_SNE_VX_VY: {
+		bool equal = type == CHIP8_SE_VX_BYTE || type == CHIP8_SE_VX_VY;
+		bool immediate = type == CHIP8_SE_VX_BYTE || type == CHIP8_SNE_VX_BYTE;
+		int32_t a = read(d, current, x);
+		int32_t b = immediate ? constant(d, kk) : read(d, current, y);
+		d->statements[s].operand = binary(d, equal ? BIN_EQ : BIN_NE, a, b);
+		break;
+	}
+	case CHIP8_LD_VX_DT:
+		define(d, current, x, s, new_expr(d, EXPR_DELAY, NO_VALUE, NO_VALUE, 0));
+		break;
+	case CHIP8_LD_VX_K:
+		define(d, current, x, s, new_expr(d, EXPR_WAIT_KEY, NO_VALUE, NO_VALUE, 0));
+		break;
+	case CHIP8_LD_B_VX:
+		use_implicitly(d, node, current[VAR_I]);
+		// fall through
+	case CHIP8_LD_DT_VX:
+	case CHIP8_LD_ST_VX:
+		d->statements[s].operand = read(d, current, x);
+		break;
+	case CHIP8_ADD_I_VX: {
+		int32_t a = read(d, current, VAR_I);
+		int32_t sum = binary(d, BIN_ADD, a, read(d, current, x));
+		d->exprs[sum].wide = true;
+		define(d, current, VAR_I, s, sum);
+		break;
+	}
+	case CHIP8_LD_F_VX:
+		define(d, current, VAR_I, s,
+		       new_expr(d, EXPR_FONT, read(d, current, x), NO_VALUE, 0));
+		break;
+	case CHIP8_LD_I_VX:
+		use_all(d, node, registers_upto(x) | 1u << VAR_I, current);
+		define(d, current, VAR_I, s, NO_VALUE);
+		break;
+	case CHIP8_LD_VX_I:
+		use_implicitly(d, node, current[VAR_I]);
+		for (uint8_t v = 0; v <= x; ++v) {
+			define(d, current, v, s, NO_VALUE);
+		}
+		define(d, current, VAR_I, s, NO_VALUE);
+		break;
+	case CHIP8_JMP_V0_ADDR:
+		d->statements[s].operand = read(d, current, 0);
+		break;
+	case CHIP8_CALL_ADDR: {
+		// What the subroutine may leave alone stays live through the call
+		int32_t callee = successor(d, node, CFG_CALL);
+		VarSet reads = callee != CFG_NONE ? d->info[callee].live_in : ALL_VARIABLES;
+		VarSet writes = callee != CFG_NONE ? d->roots[d->info[callee].root].modified :
+						     ALL_VARIABLES;
+		use_all(d, node, reads | (writes & d->info[node].live_out), current);
+		for (uint8_t v = 0; v < VARIABLES; ++v) {
+			if (writes & (1u << v)) {
+				current[v] = new_value(d, VALUE_CLOBBER, v, s, NO_VALUE);
+				d->statements[s].defs++;
+			}
+		}
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+// Forward predecessor counts, loop merges, and the dominator tree children
+// placed after each node
+static void prepare_structure(Decompiler *d, Root *root) {
+	for (size_t i = 0; i < (size_t)arrlen(root->members); ++i) {
+		int32_t m = root->members[i];
+		NodeInfo *info = &d->info[m];
+		bool retreating = false;
+		info->forward_preds = 0;
+		for (int32_t p = d->pred_start[m]; p < d->pred_start[m + 1]; ++p) {
+			int32_t pred = d->preds[p];
+			if (d->info[pred].root != d->root || cfg_dominates(&d->cfg, m, pred)) {
+				continue;
+			}
+			info->forward_preds++;
+			retreating |= d->info[pred].rpo >= info->rpo;
+		}
+		int32_t loop = d->cfg.nodes[m].loop;
+		bool header = loop != CFG_NONE && d->cfg.loops[loop].header == m;
+		info->goto_target = info->forward_preds > 1 || header || retreating;
+
+		int32_t idom = d->cfg.nodes[m].idom;
+		if (info->forward_preds > 1 && idom != CFG_NONE) {
+			arrput(d->info[idom].merges, m);
+		}
+	}
+
+	// Where a loop is only ever left for one node, that node follows the loop
+	// and is reached by `break`, rather than nested in the loop where it's left.
+	// Innermost loops get theirs first.
+	for (size_t l = arrlen(d->cfg.loops); l-- > 0;) {
+		CfgLoop *loop = &d->cfg.loops[l];
+		if (d->info[loop->header].root != d->root) {
+			continue;
+		}
+		int32_t exit = CFG_NONE;
+		bool several = false;
+		for (size_t i = 0; i < (size_t)arrlen(loop->nodes) && !several; ++i) {
+			int32_t n = loop->nodes[i];
+			for (int32_t e = d->edge_start[n]; e < d->edge_start[n + 1]; ++e) {
+				CfgEdge *edge = &d->cfg.edges[e];
+				if (edge->type == CFG_CALL || d->info[edge->to].root != d->root ||
+				    cfg_in_loop(&d->cfg, l, edge->to)) {
+					continue;
+				}
+				several |= exit != CFG_NONE && exit != edge->to;
+				exit = edge->to;
+			}
+		}
+		if (several || exit == CFG_NONE || d->info[exit].forward_preds != 1 ||
+		    d->info[exit].hoisted) {
+			continue;
+		}
+		d->info[exit].hoisted = true;
+		d->info[exit].goto_target = true; // If it's left from an inner loop
+		int32_t **merges = &d->info[loop->header].merges;
+		size_t at = arrlen(*merges);
+		while (at && d->info[(*merges)[at - 1]].rpo > d->info[exit].rpo) {
+			--at;
+		}
+		arrins(*merges, at, exit);
+	}
+}
+
+// Pruned SSA: dominance frontiers by walking up from each predecessor of a join
+// (Cooper, Harvey and Kennedy), then phis on their iterated frontiers wherever
+// the variable is live
+static void place_phis(Decompiler *d, Root *root) {
+	size_t count = arrlen(root->members);
+	for (size_t i = 0; i < count; ++i) {
+		int32_t m = root->members[i];
+		memset(d->info[m].phis, 0xFF, sizeof(d->info[m].phis)); // All NO_VALUE
+		int32_t preds = m == root->node; // Entering the function counts as one
+		for (int32_t p = d->pred_start[m]; p < d->pred_start[m + 1]; ++p) {
+			preds += d->info[d->preds[p]].root == d->root;
+		}
+		if (preds < 2) {
+			continue;
+		}
+		int32_t idom = d->cfg.nodes[m].idom;
+		for (int32_t p = d->pred_start[m]; p < d->pred_start[m + 1]; ++p) {
+			int32_t runner = d->preds[p];
+			if (d->info[runner].root != d->root) {
+				continue;
+			}
+			while (runner != CFG_NONE && runner != idom) {
+				int32_t **frontier = &d->info[runner].frontier;
+				if (!arrlen(*frontier) || arrlast(*frontier) != m) {
+					arrput(*frontier, m);
+				}
+				runner = d->cfg.nodes[runner].idom;
+			}
+		}
+	}
+
+	int32_t *worklist = NULL;
+	for (uint8_t v = 0; v < VARIABLES; ++v) {
+		int32_t stamp = d->root * VARIABLES + v + 1;
+		for (size_t i = 0; i < count; ++i) {
+			int32_t m = root->members[i];
+			if (d->info[m].defs & (1u << v)) {
+				d->info[m].queued = stamp;
+				arrput(worklist, m);
+			}
+		}
+		while (arrlen(worklist)) {
+			int32_t n = arrpop(worklist);
+			for (size_t i = 0; i < (size_t)arrlen(d->info[n].frontier); ++i) {
+				NodeInfo *join = &d->info[d->info[n].frontier[i]];
+				if (join->phis[v] != NO_VALUE || !(join->live_in & (1u << v))) {
+					continue;
+				}
+				join->phis[v] = new_value(d, VALUE_PHI, v, NO_VALUE, NO_VALUE);
+				d->values[join->phis[v]].node = d->info[n].frontier[i];
+				if (join->queued != stamp) {
+					join->queued = stamp;
+					arrput(worklist, d->info[n].frontier[i]);
+				}
+			}
+		}
+	}
+	arrfree(worklist);
+}
+
+// Nodes are visited in reverse postorder, so a node's immediate dominator is
+// always done by then and holds what reaches it without a phi
+static void rename_variables(Decompiler *d, Root *root) {
+	int32_t entry[VARIABLES];
+	for (uint8_t v = 0; v < VARIABLES; ++v) {
+		entry[v] = new_value(d, VALUE_ENTRY, v, NO_VALUE, NO_VALUE);
+	}
+
+	for (size_t i = 0; i < (size_t)arrlen(root->members); ++i) {
+		int32_t m = root->members[i];
+		NodeInfo *info = &d->info[m];
+		int32_t *before = m == root->node ? entry : d->info[d->cfg.nodes[m].idom].exit;
+		int32_t current[VARIABLES];
+		for (uint8_t v = 0; v < VARIABLES; ++v) {
+			current[v] = info->phis[v] != NO_VALUE ? info->phis[v] : before[v];
+		}
+		memcpy(info->entry, current, sizeof(current));
+
+		info->first_statement = arrlen(d->statements);
+		DisassembledInstruction *instructions = node_instructions(d, m);
+		for (size_t k = 0; k < d->cfg.nodes[m].length; ++k) {
+			build_statement(d, m, &instructions[k], current);
+		}
+		info->statements = arrlen(d->statements) - info->first_statement;
+
+		// Leaving the function uses whatever is live where it goes
+		VarSet leaving = exit_variables(d, m);
+		for (int32_t e = d->edge_start[m]; e < d->edge_start[m + 1]; ++e) {
+			CfgEdge *edge = &d->cfg.edges[e];
+			if (edge->type != CFG_CALL && d->info[edge->to].root != d->root) {
+				leaving |= d->info[edge->to].live_in;
+			}
+		}
+		use_all(d, m, leaving, current);
+		memcpy(info->exit, current, sizeof(current));
+	}
+
+	for (size_t i = 0; i < (size_t)arrlen(root->members); ++i) {
+		int32_t m = root->members[i];
+		for (uint8_t v = 0; v < VARIABLES; ++v) {
+			int32_t phi = d->info[m].phis[v];
+			if (phi == NO_VALUE) {
+				continue;
+			}
+			if (m == root->node) {
+				arrput(d->values[phi].operands, entry[v]);
+				arrput(d->values[phi].sources, CFG_NONE);
+			}
+			for (int32_t p = d->pred_start[m]; p < d->pred_start[m + 1]; ++p) {
+				int32_t pred = d->preds[p];
+				if (d->info[pred].root == d->root) {
+					arrput(d->values[phi].operands, d->info[pred].exit[v]);
+					arrput(d->values[phi].sources, pred);
+				}
+			}
+		}
+	}
+}
+
+static Lattice evaluate(Decompiler *d, int32_t index, int *result) {
+	Expr *e = &d->exprs[index];
+	switch (e->kind) {
+	case EXPR_CONST:
+		*result = e->value;
+		return LATTICE_CONST;
+	case EXPR_READ:
+		*result = d->values[e->value].constant;
+		return d->values[e->value].lattice;
+	case EXPR_BINARY: {
+		int a, b;
+		Lattice left = evaluate(d, e->left, &a);
+		Lattice right = evaluate(d, e->right, &b);
+		if (left == LATTICE_BOTTOM || right == LATTICE_BOTTOM) {
+			return LATTICE_BOTTOM;
+		} else if (left == LATTICE_TOP || right == LATTICE_TOP) {
+			return LATTICE_TOP;
+		}
+		int mask = e->wide ? 0xFFF : 0xFF;
+		switch (e->op) {
+		case BIN_ADD:
+			*result = (a + b) & mask;
+			break;
+		case BIN_SUB:
+			*result = (a - b) & mask;
+			break;
+		case BIN_OR:
+			*result = a | b;
+			break;
+		case BIN_AND:
+			*result = a & b;
+			break;
+		case BIN_XOR:
+			*result = a ^ b;
+			break;
+		case BIN_SHR:
+			*result = a >> b;
+			break;
+		case BIN_SHL:
+			*result = (a << b) & mask;
+			break;
+		case BIN_EQ:
+			*result = a == b;
+			break;
+		case BIN_NE:
+			*result = a != b;
+			break;
+		case BIN_LT:
+			*result = a < b;
+			break;
+		case BIN_LE:
+			*result = a <= b;
+			break;
+		case BIN_GT:
+			*result = a > b;
+			break;
+		case BIN_GE:
+			*result = a >= b;
+			break;
+		}
+		return LATTICE_CONST;
+	}
+	default:
+		return LATTICE_BOTTOM;
+	}
+}
+
+// Whether an expression other than a plain register read comes out constant,
+// in which case it's shown as that constant
+static bool is_constant(Decompiler *d, int32_t index, int *result) {
+	return d->exprs[index].kind != EXPR_READ && evaluate(d, index, result) == LATTICE_CONST;
+}
+
+// Whether the skip ending the node is taken: 1 if always, 0 if never, -1 if it
+// depends, and -2 if its condition isn't known yet
+static int skip_taken(Decompiler *d, int32_t node) {
+	NodeInfo *info = &d->info[node];
+	Statement *skip = &d->statements[info->first_statement + info->statements - 1];
+	if (!is_skip(instruction_type(skip->instruction))) {
+		return -1;
+	}
+	int value;
+	switch (evaluate(d, skip->operand, &value)) {
+	case LATTICE_TOP:
+		return -2;
+	case LATTICE_CONST:
+		return (value != 0) != skip->negated;
+	default:
+		return -1;
+	}
+}
+
+static bool executable(Decompiler *d, int32_t from, int32_t to) {
+	if (from == CFG_NONE) {
+		return true; // Entering the function
+	}
+	int taken = skip_taken(d, from);
+	return d->info[from].reachable && taken != -2 &&
+	       (taken == -1 || taken == (successor(d, from, CFG_SKIP) == to));
+}
+
+// Optimistic constant propagation: phis start out unknown, and so do nodes
+// behind a skip whose condition is, so a loop that never changes a register
+// keeps it constant and code after a skip that's never taken is dropped
+// (Wegman and Zadeck's conditional constant propagation).
+static void propagate_constants(Decompiler *d, Root *root) {
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (size_t i = 0; i < (size_t)arrlen(root->members); ++i) {
+			int32_t m = root->members[i];
+			bool reachable = m == root->node;
+			for (int32_t p = d->pred_start[m]; p < d->pred_start[m + 1]; ++p) {
+				int32_t pred = d->preds[p];
+				bool local = d->info[pred].root == d->root;
+				reachable |= local && executable(d, pred, m);
+			}
+			changed |= reachable != d->info[m].reachable;
+			d->info[m].reachable = reachable;
+		}
+		for (size_t i = 0; i < (size_t)arrlen(d->values); ++i) {
+			Value *v = &d->values[i];
+			Lattice lattice = LATTICE_BOTTOM;
+			int result = 0;
+			if (v->kind == VALUE_DEF && v->expr != NO_VALUE) {
+				lattice = evaluate(d, v->expr, &result);
+			} else if (v->kind == VALUE_PHI) {
+				lattice = LATTICE_TOP;
+				for (size_t j = 0; j < (size_t)arrlen(v->operands); ++j) {
+					Value *operand = &d->values[v->operands[j]];
+					if (operand->lattice == LATTICE_TOP ||
+					    !executable(d, v->sources[j], v->node)) {
+						continue;
+					} else if (operand->lattice == LATTICE_BOTTOM ||
+						   (lattice == LATTICE_CONST &&
+						    operand->constant != result)) {
+						lattice = LATTICE_BOTTOM;
+						break;
+					}
+					lattice = LATTICE_CONST;
+					result = operand->constant;
+				}
+			}
+			if (v->lattice == LATTICE_CONST && lattice == LATTICE_CONST &&
+			    v->constant != result) {
+				lattice = LATTICE_BOTTOM;
+			}
+			bool moved = lattice == LATTICE_CONST && v->constant != result;
+			if (lattice != v->lattice || moved) {
+				v->lattice = lattice;
+				v->constant = result;
+				changed = true;
+			}
+		}
+	}
+}
+
+static void mark_used(Decompiler *d, int32_t value, int32_t statement, int32_t **worklist) {
+	Value *v = &d->values[value];
+	if (statement != NO_VALUE && v->uses && v->used_by == statement) {
+		return; // Counted once per statement, however many times it's read
+	}
+	if (!v->uses++) {
+		arrput(*worklist, value);
+	}
+	v->used_by = statement;
+}
+
+static void count_reads(Decompiler *d, int32_t index, int32_t statement, int32_t **worklist) {
+	Expr *e = &d->exprs[index];
+	int value;
+	if (e->kind == EXPR_READ) {
+		mark_used(d, e->value, statement, worklist);
+	} else if (!is_constant(d, index, &value)) {
+		if (e->left != NO_VALUE) {
+			count_reads(d, e->left, statement, worklist);
+		}
+		if (e->right != NO_VALUE) {
+			count_reads(d, e->right, statement, worklist);
+		}
+	}
+}
+
+// Counts the uses that will be shown or are implied, starting from what's
+// always kept. Reads within an expression shown as a constant don't count, so
+// neither does what only they used.
+static void count_uses(Decompiler *d) {
+	for (size_t i = 0; i < (size_t)arrlen(d->values); ++i) {
+		d->values[i].uses = 0;
+		d->values[i].used_by = NO_VALUE;
+	}
+	int32_t *worklist = NULL;
+	for (size_t i = 0; i < (size_t)arrlen(d->implicit_uses); ++i) {
+		if (d->info[d->implicit_uses[i].node].reachable) {
+			mark_used(d, d->implicit_uses[i].value, NO_VALUE, &worklist);
+		}
+	}
+	for (size_t s = 0; s < (size_t)arrlen(d->statements); ++s) {
+		Statement *statement = &d->statements[s];
+		if (!d->info[statement->node].reachable) {
+			continue;
+		}
+		if (statement->operand != NO_VALUE) {
+			count_reads(d, statement->operand, s, &worklist);
+		}
+		if (instruction_type(statement->instruction) == CHIP8_DRW_VX_VY_NIBBLE) {
+			count_reads(d, d->values[statement->first_def].expr, s, &worklist);
+		}
+	}
+	while (arrlen(worklist)) {
+		Value *v = &d->values[arrpop(worklist)];
+		if (v->kind == VALUE_DEF && v->expr != NO_VALUE) {
+			count_reads(d, v->expr, v->statement, &worklist);
+		} else if (v->kind == VALUE_PHI) {
+			for (size_t i = 0; i < (size_t)arrlen(v->operands); ++i) {
+				if (executable(d, v->sources[i], v->node)) {
+					mark_used(d, v->operands[i], NO_VALUE, &worklist);
+				}
+			}
+		}
+	}
+	arrfree(worklist);
+}
+
+static bool tree_has_effects(Decompiler *d, int32_t index) {
+	Expr *e = &d->exprs[index];
+	switch (e->kind) {
+	case EXPR_RAND:
+	case EXPR_DELAY:
+	case EXPR_WAIT_KEY:
+	case EXPR_KEY_PRESSED:
+	case EXPR_DRAW:
+		return true;
+	case EXPR_BINARY:
+		return tree_has_effects(d, e->left) || tree_has_effects(d, e->right);
+	case EXPR_FONT:
+		return tree_has_effects(d, e->left);
+	default:
+		return false;
+	}
+}
+
+// Whether every register the expression reads still holds the same value
+static bool leaves_hold(Decompiler *d, int32_t index, int32_t *current) {
+	Expr *e = &d->exprs[index];
+	switch (e->kind) {
+	case EXPR_READ:
+		return current[d->values[e->value].variable] == e->value;
+	case EXPR_BINARY:
+	case EXPR_DRAW:
+		return leaves_hold(d, e->left, current) && leaves_hold(d, e->right, current);
+	case EXPR_KEY_PRESSED:
+	case EXPR_FONT:
+		return leaves_hold(d, e->left, current);
+	default:
+		return true;
+	}
+}
+
+static int live_defs(Decompiler *d, Statement *statement) {
+	int count = 0;
+	for (int32_t i = statement->first_def; i < statement->first_def + statement->defs; ++i) {
+		count += d->values[i].uses > 0;
+	}
+	return count;
+}
+
+// A draw reads I too, which no leaf shows
+static bool writes_i(Decompiler *d, int32_t statement) {
+	Statement *s = &d->statements[statement];
+	for (int32_t i = s->first_def; i < s->first_def + s->defs; ++i) {
+		if (d->values[i].variable == VAR_I) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool can_fold(Decompiler *d, int32_t value, int32_t user, int32_t first,
+		     int32_t *current) {
+	Value *v = &d->values[value];
+	if (v->kind != VALUE_DEF || v->expr == NO_VALUE || v->uses != 1 || v->used_by != user ||
+	    v->statement < first) {
+		return false;
+	}
+
+	// The rest of its statement has to go with it, or it'd be computed twice
+	Statement *def = &d->statements[v->statement];
+	for (int32_t i = def->first_def; i < def->first_def + def->defs; ++i) {
+		if (i != value && d->values[i].uses) {
+			return false;
+		}
+	}
+	int constant;
+	if (!is_constant(d, v->expr, &constant) && !leaves_hold(d, v->expr, current)) {
+		return false;
+	}
+
+	// Effects stay in order, and with a statement that's still shown
+	if (tree_has_effects(d, v->expr)) {
+		for (int32_t s = v->statement + 1; s < user; ++s) {
+			if (statement_has_effects(&d->statements[s]) || writes_i(d, s)) {
+				return false;
+			}
+		}
+		Statement *use = &d->statements[user];
+		if (!statement_has_effects(use) && use->operand == NO_VALUE && !live_defs(d, use)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void collect_reads(Decompiler *d, int32_t index, int32_t **reads) {
+	Expr *e = &d->exprs[index];
+	if (e->kind == EXPR_READ) {
+		arrput(*reads, index);
+	}
+	if (e->left != NO_VALUE) {
+		collect_reads(d, e->left, reads);
+	}
+	if (e->right != NO_VALUE) {
+		collect_reads(d, e->right, reads);
+	}
+}
+
+// Folds values used once into the statement using them, within one node.
+// Nothing is folded into a statement that shows both its result and its VF
+// flag, since the flag is assigned first.
+static void fold_node(Decompiler *d, int32_t node) {
+	NodeInfo *info = &d->info[node];
+	int32_t current[VARIABLES];
+	memcpy(current, info->entry, sizeof(current));
+	int32_t *reads = NULL;
+	int32_t first = info->first_statement;
+	for (int32_t u = first; u < first + info->statements; ++u) {
+		Statement *use = &d->statements[u];
+		if (live_defs(d, use) <= 1) {
+			arrsetlen(reads, 0);
+			for (int32_t i = use->first_def; i < use->first_def + use->defs; ++i) {
+				if (d->values[i].expr != NO_VALUE) {
+					collect_reads(d, d->values[i].expr, &reads);
+				}
+			}
+			if (use->operand != NO_VALUE) {
+				collect_reads(d, use->operand, &reads);
+			}
+
+			for (size_t r = 0; r < (size_t)arrlen(reads); ++r) {
+				Expr *e = &d->exprs[reads[r]];
+				bool foldable = e->kind == EXPR_READ &&
+						can_fold(d, e->value, u, first, current);
+				if (!foldable) {
+					continue;
+				}
+				int32_t value = e->value;
+				Expr folded = d->exprs[d->values[value].expr];
+				int result;
+				if (is_constant(d, d->values[value].expr, &result)) {
+					folded = (Expr){ .kind = EXPR_CONST, .wide = folded.wide,
+							 .left = NO_VALUE, .right = NO_VALUE,
+							 .value = result };
+				}
+				d->values[value].folded = true;
+				for (size_t j = r; j < (size_t)arrlen(reads); ++j) {
+					Expr *other = &d->exprs[reads[j]];
+					if (other->kind == EXPR_READ && other->value == value) {
+						*other = folded;
+					}
+				}
+			}
+		}
+		for (int32_t i = use->first_def; i < use->first_def + use->defs; ++i) {
+			current[d->values[i].variable] = i;
+		}
+	}
+	arrfree(reads);
+}
+
+static void emit(Decompiler *d, uint16_t address, int depth, sds text) {
+	DecompiledLine line = { address, depth, text };
+	arrput(d->lines, line);
+}
+
+static sds cat_constant(sds out, int value, bool wide, bool hex) {
+	if (wide) {
+		return sdscatprintf(out, "0x%03x", value);
+	}
+	return sdscatprintf(out, hex ? "0x%02x" : "%d", value);
+}
+
+static sds cat_expr(Decompiler *d, sds out, int32_t index, bool hex);
+
+static sds cat_operand(Decompiler *d, sds out, int32_t index, BinaryOp parent, bool right) {
+	Expr *e = &d->exprs[index];
+	int value;
+	bool bitwise = parent >= BIN_OR && parent <= BIN_SHL;
+	bool hex = parent >= BIN_OR && parent <= BIN_XOR;
+	bool parens = e->kind == EXPR_BINARY && !is_constant(d, index, &value) &&
+		      (precedences[e->op] > precedences[parent] ||
+		       (precedences[e->op] == precedences[parent] && right) ||
+		       (bitwise && e->op != parent));
+	if (!parens) {
+		return cat_expr(d, out, index, hex);
+	}
+	out = cat_expr(d, sdscat(out, "("), index, hex);
+	return sdscat(out, ")");
+}
+
+// Adding 0x80 or more to a byte reads better as a subtraction
+static bool is_subtraction(Decompiler *d, Expr *e, int *amount) {
+	int value;
+	if (e->kind != EXPR_BINARY || e->op != BIN_ADD || e->wide ||
+	    !is_constant(d, e->right, &value) || value < 0x80) {
+		return false;
+	}
+	*amount = 0x100 - value;
+	return true;
+}
+
+static sds cat_expr(Decompiler *d, sds out, int32_t index, bool hex) {
+	Expr *e = &d->exprs[index];
+	int value;
+	if (is_constant(d, index, &value)) {
+		return cat_constant(out, value, e->wide, hex);
+	}
+	switch (e->kind) {
+	case EXPR_READ:
+		return sdscat(out, variable_names[d->values[e->value].variable]);
+	case EXPR_BINARY:
+		if (is_subtraction(d, e, &value)) {
+			out = cat_operand(d, out, e->left, BIN_SUB, false);
+			return sdscatprintf(out, " - %d", value);
+		}
+		out = cat_operand(d, out, e->left, e->op, false);
+		out = sdscatprintf(out, " %s ", operators[e->op]);
+		return cat_operand(d, out, e->right, e->op, true);
+	case EXPR_RAND:
+		return sdscat(out, "rand()");
+	case EXPR_DELAY:
+		return sdscat(out, "delay");
+	case EXPR_WAIT_KEY:
+		return sdscat(out, "wait_key()");
+	case EXPR_KEY_PRESSED:
+		out = cat_expr(d, sdscat(out, "key_pressed("), e->left, false);
+		return sdscat(out, ")");
+	case EXPR_FONT:
+		out = cat_expr(d, sdscat(out, "font("), e->left, false);
+		return sdscat(out, ")");
+	case EXPR_DRAW:
+		out = cat_expr(d, sdscat(out, "draw("), e->left, false);
+		out = cat_expr(d, sdscat(out, ", "), e->right, false);
+		return sdscatprintf(out, ", %d)", e->value);
+	default:
+		return out;
+	}
+}
+
+// Whether the expression is always 0 or 1, so comparing it to either is a test
+static bool is_boolean(Decompiler *d, int32_t index) {
+	Expr *e = &d->exprs[index];
+	int value;
+	switch (e->kind) {
+	case EXPR_KEY_PRESSED:
+	case EXPR_DRAW:
+		return true;
+	case EXPR_BINARY:
+		if (e->op >= BIN_EQ) {
+			return true;
+		}
+		return is_constant(d, e->right, &value) &&
+		       ((e->op == BIN_AND && value == 1) || (e->op == BIN_SHR && value == 7));
+	default:
+		return false;
+	}
+}
+
+static sds cat_condition(Decompiler *d, sds out, int32_t index, bool negate) {
+	Expr *e = &d->exprs[index];
+	int value;
+	if (e->kind == EXPR_BINARY && (e->op == BIN_EQ || e->op == BIN_NE) &&
+	    is_constant(d, e->right, &value) && (value == 0 || value == 1) &&
+	    is_boolean(d, e->left)) {
+		bool same = (e->op == BIN_EQ) == (value == 1);
+		return cat_condition(d, out, e->left, negate != !same);
+	}
+	if (!negate) {
+		return cat_expr(d, out, index, false);
+	}
+	if (e->kind == EXPR_BINARY && e->op >= BIN_EQ && !is_constant(d, index, &value)) {
+		BinaryOp op = e->op;
+		e->op = negations[op];
+		out = cat_expr(d, out, index, false);
+		d->exprs[index].op = op;
+		return out;
+	}
+	if (e->kind == EXPR_BINARY && !is_constant(d, index, &value)) {
+		out = cat_expr(d, sdscat(out, "!("), index, false);
+		return sdscat(out, ")");
+	}
+	return cat_expr(d, sdscat(out, "!"), index, false);
+}
+
+static sds cat_function_name(Decompiler *d, sds out, int32_t root) {
+	int32_t node = d->roots[root].node;
+	uint16_t address = d->cfg.nodes[node].address + d->base;
+	if (node == d->cfg.entry) {
+		return sdscat(out, "main");
+	}
+	return sdscatprintf(out, d->roots[root].called ? "sub_0x%03x" : "code_0x%03x", address);
+}
+
+static sds cat_assignment(Decompiler *d, sds out, Value *v) {
+	const char *name = variable_names[v->variable];
+	Expr *e = &d->exprs[v->expr];
+	int value;
+	bool compound = e->kind == EXPR_BINARY && e->op <= BIN_SHL &&
+			!is_constant(d, v->expr, &value) && d->exprs[e->left].kind == EXPR_READ &&
+			d->values[d->exprs[e->left].value].variable == v->variable;
+	if (!compound) {
+		out = cat_expr(d, sdscatprintf(out, "%s = ", name), v->expr, false);
+	} else if (is_subtraction(d, e, &value)) {
+		out = sdscatprintf(out, "%s -= %d", name, value);
+	} else {
+		bool hex = e->op >= BIN_OR && e->op <= BIN_XOR;
+		out = sdscatprintf(out, "%s %s= ", name, operators[e->op]);
+		out = cat_expr(d, out, e->right, hex);
+	}
+	return sdscat(out, ";");
+}
+
+static void emit_asm(Decompiler *d, Statement *statement, int depth) {
+	char text[INST_TEXT_SIZE];
+	if (instruction_type(statement->instruction) == CHIP8_UNKNOWN) {
+		// As the raw opcode, which the compiler takes back
+		snprintf(text, sizeof(text), "0x%04hx", statement->instruction.raw);
+	} else {
+		inst2text(statement->instruction, text);
+	}
+	emit(d, statement->address, depth, sdscatprintf(sdsempty(), "asm(\"%s\");", text));
+}
+
+static void emit_statement(Decompiler *d, int32_t index, int depth) {
+	Statement *s = &d->statements[index];
+	uint16_t at = s->address;
+	uint8_t x = s->instruction.rformat.rx;
+	Chip8InstructionType type = instruction_type(s->instruction);
+	switch (type) {
+	case CHIP8_CLS:
+		emit(d, at, depth, sdsnew("cls();"));
+		return;
+	case CHIP8_SYS_ADDR:
+	case CHIP8_UNKNOWN:
+		emit_asm(d, s, depth);
+		return;
+	case CHIP8_CALL_ADDR: {
+		int32_t callee = successor(d, s->node, CFG_CALL);
+		sds text = sdsempty();
+		if (callee != CFG_NONE) {
+			text = cat_function_name(d, text, d->info[callee].root);
+		} else {
+			text = sdscatprintf(text, "sub_0x%03x", s->instruction.aformat.addr);
+		}
+		emit(d, at, depth, sdscat(text, "();"));
+		return;
+	}
+	case CHIP8_LD_DT_VX:
+	case CHIP8_LD_ST_VX: {
+		sds text = sdsnew(type == CHIP8_LD_DT_VX ? "delay = " : "sound = ");
+		emit(d, at, depth, sdscat(cat_expr(d, text, s->operand, false), ";"));
+		return;
+	}
+	case CHIP8_LD_B_VX:
+		emit(d, at, depth,
+		     sdscat(cat_expr(d, sdsnew("bcd("), s->operand, false), ");"));
+		return;
+	case CHIP8_LD_I_VX:
+	case CHIP8_LD_VX_I:
+		emit(d, at, depth,
+		     sdscatprintf(sdsempty(), "%s(%s);", type == CHIP8_LD_I_VX ? "save" : "load",
+				  variable_names[x]));
+		return;
+	default:
+		break;
+	}
+
+	// VF is defined last, so going backwards assigns the flag first while
+	// the operands still hold
+	int32_t shown[2];
+	int count = 0;
+	for (int32_t i = s->first_def + s->defs; i-- > s->first_def;) {
+		Value *v = &d->values[i];
+		if (!v->folded && v->uses && v->expr != NO_VALUE && count < 2) {
+			shown[count++] = i;
+		}
+	}
+	if (count == 2 && s->instruction.rformat.ry == VAR_VF) {
+		emit_asm(d, s, depth); // The flag would overwrite an operand
+		return;
+	}
+	for (int i = 0; i < count; ++i) {
+		emit(d, at, depth, cat_assignment(d, sdsempty(), &d->values[shown[i]]));
+	}
+
+	// Unused results of calls with effects
+	Value *v = &d->values[s->first_def];
+	bool effect = type == CHIP8_DRW_VX_VY_NIBBLE || type == CHIP8_LD_VX_K;
+	if (!count && effect && !v->folded) {
+		emit(d, at, depth, sdscat(cat_expr(d, sdsempty(), v->expr, false), ";"));
+	}
+}
+
+static void do_tree(Decompiler *d, int32_t node, Context context, int depth);
+
+static void branch(Decompiler *d, int32_t from, int32_t to, uint16_t address, Context context,
+		   int depth) {
+	uint16_t at = last_instruction(d, from)->address + d->base;
+	if (to == CFG_NONE) {
+		emit(d, at, depth, sdscatprintf(sdsempty(), "jump(0x%03x);", address));
+		return;
+	}
+
+	NodeInfo *target = &d->info[to];
+	uint16_t target_address = d->cfg.nodes[to].address + d->base;
+	if (target->root != d->root) {
+		// A jump to a subroutine from another one returns for it
+		Root *root = &d->roots[target->root];
+		if (root->node == to && root->called && d->roots[d->root].called) {
+			sds call = cat_function_name(d, sdsempty(), target->root);
+			emit(d, at, depth, sdscat(call, "();"));
+			emit(d, at, depth, sdsnew("return;"));
+		} else {
+			sds jump = sdscatprintf(sdsempty(), "jump(0x%03x);", target_address);
+			emit(d, at, depth, jump);
+		}
+	} else if (to == context.follow) {
+		return;
+	} else if (to == context.exit) {
+		emit(d, at, depth, sdsnew("break;"));
+	} else if (to == context.loop) {
+		emit(d, at, depth, sdsnew("continue;"));
+	} else if (d->cfg.nodes[to].idom == from && target->forward_preds == 1 &&
+		   !target->hoisted) {
+		do_tree(d, to, context, depth);
+	} else {
+		target->labelled = true;
+		emit(d, at, depth, sdscatprintf(sdsempty(), "goto label_0x%03x;", target_address));
+	}
+}
+
+static void append_lines(Decompiler *d, DecompiledLine *lines, int dedent) {
+	for (size_t i = 0; i < (size_t)arrlen(lines); ++i) {
+		DecompiledLine line = lines[i];
+		line.depth -= line.depth >= 0 ? dedent : 0; // Labels are marked with -1
+		arrput(d->lines, line);
+	}
+	arrfree(lines);
+}
+
+static bool ends_in_transfer(DecompiledLine *lines, int depth) {
+	if (!arrlen(lines) || arrlast(lines).depth != depth) {
+		return false;
+	}
+	static const char *transfers[] = { "return;", "break;", "continue;", "goto ", "jump(" };
+	for (size_t i = 0; i < sizeof(transfers) / sizeof(transfers[0]); ++i) {
+		if (!strncmp(arrlast(lines).text, transfers[i], strlen(transfers[i]))) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static sds if_line(Decompiler *d, Statement *skip, bool negate) {
+	sds text = cat_condition(d, sdsnew("if ("), skip->operand, skip->negated != negate);
+	return sdscat(text, ") {");
+}
+
+// A skip is an if/else between the instruction after it and the one it skips
+// to. The arm that ends by leaving comes first, so the other needs no else.
+static void emit_skip(Decompiler *d, int32_t node, Context context, int depth) {
+	NodeInfo *info = &d->info[node];
+	Statement *skip = &d->statements[info->first_statement + info->statements - 1];
+	uint16_t at = skip->address;
+	int always = skip_taken(d, node);
+	if (always >= 0 && info->reachable) {
+		CfgEdgeType type = always ? CFG_SKIP : CFG_FALLTHROUGH;
+		branch(d, node, successor(d, node, type), at + (always ? 4 : 2), context, depth);
+		return;
+	}
+
+	DecompiledLine *outer = d->lines;
+	d->lines = NULL;
+	branch(d, node, successor(d, node, CFG_SKIP), at + 4, context, depth + 1);
+	DecompiledLine *taken = d->lines;
+	d->lines = NULL;
+	branch(d, node, successor(d, node, CFG_FALLTHROUGH), at + 2, context, depth + 1);
+	DecompiledLine *not_taken = d->lines;
+	d->lines = outer;
+
+	if (!arrlen(taken) && !arrlen(not_taken)) {
+		if (tree_has_effects(d, skip->operand)) {
+			emit(d, at, depth, if_line(d, skip, false));
+			emit(d, DECOMPILED_NO_ADDRESS, depth, sdsnew("}"));
+		}
+	} else if (!arrlen(taken) || !arrlen(not_taken)) {
+		bool negate = !arrlen(taken);
+		emit(d, at, depth, if_line(d, skip, negate));
+		append_lines(d, taken, 0); // One of them is empty
+		append_lines(d, not_taken, 0);
+		emit(d, DECOMPILED_NO_ADDRESS, depth, sdsnew("}"));
+	} else if (ends_in_transfer(not_taken, depth + 1) || ends_in_transfer(taken, depth + 1)) {
+		bool negate = ends_in_transfer(not_taken, depth + 1);
+		emit(d, at, depth, if_line(d, skip, negate));
+		append_lines(d, negate ? not_taken : taken, 0);
+		emit(d, DECOMPILED_NO_ADDRESS, depth, sdsnew("}"));
+		append_lines(d, negate ? taken : not_taken, 1);
+	} else {
+		emit(d, at, depth, if_line(d, skip, false));
+		append_lines(d, taken, 0);
+		emit(d, DECOMPILED_NO_ADDRESS, depth, sdsnew("} else {"));
+		append_lines(d, not_taken, 0);
+		emit(d, DECOMPILED_NO_ADDRESS, depth, sdsnew("}"));
+	}
+}
+
+// A resolved JMP V0 is a switch on the offset, and anything else a computed jump
+static void emit_jump_table(Decompiler *d, int32_t node, Context context, int depth) {
+	NodeInfo *info = &d->info[node];
+	Statement *jump = &d->statements[info->first_statement + info->statements - 1];
+	uint16_t table = jump->instruction.aformat.addr;
+	int value;
+	if (successor(d, node, CFG_JUMP_TABLE) == CFG_NONE) {
+		sds text = sdsnew("jump(");
+		if (is_constant(d, jump->operand, &value)) {
+			text = sdscatprintf(text, "0x%03x", (table + value) & 0xFFF);
+		} else {
+			text = sdscatprintf(text, "0x%03x + ", table);
+			text = cat_operand(d, text, jump->operand, BIN_ADD, true);
+		}
+		emit(d, jump->address, depth, sdscat(text, ");"));
+		return;
+	}
+
+	sds text = cat_expr(d, sdsnew("switch ("), jump->operand, false);
+	emit(d, jump->address, depth, sdscat(text, ") {"));
+	Context cases = { .follow = CFG_NONE, .loop = context.loop, .exit = context.follow };
+	for (int32_t e = d->edge_start[node]; e < d->edge_start[node + 1]; ++e) {
+		CfgEdge *edge = &d->cfg.edges[e];
+		if (edge->type != CFG_JUMP_TABLE) {
+			continue;
+		}
+		int offset = d->cfg.nodes[edge->to].address + d->base - table;
+		emit(d, jump->address, depth, sdscatprintf(sdsempty(), "case %d:", offset));
+		branch(d, node, edge->to, 0, cases, depth + 1);
+	}
+	emit(d, DECOMPILED_NO_ADDRESS, depth, sdsnew("}"));
+}
+
+static void node_code(Decompiler *d, int32_t node, Context context, int depth) {
+	NodeInfo *info = &d->info[node];
+	int32_t last = info->first_statement + info->statements - 1;
+	Statement *statement = &d->statements[last];
+	Chip8InstructionType type = instruction_type(statement->instruction);
+	bool terminator = is_skip(type) || type == CHIP8_JMP_ADDR || type == CHIP8_RET ||
+			  type == CHIP8_JMP_V0_ADDR;
+	for (int32_t s = info->first_statement; s < last + !terminator; ++s) {
+		emit_statement(d, s, depth);
+	}
+
+	uint16_t next = statement->address + 2;
+	switch (type) {
+	case CHIP8_RET:
+		emit(d, statement->address, depth, sdsnew("return;"));
+		break;
+	case CHIP8_JMP_ADDR:
+		branch(d, node, successor(d, node, CFG_JUMP), statement->instruction.aformat.addr,
+		       context, depth);
+		break;
+	case CHIP8_JMP_V0_ADDR:
+		emit_jump_table(d, node, context, depth);
+		break;
+	case CHIP8_CALL_ADDR:
+		branch(d, node, successor(d, node, CFG_RETURN), next, context, depth);
+		break;
+	case CHIP8_UNKNOWN:
+		break;
+	default:
+		if (is_skip(type)) {
+			emit_skip(d, node, context, depth);
+		} else {
+			branch(d, node, successor(d, node, CFG_FALLTHROUGH), next, context, depth);
+		}
+		break;
+	}
+}
+
+// Code falling out of the node, or loop, into the merge nodes it dominates,
+// each into the next and the last into what follows. They're by RPO number.
+static Context into_merges(int32_t *merges, size_t count, Context context) {
+	Context inner = context;
+	inner.follow = count ? merges[0] : context.follow;
+	return inner;
+}
+
+static void merges_after(Decompiler *d, int32_t *merges, size_t count, Context context,
+			 int depth) {
+	for (size_t i = 0; i < count; ++i) {
+		Context inner = into_merges(merges + i + 1, count - i - 1, context);
+		do_tree(d, merges[i], inner, depth);
+	}
+}
+
+static void node_within(Decompiler *d, int32_t node, int32_t *merges, size_t count,
+			Context context, int depth) {
+	node_code(d, node, into_merges(merges, count, context), depth);
+	merges_after(d, merges, count, context, depth);
+}
+
+// A loop header's merges outside the loop follow the loop, while those inside
+// are placed within it
+static void loop_within(Decompiler *d, int32_t node, int32_t *outside, size_t outside_count,
+			int32_t *inside, size_t inside_count, Context context, int depth) {
+	CfgLoop *loop = &d->cfg.loops[d->cfg.nodes[node].loop];
+	sds text = sdsnew("while (1) {");
+	if (loop->trip_count >= 0) {
+		text = sdscatprintf(text, " // %d iterations", loop->trip_count);
+	} else if (loop->idle) {
+		text = sdscat(text, " // Waits on the delay timer or keys");
+	}
+	emit(d, DECOMPILED_NO_ADDRESS, depth, text);
+	Context after = into_merges(outside, outside_count, context);
+	Context body = { .follow = node, .loop = node, .exit = after.follow };
+	node_within(d, node, inside, inside_count, body, depth + 1);
+	emit(d, DECOMPILED_NO_ADDRESS, depth, sdsnew("}"));
+	merges_after(d, outside, outside_count, context, depth);
+}
+
+static void do_tree(Decompiler *d, int32_t node, Context context, int depth) {
+	NodeInfo *info = &d->info[node];
+	if (info->goto_target) {
+		uint16_t address = d->cfg.nodes[node].address + d->base;
+		emit(d, address, -1, sdscatprintf(sdsempty(), "label_0x%03x:", address));
+	}
+
+	int32_t loop = d->cfg.nodes[node].loop;
+	if (loop == CFG_NONE || d->cfg.loops[loop].header != node) {
+		node_within(d, node, info->merges, arrlen(info->merges), context, depth);
+		return;
+	}
+	int32_t *outside = NULL;
+	int32_t *inside = NULL;
+	for (size_t i = 0; i < (size_t)arrlen(info->merges); ++i) {
+		int32_t merge = info->merges[i];
+		if (cfg_in_loop(&d->cfg, loop, merge)) {
+			arrput(inside, merge);
+		} else {
+			arrput(outside, merge);
+		}
+	}
+	loop_within(d, node, outside, arrlen(outside), inside, arrlen(inside), context, depth);
+	arrfree(outside);
+	arrfree(inside);
+}
+
+static void decompile_root(Decompiler *d, int32_t index) {
+	Root *root = &d->roots[index];
+	d->root = index;
+	for (size_t i = 0; i < (size_t)arrlen(d->values); ++i) {
+		arrfree(d->values[i].operands);
+		arrfree(d->values[i].sources);
+	}
+	arrsetlen(d->exprs, 0);
+	arrsetlen(d->values, 0);
+	arrsetlen(d->statements, 0);
+	arrsetlen(d->implicit_uses, 0);
+
+	prepare_structure(d, root);
+	place_phis(d, root);
+	rename_variables(d, root);
+	propagate_constants(d, root);
+	count_uses(d);
+	for (size_t i = 0; i < (size_t)arrlen(root->members); ++i) {
+		fold_node(d, root->members[i]);
+	}
+
+	uint16_t address = d->cfg.nodes[root->node].address + d->base;
+	if (arrlen(d->lines)) {
+		emit(d, DECOMPILED_NO_ADDRESS, 0, sdsempty());
+	}
+	sds header = cat_function_name(d, sdsnew("void "), index);
+	emit(d, address, 0, sdscat(header, "() {"));
+	Context context = { CFG_NONE, CFG_NONE, CFG_NONE };
+	do_tree(d, root->node, context, 1);
+	emit(d, DECOMPILED_NO_ADDRESS, 0, sdsnew("}"));
+}
+
+// Labels no goto ended up using are dropped, and the rest go in the margin
+static void strip_labels(Decompiler *d) {
+	size_t kept = 0;
+	for (size_t i = 0; i < (size_t)arrlen(d->lines); ++i) {
+		DecompiledLine line = d->lines[i];
+		if (line.depth < 0) {
+			int32_t node = cfg_node_at(&d->cfg, line.address - d->base);
+			if (!d->info[node].labelled) {
+				sdsfree(line.text);
+				continue;
+			}
+			line.address = DECOMPILED_NO_ADDRESS;
+			line.depth = 0;
+		}
+		d->lines[kept++] = line;
+	}
+	arrsetlen(d->lines, kept);
+}
+
+Decompilation decompile(Disassembly *disassembly, uint8_t *code, size_t length) {
+	Decompiler d = {
+		.cfg = cfg_build(disassembly, code, length),
+		.base = disassembly->base,
+	};
+	size_t count = arrlen(d.cfg.nodes);
+	d.info = calloc(count + 1, sizeof(NodeInfo));
+	index_edges(&d);
+	find_roots(&d);
+	compute_liveness(&d);
+	compute_modified(&d);
+	for (size_t r = 0; r < (size_t)arrlen(d.roots); ++r) {
+		decompile_root(&d, r);
+	}
+	strip_labels(&d);
+
+	for (size_t i = 0; i < (size_t)arrlen(d.values); ++i) {
+		arrfree(d.values[i].operands);
+		arrfree(d.values[i].sources);
+	}
+	arrfree(d.exprs);
+	arrfree(d.values);
+	arrfree(d.statements);
+	arrfree(d.implicit_uses);
+	for (size_t r = 0; r < (size_t)arrlen(d.roots); ++r) {
+		arrfree(d.roots[r].members);
+	}
+	arrfree(d.roots);
+	for (size_t n = 0; n < count; ++n) {
+		arrfree(d.info[n].frontier);
+		arrfree(d.info[n].merges);
+	}
+	free(d.info);
+	free(d.edge_start);
+	free(d.pred_start);
+	free(d.preds);
+	free_cfg(&d.cfg);
+	return (Decompilation){ d.lines };
+}
+
+sds decompilation2str(Decompilation *decompilation) {
+	sds out = sdsempty();
+	for (size_t i = 0; i < (size_t)arrlen(decompilation->lines); ++i) {
+		DecompiledLine *line = &decompilation->lines[i];
+		for (int j = 0; j < line->depth; ++j) {
+			out = sdscat(out, "\t");
+		}
+		out = sdscatprintf(out, "%s\n", line->text);
+	}
+	return out;
+}
+
+void free_decompilation(Decompilation *decompilation) {
+	for (size_t i = 0; i < (size_t)arrlen(decompilation->lines); ++i) {
+		sdsfree(decompilation->lines[i].text);
+	}
+	arrfree(decompilation->lines);
+}
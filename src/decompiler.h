@@ -0,0 +1,39 @@
+#ifndef DECOMPILER_H
+#define DECOMPILER_H
+
+#include "disassembler.h"
+#include "sds.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Decompiler from the recursive descent disassembly to the C-like language
+// described in the README. Every node of the control-flow graph without a
+// dominator starts a function: the ROM's entry, CALL targets, and code shared
+// between them.
+//
+// V0-VF and I are put into pruned SSA form per function, with a CALL writing
+// whatever the subroutine may write. Constants are propagated over it, values
+// used once are folded into the expression using them, and dead ones (mostly VF
+// flags) are dropped. Loops and if/else are then recovered from the dominator
+// tree as in Ramsey's "Beyond Relooper", with a goto wherever the flow doesn't
+// nest. Registers keep their names rather than being split into variables, so
+// each line still maps back to an instruction.
+
+#define DECOMPILED_NO_ADDRESS UINT16_MAX
+
+typedef struct DecompiledLine {
+	uint16_t address; // Of the instruction it comes from, DECOMPILED_NO_ADDRESS for braces
+	int depth; // Of indentation
+	sds text;
+} DecompiledLine;
+
+typedef struct Decompilation {
+	DecompiledLine *lines; // stb_ds array
+} Decompilation;
+
+Decompilation decompile(Disassembly *disassembly, uint8_t *code, size_t length);
+sds decompilation2str(Decompilation *decompilation);
+void free_decompilation(Decompilation *decompilation);
+
+#endif // !DECOMPILER_H
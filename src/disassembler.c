@@ -1,5 +1,7 @@
 #include "disassembler.h"
 #include "instructions.h"
+#include "output.h"
+#include "value_set.h"
 
 #include "sds.h"
 #include "stb_ds.h"
@@ -12,94 +14,76 @@
 #include <stdlib.h>
 #include <string.h>
 
-void _disassemble_rd(Disassembly *disassembly, uint8_t *code, size_t length, size_t offset);
+void write_hexdump(Output *output, void *buffer, size_t length, size_t base) {
+	uint8_t *bytes = buffer;
+	output_str(output, "Offset    0 1  2 3  4 5  6 7  8 9  A B  C D  E F");
 
-sds hexdump(void *buffer, size_t length, size_t base) {
-	sds result = sdsnew("Offset    0 1  2 3  4 5  6 7  8 9  A B  C D  E F");
-
-	size_t lines = length / 16;
-	size_t whitespace_needed = 16 - (length % 16);
-	lines = whitespace_needed == 16 ? lines : lines + 1;
-
-	char ascii[17] = { 0 };
+	char ascii[16];
 	for (size_t i = 0; i < length; ++i) {
-		char byte = ((char *)buffer)[i];
-		if (isprint(byte)) {
-			ascii[i % 16] = byte;
-		} else {
-			ascii[i % 16] = '.';
-		}
+		ascii[i % 16] = isprint(bytes[i]) ? bytes[i] : '.';
 
 		if (i % 16 == 0) {
-			result = sdscatprintf(result, "\n%08zx: ", base + i);
+			output_char(output, '\n');
+			output_hex(output, base + i, 8);
+			output_str(output, ": ");
 		}
 
-		result = sdscatprintf(result, "%02hhx", byte);
+		output_hex(output, bytes[i], 2);
 
 		if ((i + 1) % 16 == 0) {
-			result = sdscatprintf(result, "  %s", ascii);
+			output_str(output, "  ");
+			output_write(output, ascii, sizeof(ascii));
 		} else if ((i + 1) % 2 == 0) {
-			result = sdscat(result, " ");
+			output_char(output, ' ');
 		}
 	}
 
+	size_t whitespace_needed = 16 - (length % 16);
 	if (whitespace_needed != 16) {
 		for (size_t i = 0; i < whitespace_needed; ++i) {
-			result = sdscat(result, "  ");
+			output_str(output, "  ");
 			if ((i + 1) % 2 == 0) {
-				result = sdscat(result, " ");
+				output_char(output, ' ');
 			}
 			ascii[15 - i] = ' ';
 		}
-		result = sdscatprintf(result, " %s\n", ascii);
+		output_char(output, ' ');
+		output_write(output, ascii, sizeof(ascii));
+		output_char(output, '\n');
 	}
-
-	return result;
 }
 
-// Recursive descent disassembler
-Disassembly disassemble_rd(uint8_t *code, size_t length, size_t base, size_t offset) {
-	Disassembly disassembly = { 0 };
-
-	disassembly.base = base;
-	disassembly.addressbook = malloc(sizeof(AddressLookup) * length);
-
-	_disassemble_rd(&disassembly, code, length, offset);
-
-	return disassembly;
+sds hexdump(void *buffer, size_t length, size_t base) {
+	Output *output = malloc(sizeof(Output));
+	output_open_string(output);
+	write_hexdump(output, buffer, length, base);
+	sds result = output_take_string(output);
+	free(output);
+	return result;
 }
 
-void disassemble_rd_update(Disassembly *disassembly, uint8_t *code, size_t length, size_t offset) {
-	// If data blocks exists, we're updating an existing disassembly.
-	// During this disassembly, bytes that were previously designated
-	// as data may now become instructions. Need to reevaluate data
-	// blocks as a result.
-	if (disassembly->data_blocks) {
-		for (size_t i = 0; i < disassembly->dblock_length; ++i) {
-			disassembly->abook_length -= disassembly->data_blocks[i].length;
-		}
-		arrfree(disassembly->data_blocks);
-		disassembly->dblock_length = 0;
-	} else {
-		// There's no data blocks to check for new instructions.
-		// For a full refresh, better to just request an entire new disassembly
-		return;
+// Queues `addr` unless it's already code or queued
+static void mark(Disassembly *disassembly, size_t **queue, uint16_t addr) {
+	AddressType type = disassembly->addressbook[addr].type;
+	if (type == ADDR_UNKNOWN || type == ADDR_DATA) {
+		disassembly->addressbook[addr].type = ADDR_MARKED;
+		arrput(*queue, addr);
 	}
-
-	_disassemble_rd(disassembly, code, length, offset);
 }
 
-void _disassemble_rd(Disassembly *disassembly, uint8_t *code, size_t length, size_t offset) {
+// Recursive descent from `offset`, through everything not yet known to be an instruction
+static void discover_instructions(Disassembly *disassembly, uint8_t *code, size_t length,
+				  size_t offset) {
 	size_t base = disassembly->base;
+	// FIFO worklist, popped by advancing `head`. Addresses are only queued when
+	// they go from unknown/data to marked, so the addressbook doubles as the
+	// visited set and each address is queued at most once.
 	size_t *queue = NULL;
+	size_t head = 0;
 	arrput(queue, offset); // Known entry point
 
-	size_t new_instructions = 0;
-
-	// First pass to discover instructions using standard recursive descent
-	while (arrlen(queue)) {
-		size_t ip = queue[0];
-		arrdel(queue, 0);
+	while (head < (size_t)arrlen(queue)) {
+		size_t ip = queue[head++];
 
 		InstructionBlock block = { 0 };
 
@@ -107,24 +91,16 @@ void _disassemble_rd(Disassembly *disassembly, uint8_t *code, size_t length, siz
 			Chip8Instruction instruction = bytes2inst(code + ip);
 			DisassembledInstruction disasm = {
 				.instruction = instruction,
-				.asm_str = inst2str(instruction),
 				.address = ip,
 			};
 
 			AddressLookup *lookup = &disassembly->addressbook[disasm.address];
-			if (lookup->type != ADDR_INSTRUCTION && lookup->type != ADDR_INST_HALF) {
-				disassembly->abook_length++;
-			}
 			lookup->block_offset = disassembly->iblock_length;
 			lookup->array_offset = block.length;
 			lookup->type = ADDR_INSTRUCTION;
-			new_instructions++;
 
 			// Account for second half of instruction
 			lookup++;
-			if (lookup->type != ADDR_INSTRUCTION && lookup->type != ADDR_INST_HALF) {
-				disassembly->abook_length++;
-			}
 			lookup->block_offset = disassembly->iblock_length;
 			lookup->array_offset = block.length++;
 			lookup->type = ADDR_INST_HALF;
@@ -139,12 +115,14 @@ void _disassemble_rd(Disassembly *disassembly, uint8_t *code, size_t length, siz
 				break;
 			case CHIP8_JMP_ADDR:
 			case CHIP8_CALL_ADDR: {
+				// Targets outside the analysed region (e.g. the interpreter
+				// area) can't be disassembled
 				uint16_t addr = instruction.aformat.addr - base;
-				AddressType type = disassembly->addressbook[addr].type;
-				if (type == ADDR_UNKNOWN || type == ADDR_DATA) {
-					disassembly->addressbook[addr].type = ADDR_MARKED;
-					arrput(queue, addr);
+				if (instruction.aformat.addr < base || addr + 1 >= length) {
+					should_break = inst_type == CHIP8_JMP_ADDR;
+					break;
 				}
+				mark(disassembly, &queue, addr);
 				if (inst_type == CHIP8_JMP_ADDR) {
 					should_break = true;
 				}
@@ -159,15 +137,14 @@ void _disassemble_rd(Disassembly *disassembly, uint8_t *code, size_t length, siz
 				// Add address that would be skipped to if condition is true.
 				// This catches JMP statements that may halt disassembly.
 				uint16_t addr = ip + 4;
-				AddressType type = disassembly->addressbook[addr].type;
-				if (type == ADDR_UNKNOWN || type == ADDR_DATA) {
-					disassembly->addressbook[addr].type = ADDR_MARKED;
-					arrput(queue, addr);
+				if (addr + 1 >= length) {
+					break;
 				}
+				mark(disassembly, &queue, addr);
 			} break;
 			case CHIP8_JMP_V0_ADDR:
-				// Unconditional jump that requires runtime info
-				// - can't disassemble unknown address
+				// Unconditional jump that depends on a register, see
+				// resolve_jump_tables()
 				should_break = true;
 				break;
 			default:
@@ -188,12 +165,163 @@ void _disassemble_rd(Disassembly *disassembly, uint8_t *code, size_t length, siz
 	}
 
 	arrfree(queue);
+}
+
+// Removes [start, end) from the data blocks, trimming or splitting those it overlaps. Blocks are
+// kept sorted by address, so the first one affected is found by binary search.
+static void carve_data(Disassembly *disassembly, size_t start, size_t end) {
+	size_t low = 0;
+	size_t high = disassembly->dblock_length;
+	while (low < high) {
+		size_t middle = (low + high) / 2;
+		DataBlock *block = &disassembly->data_blocks[middle];
+		if (block->address + block->length <= start) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+
+	size_t i = low;
+	while (i < disassembly->dblock_length && disassembly->data_blocks[i].address < end) {
+		DataBlock block = disassembly->data_blocks[i];
+		size_t block_end = block.address + block.length;
+		DataBlock before = block;
+		before.length = start > block.address ? start - block.address : 0;
+		DataBlock after = {
+			.data = block.data + (end - block.address),
+			.length = end < block_end ? block_end - end : 0,
+			.address = end,
+		};
+
+		if (before.length && after.length) {
+			disassembly->data_blocks[i] = before;
+			arrins(disassembly->data_blocks, i + 1, after);
+			disassembly->dblock_length++;
+			break;
+		} else if (before.length || after.length) {
+			disassembly->data_blocks[i++] = before.length ? before : after;
+		} else {
+			arrdel(disassembly->data_blocks, i);
+			disassembly->dblock_length--;
+		}
+	}
+}
+
+// Addresses control can enter other than by falling through from the previous instruction
+static bool *find_entry_points(Disassembly *disassembly, size_t length) {
+	size_t base = disassembly->base;
+	bool *entries = calloc(length + 4, sizeof(bool));
+	for (size_t i = 0; i < disassembly->iblock_length; ++i) {
+		InstructionBlock *block = &disassembly->instruction_blocks[i];
+		entries[block->instructions[0].address] = true;
+
+		for (size_t j = 0; j < block->length; ++j) {
+			Chip8Instruction instruction = block->instructions[j].instruction;
+			size_t addr = block->instructions[j].address;
+			Chip8InstructionType type = instruction_type(instruction);
+
+			size_t target = instruction.aformat.addr - base;
+			if ((type == CHIP8_JMP_ADDR || type == CHIP8_CALL_ADDR) &&
+			    instruction.aformat.addr >= base && target < length) {
+				entries[target] = true;
+			}
+			if (type == CHIP8_CALL_ADDR) {
+				entries[addr + 2] = true; // Reached through RET
+			}
+			if (type == CHIP8_SE_VX_BYTE || type == CHIP8_SNE_VX_BYTE ||
+			    type == CHIP8_SE_VX_VY || type == CHIP8_SNE_VX_VY ||
+			    type == CHIP8_SKP_VX || type == CHIP8_SKNP_VX) {
+				entries[addr + 4] = true;
+			}
+		}
+	}
+	for (size_t i = 0; i < (size_t)arrlen(disassembly->jump_table_targets); ++i) {
+		entries[disassembly->jump_table_targets[i]] = true;
+	}
+	return entries;
+}
+
+// Statically resolves the targets of blocks from `first_block` on that end in JMP V0, and
+// disassembles what they lead to. Each is analysed from the last point control can enter its
+// block, and since new targets can enter blocks partway through, this repeats until no new
+// targets turn up. Anything missed is still found when the jump is first taken.
+static void resolve_jump_tables(Disassembly *disassembly, uint8_t *code, size_t length,
+				size_t first_block) {
+	bool pending = false;
+	for (size_t i = first_block; i < disassembly->iblock_length && !pending; ++i) {
+		InstructionBlock *block = &disassembly->instruction_blocks[i];
+		Chip8Instruction last = block->instructions[block->length - 1].instruction;
+		pending = instruction_type(last) == CHIP8_JMP_V0_ADDR;
+	}
+	if (!pending) {
+		return;
+	}
+
+	bool *entries = NULL;
+	uint16_t *found = NULL;
+	do {
+		arrsetlen(found, 0);
+		free(entries);
+		entries = find_entry_points(disassembly, length);
+
+		for (size_t i = first_block; i < disassembly->iblock_length; ++i) {
+			InstructionBlock *block = &disassembly->instruction_blocks[i];
+			Chip8Instruction last = block->instructions[block->length - 1].instruction;
+			if (instruction_type(last) != CHIP8_JMP_V0_ADDR) {
+				continue;
+			}
 
-	// Second pass to discover data blocks based on unparsed sections
+			size_t start = block->length - 1;
+			while (start && !entries[block->instructions[start].address]) {
+				start--;
+			}
+			uint16_t *targets = resolve_jump_table(block->instructions + start,
+							       block->length - start, code,
+							       disassembly->rom_length,
+							       disassembly->base);
+			for (size_t j = 0; j < (size_t)arrlen(targets); ++j) {
+				uint16_t addr = targets[j] - disassembly->base;
+				if (targets[j] >= disassembly->base && addr + 1 < length &&
+				    !entries[addr]) {
+					entries[addr] = true;
+					arrput(found, addr);
+				}
+			}
+			arrfree(targets);
+		}
+
+		for (size_t i = 0; i < (size_t)arrlen(found); ++i) {
+			arrput(disassembly->jump_table_targets, found[i]);
+			if (disassembly->addressbook[found[i]].type != ADDR_INSTRUCTION) {
+				discover_instructions(disassembly, code, length, found[i]);
+			}
+		}
+	} while (arrlen(found));
+
+	free(entries);
+	arrfree(found);
+}
+
+// Recursive descent disassembler. Only the first `rom_length` bytes of the code are taken as
+// constant when working out jump tables.
+Disassembly disassemble_rd(uint8_t *code, size_t length, size_t rom_length, size_t base,
+			  size_t offset) {
+	Disassembly disassembly = { 0 };
+
+	disassembly.base = base;
+	disassembly.rom_length = rom_length;
+	disassembly.addressbook = calloc(length, sizeof(AddressLookup));
+	disassembly.abook_length = length;
+
+	discover_instructions(&disassembly, code, length, offset);
+	resolve_jump_tables(&disassembly, code, length, 0);
+
+	// Whatever wasn't reached is data
 	size_t data_start = -1;
 	size_t data_len = 0;
 	for (size_t ip = 0; ip < length; ++ip) {
-		AddressType type = disassembly->addressbook[ip].type;
+		AddressType type = disassembly.addressbook[ip].type;
 		assert(type != ADDR_MARKED);
 		bool processed = type == ADDR_INSTRUCTION || type == ADDR_INST_HALF;
 		if (!processed) {
@@ -201,6 +329,7 @@ void _disassemble_rd(Disassembly *disassembly, uint8_t *code, size_t length, siz
 				data_start = ip;
 			}
 			data_len++;
+			disassembly.addressbook[ip].type = ADDR_DATA;
 		}
 
 		if ((ip + 1 == length || processed) && data_len > 0) {
@@ -209,26 +338,31 @@ void _disassemble_rd(Disassembly *disassembly, uint8_t *code, size_t length, siz
 				.length = data_len,
 				.address = data_start,
 			};
-
-			for (size_t i = 0; i < data_len; ++i) {
-				AddressLookup *lookup = &disassembly->addressbook[data_start + i];
-				lookup->block_offset = disassembly->dblock_length,
-				lookup->array_offset = i;
-				lookup->type = ADDR_DATA;
-				disassembly->abook_length++;
-			}
+			arrput(disassembly.data_blocks, block);
+			disassembly.dblock_length++;
 
 			data_start = -1;
 			data_len = 0;
-
-			arrput(disassembly->data_blocks, block);
-			disassembly->dblock_length++;
 		}
 	}
 
-	// printf("Length: %zu\nAddressbook: %zu\n", length, disassembly->abook_length);
-	// printf("Discovered %zu instructions!\n", new_instructions);
-	assert(disassembly->abook_length == length);
+	return disassembly;
+}
+
+// Disassembles from another entry point, e.g. a jump target only seen at runtime. Only the data
+// the new code was found in changes, so this costs about as much as the new code itself. The
+// new code's blocks are appended after the existing ones, which keep their indices.
+void disassemble_rd_update(Disassembly *disassembly, uint8_t *code, size_t length, size_t offset) {
+	size_t first_block = disassembly->iblock_length;
+	discover_instructions(disassembly, code, length, offset);
+	resolve_jump_tables(disassembly, code, length, first_block);
+
+	for (size_t i = first_block; i < disassembly->iblock_length; ++i) {
+		InstructionBlock *block = &disassembly->instruction_blocks[i];
+		size_t start = block->instructions[0].address;
+		size_t end = block->instructions[block->length - 1].address + 2;
+		carve_data(disassembly, start, end);
+	}
 }
 
 // Linear sweep disassembler
@@ -243,7 +377,6 @@ Disassembly disassemble_linear(uint8_t *code, size_t length, size_t base) {
 	for (size_t ip = 0; (ip + 1) < length; ip += 2) {
 		Chip8Instruction instruction = bytes2inst(code + ip);
 		DisassembledInstruction disasm = {
-			.asm_str = inst2str(instruction),
 			.instruction = instruction,
 			.address = ip,
 		};
@@ -264,43 +397,194 @@ Disassembly disassemble_linear(uint8_t *code, size_t length, size_t base) {
 	return disassembly;
 }
 
-sds disassembly2str(Disassembly *disassembly) {
+// Each format writes blocks as they're reached, a line at a time, so that
+// nothing the size of the listing is ever held in memory
+typedef struct FormatTable {
+	const char *name;
+	const char *header;
+	void (*code_block)(Output *output, size_t index, uint16_t address);
+	void (*instruction)(Output *output, size_t index, uint16_t address,
+			    Chip8Instruction instruction);
+	void (*code_block_end)(Output *output);
+	void (*data_block)(Output *output, size_t index, uint16_t address, DataBlock *block);
+} FormatTable;
+
+static void text_code_block(Output *output, size_t index, uint16_t address) {
+	output_str(output, "===== BLOCK @ 0x");
+	output_hex(output, address, 8);
+	output_str(output, " =====\n");
+}
+
+static void text_instruction(Output *output, size_t index, uint16_t address,
+			     Chip8Instruction instruction) {
+	char text[INST_TEXT_SIZE];
+	output_str(output, "0x");
+	output_hex(output, address, 8);
+	output_str(output, "  ");
+	output_hex(output, instruction.raw, 4);
+	output_str(output, "    ");
+	output_str(output, inst2text(instruction, text));
+	output_char(output, '\n');
+}
+
+static void text_code_block_end(Output *output) {
+	output_char(output, '\n');
+}
+
+static void text_data_block(Output *output, size_t index, uint16_t address, DataBlock *block) {
+	output_str(output, "===== DATA @ 0x");
+	output_hex(output, address, 8);
+	output_str(output, " =====\n");
+	write_hexdump(output, block->data, block->length, address);
+	output_str(output, "\n\n");
+}
+
+static void write_bytes(Output *output, uint8_t *bytes, size_t length) {
+	for (size_t i = 0; i < length; ++i) {
+		output_hex(output, bytes[i], 2);
+	}
+}
+
+static void json_instruction(Output *output, size_t index, uint16_t address,
+			     Chip8Instruction instruction) {
+	char text[INST_TEXT_SIZE];
+	output_str(output, "{\"type\":\"code\",\"block\":");
+	output_dec(output, index);
+	output_str(output, ",\"address\":");
+	output_dec(output, address);
+	output_str(output, ",\"opcode\":\"");
+	output_hex(output, instruction.raw, 4);
+	output_str(output, "\",\"text\":");
+	output_json_string(output, inst2text(instruction, text));
+	output_str(output, "}\n");
+}
+
+static void json_data_block(Output *output, size_t index, uint16_t address, DataBlock *block) {
+	output_str(output, "{\"type\":\"data\",\"block\":");
+	output_dec(output, index);
+	output_str(output, ",\"address\":");
+	output_dec(output, address);
+	output_str(output, ",\"bytes\":\"");
+	write_bytes(output, block->data, block->length);
+	output_str(output, "\"}\n");
+}
+
+// Mnemonics have commas but never quotes, so quoting them is enough
+static void csv_instruction(Output *output, size_t index, uint16_t address,
+			    Chip8Instruction instruction) {
+	char text[INST_TEXT_SIZE];
+	output_str(output, "code,");
+	output_dec(output, index);
+	output_char(output, ',');
+	output_dec(output, address);
+	output_char(output, ',');
+	output_hex(output, instruction.raw, 4);
+	output_str(output, ",\"");
+	output_str(output, inst2text(instruction, text));
+	output_str(output, "\"\n");
+}
+
+static void csv_data_block(Output *output, size_t index, uint16_t address, DataBlock *block) {
+	output_str(output, "data,");
+	output_dec(output, index);
+	output_char(output, ',');
+	output_dec(output, address);
+	output_char(output, ',');
+	write_bytes(output, block->data, block->length);
+	output_str(output, ",\n");
+}
+
+static const FormatTable formats[] = {
+	[DISASM_TEXT] = { "text", NULL, text_code_block, text_instruction, text_code_block_end,
+			  text_data_block },
+	[DISASM_JSON_LINES] = { "jsonl", NULL, NULL, json_instruction, NULL, json_data_block },
+	[DISASM_CSV] = { "csv", "type,block,address,bytes,text\n", NULL, csv_instruction, NULL,
+			 csv_data_block },
+};
+
+bool parse_disassembly_format(const char *name, DisassemblyFormat *format) {
+	for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i) {
+		if (strcmp(name, formats[i].name) == 0) {
+			*format = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+void write_disassembly(Output *output, Disassembly *disassembly, DisassemblyFormat format) {
+	const FormatTable *table = &formats[format];
 	uint16_t base = disassembly->base;
-	sds buffer = sdsempty();
 
-	for (int j = 0; j < disassembly->iblock_length; ++j) {
-		InstructionBlock *block = &disassembly->instruction_blocks[j];
-		buffer = sdscatprintf(buffer, "===== BLOCK @ 0x%08hx =====\n",
-				      block->instructions[0].address + base);
+	if (table->header) {
+		output_str(output, table->header);
+	}
 
-		for (int i = 0; i < block->length; ++i) {
+	for (size_t j = 0; j < disassembly->iblock_length; ++j) {
+		InstructionBlock *block = &disassembly->instruction_blocks[j];
+		if (table->code_block) {
+			table->code_block(output, j, block->instructions[0].address + base);
+		}
+		for (size_t i = 0; i < block->length; ++i) {
 			DisassembledInstruction *disasm = &block->instructions[i];
-			buffer = sdscatprintf(buffer, "0x%08hx  %04hx    %s\n",
-					      disasm->address + base, disasm->instruction.raw,
-					      disasm->asm_str);
+			table->instruction(output, j, disasm->address + base, disasm->instruction);
+		}
+		if (table->code_block_end) {
+			table->code_block_end(output);
 		}
-		buffer = sdscat(buffer, "\n");
 	}
 
-	for (int i = 0; i < disassembly->dblock_length; ++i) {
+	for (size_t i = 0; i < disassembly->dblock_length; ++i) {
 		DataBlock *block = &disassembly->data_blocks[i];
-		buffer =
-			sdscatprintf(buffer, "===== DATA @ 0x%08hx =====\n", block->address + base);
-		sds dump = hexdump(block->data, block->length, block->address + base);
-		buffer = sdscatfmt(buffer, "%s\n\n", dump);
-		sdsfree(dump);
+		table->data_block(output, i, block->address + base, block);
+	}
+}
+
+sds disassembly2str(Disassembly *disassembly) {
+	Output *output = malloc(sizeof(Output));
+	output_open_string(output);
+	write_disassembly(output, disassembly, DISASM_TEXT);
+	sds result = output_take_string(output);
+	free(output);
+	return result;
+}
+
+// Deep copy, e.g. for handing to another thread. Data blocks still point into
+// the original code buffer.
+Disassembly copy_disassembly(Disassembly *disassembly) {
+	Disassembly copy = *disassembly;
+	copy.instruction_blocks = NULL;
+	copy.data_blocks = NULL;
+
+	copy.addressbook = malloc(sizeof(AddressLookup) * disassembly->abook_length);
+	memcpy(copy.addressbook, disassembly->addressbook,
+	       sizeof(AddressLookup) * disassembly->abook_length);
+
+	for (size_t i = 0; i < disassembly->iblock_length; ++i) {
+		InstructionBlock *block = &disassembly->instruction_blocks[i];
+		InstructionBlock block_copy = { .length = block->length };
+		arrsetlen(block_copy.instructions, block->length);
+		memcpy(block_copy.instructions, block->instructions,
+		       sizeof(DisassembledInstruction) * block->length);
+		arrput(copy.instruction_blocks, block_copy);
+	}
+
+	for (size_t i = 0; i < disassembly->dblock_length; ++i) {
+		arrput(copy.data_blocks, disassembly->data_blocks[i]);
+	}
+
+	copy.jump_table_targets = NULL;
+	for (size_t i = 0; i < (size_t)arrlen(disassembly->jump_table_targets); ++i) {
+		arrput(copy.jump_table_targets, disassembly->jump_table_targets[i]);
 	}
 
-	return buffer;
+	return copy;
 }
 
 void free_disassembly(Disassembly *disassembly) {
 	if (disassembly->instruction_blocks) {
 		for (int i = 0; i < disassembly->iblock_length; ++i) {
-			InstructionBlock *block = &disassembly->instruction_blocks[i];
-			for (int j = 0; j < block->length; ++j) {
-				sdsfree(block->instructions[j].asm_str);
-			}
+			arrfree(disassembly->instruction_blocks[i].instructions);
 		}
 		arrfree(disassembly->instruction_blocks);
 	}
@@ -309,7 +593,99 @@ void free_disassembly(Disassembly *disassembly) {
 		arrfree(disassembly->data_blocks);
 	}
 
+	arrfree(disassembly->jump_table_targets);
+
 	if (disassembly->addressbook) {
 		free(disassembly->addressbook);
 	}
 }
+
+static InstructionBlock copy_block(InstructionBlock *block) {
+	InstructionBlock copy = { .length = block->length };
+	arrsetlen(copy.instructions, block->length);
+	memcpy(copy.instructions, block->instructions,
+	       sizeof(DisassembledInstruction) * block->length);
+	return copy;
+}
+
+// The blocks from `first_block` and jump table targets from `first_target` on, e.g. those
+// disassemble_rd_update() added
+DisassemblyUpdate disassembly_update_since(Disassembly *disassembly, size_t first_block,
+					   size_t first_target) {
+	DisassemblyUpdate update = { 0 };
+	for (size_t i = first_block; i < disassembly->iblock_length; ++i) {
+		arrput(update.blocks, copy_block(&disassembly->instruction_blocks[i]));
+	}
+	for (size_t i = first_target; i < (size_t)arrlen(disassembly->jump_table_targets); ++i) {
+		arrput(update.jump_table_targets, disassembly->jump_table_targets[i]);
+	}
+	return update;
+}
+
+// Applies an update made from this disassembly or a copy of it. Data blocks are split the same
+// way as in the original, so they keep pointing into whatever code this one's did.
+void apply_disassembly_update(Disassembly *disassembly, DisassemblyUpdate *update) {
+	for (size_t i = 0; i < (size_t)arrlen(update->blocks); ++i) {
+		InstructionBlock block = copy_block(&update->blocks[i]);
+		for (size_t j = 0; j < block.length; ++j) {
+			AddressLookup lookup = {
+				.block_offset = disassembly->iblock_length,
+				.array_offset = j,
+				.type = ADDR_INSTRUCTION,
+			};
+			size_t addr = block.instructions[j].address;
+			disassembly->addressbook[addr] = lookup;
+			lookup.type = ADDR_INST_HALF;
+			disassembly->addressbook[addr + 1] = lookup;
+		}
+
+		size_t start = block.instructions[0].address;
+		size_t end = block.instructions[block.length - 1].address + 2;
+		carve_data(disassembly, start, end);
+		arrput(disassembly->instruction_blocks, block);
+		disassembly->iblock_length++;
+	}
+
+	for (size_t i = 0; i < (size_t)arrlen(update->jump_table_targets); ++i) {
+		arrput(disassembly->jump_table_targets, update->jump_table_targets[i]);
+	}
+
+	for (size_t i = 0; i < (size_t)arrlen(update->rewritten); ++i) {
+		DisassembledInstruction *rewritten = &update->rewritten[i];
+		AddressLookup *lookup = &disassembly->addressbook[rewritten->address];
+		if (lookup->type == ADDR_INSTRUCTION) {
+			disassembly->instruction_blocks[lookup->block_offset]
+				.instructions[lookup->array_offset] = *rewritten;
+		}
+	}
+}
+
+// Moves `later` onto the end of `update`, as if both had been made as one
+void merge_disassembly_updates(DisassemblyUpdate *update, DisassemblyUpdate *later) {
+	for (size_t i = 0; i < (size_t)arrlen(later->blocks); ++i) {
+		arrput(update->blocks, later->blocks[i]);
+	}
+	for (size_t i = 0; i < (size_t)arrlen(later->jump_table_targets); ++i) {
+		arrput(update->jump_table_targets, later->jump_table_targets[i]);
+	}
+	for (size_t i = 0; i < (size_t)arrlen(later->rewritten); ++i) {
+		arrput(update->rewritten, later->rewritten[i]);
+	}
+	arrfree(later->blocks);
+	arrfree(later->jump_table_targets);
+	arrfree(later->rewritten);
+}
+
+bool disassembly_update_empty(DisassemblyUpdate *update) {
+	return !arrlen(update->blocks) && !arrlen(update->jump_table_targets) &&
+	       !arrlen(update->rewritten);
+}
+
+void free_disassembly_update(DisassemblyUpdate *update) {
+	for (size_t i = 0; i < (size_t)arrlen(update->blocks); ++i) {
+		arrfree(update->blocks[i].instructions);
+	}
+	arrfree(update->blocks);
+	arrfree(update->jump_table_targets);
+	arrfree(update->rewritten);
+}
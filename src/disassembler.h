@@ -2,8 +2,10 @@
 #define DISASSEMBLER_H
 
 #include "instructions.h"
+#include "output.h"
 #include "sds.h"
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 
@@ -14,7 +16,6 @@ typedef struct DataBlock {
 } DataBlock;
 
 typedef struct DisassembledInstruction {
-	sds asm_str;
 	Chip8Instruction instruction;
 	uint16_t address;
 } DisassembledInstruction;
@@ -32,29 +33,60 @@ typedef enum AddressType {
 	ADDR_INST_HALF, // 2nd instruction byte - invalid by itself
 } AddressType;
 
+// Offsets are only kept for instructions. Data is found by address in the
+// data blocks instead, since updates split them.
 typedef struct AddressLookup {
 	size_t block_offset;
 	size_t array_offset;
 	AddressType type;
 } AddressLookup;
 
+typedef enum DisassemblyFormat {
+	DISASM_TEXT = 0,
+	DISASM_JSON_LINES, // An object per instruction and data block
+	DISASM_CSV, // A row per instruction and data block, after a header
+} DisassemblyFormat;
+
 typedef struct Disassembly {
 	AddressLookup *addressbook;
 	size_t abook_length;
 	InstructionBlock *instruction_blocks;
 	size_t iblock_length;
-	DataBlock *data_blocks;
+	DataBlock *data_blocks; // Sorted by address
 	size_t dblock_length;
+	uint16_t *jump_table_targets; // stb_ds array of JMP V0 targets resolved statically
+	size_t rom_length; // How much of the code is the ROM image, the rest is RAM
 	uint16_t base;
-
 } Disassembly;
 
+// What changed in a disassembly since a copy of it was made, so the copy can be brought up to
+// date for about what the changes cost rather than what the whole disassembly does. Blocks and
+// jump table targets are appended in order, and the data blocks they overlap are split. All
+// arrays are stb_ds.
+typedef struct DisassemblyUpdate {
+	InstructionBlock *blocks;
+	uint16_t *jump_table_targets;
+	DisassembledInstruction *rewritten; // Already disassembled, but changed in memory since
+} DisassemblyUpdate;
+
+void write_hexdump(Output *output, void *buffer, size_t length, size_t base);
 sds hexdump(void *buffer, size_t length, size_t base);
-Disassembly disassemble_rd(uint8_t *code, size_t length, size_t base, size_t offset);
+Disassembly disassemble_rd(uint8_t *code, size_t length, size_t rom_length, size_t base,
+			  size_t offset);
 void disassemble_rd_update(Disassembly *disassembly, uint8_t *code, size_t length, size_t offset);
 Disassembly disassemble_linear(uint8_t *code, size_t length, size_t base);
 
+bool parse_disassembly_format(const char *name, DisassemblyFormat *format);
+void write_disassembly(Output *output, Disassembly *disassembly, DisassemblyFormat format);
 sds disassembly2str(Disassembly *disassembly);
+Disassembly copy_disassembly(Disassembly *disassembly);
 void free_disassembly(Disassembly *disassembly);
 
+DisassemblyUpdate disassembly_update_since(Disassembly *disassembly, size_t first_block,
+					   size_t first_target);
+void apply_disassembly_update(Disassembly *disassembly, DisassemblyUpdate *update);
+void merge_disassembly_updates(DisassemblyUpdate *update, DisassemblyUpdate *later);
+bool disassembly_update_empty(DisassemblyUpdate *update);
+void free_disassembly_update(DisassemblyUpdate *update);
+
 #endif // !DISASSEMBLER_H
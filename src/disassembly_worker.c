@@ -0,0 +1,136 @@
+#include "disassembly_worker.h"
+#include "disassembler.h"
+
+#include "stb_ds.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void *worker_loop(void *arg) {
+	DisassemblyWorker *worker = arg;
+
+	pthread_mutex_lock(&worker->lock);
+	for (;;) {
+		while (!worker->quit && !(worker->busy && !worker->done)) {
+			pthread_cond_wait(&worker->wake, &worker->lock);
+		}
+		if (worker->quit) {
+			break;
+		}
+		pthread_mutex_unlock(&worker->lock);
+
+		// The job's buffers aren't touched by anyone else until it's collected
+		size_t first_block = worker->disassembly.iblock_length;
+		size_t first_target = arrlen(worker->disassembly.jump_table_targets);
+		for (size_t i = 0; i < (size_t)arrlen(worker->targets); ++i) {
+			uint16_t target = worker->targets[i];
+			if (worker->disassembly.addressbook[target].type != ADDR_INSTRUCTION) {
+				disassemble_rd_update(&worker->disassembly, worker->code,
+						      worker->length, target);
+			}
+		}
+
+		worker->update =
+			disassembly_update_since(&worker->disassembly, first_block, first_target);
+
+		pthread_mutex_lock(&worker->lock);
+		worker->done = true;
+	}
+	pthread_mutex_unlock(&worker->lock);
+
+	return NULL;
+}
+
+DisassemblyWorker *disassembly_worker_create(void) {
+	DisassemblyWorker *worker = calloc(1, sizeof(DisassemblyWorker));
+	pthread_mutex_init(&worker->lock, NULL);
+	pthread_cond_init(&worker->wake, NULL);
+
+	if (pthread_create(&worker->thread, NULL, worker_loop, worker) != 0) {
+		fprintf(stderr, "[!] Failed to start the disassembly worker\n");
+		pthread_mutex_destroy(&worker->lock);
+		pthread_cond_destroy(&worker->wake);
+		free(worker);
+		return NULL;
+	}
+
+	return worker;
+}
+
+// Queues `targets` to be disassembled on top of `disassembly`, which is only
+// copied if `generation` differs from the last job's. Otherwise the worker's
+// copy must have had every update it handed back applied to `disassembly`.
+// Takes ownership of `targets`, unless the worker is still busy and this
+// returns false.
+bool disassembly_worker_submit(DisassemblyWorker *worker, uint8_t *code, size_t length,
+			       Disassembly *disassembly, uint16_t *targets, uint32_t generation) {
+	pthread_mutex_lock(&worker->lock);
+	if (worker->busy) {
+		pthread_mutex_unlock(&worker->lock);
+		return false;
+	}
+
+	// The code's copied every time, since the ROM may have rewritten it anywhere
+	if (length != worker->length) {
+		worker->code = realloc(worker->code, length);
+		worker->length = length;
+		worker->copied = false;
+	}
+	memcpy(worker->code, code, length);
+	if (!worker->copied || generation != worker->generation) {
+		free_disassembly(&worker->disassembly);
+		worker->disassembly = copy_disassembly(disassembly);
+		for (size_t i = 0; i < worker->disassembly.dblock_length; ++i) {
+			DataBlock *block = &worker->disassembly.data_blocks[i];
+			block->data = worker->code + block->address;
+		}
+		worker->copied = true;
+	}
+	worker->targets = targets;
+	worker->generation = generation;
+	worker->busy = true;
+	worker->done = false;
+
+	pthread_cond_signal(&worker->wake);
+	pthread_mutex_unlock(&worker->lock);
+	return true;
+}
+
+// Hands back what a finished job added to the disassembly, if there is one
+bool disassembly_worker_collect(DisassemblyWorker *worker, DisassemblyUpdate *update,
+				uint16_t **targets, uint32_t *generation) {
+	pthread_mutex_lock(&worker->lock);
+	bool done = worker->done;
+	if (done) {
+		*update = worker->update;
+		*targets = worker->targets;
+		*generation = worker->generation;
+		memset(&worker->update, 0, sizeof(DisassemblyUpdate));
+		worker->targets = NULL;
+		worker->busy = false;
+		worker->done = false;
+	}
+	pthread_mutex_unlock(&worker->lock);
+
+	return done;
+}
+
+void disassembly_worker_free(DisassemblyWorker *worker) {
+	pthread_mutex_lock(&worker->lock);
+	worker->quit = true;
+	pthread_cond_signal(&worker->wake);
+	pthread_mutex_unlock(&worker->lock);
+	pthread_join(worker->thread, NULL);
+
+	free_disassembly(&worker->disassembly);
+	free_disassembly_update(&worker->update);
+	arrfree(worker->targets);
+	free(worker->code);
+	pthread_mutex_destroy(&worker->lock);
+	pthread_cond_destroy(&worker->wake);
+	free(worker);
+}
@@ -0,0 +1,42 @@
+#ifndef DISASSEMBLY_WORKER_H
+#define DISASSEMBLY_WORKER_H
+
+#include "disassembler.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Background thread that extends a disassembly with newly discovered entry
+// points (e.g. computed JMP V0 targets), so the interpreter never has to
+// re-disassemble inside an instruction. It keeps its own copy of the
+// disassembly, only copied again when the generation changes, and hands back
+// just what each job added to it.
+typedef struct DisassemblyWorker {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+
+	// Current job, owned by the worker between submit and collect
+	uint8_t *code;
+	size_t length;
+	Disassembly disassembly;
+	DisassemblyUpdate update;
+	uint16_t *targets; // stb_ds array of offsets into code
+	uint32_t generation;
+	bool copied; // disassembly is a copy of the given generation's
+
+	bool busy; // Job submitted and not collected yet
+	bool done; // Job finished, waiting to be collected
+	bool quit;
+} DisassemblyWorker;
+
+DisassemblyWorker *disassembly_worker_create(void);
+bool disassembly_worker_submit(DisassemblyWorker *worker, uint8_t *code, size_t length,
+			       Disassembly *disassembly, uint16_t *targets, uint32_t generation);
+bool disassembly_worker_collect(DisassemblyWorker *worker, DisassemblyUpdate *update,
+				uint16_t **targets, uint32_t *generation);
+void disassembly_worker_free(DisassemblyWorker *worker);
+
+#endif // !DISASSEMBLY_WORKER_H
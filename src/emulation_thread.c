@@ -0,0 +1,382 @@
+#include "emulation_thread.h"
+#include "analysis_cache.h"
+#include "call_graph.h"
+#include "core.h"
+#include "disassembler.h"
+#include "log.h"
+#include "sds.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+bool command_ring_push(CommandRing *ring, EmulatorCommand command) {
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+	if (tail - head == COMMAND_RING_SIZE) {
+		return false;
+	}
+
+	ring->commands[tail & (COMMAND_RING_SIZE - 1)] = command;
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+	return true;
+}
+
+bool command_ring_pop(CommandRing *ring, EmulatorCommand *command) {
+	size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	if (head == tail) {
+		return false;
+	}
+
+	*command = ring->commands[head & (COMMAND_RING_SIZE - 1)];
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+	return true;
+}
+
+// Copies the emulator into the back slot and makes it the newest snapshot.
+// Heap-owned fields are cleared, since only the emulation thread may use them.
+static void publish_snapshot(SnapshotBuffer *snapshots, EmulatorState *emulator) {
+	EmulatorState *snapshot = &snapshots->slots[snapshots->back];
+	memcpy(snapshot, emulator, sizeof(*snapshot));
+	snapshot->rom_path = NULL;
+	snapshot->rom = NULL;
+	snapshot->analysis_cache = NULL;
+	snapshot->debug_state.latest_memory_dump = NULL;
+	memset(&snapshot->debug_state.disassembly, 0, sizeof(Disassembly));
+
+	// The UI only shows the user's breakpoints, not a step's temporary one
+	DebugState *debug_state = &snapshot->debug_state;
+	if (debug_state->stepping) {
+		debug_state->instruction_breakpoints[debug_state->step_address] =
+			debug_state->step_breakpoint;
+	}
+
+	unsigned previous = atomic_exchange_explicit(
+		&snapshots->middle, snapshots->back | SNAPSHOT_FRESH, memory_order_acq_rel);
+	snapshots->back = previous & ~SNAPSHOT_FRESH;
+}
+
+// Hands the disassembly's changes to the UI. It's only copied whole when it was replaced.
+static void publish_disassembly(EmulationThread *emulation) {
+	DebugState *debug_state = &emulation->emulator.debug_state;
+	if (!debug_state->disassembly_replaced &&
+	    disassembly_update_empty(&debug_state->disassembly_changes)) {
+		return;
+	}
+
+	// Changes the UI hasn't taken yet are ours again, to add these to. Nothing else
+	// publishes, so the slot stays empty until they go back.
+	DisassemblyChanges *changes = atomic_exchange(&emulation->disassembly, NULL);
+	if (debug_state->disassembly_replaced) {
+		if (changes) {
+			free_disassembly_changes(changes);
+		}
+		changes = calloc(1, sizeof(DisassemblyChanges));
+		changes->replaced = true;
+		changes->disassembly = copy_disassembly(&debug_state->disassembly);
+		free_disassembly_update(&debug_state->disassembly_changes);
+	} else if (!changes) {
+		changes = calloc(1, sizeof(DisassemblyChanges));
+		changes->update = debug_state->disassembly_changes;
+	} else if (changes->replaced) {
+		apply_disassembly_update(&changes->disassembly, &debug_state->disassembly_changes);
+		free_disassembly_update(&debug_state->disassembly_changes);
+	} else {
+		merge_disassembly_updates(&changes->update, &debug_state->disassembly_changes);
+	}
+	memset(&debug_state->disassembly_changes, 0, sizeof(DisassemblyUpdate));
+	debug_state->disassembly_replaced = false;
+
+	atomic_store(&emulation->disassembly, changes);
+}
+
+// Executes one instruction, printing it, while paused
+static void step(EmulatorState *emulator) {
+	step_instruction(emulator, true);
+}
+
+// The breakpoint flag at `addr`. A step's temporary breakpoint stays until the
+// step ends, so changes to one on its address go to the user's underneath it.
+static bool *instruction_breakpoint(DebugState *debug_state, uint16_t addr) {
+	addr &= EMULATOR_ADDR_MASK;
+	if (debug_state->stepping && addr == debug_state->step_address) {
+		return &debug_state->step_breakpoint;
+	}
+	return &debug_state->instruction_breakpoints[addr];
+}
+
+static void set_register(EmulatorState *emulator, EmulatorRegister reg, uint16_t value) {
+	if (reg < REG_I) {
+		emulator->registers[reg - REG_V0] = value;
+		return;
+	}
+	switch (reg) {
+	case REG_I:
+		emulator->vi = value;
+		break;
+	case REG_PC:
+		emulator->pc = value & EMULATOR_ADDR_MASK;
+		break;
+	case REG_SP:
+		emulator->sp = value & EMULATOR_STACK_MASK;
+		break;
+	case REG_DT:
+		emulator->dt = value;
+		break;
+	case REG_ST:
+		emulator->st = value;
+		break;
+	default:
+		break;
+	}
+}
+
+// Returns false once the UI asks to quit
+static bool handle_command(EmulatorState *emulator, EmulatorCommand *command) {
+	DebugState *debug_state = &emulator->debug_state;
+
+	switch (command->type) {
+	case CMD_KEY:
+		emulator->keyboard[command->arg & 0xF] = command->value;
+		break;
+	case CMD_TOGGLE_PAUSE:
+		debug_state->debug_mode = !debug_state->debug_mode;
+		if (debug_state->debug_mode) {
+			cancel_step(emulator);
+		}
+		log_info(LOG_CORE, "%s emulator", debug_state->debug_mode ? "Paused" : "Unpaused");
+		break;
+	case CMD_SET_PAUSED:
+		if (command->value) {
+			cancel_step(emulator);
+		} else {
+			// Resuming runs the current instruction, even with a breakpoint on it
+			debug_state->inst_breakpoint_hit = true;
+		}
+		debug_state->debug_mode = command->value;
+		break;
+	case CMD_STEP:
+		if (debug_state->debug_mode) {
+			step(emulator);
+		}
+		break;
+	case CMD_STEP_OVER:
+		// Anything but a CALL is stepped over by stepping it
+		if (debug_state->debug_mode && !step_over(emulator)) {
+			step(emulator);
+		}
+		break;
+	case CMD_STEP_OUT:
+		if (debug_state->debug_mode && !step_out(emulator)) {
+			log_info(LOG_CPU, "Not in a subroutine");
+		}
+		break;
+	case CMD_SET_SKIP_BREAKPOINTS:
+		debug_state->skip_breakpoints = command->value;
+		break;
+	case CMD_SET_CONFIGURATION:
+		emulator->configuration = command->value;
+		break;
+	case CMD_SET_CYCLES_PER_FRAME:
+		if (command->value < CYCLES_PER_FRAME_COUNT) {
+			emulator->cycles_per_frame = command->value;
+		}
+		break;
+	case CMD_SET_PROFILING:
+		if (debug_state->profiling && !command->value) {
+			call_graph_settle(&debug_state->call_graph, emulator->cycle_count);
+		}
+		debug_state->profiling = command->value;
+		break;
+	case CMD_TOGGLE_INSTRUCTION_BREAKPOINT: {
+		bool *breakpoint = instruction_breakpoint(debug_state, command->arg);
+		*breakpoint = !*breakpoint;
+		log_info(LOG_CPU, "Breakpoint %s @ 0x%hx", *breakpoint ? "enabled" : "disabled",
+			 command->arg & EMULATOR_ADDR_MASK);
+		break;
+	}
+	case CMD_TOGGLE_MEMORY_BREAKPOINT: {
+		uint16_t addr = command->arg & EMULATOR_ADDR_MASK;
+		debug_state->memory_breakpoints[addr] = !debug_state->memory_breakpoints[addr];
+		break;
+	}
+	case CMD_SET_INSTRUCTION_BREAKPOINT:
+		*instruction_breakpoint(debug_state, command->arg) = command->value;
+		break;
+	case CMD_SET_MEMORY_BREAKPOINT:
+		debug_state->memory_breakpoints[command->arg & EMULATOR_ADDR_MASK] = command->value;
+		break;
+	case CMD_SET_REGISTER:
+		set_register(emulator, command->value, command->arg);
+		break;
+	case CMD_WRITE_MEMORY:
+		memory_at(emulator, command->arg) = command->value;
+		debug_state->memory_modifications[command->arg & EMULATOR_ADDR_MASK] = true;
+		debug_state->written_to_memory = true;
+		break;
+	case CMD_RESET:
+		reset_state(emulator);
+		break;
+	case CMD_LOAD_ROM:
+		load_rom(emulator, command->rom, command->rom_size, command->rom_path);
+		free(command->rom_path);
+		break;
+	case CMD_QUIT:
+		return false;
+	}
+
+	return true;
+}
+
+static long long elapsed_ns(struct timespec *from, struct timespec *to) {
+	return (to->tv_sec - from->tv_sec) * (long long)NANOSECONDS_PER_SECOND +
+	       (to->tv_nsec - from->tv_nsec);
+}
+
+static void advance_ns(struct timespec *time, long long ns) {
+	ns += time->tv_nsec;
+	time->tv_sec += ns / NANOSECONDS_PER_SECOND;
+	time->tv_nsec = ns % NANOSECONDS_PER_SECOND;
+}
+
+// Runs frames against absolute deadlines, so a slow frame is made up for by
+// sleeping less on the next one rather than drifting
+static void *emulation_loop(void *arg) {
+	EmulationThread *emulation = arg;
+	EmulatorState *emulator = &emulation->emulator;
+	DebugState *debug_state = &emulator->debug_state;
+	const long long frame_time = NANOSECONDS_PER_SECOND / TARGET_HZ;
+
+	struct timespec deadline, now;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+	bool running = true;
+	while (running) {
+		EmulatorCommand command;
+		while (running && command_ring_pop(&emulation->commands, &command)) {
+			running = handle_command(emulator, &command);
+		}
+
+		if (debug_state->memory_breakpoint_hit) {
+			log_info(LOG_CPU, "Memory breakpoint hit");
+			debug_state->memory_breakpoint_hit = false;
+		}
+
+		if (running && !debug_state->debug_mode) {
+			run_frame(emulator);
+		}
+
+		publish_disassembly(emulation);
+		publish_snapshot(&emulation->snapshots, emulator);
+		atomic_store_explicit(&emulation->published_commands,
+				      atomic_load_explicit(&emulation->commands.head,
+							   memory_order_relaxed),
+				      memory_order_release);
+
+		advance_ns(&deadline, frame_time);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		long long remaining = elapsed_ns(&now, &deadline);
+		if (remaining < -frame_time) {
+			// Too far behind to catch up without a burst of frames, so start over
+			atomic_fetch_add(&emulation->late_frames, 1);
+			deadline = now;
+		} else if (remaining > 0) {
+			struct timespec sleep_time = { remaining / NANOSECONDS_PER_SECOND,
+						       remaining % NANOSECONDS_PER_SECOND };
+			nanosleep(&sleep_time, NULL);
+		}
+	}
+
+	return NULL;
+}
+
+void emulation_thread_start(EmulationThread *emulation, uint8_t *rom, size_t rom_size,
+			    char *rom_path, bool debug) {
+	EmulatorState *emulator = &emulation->emulator;
+	emulator->configuration = CONFIG_CHIP8;
+	emulator->cycles_per_frame = DEFAULT_CYCLES_PER_FRAME;
+	emulator->analysis_cache = analysis_cache_directory();
+	load_rom(emulator, rom, rom_size, rom_path);
+	emulator->debug_state.debug_mode = debug;
+
+	// The UI reads a valid snapshot even before the first frame runs
+	atomic_init(&emulation->commands.head, 0);
+	atomic_init(&emulation->commands.tail, 0);
+	emulation->snapshots.back = 0;
+	emulation->snapshots.front = 1;
+	atomic_init(&emulation->snapshots.middle, 2);
+	publish_snapshot(&emulation->snapshots, emulator);
+	atomic_init(&emulation->disassembly, NULL);
+	atomic_init(&emulation->late_frames, 0);
+	atomic_init(&emulation->published_commands, 0);
+	publish_disassembly(emulation);
+
+	if (pthread_create(&emulation->thread, NULL, emulation_loop, emulation) != 0) {
+		fprintf(stderr, "[!] Failed to start the emulation thread\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+bool emulation_thread_send(EmulationThread *emulation, EmulatorCommand command) {
+	if (!command_ring_push(&emulation->commands, command)) {
+		fprintf(stderr, "[!] Emulator command queue is full, dropping command\n");
+		return false;
+	}
+	return true;
+}
+
+// Newest published snapshot. It stays valid until the next call.
+EmulatorState *emulation_thread_snapshot(EmulationThread *emulation) {
+	SnapshotBuffer *snapshots = &emulation->snapshots;
+	if (atomic_load_explicit(&snapshots->middle, memory_order_acquire) & SNAPSHOT_FRESH) {
+		unsigned previous = atomic_exchange_explicit(&snapshots->middle, snapshots->front,
+							     memory_order_acq_rel);
+		snapshots->front = previous & ~SNAPSHOT_FRESH;
+	}
+	return &snapshots->slots[snapshots->front];
+}
+
+// Waits for a snapshot taken after every command sent so far was handled, i.e.
+// up to a frame. Only for the thread that sends commands.
+EmulatorState *emulation_thread_sync(EmulationThread *emulation) {
+	size_t sent = atomic_load_explicit(&emulation->commands.tail, memory_order_relaxed);
+	while (atomic_load_explicit(&emulation->published_commands, memory_order_acquire) < sent) {
+		struct timespec wait = { 0, NANOSECONDS_PER_SECOND / 1000 };
+		nanosleep(&wait, NULL);
+	}
+	return emulation_thread_snapshot(emulation);
+}
+
+// Returns the changes to the disassembly published since the last call, if any,
+// which the caller then owns
+DisassemblyChanges *emulation_thread_take_disassembly(EmulationThread *emulation) {
+	return atomic_exchange(&emulation->disassembly, NULL);
+}
+
+void free_disassembly_changes(DisassemblyChanges *changes) {
+	free_disassembly(&changes->disassembly);
+	free_disassembly_update(&changes->update);
+	free(changes);
+}
+
+void emulation_thread_stop(EmulationThread *emulation) {
+	EmulatorCommand quit = { .type = CMD_QUIT };
+	while (!command_ring_push(&emulation->commands, quit)) {
+		struct timespec wait = { 0, NANOSECONDS_PER_SECOND / 1000 };
+		nanosleep(&wait, NULL);
+	}
+	pthread_join(emulation->thread, NULL);
+
+	DisassemblyChanges *changes = emulation_thread_take_disassembly(emulation);
+	if (changes) {
+		free_disassembly_changes(changes);
+	}
+	free_emulator(&emulation->emulator);
+	sdsfree(emulation->emulator.analysis_cache);
+}
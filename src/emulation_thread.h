@@ -0,0 +1,114 @@
+#ifndef EMULATION_THREAD_H
+#define EMULATION_THREAD_H
+
+#include "core.h"
+#include "disassembler.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define NANOSECONDS_PER_SECOND 1000000000
+#define TARGET_HZ 60
+
+#define COMMAND_RING_SIZE 256 // Must be a power of two
+#define SNAPSHOT_FRESH 0b100
+
+// Register numbers for CMD_SET_REGISTER, in the order debuggers see them
+typedef enum EmulatorRegister {
+	REG_V0 = 0, // V0-VF are REG_V0 + n
+	REG_I = 16,
+	REG_PC,
+	REG_SP,
+	REG_DT,
+	REG_ST,
+	REG_COUNT,
+} EmulatorRegister;
+
+typedef enum EmulatorCommandType {
+	CMD_KEY, // keyboard[arg] = value
+	CMD_TOGGLE_PAUSE,
+	CMD_SET_PAUSED, // value
+	CMD_STEP,
+	CMD_STEP_OVER,
+	CMD_STEP_OUT,
+	CMD_SET_SKIP_BREAKPOINTS, // value
+	CMD_SET_CONFIGURATION, // value
+	CMD_SET_CYCLES_PER_FRAME, // value
+	CMD_SET_PROFILING, // value
+	CMD_TOGGLE_INSTRUCTION_BREAKPOINT, // arg
+	CMD_TOGGLE_MEMORY_BREAKPOINT, // arg
+	CMD_SET_INSTRUCTION_BREAKPOINT, // arg, value
+	CMD_SET_MEMORY_BREAKPOINT, // arg, value
+	CMD_SET_REGISTER, // Register `value` = arg
+	CMD_WRITE_MEMORY, // memory[arg] = value
+	CMD_RESET,
+	CMD_LOAD_ROM, // rom, rom_size, rom_path (ownership passes to the emulation thread)
+	CMD_QUIT,
+} EmulatorCommandType;
+
+typedef struct EmulatorCommand {
+	EmulatorCommandType type;
+	uint16_t arg;
+	uint8_t value;
+	uint8_t *rom;
+	size_t rom_size;
+	char *rom_path;
+} EmulatorCommand;
+
+// Single-producer, single-consumer queue from the UI to the emulation thread
+typedef struct CommandRing {
+	EmulatorCommand commands[COMMAND_RING_SIZE];
+	atomic_size_t head; // Next slot to read, only written by the consumer
+	atomic_size_t tail; // Next slot to write, only written by the producer
+} CommandRing;
+
+// Changes to the disassembly for the UI's copy of it: a whole new one when it
+// was replaced, or an update to the last otherwise
+typedef struct DisassemblyChanges {
+	bool replaced;
+	Disassembly disassembly; // If replaced
+	DisassemblyUpdate update; // If not
+} DisassemblyChanges;
+
+// Triple buffer of emulator snapshots. The writer always has a back slot to
+// fill and the reader a front slot to read, so neither ever waits; the middle
+// slot is swapped with whichever side finishes next.
+typedef struct SnapshotBuffer {
+	EmulatorState slots[3];
+	atomic_uint middle; // Slot index, with SNAPSHOT_FRESH set if unread
+	unsigned back;
+	unsigned front;
+} SnapshotBuffer;
+
+typedef struct EmulationThread {
+	EmulatorState emulator; // Only touched by the emulation thread once started
+	pthread_t thread;
+	CommandRing commands;
+	SnapshotBuffer snapshots;
+
+	// Changes to the disassembly not yet taken by the UI, or NULL
+	_Atomic(DisassemblyChanges *) disassembly;
+
+	// Frames started more than a frame late, e.g. after the process was stopped
+	atomic_uint_fast64_t late_frames;
+
+	// Commands handled before the newest snapshot was published
+	atomic_size_t published_commands;
+} EmulationThread;
+
+bool command_ring_push(CommandRing *ring, EmulatorCommand command);
+bool command_ring_pop(CommandRing *ring, EmulatorCommand *command);
+
+void emulation_thread_start(EmulationThread *emulation, uint8_t *rom, size_t rom_size,
+			    char *rom_path, bool debug);
+bool emulation_thread_send(EmulationThread *emulation, EmulatorCommand command);
+EmulatorState *emulation_thread_snapshot(EmulationThread *emulation);
+EmulatorState *emulation_thread_sync(EmulationThread *emulation);
+DisassemblyChanges *emulation_thread_take_disassembly(EmulationThread *emulation);
+void free_disassembly_changes(DisassemblyChanges *changes);
+void emulation_thread_stop(EmulationThread *emulation);
+
+#endif // !EMULATION_THREAD_H
@@ -1,8 +1,14 @@
 #include "emulator.h"
+#include "call_graph.h"
 #include "common.h"
+#include "core.h"
+#include "decompiler.h"
 #include "disassembler.h"
+#include "emulation_thread.h"
 #include "instructions.h"
+#include "profiler.h"
 #include "sds.h"
+#include "stb_ds.h"
 
 #define NK_INCLUDE_STANDARD_BOOL
 #define NK_INCLUDE_FIXED_TYPES
@@ -41,60 +47,9 @@
 #include <time.h>
 #include <unistd.h>
 
-#define EMULATOR_MEMORY_SIZE 4096
-#define EMULATOR_STACK_SIZE 16
-
-#define CONFIG_CHIP8_VF_RESET 0b1
-#define CONFIG_CHIP8_MEMORY 0b10
-#define CONFIG_CHIP8_DISP_WAIT 0b100
-#define CONFIG_CHIP8_CLIPPING 0b1000
-#define CONFIG_CHIP8_SHIFTING 0b10000
-#define CONFIG_CHIP8_JUMPING 0b100000
-
-#define CONFIG_CHIP8 \
-	(CONFIG_CHIP8_VF_RESET | CONFIG_CHIP8_MEMORY | CONFIG_CHIP8_DISP_WAIT | \
-	 CONFIG_CHIP8_CLIPPING | CONFIG_CHIP8_SHIFTING | CONFIG_CHIP8_JUMPING)
-
-#define NANOSECONDS_PER_SECOND 1000000000
-#define TARGET_HZ 60
-
-#define PIXEL_COLOUR 0xFF97F1CD
-#define pixel(emulator, x, y) (emulator)->display[(y) * TARGET_WIDTH + (x)]
-#define FONT_BASE_ADDR 0x050
-
-#define TARGET_WIDTH 64
-#define TARGET_HEIGHT 32
 #define SCREEN_WIDTH 1280
 #define SCREEN_HEIGHT 640
 
-typedef enum CyclesPerFrameType {
-	CPF_7 = 0,
-	CPF_10,
-	CPF_15,
-	CPF_20,
-	CPF_30,
-	CPF_100,
-	CPF_200,
-	CPF_500,
-	CPF_1000,
-} CyclesPerFrameType;
-#define DEFAULT_CYCLES_PER_FRAME CPF_100
-
-// TODO: Tidy up breakpoint handling - event based?
-typedef struct DebugState {
-	Disassembly disassembly;
-	sds latest_memory_dump;
-	bool memory_modifications[EMULATOR_MEMORY_SIZE];
-	bool instruction_breakpoints[EMULATOR_MEMORY_SIZE];
-	bool memory_breakpoints[EMULATOR_MEMORY_SIZE];
-
-	bool debug_mode;
-	bool written_to_memory;
-	bool skip_breakpoints;
-	bool inst_breakpoint_hit;
-	bool memory_breakpoint_hit;
-} DebugState;
-
 typedef struct BeeperState {
 	SDL_AudioSpec spec;
 	SDL_AudioDeviceID id;
@@ -107,121 +62,46 @@ typedef struct BeeperState {
 	bool on;
 } Beeper;
 
-typedef struct EmulatorState {
-	// ROM to be loaded into RAM and executed
-	char *rom_path;
-	uint8_t *rom;
-	size_t rom_size;
-
-	// 0x000 - 0x1FF = Interpreter memory, not for programs
-	// Programs start at 0x200 (512)
-	// Some start at 0x600 (1536) (ETI 660 computer)
-	uint8_t memory[EMULATOR_MEMORY_SIZE];
-
-	// Stores return addresses
-	// Allows for 16 levels of nested subroutines
-	uint16_t stack[EMULATOR_STACK_SIZE];
-
-	// 0-F general purpose registers
-	uint8_t registers[16];
-
-	// Stack pointer
-	uint8_t sp;
-
-	// For memory addresses, lower 12bits used
-	uint16_t vi;
-
-	// Program counter
-	uint16_t pc;
-
-	// Delay timer
-	uint8_t dt;
-
-	// Sound timer
-	uint8_t st;
-
-	// Display pixels
-	uint32_t display[TARGET_WIDTH * TARGET_HEIGHT];
-	bool display_interrupted;
-
-	// Keyboard state, 1 = Pressed
-	uint8_t keyboard[16];
-
-	// CHIP-8 vs SUPER-CHIP/CHIP-48 differences
-	uint8_t configuration;
-
-	CyclesPerFrameType cycles_per_frame;
-	uint64_t cycle_count;
-
-	Beeper beeper;
-
-	DebugState debug_state;
-} EmulatorState;
-
 const int SCALE_X = SCREEN_WIDTH / TARGET_WIDTH;
 const int SCALE_Y = SCREEN_HEIGHT / TARGET_HEIGHT;
-const int CYCLES_PER_FRAME[] = {
-	[CPF_7] = 7,	 [CPF_10] = 10,	  [CPF_15] = 15,   [CPF_20] = 20,     [CPF_30] = 30,
-	[CPF_100] = 100, [CPF_200] = 200, [CPF_500] = 500, [CPF_1000] = 1000,
-};
-const char *CYCLES_PER_FRAME_STR[] = {
-	[CPF_7] = "7",	   [CPF_10] = "10",   [CPF_15] = "15",
-	[CPF_20] = "20",   [CPF_30] = "30",   [CPF_100] = "100",
-	[CPF_200] = "200", [CPF_500] = "500", [CPF_1000] = "1000",
-};
 
 bool g_show_debug_ui = false;
 bool g_inside_text_input = false;
 
+EmulationThread *g_emulation = NULL;
+Disassembly g_disassembly = { 0 }; // UI's copy of the emulator's disassembly
+nk_bool g_show_decompilation = false;
+Decompilation g_decompilation = { 0 }; // Of g_disassembly, redone when shown after it changes
+bool g_decompilation_stale = true;
+
 // SDL & Nuklear state
 SDL_Window *g_window = NULL;
 SDL_Renderer *g_renderer = NULL;
 SDL_Texture *g_texture = NULL;
 struct nk_context *g_ctx;
+Beeper g_beeper;
 
 static void beeper_callback(void *, uint8_t *, int);
 void beeper_toggle(Beeper *, bool);
-void free_graphics(EmulatorState *);
-static inline void dump_memory(EmulatorState *);
-void dump_registers(EmulatorState *);
-void dump_stack(EmulatorState *);
-void dump_state(EmulatorState *);
-bool execute(EmulatorState *, Chip8Instruction);
-Chip8Instruction fetch_next(EmulatorState *, bool);
-void free_emulator(EmulatorState *);
+void free_graphics(void);
 bool handle_input(EmulatorState *);
-void handle_timers(EmulatorState *);
 void init_beeper(Beeper *);
-void init_graphics(EmulatorState *);
-void load_rom(EmulatorState *, uint8_t *, size_t, char *);
-void print_instruction_state(EmulatorState *, Chip8Instruction);
-void refresh_dump(EmulatorState *);
+void init_graphics(void);
 void render(EmulatorState *);
-void reset_state(EmulatorState *);
-void update_keyboard_state(EmulatorState *, SDL_Scancode, uint8_t);
+void send_command(EmulatorCommand);
+void update_beeper(EmulatorState *);
+void update_keyboard_state(SDL_Scancode, uint8_t);
 
+// The core runs on its own thread (see emulation_thread.c), so a slow present
+// or debug UI frame here doesn't stall emulation or skew its timers. This
+// thread only reads snapshots and sends commands.
 void emulate(uint8_t *rom, size_t rom_size, bool debug, char *rom_path) {
 	printf("Emulating!\n");
 
-	EmulatorState emulator = { 0 };
-	emulator.configuration = CONFIG_CHIP8;
-	emulator.cycles_per_frame = DEFAULT_CYCLES_PER_FRAME;
-
 	srand(time(NULL));
-	load_rom(&emulator, rom, rom_size, rom_path);
-	init_graphics(&emulator);
-
-	// emulator.configuration = CONFIG_CHIP8 ^ CONFIG_CHIP8_DISP_WAIT;
-	// emulator.cycles_per_frame = CPF_1000;
-
-	DebugState *debug_state = &emulator.debug_state;
-
-	struct timespec start, current;
-	long long frame_time = NANOSECONDS_PER_SECOND / TARGET_HZ;
-	long long elapsed_time;
+	init_graphics();
 
 	if (debug) {
-		debug_state->debug_mode = true;
 		g_show_debug_ui = true;
 		printf("Debugging enabled!\n");
 		printf("  - <SPACE> to pause/unpause\n");
@@ -229,57 +109,39 @@ void emulate(uint8_t *rom, size_t rom_size, bool debug, char *rom_path) {
 		printf("  - <N> to step (execute the next instruction)\n");
 	}
 
+	g_emulation = calloc(1, sizeof(EmulationThread));
+	emulation_thread_start(g_emulation, rom, rom_size, rom_path, debug);
+
+	struct timespec start, current;
+	long long frame_time = NANOSECONDS_PER_SECOND / TARGET_HZ;
+	long long elapsed_time;
+
 	bool running = true;
 	while (running) {
-		running = handle_input(&emulator);
 		clock_gettime(CLOCK_MONOTONIC, &start);
 
-		if (debug_state->memory_breakpoint_hit) {
-			printf("Memory breakpoint hit!\n");
-			debug_state->memory_breakpoint_hit = false;
-		}
-
-		if (!debug_state->debug_mode) {
-			for (int cycle = 0;
-			     cycle < CYCLES_PER_FRAME[emulator.cycles_per_frame] && running;
-			     ++cycle) {
-				running = handle_input(&emulator);
-
-				Chip8Instruction instruction = fetch_next(&emulator, false);
-				if (!debug_state->skip_breakpoints &&
-				    debug_state->instruction_breakpoints[emulator.pc - 2] &&
-				    !debug_state->inst_breakpoint_hit) {
-					debug_state->inst_breakpoint_hit = true;
-					debug_state->debug_mode = true;
-					emulator.pc -= 2;
-					printf("Hit breakpoint @ 0x%03hx\n", emulator.pc);
-					break;
-				}
-
-				debug_state->inst_breakpoint_hit = false;
-
-				if (!execute(&emulator, instruction)) {
-					dump_state(&emulator);
-					debug_state->debug_mode = true;
-					printf("\n[!] Something went wrong @ 0x%03hx: ",
-					       emulator.pc - 2);
-					sds asm_str = inst2str(instruction);
-					printf("%s\n", asm_str);
-					sdsfree(asm_str);
-				}
-				if (emulator.display_interrupted ||
-				    debug_state->memory_breakpoint_hit) {
-					break;
-				}
-			}
-
-			if (!(debug_state->inst_breakpoint_hit ||
-			      debug_state->memory_breakpoint_hit)) {
-				handle_timers(&emulator);
+		DisassemblyChanges *changes = emulation_thread_take_disassembly(g_emulation);
+		if (changes) {
+			if (changes->replaced) {
+				free_disassembly(&g_disassembly);
+				g_disassembly = changes->disassembly;
+				memset(&changes->disassembly, 0, sizeof(Disassembly));
+			} else {
+				apply_disassembly_update(&g_disassembly, &changes->update);
 			}
+			free_disassembly_changes(changes);
+			g_decompilation_stale = true;
 		}
 
-		render(&emulator);
+		// Private copy, so widgets can point into it without racing the emulator
+		static EmulatorState view;
+		memcpy(&view, emulation_thread_snapshot(g_emulation), sizeof(view));
+		view.rom_path = rom_path;
+		view.debug_state.disassembly = g_disassembly;
+
+		running = handle_input(&view);
+		update_beeper(&view);
+		render(&view);
 
 		do { // Lock to TARGET_HZ
 			clock_gettime(CLOCK_MONOTONIC, &current);
@@ -288,344 +150,15 @@ void emulate(uint8_t *rom, size_t rom_size, bool debug, char *rom_path) {
 		} while (elapsed_time < frame_time);
 	}
 
-	free_emulator(&emulator);
+	emulation_thread_stop(g_emulation);
+	free(g_emulation);
+	free_disassembly(&g_disassembly);
+	free_decompilation(&g_decompilation);
+	free_graphics();
 }
 
-Chip8Instruction fetch_next(EmulatorState *emulator, bool trace) {
-	static uint16_t prev_inst_addr = 0;
-	uint16_t addr = emulator->pc;
-
-	DebugState *debug_state = &emulator->debug_state;
-	Disassembly *disassembly = &debug_state->disassembly;
-
-	Chip8Instruction instruction = bytes2inst(&emulator->memory[addr]);
-
-	bool modified = debug_state->memory_modifications[addr];
-	if (modified || addr != prev_inst_addr && trace) {
-		AddressLookup *lookup = &disassembly->addressbook[addr - disassembly->base];
-		DisassembledInstruction *disasm =
-			&disassembly->instruction_blocks[lookup->block_offset]
-				 .instructions[lookup->array_offset];
-
-		if (modified) {
-			disasm->instruction = instruction;
-			sds old_str = disasm->asm_str;
-			disasm->asm_str = inst2str(instruction);
-
-			printf("Modified instruction @ 0x%03hx:\n  Old: %s\n  New: %s\n", addr,
-			       old_str, disasm->asm_str);
-
-			debug_state->memory_modifications[addr] = false;
-			sdsfree(old_str);
-		}
-
-		if (trace) {
-			printf("[0x%03hX] %04hX => %s\t", emulator->pc, disasm->instruction.raw,
-			       disasm->asm_str);
-			print_instruction_state(emulator, disasm->instruction);
-			printf("\n");
-			dump_state(emulator);
-			printf("\n\n");
-		}
-	}
-
-	prev_inst_addr = addr;
-	emulator->pc += 2;
-
-	return instruction;
-}
-
-bool execute(EmulatorState *emulator, Chip8Instruction instruction) {
-	if (emulator->pc < 0 || emulator->pc > EMULATOR_MEMORY_SIZE) {
-		fprintf(stderr, "[!] PC exceeds memory boundaries\n");
-		return false;
-	}
-
-	DebugState *debug_state = &emulator->debug_state;
-	emulator->cycle_count++;
-
-	switch (instruction_type(instruction)) {
-	case CHIP8_CLS:
-		memset(emulator->display, 0, sizeof(emulator->display));
-		break;
-	case CHIP8_RET:
-		emulator->pc = emulator->stack[--emulator->sp];
-		break;
-	case CHIP8_SYS_ADDR:
-		// Ignore
-		fprintf(stderr, "[*] SYS attempt: 0x%04hx\n", instruction.raw);
-		break;
-	case CHIP8_JMP_ADDR:
-		emulator->pc = instruction.aformat.addr;
-		break;
-	case CHIP8_CALL_ADDR:
-		emulator->stack[emulator->sp++] = emulator->pc;
-		emulator->pc = instruction.aformat.addr;
-		break;
-	case CHIP8_SE_VX_BYTE:
-		if (emulator->registers[instruction.iformat.reg] == instruction.iformat.imm) {
-			emulator->pc += 2;
-		}
-		break;
-	case CHIP8_SNE_VX_BYTE:
-		if (emulator->registers[instruction.iformat.reg] != instruction.iformat.imm) {
-			emulator->pc += 2;
-		}
-		break;
-	case CHIP8_SE_VX_VY:
-		if (emulator->registers[instruction.rformat.rx] ==
-		    emulator->registers[instruction.rformat.ry]) {
-			emulator->pc += 2;
-		}
-		break;
-	case CHIP8_LD_VX_BYTE:
-		emulator->registers[instruction.iformat.reg] = instruction.iformat.imm;
-		break;
-	case CHIP8_ADD_VX_BYTE:
-		emulator->registers[instruction.iformat.reg] += instruction.iformat.imm;
-		break;
-	case CHIP8_LD_VX_VY:
-		emulator->registers[instruction.rformat.rx] =
-			emulator->registers[instruction.rformat.ry];
-		break;
-	case CHIP8_OR_VX_VY:
-		emulator->registers[instruction.rformat.rx] |=
-			emulator->registers[instruction.rformat.ry];
-		if (emulator->configuration & CONFIG_CHIP8_VF_RESET) {
-			emulator->registers[0xF] = 0;
-		}
-		break;
-	case CHIP8_AND_VX_VY:
-		emulator->registers[instruction.rformat.rx] &=
-			emulator->registers[instruction.rformat.ry];
-		if (emulator->configuration & CONFIG_CHIP8_VF_RESET) {
-			emulator->registers[0xF] = 0;
-		}
-		break;
-	case CHIP8_XOR_VX_VY:
-		emulator->registers[instruction.rformat.rx] ^=
-			emulator->registers[instruction.rformat.ry];
-		if (emulator->configuration & CONFIG_CHIP8_VF_RESET) {
-			emulator->registers[0xF] = 0;
-		}
-		break;
-	case CHIP8_ADD_VX_VY: {
-		uint16_t result = emulator->registers[instruction.rformat.rx] +
-				  emulator->registers[instruction.rformat.ry];
-		emulator->registers[instruction.rformat.rx] = (uint8_t)result;
-		emulator->registers[0xF] = (0x100 & result) > 0;
-		break;
-	}
-	case CHIP8_SUB_VX_VY: {
-		bool flag = emulator->registers[instruction.rformat.rx] >=
-			    emulator->registers[instruction.rformat.ry];
-		emulator->registers[instruction.rformat.rx] -=
-			emulator->registers[instruction.rformat.ry];
-		emulator->registers[0xF] = flag;
-		break;
-	}
-	case CHIP8_SHR_VX: {
-		if (emulator->configuration & CONFIG_CHIP8_SHIFTING) {
-			emulator->registers[instruction.rformat.rx] =
-				emulator->registers[instruction.rformat.ry];
-		}
-		bool flag = emulator->registers[instruction.rformat.rx] & 1;
-		emulator->registers[instruction.rformat.rx] >>= 1;
-		emulator->registers[0xF] = flag;
-		break;
-	}
-	case CHIP8_SUBN_VX_VY: {
-		bool flag = emulator->registers[instruction.rformat.ry] >=
-			    emulator->registers[instruction.rformat.rx];
-		emulator->registers[instruction.rformat.rx] =
-			emulator->registers[instruction.rformat.ry] -
-			emulator->registers[instruction.rformat.rx];
-		emulator->registers[0xF] = flag;
-		break;
-	}
-	case CHIP8_SHL_VX: {
-		if (emulator->configuration & CONFIG_CHIP8_SHIFTING) {
-			emulator->registers[instruction.rformat.rx] =
-				emulator->registers[instruction.rformat.ry];
-		}
-		bool flag = (emulator->registers[instruction.rformat.rx] & 0x80) > 0;
-		emulator->registers[instruction.rformat.rx] <<= 1;
-		emulator->registers[0xF] = flag;
-		break;
-	}
-	case CHIP8_SNE_VX_VY:
-		if (emulator->registers[instruction.rformat.rx] !=
-		    emulator->registers[instruction.rformat.ry]) {
-			emulator->pc += 2;
-		}
-		break;
-	case CHIP8_LD_I_ADDR:
-		emulator->vi = instruction.aformat.addr;
-		break;
-	case CHIP8_JMP_V0_ADDR: {
-		if (emulator->configuration & CONFIG_CHIP8_JUMPING) {
-			emulator->pc = instruction.aformat.addr + emulator->registers[0];
-		} else {
-			emulator->pc = instruction.aformat.addr +
-				       emulator->registers[instruction.iformat.reg];
-		}
-		uint16_t addr = emulator->pc;
-		printf("JMP V0 @ 0x%03hx\n", addr);
-		disassemble_rd_update(&debug_state->disassembly, emulator->memory + PROG_BASE,
-				      EMULATOR_MEMORY_SIZE - PROG_BASE, addr - PROG_BASE);
-		break;
-	}
-	case CHIP8_RND_VX_BYTE:
-		emulator->registers[instruction.iformat.reg] = (rand() % 256) &
-							       instruction.iformat.imm;
-		break;
-	case CHIP8_DRW_VX_VY_NIBBLE: {
-		if (emulator->configuration & CONFIG_CHIP8_DISP_WAIT &&
-		    !emulator->display_interrupted) {
-			emulator->display_interrupted = true;
-			emulator->pc -= 2;
-			emulator->cycle_count--;
-			break;
-		}
-		bool flag = false;
-		int origin_x = emulator->registers[instruction.rformat.rx] % TARGET_WIDTH;
-		int origin_y = emulator->registers[instruction.rformat.ry] % TARGET_HEIGHT;
-		int max_row = instruction.rformat.imm;
-		int max_col = 8;
-
-		if (emulator->configuration & CONFIG_CHIP8_CLIPPING) {
-			max_row = origin_y + max_row > TARGET_HEIGHT ? TARGET_HEIGHT - origin_y :
-								       max_row;
-			max_col = origin_x + max_col > TARGET_WIDTH ? TARGET_WIDTH - origin_x :
-								      max_col;
-		}
-
-		for (int row = 0; row < max_row; ++row) {
-			uint8_t byte = emulator->memory[emulator->vi + row];
-			int y = origin_y + row;
-			for (uint8_t col = 0; col < max_col && byte; ++col) {
-				int x = origin_x + col;
-				uint8_t state = byte & 0x80;
-				flag |= pixel(emulator, x, y) > 0 && state;
-				pixel(emulator, x, y) ^= state ? PIXEL_COLOUR : 0;
-				byte <<= 1;
-			}
-		}
-
-		emulator->registers[0xF] = flag;
-		emulator->display_interrupted = false;
-		break;
-	}
-	case CHIP8_SKP_VX:
-		if (emulator->keyboard[emulator->registers[instruction.iformat.reg]]) {
-			emulator->pc += 2;
-		}
-		break;
-	case CHIP8_SKNP_VX:
-		if (emulator->keyboard[emulator->registers[instruction.iformat.reg]] == 0) {
-			emulator->pc += 2;
-		}
-		break;
-	case CHIP8_LD_VX_DT:
-		emulator->registers[instruction.iformat.reg] = emulator->dt;
-		break;
-	case CHIP8_LD_VX_K: {
-		static int8_t key = -1;
-		static bool is_held = false;
-
-		bool is_pressed = false;
-		for (int i = 0; i < sizeof(emulator->keyboard); ++i) {
-			if (emulator->keyboard[i]) {
-				is_pressed = true;
-				key = i;
-				break;
-			}
-		}
-
-		if (is_pressed) {
-			is_held = true;
-		} else if (is_held) {
-			emulator->registers[instruction.iformat.reg] = key;
-			is_held = false;
-			break;
-		}
-
-		emulator->pc -= 2;
-		break;
-	}
-	case CHIP8_LD_DT_VX:
-		emulator->dt = emulator->registers[instruction.iformat.reg];
-		break;
-	case CHIP8_LD_ST_VX:
-		emulator->st = emulator->registers[instruction.iformat.reg];
-		break;
-	case CHIP8_ADD_I_VX:
-		emulator->vi += emulator->registers[instruction.iformat.reg];
-		break;
-	case CHIP8_LD_F_VX:
-		emulator->vi = FONT_BASE_ADDR + emulator->registers[instruction.iformat.reg] * 5;
-		break;
-	case CHIP8_LD_B_VX: {
-		uint8_t digit = emulator->registers[instruction.iformat.reg];
-		emulator->memory[emulator->vi + 2] = digit % 10;
-		digit /= 10;
-		emulator->memory[emulator->vi + 1] = digit % 10;
-		digit /= 10;
-		emulator->memory[emulator->vi] = digit % 10;
-		break;
-	}
-	case CHIP8_LD_I_VX:
-		debug_state->written_to_memory = true;
-		for (int i = 0; i <= instruction.iformat.reg; ++i) {
-			uint16_t addr = emulator->vi + i;
-			emulator->memory[addr] = emulator->registers[i];
-			debug_state->memory_modifications[addr] = true;
-			if (!debug_state->skip_breakpoints &&
-			    debug_state->memory_breakpoints[addr]) {
-				debug_state->debug_mode = true;
-				debug_state->memory_breakpoint_hit = true;
-			}
-		}
-		if (emulator->configuration & CONFIG_CHIP8_MEMORY) {
-			emulator->vi = instruction.iformat.reg + 1;
-		}
-		break;
-	case CHIP8_LD_VX_I:
-		for (int i = 0; i <= instruction.iformat.reg; ++i) {
-			uint16_t addr = emulator->vi + i;
-			emulator->registers[i] = emulator->memory[addr];
-			if (!debug_state->skip_breakpoints &&
-			    debug_state->memory_breakpoints[addr]) {
-				debug_state->debug_mode = true;
-				debug_state->memory_breakpoint_hit = true;
-			}
-		}
-		if (emulator->configuration & CONFIG_CHIP8_MEMORY) {
-			emulator->vi = instruction.iformat.reg + 1;
-		}
-		break;
-	case CHIP8_UNKNOWN:
-		// TODO: Handle CHIP-48 instructions
-		fprintf(stderr, "[!] Unknown instruction received: 0x%04hx @ 0x%03hx\n",
-			instruction.raw, emulator->pc);
-		return false;
-	}
-
-	return true;
-}
-
-void handle_timers(EmulatorState *emulator) {
-	if (emulator->dt > 0) {
-		emulator->dt--;
-	}
-	if (emulator->st > 0) {
-		emulator->st--;
-		if (!emulator->debug_state.debug_mode) {
-			beeper_toggle(&emulator->beeper, true);
-		}
-	} else {
-		beeper_toggle(&emulator->beeper, false);
-	}
+void send_command(EmulatorCommand command) {
+	emulation_thread_send(g_emulation, command);
 }
 
 bool handle_input(EmulatorState *emulator) {
@@ -643,35 +176,28 @@ bool handle_input(EmulatorState *emulator) {
 
 			switch (e.type) {
 			case SDL_KEYUP: {
-				update_keyboard_state(emulator, e.key.keysym.scancode, 0);
+				update_keyboard_state(e.key.keysym.scancode, 0);
 				break;
 			}
 			case SDL_KEYDOWN: {
 				switch (e.key.keysym.scancode) {
 				case SDL_SCANCODE_SPACE:
-					debug_state->debug_mode = !debug_state->debug_mode;
-					printf("%s emulator\n",
-					       debug_state->debug_mode ? "Paused" : "Unpaused");
+					send_command((EmulatorCommand){ .type = CMD_TOGGLE_PAUSE });
 					break;
 				case SDL_SCANCODE_G:
-					debug_state->skip_breakpoints =
-						!debug_state->skip_breakpoints;
+					send_command((EmulatorCommand){
+						.type = CMD_SET_SKIP_BREAKPOINTS,
+						.value = !debug_state->skip_breakpoints,
+					});
 					break;
 				case SDL_SCANCODE_H:
 					g_show_debug_ui = !g_show_debug_ui;
 					break;
 				case SDL_SCANCODE_N:
-					if (debug_state->debug_mode) {
-						execute(emulator, fetch_next(emulator, true));
-						if (emulator->cycle_count %
-							    emulator->cycles_per_frame ==
-						    0) {
-							handle_timers(emulator);
-						}
-					}
+					send_command((EmulatorCommand){ .type = CMD_STEP });
 					break;
 				default:
-					update_keyboard_state(emulator, e.key.keysym.scancode, 1);
+					update_keyboard_state(e.key.keysym.scancode, 1);
 					break;
 				}
 				break;
@@ -685,61 +211,97 @@ bool handle_input(EmulatorState *emulator) {
 	return true;
 }
 
-void update_keyboard_state(EmulatorState *emulator, SDL_Scancode scancode, uint8_t state) {
-	bool keypad_pressed = true;
+// Linear blend from `from` (amount = 0) to `to` (amount = 1)
+static struct nk_color blend_colours(struct nk_color from, struct nk_color to, float amount) {
+	return nk_rgb(from.r + (to.r - from.r) * amount, from.g + (to.g - from.g) * amount,
+		      from.b + (to.b - from.b) * amount);
+}
+
+// One tree node per call path, labelled with its share of the profiled cycles
+static void render_call_node(CallGraph *graph, int16_t index, uint64_t total) {
+	CallNode *node = &graph->nodes[index];
+	char text[96];
+	if (index == CALL_GRAPH_ROOT) {
+		snprintf(text, sizeof(text), "main  %.1f%% (%.1f%% self)", 100.0,
+			 100.0 * node->exclusive_cycles / total);
+	} else {
+		snprintf(text, sizeof(text), "sub_0x%03hx  %.1f%% (%.1f%% self)  x%llu",
+			 node->entry, 100.0 * node->inclusive_cycles / total,
+			 100.0 * node->exclusive_cycles / total, (unsigned long long)node->calls);
+	}
+
+	if (node->first_child == CALL_GRAPH_NONE) {
+		nk_label(g_ctx, text, NK_TEXT_LEFT);
+		return;
+	}
+	if (nk_tree_push_id(g_ctx, NK_TREE_NODE, text,
+			    index == CALL_GRAPH_ROOT ? NK_MAXIMIZED : NK_MINIMIZED, index)) {
+		for (int16_t child = node->first_child; child != CALL_GRAPH_NONE;
+		     child = graph->nodes[child].next_sibling) {
+			render_call_node(graph, child, total);
+		}
+		nk_tree_pop(g_ctx);
+	}
+}
+
+void update_keyboard_state(SDL_Scancode scancode, uint8_t state) {
+	int key = -1;
 	switch (scancode) {
 	case SDL_SCANCODE_1:
-		emulator->keyboard[0x1] = state;
+		key = 0x1;
 		break;
 	case SDL_SCANCODE_2:
-		emulator->keyboard[0x2] = state;
+		key = 0x2;
 		break;
 	case SDL_SCANCODE_3:
-		emulator->keyboard[0x3] = state;
+		key = 0x3;
 		break;
 	case SDL_SCANCODE_4:
-		emulator->keyboard[0xC] = state;
+		key = 0xC;
 		break;
 	case SDL_SCANCODE_Q:
-		emulator->keyboard[0x4] = state;
+		key = 0x4;
 		break;
 	case SDL_SCANCODE_W:
-		emulator->keyboard[0x5] = state;
+		key = 0x5;
 		break;
 	case SDL_SCANCODE_E:
-		emulator->keyboard[0x6] = state;
+		key = 0x6;
 		break;
 	case SDL_SCANCODE_R:
-		emulator->keyboard[0xD] = state;
+		key = 0xD;
 		break;
 	case SDL_SCANCODE_A:
-		emulator->keyboard[0x7] = state;
+		key = 0x7;
 		break;
 	case SDL_SCANCODE_S:
-		emulator->keyboard[0x8] = state;
+		key = 0x8;
 		break;
 	case SDL_SCANCODE_D:
-		emulator->keyboard[0x9] = state;
+		key = 0x9;
 		break;
 	case SDL_SCANCODE_F:
-		emulator->keyboard[0xE] = state;
+		key = 0xE;
 		break;
 	case SDL_SCANCODE_Z:
-		emulator->keyboard[0xA] = state;
+		key = 0xA;
 		break;
 	case SDL_SCANCODE_X:
-		emulator->keyboard[0x0] = state;
+		key = 0x0;
 		break;
 	case SDL_SCANCODE_C:
-		emulator->keyboard[0xB] = state;
+		key = 0xB;
 		break;
 	case SDL_SCANCODE_V:
-		emulator->keyboard[0xF] = state;
+		key = 0xF;
 		break;
 	default:
-		keypad_pressed = false;
 		break;
 	}
+
+	if (key >= 0) {
+		send_command((EmulatorCommand){ .type = CMD_KEY, .arg = key, .value = state });
+	}
 }
 
 void render(EmulatorState *emulator) {
@@ -760,8 +322,6 @@ void render(EmulatorState *emulator) {
 	// TODO: Change pixel colours
 	// TODO: Shows sprites in memory
 	// TODO: Save and load emulator state (snapshots)
-	// TODO: Call graph
-	// TODO: Decompiler output
 	// TODO: Audio waveform
 	if (g_show_debug_ui) {
 		const int window_flags = NK_WINDOW_BORDER | NK_WINDOW_TITLE |
@@ -773,6 +333,8 @@ void render(EmulatorState *emulator) {
 		struct nk_color active_colour = { 230, 150, 150, 255 };
 		struct nk_color error_colour = { 255, 80, 80, 255 };
 		struct nk_color pc_colour = { 80, 80, 85, 255 };
+		struct nk_color hot_colour = { 200, 60, 40, 255 };
+		struct nk_color read_colour = { 40, 90, 200, 255 };
 
 		// Bounding boxes
 		struct nk_rect emu_config_rect = nk_rect(0, 0, 250, 250);
@@ -789,6 +351,12 @@ void render(EmulatorState *emulator) {
 						    disasm_rect.x - memory_rect.x - memory_rect.w,
 						    memory_rect.h);
 
+		struct nk_rect call_graph_rect =
+			nk_rect(registers_rect.x, registers_rect.y + registers_rect.h,
+				registers_rect.w,
+				memory_rect.y - registers_rect.y - registers_rect.h);
+		struct nk_rect decompiled_rect = call_graph_rect;
+
 		emu_x = registers_rect.x + (registers_rect.w - emu_width) / 2;
 		emu_y = registers_rect.y + registers_rect.h;
 
@@ -802,24 +370,29 @@ void render(EmulatorState *emulator) {
 			nk_bool jumping = emulator->configuration & CONFIG_CHIP8_JUMPING;
 			nk_bool memory = emulator->configuration & CONFIG_CHIP8_MEMORY;
 
+			uint8_t configuration = emulator->configuration;
 			nk_layout_row_dynamic(g_ctx, default_line_height, 2);
 			if (nk_checkbox_label(g_ctx, "VF Reset", &vf_reset)) {
-				emulator->configuration ^= CONFIG_CHIP8_VF_RESET;
+				configuration ^= CONFIG_CHIP8_VF_RESET;
 			}
 			if (nk_checkbox_label(g_ctx, "Display Wait", &disp_wait)) {
-				emulator->configuration ^= CONFIG_CHIP8_DISP_WAIT;
+				configuration ^= CONFIG_CHIP8_DISP_WAIT;
 			}
 			if (nk_checkbox_label(g_ctx, "Clipping", &clipping)) {
-				emulator->configuration ^= CONFIG_CHIP8_CLIPPING;
+				configuration ^= CONFIG_CHIP8_CLIPPING;
 			}
 			if (nk_checkbox_label(g_ctx, "Shifting", &shifting)) {
-				emulator->configuration ^= CONFIG_CHIP8_SHIFTING;
+				configuration ^= CONFIG_CHIP8_SHIFTING;
 			}
 			if (nk_checkbox_label(g_ctx, "Jumping", &jumping)) {
-				emulator->configuration ^= CONFIG_CHIP8_JUMPING;
+				configuration ^= CONFIG_CHIP8_JUMPING;
 			}
 			if (nk_checkbox_label(g_ctx, "Memory", &memory)) {
-				emulator->configuration ^= CONFIG_CHIP8_MEMORY;
+				configuration ^= CONFIG_CHIP8_MEMORY;
+			}
+			if (configuration != emulator->configuration) {
+				send_command((EmulatorCommand){ .type = CMD_SET_CONFIGURATION,
+								.value = configuration });
 			}
 
 			int selected_cpf = emulator->cycles_per_frame;
@@ -828,7 +401,10 @@ void render(EmulatorState *emulator) {
 			nk_combobox(g_ctx, CYCLES_PER_FRAME_STR,
 				    sizeof(CYCLES_PER_FRAME) / sizeof(int), &selected_cpf, 20,
 				    nk_vec2(100, 225));
-			emulator->cycles_per_frame = selected_cpf;
+			if (selected_cpf != emulator->cycles_per_frame) {
+				send_command((EmulatorCommand){ .type = CMD_SET_CYCLES_PER_FRAME,
+								.value = selected_cpf });
+			}
 
 			nk_layout_row_dynamic(g_ctx, 10, 1);
 			nk_spacer(g_ctx);
@@ -837,10 +413,10 @@ void render(EmulatorState *emulator) {
 			nk_label(g_ctx, "Volume", NK_TEXT_LEFT);
 			static float volume = -1;
 			if (volume == -1) {
-				volume = (float)emulator->beeper.volume;
+				volume = (float)g_beeper.volume;
 			}
 			nk_slider_float(g_ctx, 0, &volume, 1, 0.1);
-			emulator->beeper.volume = volume;
+			g_beeper.volume = volume;
 		}
 		nk_end(g_ctx);
 
@@ -873,6 +449,12 @@ void render(EmulatorState *emulator) {
 			int line_height = 30;
 			char header_offsets[] = "0123456789ABCDEF";
 
+			// While profiling, bytes are shaded blue if only read and red if written
+			uint64_t max_count = debug_state->profiling ?
+						     max_memory_access_count(debug_state) :
+						     0;
+			struct nk_color colour = g_ctx->style.selectable.normal.data.color;
+
 			// Header
 			nk_layout_space_begin(g_ctx, NK_STATIC, 0, 18);
 			nk_layout_space_push(g_ctx, nk_rect(x, y, addr_width, line_height));
@@ -905,24 +487,44 @@ void render(EmulatorState *emulator) {
 					x += addr_width;
 				}
 
+				uint64_t writes = debug_state->memory_writes[i];
+				uint64_t count = debug_state->memory_reads[i] +
+						 debug_state->sprite_reads[i] + writes;
+				if (max_count && count) {
+					g_ctx->style.selectable.normal.data.color = blend_colours(
+						colour, writes ? hot_colour : read_colour,
+						(float)count / max_count);
+				}
+
 				snprintf(byte_str, sizeof(byte_str), "%02hx", byte);
 				nk_layout_space_push(g_ctx, nk_rect(x, y, byte_width, line_height));
-				nk_selectable_label(g_ctx, byte_str, NK_TEXT_CENTERED,
-						    debug_state->memory_breakpoints + i);
+				if (nk_selectable_label(g_ctx, byte_str, NK_TEXT_CENTERED,
+							debug_state->memory_breakpoints + i)) {
+					send_command((EmulatorCommand){
+						.type = CMD_TOGGLE_MEMORY_BREAKPOINT, .arg = i });
+				}
+				g_ctx->style.selectable.normal.data.color = colour;
 
 				x += byte_width;
 
 				if ((i + 1) % 16 == 0) {
 					x += 10;
 					for (int j = 0; j < sizeof(ascii) - 1; ++j) {
+						uint16_t addr = i - 15 + j;
+						bool *breakpoint =
+							&debug_state->memory_breakpoints[addr];
 						nk_layout_space_push(g_ctx,
 								     nk_rect(x, y, char_width,
 									     line_height));
-						nk_selectable_text(g_ctx, ascii + j, 1,
-								   NK_TEXT_ALIGN_MIDDLE |
-									   NK_TEXT_ALIGN_LEFT,
-								   debug_state->memory_breakpoints +
-									   i - 15 + j);
+						if (nk_selectable_text(g_ctx, ascii + j, 1,
+								       NK_TEXT_ALIGN_MIDDLE |
+									       NK_TEXT_ALIGN_LEFT,
+								       breakpoint)) {
+							EmulatorCommand toggle = {
+								CMD_TOGGLE_MEMORY_BREAKPOINT, addr
+							};
+							send_command(toggle);
+						}
 						x += char_width;
 					}
 				}
@@ -934,22 +536,42 @@ void render(EmulatorState *emulator) {
 		if (nk_begin(g_ctx, "Debug", debug_rect, window_flags)) {
 			// TODO: Conditional breakpoints, e.g., break on all DRW
 			// instructions
-			// TODO: Step in and out of functions
 			// TODO: Separate out debugging logic and state
 			// TODO: Timeless debugging like rr
 			nk_layout_row_dynamic(g_ctx, default_line_height, 2);
 			if (nk_button_label(g_ctx, debug_state->debug_mode ? "Resume" : "Pause")) {
-				debug_state->debug_mode = !debug_state->debug_mode;
+				send_command((EmulatorCommand){ .type = CMD_TOGGLE_PAUSE });
 			}
 			if (nk_button_label(g_ctx, "Step")) {
-				execute(emulator, fetch_next(emulator, true));
+				send_command((EmulatorCommand){ .type = CMD_STEP });
 			}
-			nk_layout_row_dynamic(g_ctx, default_line_height, 1);
-			nk_checkbox_label(g_ctx, "Ignore BPs", &debug_state->skip_breakpoints);
+			if (nk_button_label(g_ctx, "Step Over")) {
+				send_command((EmulatorCommand){ .type = CMD_STEP_OVER });
+			}
+			if (nk_button_label(g_ctx, "Step Out")) {
+				send_command((EmulatorCommand){ .type = CMD_STEP_OUT });
+			}
+			nk_layout_row_dynamic(g_ctx, default_line_height, 2);
+			nk_bool *skip_breakpoints = &debug_state->skip_breakpoints;
+			if (nk_checkbox_label(g_ctx, "Ignore BPs", skip_breakpoints)) {
+				send_command((EmulatorCommand){
+					.type = CMD_SET_SKIP_BREAKPOINTS,
+					.value = *skip_breakpoints,
+				});
+			}
+
+			nk_bool *profiling = &debug_state->profiling;
+			if (nk_checkbox_label(g_ctx, "Profile", profiling)) {
+				send_command((EmulatorCommand){
+					.type = CMD_SET_PROFILING,
+					.value = *profiling,
+				});
+			}
+			nk_checkbox_label(g_ctx, "Decompile", &g_show_decompilation);
 
 			nk_layout_row_dynamic(g_ctx, default_line_height, 1);
 			if (nk_button_label(g_ctx, "Reset")) {
-				reset_state(emulator);
+				send_command((EmulatorCommand){ .type = CMD_RESET });
 			}
 
 			nk_layout_row_dynamic(g_ctx, 3, 1);
@@ -973,7 +595,12 @@ void render(EmulatorState *emulator) {
 					if (access(rom_path, F_OK) != -1) {
 						size_t rom_size;
 						uint8_t *rom = read_rom(rom_path, &rom_size);
-						load_rom(emulator, rom, rom_size, rom_path);
+						send_command((EmulatorCommand){
+							.type = CMD_LOAD_ROM,
+							.rom = rom,
+							.rom_size = rom_size,
+							.rom_path = strdup(rom_path),
+						});
 						invalid = false;
 					} else {
 						invalid = true;
@@ -1025,6 +652,12 @@ void render(EmulatorState *emulator) {
 			g_ctx->style.selectable.text_hover_active = active_colour;
 			g_ctx->style.selectable.text_hover = active_colour;
 
+			// Instructions are shaded by how often they've run relative to the hottest,
+			// or when not profiling, by how often they did the last time the ROM was
+			uint64_t max_count = debug_state->profiling ?
+						     max_execution_count(debug_state) :
+						     0;
+
 			size_t skipped = 0;
 			bool blanked = false;
 			for (uint16_t ip = 0; ip < debug_state->disassembly.abook_length; ++ip) {
@@ -1050,12 +683,25 @@ void render(EmulatorState *emulator) {
 						 .instructions[lookup->array_offset];
 
 				static uint16_t prev_pc = 0;
+				char asm_text[INST_TEXT_SIZE];
 				snprintf(text, sizeof(text), "0x%08hx  %s",
 					 instruction->address + debug_state->disassembly.base,
-					 instruction->asm_str);
+					 inst2text(instruction->instruction, asm_text));
 
 				// Highlight instructions with breakpoints
 				struct nk_color colour = g_ctx->style.selectable.normal.data.color;
+				uint16_t addr = debug_state->disassembly.base + ip;
+				if (max_count && debug_state->execution_counts[addr]) {
+					float heat = (float)debug_state->execution_counts[addr] /
+						     max_count;
+					g_ctx->style.selectable.normal.data.color =
+						blend_colours(colour, hot_colour, heat);
+				} else if (!debug_state->profiling &&
+					   debug_state->cached_heat[addr]) {
+					float heat = debug_state->cached_heat[addr] / 255.0f;
+					g_ctx->style.selectable.normal.data.color =
+						blend_colours(colour, hot_colour, heat);
+				}
 				if (emulator->pc ==
 				    instruction->address + debug_state->disassembly.base) {
 					g_ctx->style.selectable.normal.data.color = pc_colour;
@@ -1069,21 +715,73 @@ void render(EmulatorState *emulator) {
 					}
 				}
 
-				uint16_t addr = debug_state->disassembly.base + ip;
 				if (nk_selectable_label(g_ctx, text, NK_TEXT_LEFT,
 							debug_state->instruction_breakpoints +
 								addr)) {
-					printf("Breakpoint %s @ 0x%hx!\n",
-					       debug_state->instruction_breakpoints[addr] ?
-						       "enabled" :
-						       "disabled",
-					       addr);
-					fflush(stdout);
+					send_command((EmulatorCommand){
+						.type = CMD_TOGGLE_INSTRUCTION_BREAKPOINT,
+						.arg = addr });
 				}
 				g_ctx->style.selectable.normal.data.color = colour;
 			}
 		}
 		nk_end(g_ctx);
+
+		// Floats over the display while profiling, as there's no room for it
+		if (debug_state->profiling &&
+		    nk_begin(g_ctx, "Call Graph", call_graph_rect,
+			     NK_WINDOW_BORDER | NK_WINDOW_TITLE | NK_WINDOW_MOVABLE |
+				     NK_WINDOW_SCALABLE | NK_WINDOW_MINIMIZABLE)) {
+			// The open calls are closed on a copy so the totals include them
+			static CallGraph settled;
+			settled = debug_state->call_graph;
+			call_graph_settle(&settled, emulator->cycle_count);
+			uint64_t total = settled.nodes[CALL_GRAPH_ROOT].inclusive_cycles;
+
+			nk_layout_row_dynamic(g_ctx, 20, 1);
+			if (!settled.length || !total) {
+				nk_label(g_ctx, "No cycles profiled yet", NK_TEXT_LEFT);
+			} else {
+				render_call_node(&settled, CALL_GRAPH_ROOT, total);
+			}
+			if (settled.dropped_calls) {
+				nk_labelf(g_ctx, NK_TEXT_LEFT, "%llu calls too deep to track",
+					  (unsigned long long)settled.dropped_calls);
+			}
+		}
+		if (debug_state->profiling) {
+			nk_end(g_ctx);
+		}
+
+		// Decompiling takes milliseconds, so it's only redone when new code is found
+		if (g_show_decompilation &&
+		    nk_begin(g_ctx, "Decompiled", decompiled_rect,
+			     NK_WINDOW_BORDER | NK_WINDOW_TITLE | NK_WINDOW_MOVABLE |
+				     NK_WINDOW_SCALABLE | NK_WINDOW_MINIMIZABLE)) {
+			if (g_decompilation_stale) {
+				free_decompilation(&g_decompilation);
+				g_decompilation = decompile(&g_disassembly,
+							    emulator->memory + g_disassembly.base,
+							    g_disassembly.abook_length);
+				g_decompilation_stale = false;
+			}
+
+			nk_layout_row_dynamic(g_ctx, 20, 1);
+			for (size_t i = 0; i < (size_t)arrlen(g_decompilation.lines); ++i) {
+				DecompiledLine *line = &g_decompilation.lines[i];
+				char text[256];
+				snprintf(text, sizeof(text), "%*s%s", line->depth * 4, "",
+					 line->text);
+				if (line->address == emulator->pc) {
+					nk_label_colored(g_ctx, text, NK_TEXT_LEFT, active_colour);
+				} else {
+					nk_label(g_ctx, text, NK_TEXT_LEFT);
+				}
+			}
+		}
+		if (g_show_decompilation) {
+			nk_end(g_ctx);
+		}
 	} else {
 		SDL_SetWindowSize(g_window, SCREEN_WIDTH, SCREEN_HEIGHT);
 	}
@@ -1145,6 +843,10 @@ static void beeper_callback(void *userdata, uint8_t *_stream, int _len) {
 	}
 }
 
+void update_beeper(EmulatorState *emulator) {
+	beeper_toggle(&g_beeper, emulator->sound_active && !emulator->debug_state.debug_mode);
+}
+
 void beeper_toggle(Beeper *beeper, bool on) {
 	if (!beeper->on && on) {
 		beeper->on = true;
@@ -1159,30 +861,7 @@ void beeper_toggle(Beeper *beeper, bool on) {
 	}
 }
 
-void load_rom(EmulatorState *emulator, uint8_t *rom, size_t rom_size, char *rom_path) {
-	printf("[*] Loading ROM @ %s\n", rom_path);
-	if (emulator->rom) {
-		free(emulator->rom);
-	}
-	if (emulator->rom_path) {
-		free(emulator->rom_path);
-	}
-
-	if (rom_path) {
-		size_t path_len = strlen(rom_path);
-		emulator->rom_path = malloc(path_len);
-		memcpy(emulator->rom_path, rom_path, path_len);
-	} else {
-		emulator->rom_path = NULL;
-	}
-
-	emulator->rom = rom;
-	emulator->rom_size = rom_size;
-
-	reset_state(emulator);
-}
-
-void init_graphics(EmulatorState *emulator) {
+void init_graphics(void) {
 	SDL_SetHint(SDL_HINT_VIDEO_HIGHDPI_DISABLED, "0");
 	if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) {
 		fprintf(stderr, "[!] SDL could not initialise! SDL error: %s\n", SDL_GetError());
@@ -1232,7 +911,7 @@ void init_graphics(EmulatorState *emulator) {
 				nk_style_set_font(g_ctx, &font->handle);
 			}
 
-			init_beeper(&emulator->beeper);
+			init_beeper(&g_beeper);
 		}
 	}
 }
@@ -1263,139 +942,11 @@ void init_beeper(Beeper *beeper) {
 	}
 }
 
-void print_instruction_state(EmulatorState *emulator, Chip8Instruction instruction) {
-	switch (instruction_format(instruction_type(instruction))) {
-	case R_FORMAT:
-		printf("# V%hX = %02hhx, V%hX = %02hhx", instruction.rformat.rx,
-		       emulator->registers[instruction.rformat.rx], instruction.rformat.ry,
-		       emulator->registers[instruction.rformat.ry]);
-		break;
-	case I_FORMAT:
-		printf("# V%hX = %02hhx", instruction.iformat.reg,
-		       emulator->registers[instruction.iformat.reg]);
-		break;
-	case A_FORMAT:
-	case UNKNOWN_FORMAT:
-		break;
-	}
-}
-
-void dump_registers(EmulatorState *emulator) {
-	fprintf(stderr, "===== REGISTERS DUMP ====\n");
-	for (int i = 0; i < sizeof(emulator->registers); ++i) {
-		fprintf(stderr, "V%X = 0x%02hx  ", i, emulator->registers[i]);
-		if ((i + 1) % 4 == 0) {
-			fprintf(stderr, "\n");
-		}
-	}
-	fprintf(stderr, "SP = 0x%02hx  ", emulator->sp);
-	fprintf(stderr, "DT = 0x%02hx  ", emulator->dt);
-	fprintf(stderr, "ST = 0x%02hx\n", emulator->st);
-	fprintf(stderr, "VI = 0x%04hx\n", emulator->vi);
-	fprintf(stderr, "PC = 0x%04hx\n", emulator->pc);
-}
-
-void dump_stack(EmulatorState *emulator) {
-	fprintf(stderr, "\n===== STACK DUMP ====\n");
-	for (int i = 0; i < EMULATOR_STACK_SIZE; ++i) {
-		fprintf(stderr, "[%02hhd] = 0x%03hx  ", i, emulator->stack[i]);
-		if (i == emulator->sp) {
-			printf("<-- SP  ");
-		}
-
-		if ((i + 1) % 2 == 0) {
-			printf("\n");
-		}
-	}
-}
-
-static inline void dump_memory(EmulatorState *emulator) {
-	fprintf(stderr, "\n===== MEMORY DUMP ====\n");
-	if (!emulator->debug_state.latest_memory_dump) {
-		refresh_dump(emulator);
-	}
-	printf("%s\n", emulator->debug_state.latest_memory_dump);
-}
-
-void refresh_dump(EmulatorState *emulator) {
-	DebugState *debug_state = &emulator->debug_state;
-	if (debug_state->written_to_memory || !debug_state->latest_memory_dump) {
-		if (debug_state->latest_memory_dump) {
-			sdsfree(debug_state->latest_memory_dump);
-		}
-		debug_state->latest_memory_dump =
-			hexdump(emulator->memory, EMULATOR_MEMORY_SIZE, 0);
-		debug_state->written_to_memory = false;
-	}
-}
-
-void dump_state(EmulatorState *emulator) {
-	dump_registers(emulator);
-	dump_stack(emulator);
-	// dump_memory(emulator);
-}
-
-void reset_state(EmulatorState *emulator) {
-	free_disassembly(&emulator->debug_state.disassembly);
-
-	char *rom_path = emulator->rom_path;
-	uint8_t *rom = emulator->rom;
-	size_t rom_size = emulator->rom_size;
-	size_t config = emulator->configuration;
-	size_t cycles_per_frame = emulator->cycles_per_frame;
-
-	memset(emulator, 0, sizeof(*emulator));
-
-	emulator->rom_path = rom_path;
-	emulator->rom = rom;
-	emulator->rom_size = rom_size;
-	emulator->configuration = config;
-	emulator->cycles_per_frame = cycles_per_frame;
-	emulator->pc = PROG_BASE;
-
-	const uint8_t emulator_fonts[80] = {
-		// https://tobiasvl.github.io/blog/write-a-chip-8-emulator/#fx29-font-character
-		0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-		0x20, 0x60, 0x20, 0x20, 0x70, // 1
-		0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-		0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-		0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-		0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-		0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-		0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-		0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-		0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-		0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-		0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-		0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-		0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-		0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-		0xF0, 0x80, 0xF0, 0x80, 0x80, // F
-	};
-
-	memcpy(emulator->memory + FONT_BASE_ADDR, emulator_fonts, sizeof(emulator_fonts));
-
-	memcpy(emulator->memory + PROG_BASE, emulator->rom, emulator->rom_size);
-
-	emulator->debug_state.written_to_memory = false;
-	emulator->debug_state.latest_memory_dump =
-		hexdump(emulator->memory, EMULATOR_MEMORY_SIZE, 0);
-	emulator->debug_state.disassembly = disassemble_rd(
-		emulator->memory + PROG_BASE, EMULATOR_MEMORY_SIZE - PROG_BASE, PROG_BASE, 0);
-}
-
-void free_emulator(EmulatorState *emulator) {
-	free_graphics(emulator);
-	if (emulator->rom) {
-		free(emulator->rom);
-	}
-}
-
-void free_graphics(EmulatorState *emulator) {
+void free_graphics(void) {
 	nk_sdl_shutdown();
 	SDL_DestroyTexture(g_texture);
 	SDL_DestroyRenderer(g_renderer);
 	SDL_DestroyWindow(g_window);
-	SDL_CloseAudioDevice(emulator->beeper.id);
+	SDL_CloseAudioDevice(g_beeper.id);
 	SDL_Quit();
 }
@@ -0,0 +1,524 @@
+#include "gdb_server.h"
+#include "core.h"
+#include "emulation_thread.h"
+#include "log.h"
+#include "sds.h"
+
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define GDB_INTERRUPT 0x03
+#define GDB_SIGINT 2
+#define GDB_SIGTRAP 5
+
+typedef struct GdbConnection {
+	int fd;
+	EmulationThread *emulation;
+	bool no_ack; // After QStartNoAckMode
+	uint8_t input[GDB_PACKET_SIZE];
+	size_t input_start;
+	size_t input_length;
+	sds last_packet; // For resending when the client NAKs it
+} GdbConnection;
+
+static const char HEX_DIGITS[] = "0123456789abcdef";
+
+static int hex_value(char c) {
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	}
+	c = tolower(c);
+	return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+static sds cat_hex_byte(sds out, uint8_t byte) {
+	char hex[2] = { HEX_DIGITS[byte >> 4], HEX_DIGITS[byte & 0xF] };
+	return sdscatlen(out, hex, 2);
+}
+
+// Decodes `length` bytes of hex, false if any digit is invalid
+static bool parse_hex_bytes(const char *hex, uint8_t *out, size_t length) {
+	for (size_t i = 0; i < length; ++i) {
+		int high = hex_value(hex[2 * i]);
+		int low = high < 0 ? -1 : hex_value(hex[2 * i + 1]);
+		if (low < 0) {
+			return false;
+		}
+		out[i] = high << 4 | low;
+	}
+	return true;
+}
+
+// Returns a byte from the client, -1 once it disconnects or -2 after
+// `timeout_ms` with nothing to read (-1 waits forever)
+static int read_byte(GdbConnection *connection, int timeout_ms) {
+	if (connection->input_start == connection->input_length) {
+		struct pollfd fd = { .fd = connection->fd, .events = POLLIN };
+		int ready = poll(&fd, 1, timeout_ms);
+		if (ready == 0) {
+			return -2;
+		}
+		ssize_t length = ready < 0 ? -1 :
+					     read(connection->fd, connection->input,
+						  sizeof(connection->input));
+		if (length <= 0) {
+			return -1;
+		}
+		connection->input_start = 0;
+		connection->input_length = length;
+	}
+	return connection->input[connection->input_start++];
+}
+
+static bool write_all(int fd, const char *data, size_t length) {
+	while (length) {
+		// A client that hung up mustn't kill the emulator with SIGPIPE
+		ssize_t written = send(fd, data, length, MSG_NOSIGNAL);
+		if (written <= 0) {
+			return false;
+		}
+		data += written;
+		length -= written;
+	}
+	return true;
+}
+
+static bool send_packet(GdbConnection *connection, const char *data) {
+	uint8_t checksum = 0;
+	for (const char *c = data; *c; ++c) {
+		checksum += *c;
+	}
+	sdsfree(connection->last_packet);
+	connection->last_packet = sdscatprintf(sdsempty(), "$%s#%02x", data, checksum);
+	return write_all(connection->fd, connection->last_packet, sdslen(connection->last_packet));
+}
+
+// Reads the next packet's payload, acknowledging it. NULL once the client
+// disconnects.
+static sds read_packet(GdbConnection *connection) {
+	for (;;) {
+		int c = read_byte(connection, -1);
+		if (c < 0) {
+			return NULL;
+		}
+		if (c == '-' && connection->last_packet) {
+			write_all(connection->fd, connection->last_packet,
+				  sdslen(connection->last_packet));
+		}
+		if (c != '$') {
+			continue; // Acks, and interrupts while already stopped
+		}
+
+		sds payload = sdsempty();
+		uint8_t checksum = 0;
+		while ((c = read_byte(connection, -1)) >= 0 && c != '#') {
+			char byte = c;
+			payload = sdscatlen(payload, &byte, 1);
+			checksum += byte;
+		}
+		int high = c < 0 ? -1 : read_byte(connection, -1);
+		int low = high < 0 ? -1 : read_byte(connection, -1);
+		if (low < 0) {
+			sdsfree(payload);
+			return NULL;
+		}
+
+		if (connection->no_ack) {
+			return payload;
+		}
+		if (hex_value(high) == checksum >> 4 && hex_value(low) == (checksum & 0xF)) {
+			write_all(connection->fd, "+", 1);
+			return payload;
+		}
+		write_all(connection->fd, "-", 1);
+		sdsfree(payload);
+	}
+}
+
+// Queues a command, waiting for room rather than dropping it
+static void send_command(GdbConnection *connection, EmulatorCommand command) {
+	while (!command_ring_push(&connection->emulation->commands, command)) {
+		struct timespec wait = { 0, NANOSECONDS_PER_SECOND / 1000 };
+		nanosleep(&wait, NULL);
+	}
+}
+
+static int register_size(EmulatorRegister reg) {
+	return reg == REG_I || reg == REG_PC ? 2 : 1;
+}
+
+static uint16_t register_value(EmulatorState *emulator, EmulatorRegister reg) {
+	if (reg < REG_I) {
+		return emulator->registers[reg - REG_V0];
+	}
+	switch (reg) {
+	case REG_I:
+		return emulator->vi;
+	case REG_PC:
+		return emulator->pc;
+	case REG_SP:
+		return emulator->sp;
+	case REG_DT:
+		return emulator->dt;
+	case REG_ST:
+		return emulator->st;
+	default:
+		return 0;
+	}
+}
+
+static sds cat_register(sds out, EmulatorState *emulator, EmulatorRegister reg) {
+	uint16_t value = register_value(emulator, reg);
+	if (register_size(reg) == 2) {
+		out = cat_hex_byte(out, value >> 8);
+	}
+	return cat_hex_byte(out, value);
+}
+
+// Parses one register's hex, returning the number of characters used or 0
+static int parse_register(const char *hex, EmulatorRegister reg, uint16_t *value) {
+	uint8_t bytes[2];
+	int size = register_size(reg);
+	if (strlen(hex) < (size_t)size * 2 || !parse_hex_bytes(hex, bytes, size)) {
+		return 0;
+	}
+	*value = size == 2 ? bytes[0] << 8 | bytes[1] : bytes[0];
+	return size * 2;
+}
+
+static sds target_xml(void) {
+	sds xml = sdsnew("<?xml version=\"1.0\"?>\n"
+			 "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">\n"
+			 "<target version=\"1.0\">\n"
+			 "<feature name=\"org.eo8.chip8\">\n");
+	for (int i = 0; i < 16; ++i) {
+		xml = sdscatprintf(xml, "<reg name=\"v%x\" bitsize=\"8\" regnum=\"%d\"/>\n", i,
+				   REG_V0 + i);
+	}
+	return sdscat(xml, "<reg name=\"i\" bitsize=\"16\" type=\"data_ptr\"/>\n"
+			   "<reg name=\"pc\" bitsize=\"16\" type=\"code_ptr\"/>\n"
+			   "<reg name=\"sp\" bitsize=\"8\"/>\n"
+			   "<reg name=\"dt\" bitsize=\"8\"/>\n"
+			   "<reg name=\"st\" bitsize=\"8\"/>\n"
+			   "</feature>\n"
+			   "</target>\n");
+}
+
+// qXfer:features:read:target.xml:offset,length
+static sds read_features(const char *args) {
+	const char *annex = "target.xml:";
+	if (strncmp(args, annex, strlen(annex)) != 0) {
+		return sdsnew("E00");
+	}
+	char *end;
+	size_t offset = strtoul(args + strlen(annex), &end, 16);
+	size_t length = *end == ',' ? strtoul(end + 1, NULL, 16) : 0;
+
+	sds xml = target_xml();
+	sds reply;
+	if (offset >= sdslen(xml)) {
+		reply = sdsnew("l");
+	} else {
+		size_t remaining = sdslen(xml) - offset;
+		bool last = remaining <= length;
+		reply = sdscatlen(sdsnew(last ? "l" : "m"), xml + offset,
+				  last ? remaining : length);
+	}
+	sdsfree(xml);
+	return reply;
+}
+
+// Runs until the emulator stops by itself or the client interrupts it, and
+// returns the stop reply. NULL if the client disconnects meanwhile.
+static sds wait_for_stop(GdbConnection *connection) {
+	for (;;) {
+		EmulatorState *emulator = emulation_thread_sync(connection->emulation);
+		if (emulator->debug_state.debug_mode) {
+			return sdscatprintf(sdsempty(), "S%02x", GDB_SIGTRAP);
+		}
+
+		int c = read_byte(connection, 1000 / TARGET_HZ);
+		if (c == -1) {
+			return NULL;
+		}
+		if (c == GDB_INTERRUPT) {
+			send_command(connection,
+				     (EmulatorCommand){ .type = CMD_SET_PAUSED, .value = true });
+			emulation_thread_sync(connection->emulation);
+			return sdscatprintf(sdsempty(), "S%02x", GDB_SIGINT);
+		}
+	}
+}
+
+// Z/z packets: type,addr,kind. Software and hardware breakpoints both use the
+// core's instruction breakpoints, and every kind of watchpoint its memory
+// breakpoints, which fire on reads and writes alike.
+static sds set_breakpoint(GdbConnection *connection, const char *args, bool enabled) {
+	char *end;
+	unsigned long type = strtoul(args, &end, 10);
+	unsigned long addr = *end == ',' ? strtoul(end + 1, &end, 16) : EMULATOR_MEMORY_SIZE;
+	unsigned long length = *end == ',' ? strtoul(end + 1, NULL, 16) : 1;
+	if (type > 4) {
+		return sdsempty(); // Unsupported
+	}
+	if (addr >= EMULATOR_MEMORY_SIZE) {
+		return sdsnew("E01");
+	}
+
+	if (type <= 1) {
+		send_command(connection, (EmulatorCommand){ .type = CMD_SET_INSTRUCTION_BREAKPOINT,
+							    .arg = addr,
+							    .value = enabled });
+		return sdsnew("OK");
+	}
+	for (unsigned long i = 0; i < length && addr + i < EMULATOR_MEMORY_SIZE; ++i) {
+		send_command(connection, (EmulatorCommand){ .type = CMD_SET_MEMORY_BREAKPOINT,
+							    .arg = addr + i,
+							    .value = enabled });
+	}
+	return sdsnew("OK");
+}
+
+// Handles a packet, returning the reply or NULL to end the session. `quit`
+// is set when the client asks to kill the target.
+static sds handle_packet(GdbConnection *connection, sds packet, bool *quit) {
+	EmulatorState *emulator = emulation_thread_sync(connection->emulation);
+	char *args = packet + 1;
+	char *end;
+
+	switch (packet[0]) {
+	case '?':
+		return sdscatprintf(sdsempty(), "S%02x", GDB_SIGTRAP);
+	case 'g': {
+		sds reply = sdsempty();
+		for (EmulatorRegister reg = 0; reg < REG_COUNT; ++reg) {
+			reply = cat_register(reply, emulator, reg);
+		}
+		return reply;
+	}
+	case 'G':
+		for (EmulatorRegister reg = 0; reg < REG_COUNT; ++reg) {
+			uint16_t value;
+			int used = parse_register(args, reg, &value);
+			if (!used) {
+				return sdsnew("E01");
+			}
+			args += used;
+			send_command(connection, (EmulatorCommand){ .type = CMD_SET_REGISTER,
+								    .arg = value,
+								    .value = reg });
+		}
+		return sdsnew("OK");
+	case 'p': {
+		unsigned long reg = strtoul(args, NULL, 16);
+		return reg < REG_COUNT ? cat_register(sdsempty(), emulator, reg) : sdsnew("E01");
+	}
+	case 'P': {
+		unsigned long reg = strtoul(args, &end, 16);
+		uint16_t value;
+		if (reg >= REG_COUNT || *end != '=' || !parse_register(end + 1, reg, &value)) {
+			return sdsnew("E01");
+		}
+		send_command(connection, (EmulatorCommand){ .type = CMD_SET_REGISTER,
+							    .arg = value,
+							    .value = reg });
+		return sdsnew("OK");
+	}
+	case 'm': {
+		unsigned long addr = strtoul(args, &end, 16);
+		unsigned long length = *end == ',' ? strtoul(end + 1, NULL, 16) : 0;
+		if (addr >= EMULATOR_MEMORY_SIZE) {
+			return sdsnew("E01");
+		}
+		// Short reads at the end of memory are allowed
+		sds reply = sdsempty();
+		for (unsigned long i = 0; i < length && addr + i < EMULATOR_MEMORY_SIZE; ++i) {
+			reply = cat_hex_byte(reply, emulator->memory[addr + i]);
+		}
+		return reply;
+	}
+	case 'M': {
+		unsigned long addr = strtoul(args, &end, 16);
+		unsigned long length = *end == ',' ? strtoul(end + 1, &end, 16) : 0;
+		if (*end != ':' || addr + length > EMULATOR_MEMORY_SIZE ||
+		    strlen(end + 1) < 2 * length) {
+			return sdsnew("E01");
+		}
+		uint8_t bytes[EMULATOR_MEMORY_SIZE];
+		if (!parse_hex_bytes(end + 1, bytes, length)) {
+			return sdsnew("E01");
+		}
+		for (unsigned long i = 0; i < length; ++i) {
+			send_command(connection, (EmulatorCommand){ .type = CMD_WRITE_MEMORY,
+								    .arg = addr + i,
+								    .value = bytes[i] });
+		}
+		return sdsnew("OK");
+	}
+	case 'c':
+	case 's':
+		if (*args) {
+			send_command(connection, (EmulatorCommand){ .type = CMD_SET_REGISTER,
+								    .arg = strtoul(args, NULL, 16),
+								    .value = REG_PC });
+		}
+		if (packet[0] == 's') {
+			send_command(connection, (EmulatorCommand){ .type = CMD_STEP });
+			emulation_thread_sync(connection->emulation);
+			return sdscatprintf(sdsempty(), "S%02x", GDB_SIGTRAP);
+		}
+		send_command(connection,
+			     (EmulatorCommand){ .type = CMD_SET_PAUSED, .value = false });
+		return wait_for_stop(connection);
+	case 'Z':
+	case 'z':
+		return set_breakpoint(connection, args, packet[0] == 'Z');
+	case 'D':
+		send_command(connection,
+			     (EmulatorCommand){ .type = CMD_SET_PAUSED, .value = false });
+		send_packet(connection, "OK");
+		return NULL;
+	case 'k':
+		*quit = true;
+		return NULL;
+	case 'H':
+	case 'T':
+		return sdsnew("OK");
+	case 'q':
+		if (strncmp(packet, "qSupported", 10) == 0) {
+			return sdscatprintf(sdsempty(),
+					    "PacketSize=%x;qXfer:features:read+;QStartNoAckMode+",
+					    GDB_PACKET_SIZE);
+		} else if (strncmp(packet, "qXfer:features:read:", 20) == 0) {
+			return read_features(packet + 20);
+		} else if (strcmp(packet, "qAttached") == 0) {
+			return sdsnew("1");
+		} else if (strcmp(packet, "qC") == 0) {
+			return sdsnew("QC1");
+		} else if (strcmp(packet, "qfThreadInfo") == 0) {
+			return sdsnew("m1");
+		} else if (strcmp(packet, "qsThreadInfo") == 0) {
+			return sdsnew("l");
+		}
+		return sdsempty();
+	case 'Q':
+		// Acks stop after the reply (see serve_connection())
+		return sdsnew(strcmp(packet, "QStartNoAckMode") == 0 ? "OK" : "");
+	default:
+		return sdsempty(); // Unsupported
+	}
+}
+
+// Serves one client until it detaches or disconnects. False if it asked to
+// kill the target.
+static bool serve_connection(EmulationThread *emulation, int fd) {
+	GdbConnection connection = { .fd = fd, .emulation = emulation };
+
+	// The target is stopped whenever a client is in control
+	send_command(&connection, (EmulatorCommand){ .type = CMD_SET_PAUSED, .value = true });
+
+	bool quit = false;
+	sds packet;
+	while ((packet = read_packet(&connection))) {
+		sds reply = handle_packet(&connection, packet, &quit);
+		if (reply) {
+			send_packet(&connection, reply);
+			connection.no_ack |= strcmp(packet, "QStartNoAckMode") == 0;
+		}
+		sdsfree(packet);
+		if (!reply) {
+			break;
+		}
+		sdsfree(reply);
+	}
+
+	sdsfree(connection.last_packet);
+	close(fd);
+	return !quit;
+}
+
+// Opens a listening socket, a Unix one if `address` isn't a port number
+static int listen_on(const char *address, bool *unix_socket) {
+	char *end;
+	unsigned long port = strtoul(address, &end, 10);
+	*unix_socket = *end != '\0' || end == address;
+
+	int fd;
+	if (*unix_socket) {
+		struct sockaddr_un addr = { .sun_family = AF_UNIX };
+		if (strlen(address) >= sizeof(addr.sun_path)) {
+			fprintf(stderr, "[!] GDB socket path is too long: %s\n", address);
+			return -1;
+		}
+		strcpy(addr.sun_path, address);
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd >= 0 && bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+			close(fd);
+			fd = -1;
+		}
+	} else {
+		struct sockaddr_in addr = {
+			.sin_family = AF_INET,
+			.sin_port = htons(port),
+			.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+		};
+		int reuse = 1;
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd >= 0) {
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+		}
+		if (fd >= 0 && (port > UINT16_MAX ||
+				bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)) {
+			close(fd);
+			fd = -1;
+		}
+	}
+
+	if (fd < 0 || listen(fd, 1) != 0) {
+		fprintf(stderr, "[!] Failed to listen for GDB on %s\n", address);
+		if (fd >= 0) {
+			close(fd);
+		}
+		return -1;
+	}
+	return fd;
+}
+
+bool gdb_serve(EmulationThread *emulation, const char *address) {
+	bool unix_socket;
+	int listener = listen_on(address, &unix_socket);
+	if (listener < 0) {
+		return false;
+	}
+	printf("Waiting for GDB on %s\n", address);
+	fflush(stdout); // Scripts wait for this line before connecting
+
+	bool serving = true;
+	while (serving) {
+		int fd = accept(listener, NULL, NULL);
+		if (fd < 0) {
+			fprintf(stderr, "[!] Failed to accept a GDB connection\n");
+			break;
+		}
+		log_info(LOG_CORE, "GDB client connected");
+		serving = serve_connection(emulation, fd);
+		log_info(LOG_CORE, "GDB client %s", serving ? "detached" : "killed the target");
+	}
+
+	close(listener);
+	if (unix_socket) {
+		unlink(address);
+	}
+	return true;
+}
@@ -0,0 +1,22 @@
+#ifndef GDB_SERVER_H
+#define GDB_SERVER_H
+
+#include "emulation_thread.h"
+
+#include <stdbool.h>
+
+// GDB remote serial protocol stub for a running emulation thread. It talks to
+// the emulator only through commands and snapshots, so breakpoints are the
+// core's own and nothing polls the socket while the emulator runs.
+//
+// Registers are numbered as in EmulatorRegister: V0-VF and SP, DT and ST are 8
+// bits, I and PC 16 bits, big endian like CHIP-8 memory. qXfer target.xml
+// describes them for clients that read it.
+
+#define GDB_PACKET_SIZE 4096
+
+// Serves clients one at a time on `address`, a TCP port on localhost or a Unix
+// socket path, until one sends a kill request. False if it can't listen.
+bool gdb_serve(EmulationThread *emulation, const char *address);
+
+#endif // !GDB_SERVER_H
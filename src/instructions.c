@@ -28,138 +28,187 @@ void print_instruction(Chip8Instruction instruction, Chip8InstructionFormat form
 	}
 }
 
-sds inst2str(Chip8Instruction instruction) {
-	sds buffer = sdsempty();
+static const char *INSTRUCTION_FORMS[CHIP8_UNKNOWN + 1] = {
+	[CHIP8_CLS] = "CLS",
+	[CHIP8_RET] = "RET",
+	[CHIP8_SYS_ADDR] = "SYS addr",
+	[CHIP8_JMP_ADDR] = "JMP addr",
+	[CHIP8_CALL_ADDR] = "CALL addr",
+	[CHIP8_SE_VX_BYTE] = "SE Vx, byte",
+	[CHIP8_SNE_VX_BYTE] = "SNE Vx, byte",
+	[CHIP8_SE_VX_VY] = "SE Vx, Vy",
+	[CHIP8_LD_VX_BYTE] = "LD Vx, byte",
+	[CHIP8_ADD_VX_BYTE] = "ADD Vx, byte",
+	[CHIP8_LD_VX_VY] = "LD Vx, Vy",
+	[CHIP8_OR_VX_VY] = "OR Vx, Vy",
+	[CHIP8_AND_VX_VY] = "AND Vx, Vy",
+	[CHIP8_XOR_VX_VY] = "XOR Vx, Vy",
+	[CHIP8_ADD_VX_VY] = "ADD Vx, Vy",
+	[CHIP8_SUB_VX_VY] = "SUB Vx, Vy",
+	[CHIP8_SHR_VX] = "SHR Vx",
+	[CHIP8_SUBN_VX_VY] = "SUBN Vx, Vy",
+	[CHIP8_SHL_VX] = "SHL Vx",
+	[CHIP8_SNE_VX_VY] = "SNE Vx, Vy",
+	[CHIP8_LD_I_ADDR] = "LD I, addr",
+	[CHIP8_JMP_V0_ADDR] = "JMP V0, addr",
+	[CHIP8_RND_VX_BYTE] = "RND Vx, byte",
+	[CHIP8_DRW_VX_VY_NIBBLE] = "DRW Vx, Vy, nibble",
+	[CHIP8_SKP_VX] = "SKP Vx",
+	[CHIP8_SKNP_VX] = "SKNP Vx",
+	[CHIP8_LD_VX_DT] = "LD Vx, DT",
+	[CHIP8_LD_VX_K] = "LD Vx, K",
+	[CHIP8_LD_DT_VX] = "LD DT, Vx",
+	[CHIP8_LD_ST_VX] = "LD ST, Vx",
+	[CHIP8_ADD_I_VX] = "ADD I, Vx",
+	[CHIP8_LD_F_VX] = "LD F, Vx",
+	[CHIP8_LD_B_VX] = "LD B, Vx",
+	[CHIP8_LD_I_VX] = "LD [I], Vx",
+	[CHIP8_LD_VX_I] = "LD Vx, [I]",
+	[CHIP8_UNKNOWN] = "???",
+};
+
+// The instruction's general form, e.g. "ADD Vx, byte"
+const char *instruction_form(Chip8InstructionType type) {
+	return INSTRUCTION_FORMS[type];
+}
 
+// Writes the instruction's assembly into `text`, which must hold INST_TEXT_SIZE
+// bytes, and returns it. Nothing is allocated, so it suits per-line rendering.
+const char *inst2text(Chip8Instruction instruction, char *text) {
 	switch (instruction_type(instruction)) {
 	case CHIP8_CLS:
-		memcpy(buffer, "CLS", 4);
+		strcpy(text, "CLS");
 		break;
 	case CHIP8_RET:
-		memcpy(buffer, "RET", 4);
+		strcpy(text, "RET");
 		break;
 	case CHIP8_SYS_ADDR:
-		buffer = sdscatprintf(buffer, "SYS %#03x", instruction.aformat.addr);
+		snprintf(text, INST_TEXT_SIZE, "SYS %#03x", instruction.aformat.addr);
 		break;
 	case CHIP8_JMP_ADDR:
-		buffer = sdscatprintf(buffer, "JMP %#03x", instruction.aformat.addr);
+		snprintf(text, INST_TEXT_SIZE, "JMP %#03x", instruction.aformat.addr);
 		break;
 	case CHIP8_CALL_ADDR:
-		buffer = sdscatprintf(buffer, "CALL %#03x", instruction.aformat.addr);
+		snprintf(text, INST_TEXT_SIZE, "CALL %#03x", instruction.aformat.addr);
 		break;
 	case CHIP8_SE_VX_BYTE:
-		buffer = sdscatprintf(buffer, "SE V%hX, %#02x", instruction.iformat.reg,
-				      instruction.iformat.imm);
+		snprintf(text, INST_TEXT_SIZE, "SE V%hX, %#02x", instruction.iformat.reg,
+			 instruction.iformat.imm);
 		break;
 	case CHIP8_SNE_VX_BYTE:
-		buffer = sdscatprintf(buffer, "SNE V%hX, %#02x", instruction.iformat.reg,
-				      instruction.iformat.imm);
+		snprintf(text, INST_TEXT_SIZE, "SNE V%hX, %#02x", instruction.iformat.reg,
+			 instruction.iformat.imm);
 		break;
 	case CHIP8_SE_VX_VY:
-		buffer = sdscatprintf(buffer, "SE V%hX, V%hX", instruction.rformat.rx,
-				      instruction.rformat.ry);
+		snprintf(text, INST_TEXT_SIZE, "SE V%hX, V%hX", instruction.rformat.rx,
+			 instruction.rformat.ry);
 		break;
 	case CHIP8_LD_VX_BYTE:
-		buffer = sdscatprintf(buffer, "LD V%hX, %#02x", instruction.iformat.reg,
-				      instruction.iformat.imm);
+		snprintf(text, INST_TEXT_SIZE, "LD V%hX, %#02x", instruction.iformat.reg,
+			 instruction.iformat.imm);
 		break;
 	case CHIP8_ADD_VX_BYTE:
-		buffer = sdscatprintf(buffer, "ADD V%hX, %#02x", instruction.iformat.reg,
-				      instruction.iformat.imm);
+		snprintf(text, INST_TEXT_SIZE, "ADD V%hX, %#02x", instruction.iformat.reg,
+			 instruction.iformat.imm);
 		break;
 	case CHIP8_LD_VX_VY:
-		buffer = sdscatprintf(buffer, "LD V%hX, V%hX", instruction.rformat.rx,
-				      instruction.rformat.ry);
+		snprintf(text, INST_TEXT_SIZE, "LD V%hX, V%hX", instruction.rformat.rx,
+			 instruction.rformat.ry);
 		break;
 	case CHIP8_OR_VX_VY:
-		buffer = sdscatprintf(buffer, "OR V%hX, V%hX", instruction.rformat.rx,
-				      instruction.rformat.ry);
+		snprintf(text, INST_TEXT_SIZE, "OR V%hX, V%hX", instruction.rformat.rx,
+			 instruction.rformat.ry);
 		break;
 	case CHIP8_AND_VX_VY:
-		buffer = sdscatprintf(buffer, "AND V%hX, V%hX", instruction.rformat.rx,
-				      instruction.rformat.ry);
+		snprintf(text, INST_TEXT_SIZE, "AND V%hX, V%hX", instruction.rformat.rx,
+			 instruction.rformat.ry);
 		break;
 	case CHIP8_XOR_VX_VY:
-		buffer = sdscatprintf(buffer, "XOR V%hX, V%hX", instruction.rformat.rx,
-				      instruction.rformat.ry);
+		snprintf(text, INST_TEXT_SIZE, "XOR V%hX, V%hX", instruction.rformat.rx,
+			 instruction.rformat.ry);
 		break;
 	case CHIP8_ADD_VX_VY:
-		buffer = sdscatprintf(buffer, "ADD V%hX, V%hX", instruction.rformat.rx,
-				      instruction.rformat.ry);
+		snprintf(text, INST_TEXT_SIZE, "ADD V%hX, V%hX", instruction.rformat.rx,
+			 instruction.rformat.ry);
 		break;
 	case CHIP8_SUB_VX_VY:
-		buffer = sdscatprintf(buffer, "SUB V%hX, V%hX", instruction.rformat.rx,
-				      instruction.rformat.ry);
+		snprintf(text, INST_TEXT_SIZE, "SUB V%hX, V%hX", instruction.rformat.rx,
+			 instruction.rformat.ry);
 		break;
 	case CHIP8_SHR_VX:
-		buffer = sdscatprintf(buffer, "SHR V%hX, V%hX", instruction.rformat.rx,
-				      instruction.rformat.ry);
+		snprintf(text, INST_TEXT_SIZE, "SHR V%hX, V%hX", instruction.rformat.rx,
+			 instruction.rformat.ry);
 		break;
 	case CHIP8_SUBN_VX_VY:
-		buffer = sdscatprintf(buffer, "SUBN V%hX, V%hX", instruction.rformat.rx,
-				      instruction.rformat.ry);
+		snprintf(text, INST_TEXT_SIZE, "SUBN V%hX, V%hX", instruction.rformat.rx,
+			 instruction.rformat.ry);
 		break;
 	case CHIP8_SHL_VX:
-		buffer = sdscatprintf(buffer, "SHL V%hX, V%hX", instruction.rformat.rx,
-				      instruction.rformat.ry);
+		snprintf(text, INST_TEXT_SIZE, "SHL V%hX, V%hX", instruction.rformat.rx,
+			 instruction.rformat.ry);
 		break;
 	case CHIP8_SNE_VX_VY:
-		buffer = sdscatprintf(buffer, "SNE V%hX, V%hX", instruction.rformat.rx,
-				      instruction.rformat.ry);
+		snprintf(text, INST_TEXT_SIZE, "SNE V%hX, V%hX", instruction.rformat.rx,
+			 instruction.rformat.ry);
 		break;
 	case CHIP8_LD_I_ADDR:
-		buffer = sdscatprintf(buffer, "LD I, %#03x", instruction.aformat.addr);
+		snprintf(text, INST_TEXT_SIZE, "LD I, %#03x", instruction.aformat.addr);
 		break;
 	case CHIP8_JMP_V0_ADDR:
-		buffer = sdscatprintf(buffer, "JMP V0, %#03x", instruction.aformat.addr);
+		snprintf(text, INST_TEXT_SIZE, "JMP V0, %#03x", instruction.aformat.addr);
 		break;
 	case CHIP8_RND_VX_BYTE:
-		buffer = sdscatprintf(buffer, "RND V%hX, %#02x", instruction.iformat.reg,
-				      instruction.iformat.imm);
+		snprintf(text, INST_TEXT_SIZE, "RND V%hX, %#02x", instruction.iformat.reg,
+			 instruction.iformat.imm);
 		break;
 	case CHIP8_DRW_VX_VY_NIBBLE:
-		buffer = sdscatprintf(buffer, "DRW V%hX, V%hX, %d", instruction.rformat.rx,
-				      instruction.rformat.ry, instruction.rformat.imm);
+		snprintf(text, INST_TEXT_SIZE, "DRW V%hX, V%hX, %d", instruction.rformat.rx,
+			 instruction.rformat.ry, instruction.rformat.imm);
 		break;
 	case CHIP8_SKP_VX:
-		buffer = sdscatprintf(buffer, "SKP V%hX", instruction.iformat.reg);
+		snprintf(text, INST_TEXT_SIZE, "SKP V%hX", instruction.iformat.reg);
 		break;
 	case CHIP8_SKNP_VX:
-		buffer = sdscatprintf(buffer, "SKNP V%hX", instruction.iformat.reg);
+		snprintf(text, INST_TEXT_SIZE, "SKNP V%hX", instruction.iformat.reg);
 		break;
 	case CHIP8_LD_VX_DT:
-		buffer = sdscatprintf(buffer, "LD V%hX, DT", instruction.iformat.reg);
+		snprintf(text, INST_TEXT_SIZE, "LD V%hX, DT", instruction.iformat.reg);
 		break;
 	case CHIP8_LD_VX_K:
-		buffer = sdscatprintf(buffer, "LD V%hX, K", instruction.iformat.reg);
+		snprintf(text, INST_TEXT_SIZE, "LD V%hX, K", instruction.iformat.reg);
 		break;
 	case CHIP8_LD_DT_VX:
-		buffer = sdscatprintf(buffer, "LD DT, V%hX", instruction.iformat.reg);
+		snprintf(text, INST_TEXT_SIZE, "LD DT, V%hX", instruction.iformat.reg);
 		break;
 	case CHIP8_LD_ST_VX:
-		buffer = sdscatprintf(buffer, "LD ST, V%hX", instruction.iformat.reg);
+		snprintf(text, INST_TEXT_SIZE, "LD ST, V%hX", instruction.iformat.reg);
 		break;
 	case CHIP8_ADD_I_VX:
-		buffer = sdscatprintf(buffer, "ADD I, V%hX", instruction.iformat.reg);
+		snprintf(text, INST_TEXT_SIZE, "ADD I, V%hX", instruction.iformat.reg);
 		break;
 	case CHIP8_LD_F_VX:
-		buffer = sdscatprintf(buffer, "LD F, V%hX", instruction.iformat.reg);
+		snprintf(text, INST_TEXT_SIZE, "LD F, V%hX", instruction.iformat.reg);
 		break;
 	case CHIP8_LD_B_VX:
-		buffer = sdscatprintf(buffer, "LD B, V%hX", instruction.iformat.reg);
+		snprintf(text, INST_TEXT_SIZE, "LD B, V%hX", instruction.iformat.reg);
 		break;
 	case CHIP8_LD_I_VX:
-		buffer = sdscatprintf(buffer, "LD [I], V%hX", instruction.iformat.reg);
+		snprintf(text, INST_TEXT_SIZE, "LD [I], V%hX", instruction.iformat.reg);
 		break;
 	case CHIP8_LD_VX_I:
-		buffer = sdscatprintf(buffer, "LD V%hX, [I]", instruction.iformat.reg);
+		snprintf(text, INST_TEXT_SIZE, "LD V%hX, [I]", instruction.iformat.reg);
 		break;
 	default:
-		memcpy(buffer, "unknown", 8);
+		strcpy(text, "unknown");
 		break;
 	}
 
-	return buffer;
+	return text;
+}
+
+sds inst2str(Chip8Instruction instruction) {
+	char text[INST_TEXT_SIZE];
+	return sdsnew(inst2text(instruction, text));
 }
 
 Chip8InstructionType instruction_type(Chip8Instruction instruction) {
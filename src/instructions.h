@@ -187,7 +187,7 @@ static inline Chip8Instruction aformat(uint8_t opcode, uint16_t addr) {
 #define INST_OR_VX_VY(vx, vy) rformat(OP_OR_VX_VY, (vx), (vy), IMM_OR_VX_VY)
 #define INST_AND_VX_VY(vx, vy) rformat(OP_AND_VX_VY, (vx), (vy), IMM_AND_VX_VY)
 #define INST_XOR_VX_VY(vx, vy) rformat(OP_XOR_VX_VY, (vx), (vy), IMM_XOR_VX_VY)
-#define INST_ADD_VX_VY(vx, vy) rformat(OP_ADD_VX_VY, (vx), (vy), IMM_AND_VX_VY)
+#define INST_ADD_VX_VY(vx, vy) rformat(OP_ADD_VX_VY, (vx), (vy), IMM_ADD_VX_VY)
 #define INST_SUB_VX_VY(vx, vy) rformat(OP_SUB_VX_VY, (vx), (vy), IMM_SUB_VX_VY)
 #define INST_SHR_VX(vx, vy) rformat(OP_SHR_VX, (vx), (vy), IMM_SHR_VX)
 #define INST_SUBN_VX_VY(vx, vy) rformat(OP_SUBN_VX_VY, (vx), (vy), IMM_SUBN_VX_VY)
@@ -202,16 +202,20 @@ static inline Chip8Instruction aformat(uint8_t opcode, uint16_t addr) {
 #define INST_LD_VX_DT(vx) iformat(OP_LD_VX_DT, (vx), IMM_LD_VX_DT)
 #define INST_LD_VX_K(vx) iformat(OP_LD_VX_K, (vx), IMM_LD_VX_K)
 #define INST_LD_DT_VX(vx) iformat(OP_LD_DT_VX, (vx), IMM_LD_DT_VX)
-#define INST_LD_ST_VX(vx) iformat(IMM_LD_ST_VX, (vx), IMM_LD_ST_VX)
+#define INST_LD_ST_VX(vx) iformat(OP_LD_ST_VX, (vx), IMM_LD_ST_VX)
 #define INST_ADD_I_VX(vx) iformat(OP_ADD_I_VX, (vx), IMM_ADD_I_VX)
 #define INST_LD_F_VX(vx) iformat(OP_LD_F_VX, (vx), IMM_LD_F_VX)
 #define INST_LD_B_VX(vx) iformat(OP_LD_B_VX, (vx), IMM_LD_B_VX)
 #define INST_LD_I_VX(vx) iformat(OP_LD_I_VX, (vx), IMM_LD_I_VX)
 #define INST_LD_VX_I(vx) iformat(OP_LD_VX_I, (vx), IMM_LD_VX_I)
 
+#define INST_TEXT_SIZE 24 // Longest is "DRW VF, VF, 15"
+
+const char *inst2text(Chip8Instruction instruction, char *text);
 sds inst2str(Chip8Instruction instruction);
 void print_instruction(Chip8Instruction instruction, Chip8InstructionFormat format);
 Chip8InstructionType instruction_type(Chip8Instruction instruction);
 Chip8InstructionFormat instruction_format(Chip8InstructionType type);
+const char *instruction_form(Chip8InstructionType type);
 
 #endif // !INSTRUCTIONS_H
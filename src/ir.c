@@ -0,0 +1,474 @@
+#include "ir.h"
+#include "disassembler.h"
+#include "instructions.h"
+
+#include "stb_ds.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Mid-level IR
+//
+// Mirrors the disassembler's instruction blocks one instruction at a time so
+// that every guest address stays a valid place to stop or resume, but lets
+// the passes below rewrite or drop instructions. Analyses restart from scratch
+// at every IR_LEADER, so engines consuming the IR must only enter a block at a
+// leader, or where they themselves left it.
+
+#define REG(x) (1u << (x))
+#define REG_VF REG(0xF)
+#define REG_I (1u << 16)
+#define REG_ALL 0x1FFFFu
+
+// Block-relative index of the instruction at `addr`, or -1 if it lives elsewhere
+static long index_in_block(IRProgram *program, size_t block, uint16_t addr) {
+	Disassembly *disassembly = program->disassembly;
+	if (addr < disassembly->base || addr - disassembly->base >= disassembly->abook_length) {
+		return -1;
+	}
+
+	AddressLookup *lookup = &disassembly->addressbook[addr - disassembly->base];
+	if (lookup->type != ADDR_INSTRUCTION || lookup->block_offset != block) {
+		return -1;
+	}
+	return lookup->array_offset;
+}
+
+static void mark_leader(Disassembly *disassembly, bool *leaders, uint16_t addr) {
+	if (addr >= disassembly->base && addr - disassembly->base < disassembly->abook_length) {
+		leaders[addr - disassembly->base] = true;
+	}
+}
+
+static bool falls_through(Chip8InstructionType type) {
+	switch (type) {
+	case CHIP8_RET:
+	case CHIP8_SYS_ADDR:
+	case CHIP8_JMP_ADDR:
+	case CHIP8_CALL_ADDR:
+	case CHIP8_JMP_V0_ADDR:
+	case CHIP8_UNKNOWN:
+		return false;
+	default:
+		return true;
+	}
+}
+
+static bool is_skip(Chip8InstructionType type) {
+	switch (type) {
+	case CHIP8_SE_VX_BYTE:
+	case CHIP8_SNE_VX_BYTE:
+	case CHIP8_SE_VX_VY:
+	case CHIP8_SNE_VX_VY:
+	case CHIP8_SKP_VX:
+	case CHIP8_SKNP_VX:
+		return true;
+	default:
+		return false;
+	}
+}
+
+IRProgram ir_build(Disassembly *disassembly) {
+	IRProgram program = { .disassembly = disassembly };
+	uint16_t base = disassembly->base;
+
+	// Every address control can reach other than by falling through from the
+	// previous instruction of the same block
+	bool *leaders = calloc(disassembly->abook_length + 1, sizeof(bool));
+	for (size_t i = 0; i < disassembly->iblock_length; ++i) {
+		InstructionBlock *block = &disassembly->instruction_blocks[i];
+		mark_leader(disassembly, leaders, block->instructions[0].address + base);
+
+		for (size_t j = 0; j < block->length; ++j) {
+			Chip8Instruction instruction = block->instructions[j].instruction;
+			uint16_t addr = block->instructions[j].address + base;
+			Chip8InstructionType type = instruction_type(instruction);
+
+			if (type == CHIP8_JMP_ADDR || type == CHIP8_CALL_ADDR) {
+				mark_leader(disassembly, leaders, instruction.aformat.addr);
+			}
+			if (type == CHIP8_CALL_ADDR) {
+				mark_leader(disassembly, leaders, addr + 2); // Reached through RET
+			}
+			if (is_skip(type)) {
+				mark_leader(disassembly, leaders, addr + 4);
+			}
+			if (j + 1 == block->length && falls_through(type)) {
+				// Falls into another block
+				mark_leader(disassembly, leaders, addr + 2);
+			}
+		}
+	}
+	for (size_t i = 0; i < (size_t)arrlen(disassembly->jump_table_targets); ++i) {
+		mark_leader(disassembly, leaders, disassembly->jump_table_targets[i] + base);
+	}
+
+	for (size_t i = 0; i < disassembly->iblock_length; ++i) {
+		InstructionBlock *block = &disassembly->instruction_blocks[i];
+		IRBlock ir_block = { 0 };
+		for (size_t j = 0; j < block->length; ++j) {
+			IRInstruction ir = {
+				.instruction = block->instructions[j].instruction,
+				.type = instruction_type(block->instructions[j].instruction),
+				.address = block->instructions[j].address,
+				.flags = leaders[block->instructions[j].address] ? IR_LEADER : 0,
+			};
+			arrput(ir_block.instructions, ir);
+			ir_block.length++;
+		}
+		arrput(program.blocks, ir_block);
+		program.length++;
+	}
+
+	free(leaders);
+	return program;
+}
+
+// Registers (V0-VF, then I) read by the instruction, and those it always writes
+static void register_effects(IRInstruction *ir, uint32_t *uses, uint32_t *defs) {
+	uint8_t x = ir->instruction.rformat.rx;
+	uint8_t y = ir->instruction.rformat.ry;
+	*uses = 0;
+	*defs = 0;
+
+	switch (ir->type) {
+	case CHIP8_SE_VX_BYTE:
+	case CHIP8_SNE_VX_BYTE:
+	case CHIP8_SKP_VX:
+	case CHIP8_SKNP_VX:
+	case CHIP8_LD_DT_VX:
+	case CHIP8_LD_ST_VX:
+		*uses = REG(x);
+		break;
+	case CHIP8_SE_VX_VY:
+	case CHIP8_SNE_VX_VY:
+		*uses = REG(x) | REG(y);
+		break;
+	case CHIP8_LD_VX_BYTE:
+	case CHIP8_RND_VX_BYTE:
+	case CHIP8_LD_VX_DT:
+	case CHIP8_LD_VX_K:
+		*defs = REG(x);
+		break;
+	case CHIP8_ADD_VX_BYTE:
+		*uses = REG(x);
+		*defs = REG(x);
+		break;
+	case CHIP8_LD_VX_VY:
+		*uses = REG(y);
+		*defs = REG(x);
+		break;
+	case CHIP8_OR_VX_VY:
+	case CHIP8_AND_VX_VY:
+	case CHIP8_XOR_VX_VY:
+		// VF is only reset with CONFIG_CHIP8_VF_RESET, so it isn't a kill
+		*uses = REG(x) | REG(y);
+		*defs = REG(x);
+		break;
+	case CHIP8_ADD_VX_VY:
+	case CHIP8_SUB_VX_VY:
+	case CHIP8_SUBN_VX_VY:
+	case CHIP8_SHR_VX:
+	case CHIP8_SHL_VX:
+		*uses = REG(x) | REG(y);
+		*defs = REG(x) | REG_VF;
+		break;
+	case CHIP8_LD_I_ADDR:
+		*defs = REG_I;
+		break;
+	case CHIP8_DRW_VX_VY_NIBBLE:
+		*uses = REG(x) | REG(y) | REG_I;
+		*defs = REG_VF;
+		break;
+	case CHIP8_ADD_I_VX:
+		*uses = REG(x) | REG_I;
+		*defs = REG_I;
+		break;
+	case CHIP8_LD_F_VX:
+		*uses = REG(x);
+		*defs = REG_I;
+		break;
+	case CHIP8_LD_B_VX:
+		*uses = REG(x) | REG_I;
+		break;
+	case CHIP8_LD_I_VX:
+		*uses = (REG(x + 1) - 1) | REG_I;
+		break;
+	case CHIP8_LD_VX_I:
+		*uses = REG_I;
+		*defs = REG(x + 1) - 1;
+		break;
+	case CHIP8_CLS:
+	case CHIP8_JMP_ADDR:
+		break;
+	default:
+		// Leaves the block for somewhere unknown
+		*uses = REG_ALL;
+		break;
+	}
+}
+
+// Removes the flag computation from ALU instructions whose VF result is
+// overwritten before anything reads it
+void ir_eliminate_dead_flags(IRProgram *program) {
+	for (size_t b = 0; b < program->length; ++b) {
+		IRBlock *block = &program->blocks[b];
+		uint32_t *live_in = calloc(block->length, sizeof(uint32_t));
+		uint32_t *live_out = calloc(block->length, sizeof(uint32_t));
+
+		// Backward liveness, iterated because skips and jumps can loop back
+		bool changed = true;
+		while (changed) {
+			changed = false;
+			for (size_t i = block->length; i-- > 0;) {
+				IRInstruction *ir = &block->instructions[i];
+				uint16_t addr = ir->address + program->disassembly->base;
+
+				long successors[2] = { -1, -1 };
+				size_t count = 0;
+				if (ir->type == CHIP8_JMP_ADDR) {
+					uint16_t target = ir->instruction.aformat.addr;
+					successors[count++] = index_in_block(program, b, target);
+				} else if (falls_through(ir->type)) {
+					successors[count++] =
+						i + 1 < block->length ? (long)i + 1 : -1;
+					if (is_skip(ir->type)) {
+						successors[count++] =
+							index_in_block(program, b, addr + 4);
+					}
+				} else {
+					count = 1;
+				}
+
+				uint32_t out = 0;
+				for (size_t s = 0; s < count; ++s) {
+					out |= successors[s] < 0 ? REG_ALL : live_in[successors[s]];
+				}
+
+				uint32_t uses, defs;
+				register_effects(ir, &uses, &defs);
+				uint32_t in = uses | (out & ~defs);
+				if (in != live_in[i] || out != live_out[i]) {
+					live_in[i] = in;
+					live_out[i] = out;
+					changed = true;
+				}
+			}
+		}
+
+		for (size_t i = 0; i < block->length; ++i) {
+			IRInstruction *ir = &block->instructions[i];
+			switch (ir->type) {
+			case CHIP8_OR_VX_VY:
+			case CHIP8_AND_VX_VY:
+			case CHIP8_XOR_VX_VY:
+			case CHIP8_ADD_VX_VY:
+			case CHIP8_SUB_VX_VY:
+			case CHIP8_SUBN_VX_VY:
+			case CHIP8_SHR_VX:
+			case CHIP8_SHL_VX:
+				if (live_out[i] & REG_VF) {
+					break;
+				}
+				ir->flags |= IR_VF_DEAD;
+				if (ir->instruction.rformat.rx == 0xF) {
+					ir->flags |= IR_DEAD; // Result was going to VF too
+				}
+				break;
+			default:
+				break;
+			}
+		}
+
+		free(live_in);
+		free(live_out);
+	}
+}
+
+typedef struct ConstantState {
+	uint8_t values[16];
+	uint16_t known;
+} ConstantState;
+
+static void fold(IRInstruction *ir, uint8_t x, uint8_t value) {
+	ir->instruction = INST_LD_VX_BYTE(x, value);
+	ir->type = CHIP8_LD_VX_BYTE;
+	ir->flags |= IR_FOLDED;
+}
+
+// Folds ALU results whose operands are known after a chain of LD Vx, byte
+void ir_propagate_constants(IRProgram *program) {
+	for (size_t b = 0; b < program->length; ++b) {
+		IRBlock *block = &program->blocks[b];
+		ConstantState state = { 0 };
+
+		for (size_t i = 0; i < block->length; ++i) {
+			IRInstruction *ir = &block->instructions[i];
+			uint8_t x = ir->instruction.rformat.rx;
+			uint8_t y = ir->instruction.rformat.ry;
+			uint8_t kk = ir->instruction.iformat.imm;
+			bool x_known = state.known & REG(x);
+			bool y_known = state.known & REG(y);
+			uint8_t vx = state.values[x];
+			uint8_t vy = state.values[y];
+
+			if (ir->flags & IR_LEADER) {
+				state.known = 0;
+				x_known = y_known = false;
+			}
+			if (ir->flags & IR_DEAD) {
+				state.known &= ~REG(x);
+				continue;
+			}
+
+			// Result of the instruction, if it turns out to be known
+			bool result_known = false;
+			uint8_t result = 0;
+			bool flag_known = false;
+			uint8_t flag = 0;
+
+			switch (ir->type) {
+			case CHIP8_LD_VX_BYTE:
+				result_known = true;
+				result = kk;
+				break;
+			case CHIP8_ADD_VX_BYTE:
+				if (x_known) {
+					result_known = true;
+					result = vx + kk;
+					fold(ir, x, result);
+				}
+				break;
+			case CHIP8_LD_VX_VY:
+				if (y_known) {
+					result_known = true;
+					result = vy;
+					fold(ir, x, result);
+				}
+				break;
+			case CHIP8_OR_VX_VY:
+			case CHIP8_AND_VX_VY:
+			case CHIP8_XOR_VX_VY:
+				// Into VF, the result depends on CONFIG_CHIP8_VF_RESET,
+				// which is only known at runtime
+				if (x_known && y_known && x != 0xF) {
+					result_known = true;
+					result = ir->type == CHIP8_OR_VX_VY  ? vx | vy :
+						 ir->type == CHIP8_AND_VX_VY ? vx & vy :
+									       vx ^ vy;
+				}
+				break;
+			case CHIP8_ADD_VX_VY:
+				if (x_known && y_known) {
+					result_known = flag_known = true;
+					result = vx + vy;
+					flag = vx + vy > 0xFF;
+				}
+				break;
+			case CHIP8_SUB_VX_VY:
+				if (x_known && y_known) {
+					result_known = flag_known = true;
+					result = vx - vy;
+					flag = vx >= vy;
+				}
+				break;
+			case CHIP8_SUBN_VX_VY:
+				if (x_known && y_known) {
+					result_known = flag_known = true;
+					result = vy - vx;
+					flag = vy >= vx;
+				}
+				break;
+			case CHIP8_SHR_VX:
+			case CHIP8_SHL_VX:
+				// The operand depends on CONFIG_CHIP8_SHIFTING, unless both agree
+				if (x_known && y_known && vx == vy) {
+					result_known = flag_known = true;
+					result = ir->type == CHIP8_SHR_VX ? vx >> 1 : vx << 1;
+					flag = ir->type == CHIP8_SHR_VX ? vx & 1 : (vx & 0x80) > 0;
+				}
+				break;
+			default:
+				break;
+			}
+
+			// With its flag unused, any known ALU result becomes a plain load
+			if (result_known && (ir->flags & IR_VF_DEAD) && !(ir->flags & IR_FOLDED)) {
+				fold(ir, x, result);
+			}
+
+			uint32_t uses, defs;
+			register_effects(ir, &uses, &defs);
+			state.known &= ~defs;
+			if (ir->flags & IR_VF_DEAD || ir->type == CHIP8_OR_VX_VY ||
+			    ir->type == CHIP8_AND_VX_VY || ir->type == CHIP8_XOR_VX_VY) {
+				state.known &= ~REG_VF; // Not written, or only under a quirk
+			}
+			if (result_known) {
+				state.values[x] = result;
+				state.known |= REG(x);
+			}
+			if (flag_known && !(ir->flags & IR_VF_DEAD)) {
+				state.values[0xF] = flag;
+				state.known |= REG_VF;
+			}
+
+			if (!falls_through(ir->type)) {
+				state.known = 0;
+			}
+		}
+	}
+}
+
+// Drops LD I, addr when I already holds addr
+void ir_remove_redundant_loads(IRProgram *program) {
+	for (size_t b = 0; b < program->length; ++b) {
+		IRBlock *block = &program->blocks[b];
+		bool known = false;
+		uint16_t vi = 0;
+
+		for (size_t i = 0; i < block->length; ++i) {
+			IRInstruction *ir = &block->instructions[i];
+			if (ir->flags & IR_LEADER) {
+				known = false;
+			}
+
+			switch (ir->type) {
+			case CHIP8_LD_I_ADDR:
+				if (known && vi == ir->instruction.aformat.addr) {
+					ir->flags |= IR_DEAD;
+				}
+				known = true;
+				vi = ir->instruction.aformat.addr;
+				break;
+			case CHIP8_ADD_I_VX:
+			case CHIP8_LD_F_VX:
+			case CHIP8_LD_I_VX: // I moves with CONFIG_CHIP8_MEMORY
+			case CHIP8_LD_VX_I:
+				known = false;
+				break;
+			default:
+				if (!falls_through(ir->type)) {
+					known = false;
+				}
+				break;
+			}
+		}
+	}
+}
+
+void ir_optimise(IRProgram *program) {
+	// Dead flags first, so that constant ALU results can fold into plain loads
+	ir_eliminate_dead_flags(program);
+	ir_propagate_constants(program);
+	ir_remove_redundant_loads(program);
+}
+
+void free_ir(IRProgram *program) {
+	for (size_t i = 0; i < program->length; ++i) {
+		arrfree(program->blocks[i].instructions);
+	}
+	arrfree(program->blocks);
+	program->length = 0;
+}
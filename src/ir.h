@@ -0,0 +1,47 @@
+#ifndef IR_H
+#define IR_H
+
+#include "disassembler.h"
+#include "instructions.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Control can enter here from outside the straight-line path that precedes it
+#define IR_LEADER 0b1
+// Has no observable effect, only its cycle needs accounting for
+#define IR_DEAD 0b10
+// VF written by this instruction is always overwritten before being read
+#define IR_VF_DEAD 0b100
+// Rewritten from a constant expression into LD Vx, byte
+#define IR_FOLDED 0b1000
+
+typedef struct IRInstruction {
+	// May differ from the guest's when an optimisation rewrote it
+	Chip8Instruction instruction;
+	Chip8InstructionType type;
+	uint16_t address; // Relative to the disassembly base
+	uint8_t flags;
+} IRInstruction;
+
+typedef struct IRBlock {
+	IRInstruction *instructions;
+	size_t length;
+} IRBlock;
+
+// One IRBlock per InstructionBlock of the disassembly it was built from
+typedef struct IRProgram {
+	IRBlock *blocks;
+	size_t length;
+	Disassembly *disassembly;
+} IRProgram;
+
+IRProgram ir_build(Disassembly *disassembly);
+void ir_eliminate_dead_flags(IRProgram *program);
+void ir_propagate_constants(IRProgram *program);
+void ir_remove_redundant_loads(IRProgram *program);
+void ir_optimise(IRProgram *program);
+void free_ir(IRProgram *program);
+
+#endif // !IR_H
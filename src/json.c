@@ -0,0 +1,322 @@
+#include "json.h"
+#include "sds.h"
+#include "stb_ds.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define JSON_MAX_DEPTH 64
+
+typedef struct JsonParser {
+	const char *text;
+	size_t length;
+	size_t position;
+	int depth;
+} JsonParser;
+
+static JsonValue *parse_value(JsonParser *parser);
+
+static void skip_whitespace(JsonParser *parser) {
+	while (parser->position < parser->length &&
+	       strchr(" \t\r\n", parser->text[parser->position])) {
+		parser->position++;
+	}
+}
+
+static bool consume(JsonParser *parser, char c) {
+	skip_whitespace(parser);
+	if (parser->position < parser->length && parser->text[parser->position] == c) {
+		parser->position++;
+		return true;
+	}
+	return false;
+}
+
+static bool consume_word(JsonParser *parser, const char *word) {
+	size_t length = strlen(word);
+	if (parser->length - parser->position >= length &&
+	    memcmp(parser->text + parser->position, word, length) == 0) {
+		parser->position += length;
+		return true;
+	}
+	return false;
+}
+
+static int hex_digit(char c) {
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	} else if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	} else if (c >= 'A' && c <= 'F') {
+		return c - 'A' + 10;
+	}
+	return -1;
+}
+
+// Appends `codepoint` as UTF-8
+static sds cat_utf8(sds out, uint32_t codepoint) {
+	char bytes[4];
+	size_t length;
+	if (codepoint < 0x80) {
+		bytes[0] = codepoint;
+		length = 1;
+	} else if (codepoint < 0x800) {
+		bytes[0] = 0xC0 | codepoint >> 6;
+		bytes[1] = 0x80 | (codepoint & 0x3F);
+		length = 2;
+	} else if (codepoint < 0x10000) {
+		bytes[0] = 0xE0 | codepoint >> 12;
+		bytes[1] = 0x80 | (codepoint >> 6 & 0x3F);
+		bytes[2] = 0x80 | (codepoint & 0x3F);
+		length = 3;
+	} else {
+		bytes[0] = 0xF0 | codepoint >> 18;
+		bytes[1] = 0x80 | (codepoint >> 12 & 0x3F);
+		bytes[2] = 0x80 | (codepoint >> 6 & 0x3F);
+		bytes[3] = 0x80 | (codepoint & 0x3F);
+		length = 4;
+	}
+	return sdscatlen(out, bytes, length);
+}
+
+static bool parse_codepoint(JsonParser *parser, uint32_t *codepoint) {
+	if (parser->length - parser->position < 4) {
+		return false;
+	}
+	*codepoint = 0;
+	for (int i = 0; i < 4; ++i) {
+		int digit = hex_digit(parser->text[parser->position++]);
+		if (digit < 0) {
+			return false;
+		}
+		*codepoint = *codepoint << 4 | digit;
+	}
+	return true;
+}
+
+// Parses a string after its opening quote
+static sds parse_string(JsonParser *parser) {
+	sds string = sdsempty();
+	while (parser->position < parser->length) {
+		char c = parser->text[parser->position++];
+		if (c == '"') {
+			return string;
+		} else if (c != '\\') {
+			string = sdscatlen(string, &c, 1);
+			continue;
+		} else if (parser->position == parser->length) {
+			break;
+		}
+
+		char escaped = parser->text[parser->position++];
+		const char *from = "\"\\/bfnrt";
+		const char *to = "\"\\/\b\f\n\r\t";
+		const char *match = strchr(from, escaped);
+		if (match && escaped) {
+			string = sdscatlen(string, &to[match - from], 1);
+			continue;
+		} else if (escaped != 'u') {
+			break;
+		}
+
+		uint32_t codepoint;
+		if (!parse_codepoint(parser, &codepoint)) {
+			break;
+		}
+		// Surrogate pairs encode codepoints past the BMP
+		if (codepoint >= 0xD800 && codepoint < 0xDC00 && consume_word(parser, "\\u")) {
+			uint32_t low;
+			if (!parse_codepoint(parser, &low) || low < 0xDC00 || low > 0xDFFF) {
+				break;
+			}
+			codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+		}
+		string = cat_utf8(string, codepoint);
+	}
+	sdsfree(string);
+	return NULL;
+}
+
+static JsonValue *parse_array(JsonParser *parser, JsonValue *array) {
+	if (consume(parser, ']')) {
+		return array;
+	}
+	do {
+		JsonValue *item = parse_value(parser);
+		if (!item) {
+			json_free(array);
+			return NULL;
+		}
+		arrput(array->items, item);
+	} while (consume(parser, ','));
+
+	if (!consume(parser, ']')) {
+		json_free(array);
+		return NULL;
+	}
+	return array;
+}
+
+static JsonValue *parse_object(JsonParser *parser, JsonValue *object) {
+	if (consume(parser, '}')) {
+		return object;
+	}
+	do {
+		sds key = consume(parser, '"') ? parse_string(parser) : NULL;
+		JsonValue *value = key && consume(parser, ':') ? parse_value(parser) : NULL;
+		if (!value) {
+			sdsfree(key);
+			json_free(object);
+			return NULL;
+		}
+		JsonMember member = { key, value };
+		arrput(object->members, member);
+	} while (consume(parser, ','));
+
+	if (!consume(parser, '}')) {
+		json_free(object);
+		return NULL;
+	}
+	return object;
+}
+
+static JsonValue *parse_value(JsonParser *parser) {
+	skip_whitespace(parser);
+	if (parser->position == parser->length || parser->depth == JSON_MAX_DEPTH) {
+		return NULL;
+	}
+
+	JsonValue *value = calloc(1, sizeof(JsonValue));
+	char c = parser->text[parser->position];
+	if (consume_word(parser, "null")) {
+		value->type = JSON_NULL;
+	} else if (consume_word(parser, "true") || consume_word(parser, "false")) {
+		value->type = JSON_BOOL;
+		value->boolean = c == 't';
+	} else if (c == '"') {
+		parser->position++;
+		value->type = JSON_STRING;
+		value->string = parse_string(parser);
+		if (!value->string) {
+			free(value);
+			return NULL;
+		}
+	} else if (c == '[' || c == '{') {
+		parser->position++;
+		parser->depth++;
+		value->type = c == '[' ? JSON_ARRAY : JSON_OBJECT;
+		value = c == '[' ? parse_array(parser, value) : parse_object(parser, value);
+		parser->depth--;
+	} else {
+		// strtod() needs a terminator, so copy the number out first
+		char number[64];
+		size_t length = 0;
+		while (parser->position + length < parser->length && length + 1 < sizeof(number) &&
+		       strchr("+-0123456789.eE", parser->text[parser->position + length])) {
+			number[length] = parser->text[parser->position + length];
+			length++;
+		}
+		number[length] = '\0';
+		char *end;
+		value->type = JSON_NUMBER;
+		value->number = strtod(number, &end);
+		if (!length || end != number + length) {
+			free(value);
+			return NULL;
+		}
+		parser->position += length;
+	}
+	return value;
+}
+
+// Parses a complete document, NULL if it isn't valid JSON
+JsonValue *json_parse(const char *text, size_t length) {
+	JsonParser parser = { text, length, 0, 0 };
+	JsonValue *value = parse_value(&parser);
+	skip_whitespace(&parser);
+	if (value && parser.position != length) {
+		json_free(value);
+		return NULL;
+	}
+	return value;
+}
+
+void json_free(JsonValue *value) {
+	if (!value) {
+		return;
+	}
+	sdsfree(value->string);
+	for (size_t i = 0; i < (size_t)arrlen(value->items); ++i) {
+		json_free(value->items[i]);
+	}
+	arrfree(value->items);
+	for (size_t i = 0; i < (size_t)arrlen(value->members); ++i) {
+		sdsfree(value->members[i].key);
+		json_free(value->members[i].value);
+	}
+	arrfree(value->members);
+	free(value);
+}
+
+// Member `key` of `object`, or NULL if either is missing
+JsonValue *json_get(JsonValue *object, const char *key) {
+	if (!object || object->type != JSON_OBJECT) {
+		return NULL;
+	}
+	for (size_t i = 0; i < (size_t)arrlen(object->members); ++i) {
+		if (strcmp(object->members[i].key, key) == 0) {
+			return object->members[i].value;
+		}
+	}
+	return NULL;
+}
+
+const char *json_get_string(JsonValue *object, const char *key, const char *fallback) {
+	JsonValue *value = json_get(object, key);
+	return value && value->type == JSON_STRING ? value->string : fallback;
+}
+
+double json_get_number(JsonValue *object, const char *key, double fallback) {
+	JsonValue *value = json_get(object, key);
+	return value && value->type == JSON_NUMBER ? value->number : fallback;
+}
+
+bool json_get_bool(JsonValue *object, const char *key, bool fallback) {
+	JsonValue *value = json_get(object, key);
+	return value && value->type == JSON_BOOL ? value->boolean : fallback;
+}
+
+// Appends `string` quoted, with everything JSON requires escaped
+sds json_cat_string(sds out, const char *string) {
+	out = sdscatlen(out, "\"", 1);
+	for (const char *c = string; *c; ++c) {
+		switch (*c) {
+		case '"':
+			out = sdscat(out, "\\\"");
+			break;
+		case '\\':
+			out = sdscat(out, "\\\\");
+			break;
+		case '\n':
+			out = sdscat(out, "\\n");
+			break;
+		case '\r':
+			out = sdscat(out, "\\r");
+			break;
+		case '\t':
+			out = sdscat(out, "\\t");
+			break;
+		default:
+			if ((unsigned char)*c < 0x20) {
+				out = sdscatprintf(out, "\\u%04x", (unsigned char)*c);
+			} else {
+				out = sdscatlen(out, c, 1);
+			}
+			break;
+		}
+	}
+	return sdscatlen(out, "\"", 1);
+}
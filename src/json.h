@@ -0,0 +1,47 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include "sds.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Just enough JSON for protocol messages: a parser into a tree of values, and
+// helpers for writing strings. Everything else is written with sdscatprintf().
+
+typedef enum JsonType {
+	JSON_NULL = 0,
+	JSON_BOOL,
+	JSON_NUMBER,
+	JSON_STRING,
+	JSON_ARRAY,
+	JSON_OBJECT,
+} JsonType;
+
+typedef struct JsonValue JsonValue;
+
+typedef struct JsonMember {
+	sds key;
+	JsonValue *value;
+} JsonMember;
+
+struct JsonValue {
+	JsonType type;
+	bool boolean;
+	double number;
+	sds string;
+	JsonValue **items; // stb_ds array, for arrays
+	JsonMember *members; // stb_ds array, for objects
+};
+
+JsonValue *json_parse(const char *text, size_t length);
+void json_free(JsonValue *value);
+
+JsonValue *json_get(JsonValue *object, const char *key);
+const char *json_get_string(JsonValue *object, const char *key, const char *fallback);
+double json_get_number(JsonValue *object, const char *key, double fallback);
+bool json_get_bool(JsonValue *object, const char *key, bool fallback);
+
+sds json_cat_string(sds out, const char *string);
+
+#endif // !JSON_H
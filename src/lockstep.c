@@ -0,0 +1,417 @@
+#include "lockstep.h"
+#include "core.h"
+#include "instructions.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Lockstep multi-instance interpreter
+//
+// Every dispatch picks the lowest PC among lanes with cycles left, decodes the
+// instruction there once and executes it on all lanes at that PC with a lane
+// mask. Lanes that branched elsewhere wait, and get picked back up once the
+// leading group reaches them, which is where diverged paths usually join.
+// Each lane still executes exactly its own instruction stream and cycle
+// budget, so lanes match independent EmulatorStates run with the same input.
+//
+// Differences from the core: RND draws from a per-lane xorshift generator
+// seeded at creation, and sprites wrap instead of overrunning the display when
+// clipping is disabled.
+
+typedef int8_t LaneMask __attribute__((vector_size(LOCKSTEP_MAX_LANES)));
+typedef int16_t LaneWordMask __attribute__((vector_size(LOCKSTEP_MAX_LANES * 2)));
+
+// `a` in lanes set in `mask`, `b` elsewhere
+#define SELECT(mask, a, b) (((a) & (mask)) | ((b) & ~(mask)))
+
+#define for_each_lane(state, mask, lane) \
+	for (int lane = 0; lane < (state)->lanes; ++lane) \
+		if ((mask)[lane])
+
+// Runtime dispatch between AVX2 and baseline code where the toolchain supports it
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__)
+#define LOCKSTEP_TARGETS __attribute__((target_clones("avx2", "default")))
+#else
+#define LOCKSTEP_TARGETS
+#endif
+
+// Macros rather than functions, since passing wide vectors by value isn't ABI-stable
+#define widen(bytes) __builtin_convertvector((bytes), LaneWords)
+#define widen_mask(mask) ((LaneWords)__builtin_convertvector((LaneMask)(mask), LaneWordMask))
+
+static inline uint32_t next_random(uint32_t *rng) {
+	uint32_t x = *rng;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *rng = x;
+}
+
+static void draw_sprite(LockstepState *state, int lane, Chip8Instruction instruction) {
+	uint8_t *memory = state->memory[lane];
+	uint64_t *display = state->display[lane];
+	bool clipping = state->configuration & CONFIG_CHIP8_CLIPPING;
+	int origin_x = state->registers[instruction.rformat.rx][lane] % TARGET_WIDTH;
+	int origin_y = state->registers[instruction.rformat.ry][lane] % TARGET_HEIGHT;
+	bool flag = false;
+
+	for (int row = 0; row < instruction.rformat.imm; ++row) {
+		int y = origin_y + row;
+		if (y >= TARGET_HEIGHT) {
+			if (clipping) {
+				break;
+			}
+			y %= TARGET_HEIGHT;
+		}
+
+		uint64_t byte = memory[(state->vi[lane] + row) & EMULATOR_ADDR_MASK];
+		uint64_t bits = origin_x <= 56 ? byte << (56 - origin_x) : byte >> (origin_x - 56);
+		if (!clipping && origin_x > 56) {
+			bits |= byte << (64 - (origin_x - 56));
+		}
+
+		flag |= (display[y] & bits) != 0;
+		display[y] ^= bits;
+	}
+
+	state->registers[0xF][lane] = flag;
+}
+
+// Executes `instruction` on every lane set in `lanes`, all of which share a PC.
+// The mask is passed by pointer, as vectors passed by value get an ABI note.
+static inline __attribute__((always_inline)) void
+execute_lanes(LockstepState *state, Chip8Instruction instruction, const LaneBytes *lanes) {
+	LaneBytes mask = *lanes;
+	LaneBytes *v = state->registers;
+	LaneWords word_mask = widen_mask(mask);
+	uint8_t x = instruction.rformat.rx;
+	uint8_t y = instruction.rformat.ry;
+	uint8_t kk = instruction.iformat.imm;
+	uint16_t nnn = instruction.aformat.addr;
+	LaneBytes zero = { 0 };
+	LaneWords zero_words = { 0 };
+
+	state->pc = SELECT(word_mask, state->pc + 2, state->pc);
+
+	switch (instruction_type(instruction)) {
+	case CHIP8_CLS:
+		for_each_lane(state, mask, lane) {
+			memset(state->display[lane], 0, sizeof(state->display[lane]));
+		}
+		break;
+	case CHIP8_RET:
+		for_each_lane(state, mask, lane) {
+			state->sp[lane] = (state->sp[lane] - 1) & EMULATOR_STACK_MASK;
+			state->pc[lane] = state->stack[state->sp[lane]][lane];
+		}
+		break;
+	case CHIP8_SYS_ADDR:
+		break;
+	case CHIP8_JMP_ADDR:
+		state->pc = SELECT(word_mask, zero_words + nnn, state->pc);
+		break;
+	case CHIP8_CALL_ADDR:
+		for_each_lane(state, mask, lane) {
+			state->stack[state->sp[lane]][lane] = state->pc[lane];
+			state->sp[lane] = (state->sp[lane] + 1) & EMULATOR_STACK_MASK;
+			state->pc[lane] = nnn;
+		}
+		break;
+	case CHIP8_SE_VX_BYTE:
+		state->pc += widen_mask((LaneBytes)(v[x] == kk) & mask) & 2;
+		break;
+	case CHIP8_SNE_VX_BYTE:
+		state->pc += widen_mask((LaneBytes)(v[x] != kk) & mask) & 2;
+		break;
+	case CHIP8_SE_VX_VY:
+		state->pc += widen_mask((LaneBytes)(v[x] == v[y]) & mask) & 2;
+		break;
+	case CHIP8_SNE_VX_VY:
+		state->pc += widen_mask((LaneBytes)(v[x] != v[y]) & mask) & 2;
+		break;
+	case CHIP8_LD_VX_BYTE:
+		v[x] = SELECT(mask, zero + kk, v[x]);
+		break;
+	case CHIP8_ADD_VX_BYTE:
+		v[x] = SELECT(mask, v[x] + kk, v[x]);
+		break;
+	case CHIP8_LD_VX_VY:
+		v[x] = SELECT(mask, v[y], v[x]);
+		break;
+	case CHIP8_OR_VX_VY:
+	case CHIP8_AND_VX_VY:
+	case CHIP8_XOR_VX_VY: {
+		Chip8InstructionType type = instruction_type(instruction);
+		LaneBytes result = type == CHIP8_OR_VX_VY  ? v[x] | v[y] :
+				   type == CHIP8_AND_VX_VY ? v[x] & v[y] :
+							     v[x] ^ v[y];
+		v[x] = SELECT(mask, result, v[x]);
+		if (state->configuration & CONFIG_CHIP8_VF_RESET) {
+			v[0xF] = SELECT(mask, zero, v[0xF]);
+		}
+		break;
+	}
+	case CHIP8_ADD_VX_VY: {
+		LaneBytes sum = v[x] + v[y];
+		LaneBytes carry = (LaneBytes)(sum < v[x]) & 1;
+		v[x] = SELECT(mask, sum, v[x]);
+		v[0xF] = SELECT(mask, carry, v[0xF]);
+		break;
+	}
+	case CHIP8_SUB_VX_VY: {
+		LaneBytes flag = (LaneBytes)(v[x] >= v[y]) & 1;
+		v[x] = SELECT(mask, v[x] - v[y], v[x]);
+		v[0xF] = SELECT(mask, flag, v[0xF]);
+		break;
+	}
+	case CHIP8_SUBN_VX_VY: {
+		LaneBytes flag = (LaneBytes)(v[y] >= v[x]) & 1;
+		v[x] = SELECT(mask, v[y] - v[x], v[x]);
+		v[0xF] = SELECT(mask, flag, v[0xF]);
+		break;
+	}
+	case CHIP8_SHR_VX:
+	case CHIP8_SHL_VX: {
+		LaneBytes source = state->configuration & CONFIG_CHIP8_SHIFTING ? v[y] : v[x];
+		bool right = instruction_type(instruction) == CHIP8_SHR_VX;
+		LaneBytes flag = right ? source & 1 : source >> 7;
+		v[x] = SELECT(mask, right ? source >> 1 : source << 1, v[x]);
+		v[0xF] = SELECT(mask, flag, v[0xF]);
+		break;
+	}
+	case CHIP8_LD_I_ADDR:
+		state->vi = SELECT(word_mask, zero_words + nnn, state->vi);
+		break;
+	case CHIP8_JMP_V0_ADDR: {
+		uint8_t reg = state->configuration & CONFIG_CHIP8_JUMPING ? 0 :
+									    instruction.iformat.reg;
+		LaneWords target = (widen(v[reg]) + nnn) & EMULATOR_ADDR_MASK;
+		state->pc = SELECT(word_mask, target, state->pc);
+		break;
+	}
+	case CHIP8_RND_VX_BYTE:
+		for_each_lane(state, mask, lane) {
+			v[x][lane] = next_random(&state->rng[lane]) & kk;
+		}
+		break;
+	case CHIP8_DRW_VX_VY_NIBBLE:
+		for_each_lane(state, mask, lane) {
+			if (state->configuration & CONFIG_CHIP8_DISP_WAIT &&
+			    !state->display_interrupted[lane]) {
+				state->display_interrupted[lane] = true;
+				state->pc[lane] -= 2;
+				state->cycle_count[lane]--;
+				continue;
+			}
+			draw_sprite(state, lane, instruction);
+			state->display_interrupted[lane] = false;
+		}
+		break;
+	case CHIP8_SKP_VX:
+	case CHIP8_SKNP_VX: {
+		bool pressed_skips = instruction_type(instruction) == CHIP8_SKP_VX;
+		for_each_lane(state, mask, lane) {
+			bool pressed = (state->keyboard[lane] >> (v[x][lane] & 0xF)) & 1;
+			if (pressed == pressed_skips) {
+				state->pc[lane] += 2;
+			}
+		}
+		break;
+	}
+	case CHIP8_LD_VX_DT:
+		v[x] = SELECT(mask, state->dt, v[x]);
+		break;
+	case CHIP8_LD_VX_K:
+		// Same as the core: wait for a key to be pressed and then released
+		for_each_lane(state, mask, lane) {
+			uint16_t keys = state->keyboard[lane];
+			if (keys) {
+				state->held_key[lane] = __builtin_ctz(keys);
+			} else if (state->held_key[lane] >= 0) {
+				v[x][lane] = state->held_key[lane];
+				state->held_key[lane] = -1;
+				continue;
+			}
+			state->pc[lane] -= 2;
+		}
+		break;
+	case CHIP8_LD_DT_VX:
+		state->dt = SELECT(mask, v[x], state->dt);
+		break;
+	case CHIP8_LD_ST_VX:
+		state->st = SELECT(mask, v[x], state->st);
+		break;
+	case CHIP8_ADD_I_VX:
+		state->vi = SELECT(word_mask, (state->vi + widen(v[x])) & EMULATOR_ADDR_MASK,
+				   state->vi);
+		break;
+	case CHIP8_LD_F_VX:
+		state->vi = SELECT(word_mask, FONT_BASE_ADDR + (widen(v[x]) & 0xF) * 5, state->vi);
+		break;
+	case CHIP8_LD_B_VX:
+		for_each_lane(state, mask, lane) {
+			uint8_t *memory = state->memory[lane];
+			uint8_t digit = v[x][lane];
+			memory[(state->vi[lane] + 2) & EMULATOR_ADDR_MASK] = digit % 10;
+			memory[(state->vi[lane] + 1) & EMULATOR_ADDR_MASK] = digit / 10 % 10;
+			memory[state->vi[lane] & EMULATOR_ADDR_MASK] = digit / 100;
+			state->wrote_memory[lane] = true;
+		}
+		break;
+	case CHIP8_LD_I_VX:
+	case CHIP8_LD_VX_I: {
+		bool store = instruction_type(instruction) == CHIP8_LD_I_VX;
+		for_each_lane(state, mask, lane) {
+			uint8_t *memory = state->memory[lane];
+			for (int i = 0; i <= x; ++i) {
+				uint16_t addr = (state->vi[lane] + i) & EMULATOR_ADDR_MASK;
+				if (store) {
+					memory[addr] = v[i][lane];
+				} else {
+					v[i][lane] = memory[addr];
+				}
+			}
+			state->wrote_memory[lane] |= store;
+			if (state->configuration & CONFIG_CHIP8_MEMORY) {
+				state->vi[lane] = x + 1;
+			}
+		}
+		break;
+	}
+	case CHIP8_UNKNOWN:
+		for_each_lane(state, mask, lane) {
+			state->halted[lane] = true;
+		}
+		break;
+	}
+
+	state->pc &= EMULATOR_ADDR_MASK;
+}
+
+LockstepState *lockstep_create(uint8_t *rom, size_t rom_size, int lanes, uint32_t seed) {
+	if (lanes < 1 || lanes > LOCKSTEP_MAX_LANES) {
+		return NULL;
+	}
+
+	size_t size = sizeof(LockstepState);
+	size_t alignment = _Alignof(LockstepState);
+	size = (size + alignment - 1) / alignment * alignment;
+	LockstepState *state = aligned_alloc(alignment, size);
+	memset(state, 0, sizeof(*state));
+
+	// Let the core lay out memory (fonts, ROM) once, then copy it into every lane
+	EmulatorState *emulator = calloc(1, sizeof(EmulatorState));
+	emulator->configuration = CONFIG_CHIP8;
+	emulator->cycles_per_frame = DEFAULT_CYCLES_PER_FRAME;
+	uint8_t *copy = malloc(rom_size);
+	memcpy(copy, rom, rom_size);
+	load_rom(emulator, copy, rom_size, NULL);
+
+	state->lanes = lanes;
+	state->configuration = emulator->configuration;
+	state->cycles_per_frame = emulator->cycles_per_frame;
+	state->pc = (LaneWords){ 0 } + emulator->pc;
+	for (int lane = 0; lane < LOCKSTEP_MAX_LANES; ++lane) {
+		memcpy(state->memory[lane], emulator->memory, sizeof(state->memory[lane]));
+		state->held_key[lane] = -1;
+		state->rng[lane] = (seed + lane) * 2654435761u | 1;
+	}
+
+	free_emulator(emulator);
+	free(emulator);
+	return state;
+}
+
+void lockstep_set_keys(LockstepState *state, int lane, uint16_t keys) {
+	state->keyboard[lane] = keys;
+}
+
+LOCKSTEP_TARGETS
+void lockstep_run_frame(LockstepState *state) {
+	int budget[LOCKSTEP_MAX_LANES] = { 0 };
+	for (int lane = 0; lane < state->lanes; ++lane) {
+		budget[lane] = state->halted[lane] ? 0 : CYCLES_PER_FRAME[state->cycles_per_frame];
+	}
+
+	for (;;) {
+		// Regroup around the lowest outstanding PC
+		int leader = -1;
+		for (int lane = 0; lane < state->lanes; ++lane) {
+			if (budget[lane] <= 0) {
+				continue;
+			}
+			if (leader < 0 || state->pc[lane] < state->pc[leader]) {
+				leader = lane;
+			}
+		}
+		if (leader < 0) {
+			break;
+		}
+
+		uint16_t pc = state->pc[leader];
+		Chip8Instruction instruction = opcode_at(state->memory[leader], pc);
+		LaneBytes mask = { 0 };
+		for (int lane = 0; lane < state->lanes; ++lane) {
+			// Lanes that stored to memory may be running different code
+			bool wrote = state->wrote_memory[lane] || state->wrote_memory[leader];
+			bool same_code =
+				!wrote || opcode_at(state->memory[lane], pc).raw == instruction.raw;
+			bool active = budget[lane] > 0 && state->pc[lane] == pc && same_code;
+			mask[lane] = active ? 0xFF : 0;
+		}
+
+		for_each_lane(state, mask, lane) {
+			state->cycle_count[lane]++;
+		}
+		execute_lanes(state, instruction, &mask);
+
+		state->dispatches++;
+		for_each_lane(state, mask, lane) {
+			state->lane_instructions++;
+			budget[lane]--;
+			if (state->display_interrupted[lane] || state->halted[lane]) {
+				budget[lane] = 0;
+			}
+		}
+	}
+
+	state->dt -= (LaneBytes)(state->dt != 0) & 1;
+	state->st -= (LaneBytes)(state->st != 0) & 1;
+}
+
+// Copies a lane out into a regular EmulatorState, e.g. to dump or display it
+void lockstep_export(LockstepState *state, int lane, EmulatorState *emulator) {
+	for (int i = 0; i < 16; ++i) {
+		emulator->registers[i] = state->registers[i][lane];
+	}
+	for (int i = 0; i < EMULATOR_STACK_SIZE; ++i) {
+		emulator->stack[i] = state->stack[i][lane];
+	}
+	emulator->pc = state->pc[lane];
+	emulator->vi = state->vi[lane];
+	emulator->sp = state->sp[lane];
+	emulator->dt = state->dt[lane];
+	emulator->st = state->st[lane];
+	emulator->sound_active = state->st[lane] > 0;
+	emulator->display_interrupted = state->display_interrupted[lane];
+	emulator->configuration = state->configuration;
+	emulator->cycles_per_frame = state->cycles_per_frame;
+	emulator->cycle_count = state->cycle_count[lane];
+	emulator->frame_start = state->cycle_count[lane]; // Lanes stop between frames
+	memcpy(emulator->memory, state->memory[lane], sizeof(emulator->memory));
+	for (int y = 0; y < TARGET_HEIGHT; ++y) {
+		for (int x = 0; x < TARGET_WIDTH; ++x) {
+			bool set = (state->display[lane][y] >> (63 - x)) & 1;
+			pixel(emulator, x, y) = set ? PIXEL_COLOUR : 0;
+		}
+	}
+	for (int key = 0; key < 16; ++key) {
+		emulator->keyboard[key] = (state->keyboard[lane] >> key) & 1;
+	}
+}
+
+void lockstep_free(LockstepState *state) {
+	free(state);
+}
@@ -0,0 +1,57 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include "core.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define LOCKSTEP_MAX_LANES 32
+
+// One element per lane. GCC/Clang lower operations on these to AVX2 or SSE2
+// where available, and to scalar code everywhere else. The alignment is spelled
+// out since it otherwise depends on the instruction set being compiled for.
+typedef uint8_t LaneBytes
+	__attribute__((vector_size(LOCKSTEP_MAX_LANES), aligned(LOCKSTEP_MAX_LANES)));
+typedef uint16_t LaneWords
+	__attribute__((vector_size(LOCKSTEP_MAX_LANES * 2), aligned(LOCKSTEP_MAX_LANES * 2)));
+
+// Many instances of one ROM, stored as structure-of-arrays so each decoded
+// instruction executes at once across every lane sitting at that PC
+typedef struct LockstepState {
+	LaneBytes registers[16];
+	LaneWords pc;
+	LaneWords vi;
+	LaneWords stack[EMULATOR_STACK_SIZE];
+	LaneBytes sp;
+	LaneBytes dt;
+	LaneBytes st;
+
+	// Only touched per lane
+	uint8_t memory[LOCKSTEP_MAX_LANES][EMULATOR_MEMORY_SIZE];
+	uint64_t display[LOCKSTEP_MAX_LANES][TARGET_HEIGHT]; // Bit 63 is the leftmost pixel
+	uint16_t keyboard[LOCKSTEP_MAX_LANES]; // Bit n set = key n pressed
+	int8_t held_key[LOCKSTEP_MAX_LANES]; // Key LD Vx, K is waiting on, or -1
+	uint32_t rng[LOCKSTEP_MAX_LANES];
+	bool wrote_memory[LOCKSTEP_MAX_LANES]; // Code may differ from the other lanes
+	bool display_interrupted[LOCKSTEP_MAX_LANES];
+	bool halted[LOCKSTEP_MAX_LANES]; // Hit an unknown instruction
+	uint64_t cycle_count[LOCKSTEP_MAX_LANES];
+
+	int lanes;
+	uint8_t configuration;
+	CyclesPerFrameType cycles_per_frame;
+
+	// Instructions decoded, and instructions executed across all lanes
+	uint64_t dispatches;
+	uint64_t lane_instructions;
+} LockstepState;
+
+LockstepState *lockstep_create(uint8_t *rom, size_t rom_size, int lanes, uint32_t seed);
+void lockstep_set_keys(LockstepState *state, int lane, uint16_t keys);
+void lockstep_run_frame(LockstepState *state);
+void lockstep_export(LockstepState *state, int lane, EmulatorState *emulator);
+void lockstep_free(LockstepState *state);
+
+#endif // !LOCKSTEP_H
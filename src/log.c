@@ -0,0 +1,201 @@
+#include "log.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct LogEntry {
+	atomic_size_t sequence; // Slot state, see log_write() and drain()
+	LogLevel level;
+	uint8_t category;
+	char message[LOG_MESSAGE_SIZE];
+} LogEntry;
+
+static const char *LEVEL_PREFIXES[LOG_OFF] = {
+	[LOG_TRACE] = "[*]", [LOG_DEBUG] = "[*]", [LOG_INFO] = "[*]",
+	[LOG_WARN] = "[!]",  [LOG_ERROR] = "[!]",
+};
+static const char *LEVEL_NAMES[LOG_OFF + 1] = {
+	[LOG_TRACE] = "trace", [LOG_DEBUG] = "debug", [LOG_INFO] = "info",
+	[LOG_WARN] = "warn",   [LOG_ERROR] = "error", [LOG_OFF] = "off",
+};
+static const char *CATEGORY_NAMES[] = { "core", "cpu", "disasm", "trace" };
+
+// Bounded multi-producer queue: a slot whose sequence equals the enqueue
+// position is free, and one equal to the dequeue position + 1 is ready
+static LogEntry g_ring[LOG_RING_SIZE];
+static atomic_size_t g_enqueue;
+static size_t g_dequeue; // Only touched by the writer thread
+static atomic_uint_fast64_t g_dropped;
+
+static atomic_int g_level = LOG_DEBUG;
+static atomic_uint g_categories = LOG_ALL;
+static _Atomic(FILE *) g_output; // Only set before the writer starts
+static atomic_bool g_stop;
+
+static pthread_once_t g_once = PTHREAD_ONCE_INIT;
+static pthread_t g_writer;
+
+static void sleep_briefly(void) {
+	struct timespec time = { 0, 1000000 };
+	nanosleep(&time, NULL);
+}
+
+// Writes out every ready entry, returning how many there were
+static size_t drain(FILE *output) {
+	size_t count = 0;
+	for (;;) {
+		LogEntry *entry = &g_ring[g_dequeue & (LOG_RING_SIZE - 1)];
+		size_t sequence = atomic_load_explicit(&entry->sequence, memory_order_acquire);
+		if (sequence != g_dequeue + 1) {
+			return count;
+		}
+
+		const char *category = "log";
+		for (int i = 0; i < sizeof(CATEGORY_NAMES) / sizeof(CATEGORY_NAMES[0]); ++i) {
+			if (entry->category & (1 << i)) {
+				category = CATEGORY_NAMES[i];
+				break;
+			}
+		}
+		fprintf(output, "%s %s: %s\n", LEVEL_PREFIXES[entry->level], category,
+			entry->message);
+
+		atomic_store_explicit(&entry->sequence, g_dequeue + LOG_RING_SIZE,
+				      memory_order_release);
+		g_dequeue++;
+		count++;
+	}
+}
+
+static void *writer_loop(void *arg) {
+	(void)arg;
+	for (;;) {
+		FILE *output = atomic_load(&g_output);
+		if (drain(output) == 0) {
+			fflush(output);
+			if (atomic_load(&g_stop)) {
+				break;
+			}
+			sleep_briefly();
+		}
+	}
+	return NULL;
+}
+
+static void log_shutdown(void) {
+	atomic_store(&g_stop, true);
+	pthread_join(g_writer, NULL);
+
+	FILE *output = atomic_load(&g_output);
+	if (output != stderr) {
+		fclose(output);
+	}
+
+	uint64_t dropped = atomic_load(&g_dropped);
+	if (dropped) {
+		fprintf(stderr, "[!] log: dropped %llu messages\n", (unsigned long long)dropped);
+	}
+}
+
+// EO8_LOG accepts "<level>" or "<level>:<category>,<category>...", e.g. "trace:cpu,disasm",
+// and EO8_LOG_FILE is appended to instead of writing to stderr
+static void parse_environment(void) {
+	char *path = getenv("EO8_LOG_FILE");
+	if (path && *path) {
+		FILE *file = fopen(path, "a");
+		if (file) {
+			atomic_store(&g_output, file);
+		} else {
+			fprintf(stderr, "[!] Failed to open log file %s\n", path);
+		}
+	}
+
+	char *spec = getenv("EO8_LOG");
+	if (!spec) {
+		return;
+	}
+
+	char level[16] = { 0 };
+	char *categories = strchr(spec, ':');
+	size_t level_length = categories ? (size_t)(categories - spec) : strlen(spec);
+	if (level_length < sizeof(level)) {
+		memcpy(level, spec, level_length);
+		for (int i = 0; i <= LOG_OFF; ++i) {
+			if (strcmp(level, LEVEL_NAMES[i]) == 0) {
+				atomic_store(&g_level, i);
+			}
+		}
+	}
+
+	if (categories) {
+		unsigned mask = 0;
+		for (int i = 0; i < sizeof(CATEGORY_NAMES) / sizeof(CATEGORY_NAMES[0]); ++i) {
+			if (strstr(categories + 1, CATEGORY_NAMES[i])) {
+				mask |= 1 << i;
+			}
+		}
+		atomic_store(&g_categories, mask);
+	}
+}
+
+static void log_init(void) {
+	for (size_t i = 0; i < LOG_RING_SIZE; ++i) {
+		atomic_init(&g_ring[i].sequence, i);
+	}
+	atomic_store(&g_output, stderr);
+	parse_environment();
+
+	if (pthread_create(&g_writer, NULL, writer_loop, NULL) != 0) {
+		fprintf(stderr, "[!] Failed to start the log writer, logging disabled\n");
+		atomic_store(&g_level, LOG_OFF);
+		return;
+	}
+	atexit(log_shutdown);
+}
+
+bool log_enabled(LogLevel level, uint8_t category) {
+	pthread_once(&g_once, log_init);
+	return level >= atomic_load_explicit(&g_level, memory_order_relaxed) &&
+	       (category & atomic_load_explicit(&g_categories, memory_order_relaxed));
+}
+
+void log_write(LogLevel level, uint8_t category, const char *format, ...) {
+	pthread_once(&g_once, log_init);
+
+	size_t position = atomic_load_explicit(&g_enqueue, memory_order_relaxed);
+	LogEntry *entry;
+	for (;;) {
+		entry = &g_ring[position & (LOG_RING_SIZE - 1)];
+		size_t sequence = atomic_load_explicit(&entry->sequence, memory_order_acquire);
+		intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+		if (difference == 0) {
+			if (atomic_compare_exchange_weak_explicit(&g_enqueue, &position,
+								  position + 1,
+								  memory_order_relaxed,
+								  memory_order_relaxed)) {
+				break;
+			}
+		} else if (difference < 0) {
+			atomic_fetch_add_explicit(&g_dropped, 1, memory_order_relaxed);
+			return;
+		} else {
+			position = atomic_load_explicit(&g_enqueue, memory_order_relaxed);
+		}
+	}
+
+	entry->level = level;
+	entry->category = category;
+	va_list args;
+	va_start(args, format);
+	vsnprintf(entry->message, sizeof(entry->message), format, args);
+	va_end(args);
+
+	atomic_store_explicit(&entry->sequence, position + 1, memory_order_release);
+}
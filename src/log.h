@@ -0,0 +1,59 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Asynchronous logging. Messages are formatted into a lock-free ring and
+// written out by a background thread, so diagnostics on hot paths cost a
+// snprintf rather than a blocking write to the terminal. When the ring is
+// full, messages are dropped and counted rather than stalling the caller.
+//
+// The runtime level and categories default to everything at LOG_DEBUG and up,
+// and can be set with the EO8_LOG environment variable, e.g. EO8_LOG=info.
+// Output goes to stderr, or is appended to the file named by EO8_LOG_FILE.
+// Whatever's still queued is written out at exit, along with how many
+// messages were dropped.
+
+typedef enum LogLevel {
+	LOG_TRACE = 0,
+	LOG_DEBUG,
+	LOG_INFO,
+	LOG_WARN,
+	LOG_ERROR,
+	LOG_OFF,
+} LogLevel;
+
+// Categories can be combined into a filter mask
+#define LOG_CORE 0b1 // ROM loading, emulator lifecycle
+#define LOG_CPU 0b10 // Instruction execution
+#define LOG_DISASM 0b100 // Disassembly updates
+#define LOG_TRACE_CPU 0b1000 // Per-instruction trace while stepping
+#define LOG_ALL 0xFF
+
+// Calls below this level are compiled out entirely, e.g. -DEO8_LOG_LEVEL=LOG_INFO
+#ifndef EO8_LOG_LEVEL
+#define EO8_LOG_LEVEL LOG_TRACE
+#endif
+
+#define LOG_RING_SIZE 512 // Must be a power of two
+#define LOG_MESSAGE_SIZE 1024 // Longer messages are truncated
+
+#define eo8_log(level, category, ...) \
+	do { \
+		if ((level) >= EO8_LOG_LEVEL && log_enabled((level), (category))) { \
+			log_write((level), (category), __VA_ARGS__); \
+		} \
+	} while (0)
+
+#define log_trace(category, ...) eo8_log(LOG_TRACE, category, __VA_ARGS__)
+#define log_debug(category, ...) eo8_log(LOG_DEBUG, category, __VA_ARGS__)
+#define log_info(category, ...) eo8_log(LOG_INFO, category, __VA_ARGS__)
+#define log_warn(category, ...) eo8_log(LOG_WARN, category, __VA_ARGS__)
+#define log_error(category, ...) eo8_log(LOG_ERROR, category, __VA_ARGS__)
+
+bool log_enabled(LogLevel level, uint8_t category);
+void log_write(LogLevel level, uint8_t category, const char *format, ...)
+	__attribute__((format(printf, 3, 4)));
+
+#endif // !LOG_H
@@ -1,36 +1,87 @@
+#include "analyze.h"
 #include "assembler.h"
+#include "call_graph.h"
+#include "cfg.h"
 #include "common.h"
+#include "compiler.h"
+#include "dap.h"
+#include "decompiler.h"
 #include "disassembler.h"
+#include "emulation_thread.h"
 #include "emulator.h"
+#include "gdb_server.h"
+#include "lockstep.h"
+#include "output.h"
+#include "profiler.h"
+#include "recompiler.h"
 #include "sds.h"
-#include <stdint.h>
-
-#define STB_DS_IMPLEMENTATION
 #include "stb_ds.h"
+#include "superinstructions.h"
+#include "trace.h"
+#include <stdint.h>
 
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 void print_usage() {
 	printf("Usage: eo8 <command> <rom>\n\n");
 	printf("    <rom>                         Compiled CHIP-8 binary ROM\n\n");
 	printf("Commands:\n");
 	printf("    hexdump <rom>                 Outputs a hexdump of the ROM\n");
-	printf("    disassemble <method> <rom>    Disassembles the ROM using the "
+	printf("    disassemble <method> <rom> [--format text|jsonl|csv]\n");
+	printf("                                  Disassembles the ROM using the "
 	       "selected method\n");
 	printf("                                    Methods:\n");
 	printf("                                      - linear       Linear sweep\n");
 	printf("                                      - recursive    Recursive "
 	       "descent\n");
+	printf("                                    --format   Text listing (default), "
+	       "JSON lines\n");
+	printf("                                               or CSV, a record per "
+	       "instruction\n");
+	printf("                                               and data block\n");
+	printf("    analyze <dir> <index> [--threads N]\n");
+	printf("                                  Indexes every ROM under the directory "
+	       "as JSON lines:\n");
+	printf("                                  hashes, instruction mix, quirks and "
+	       "extensions\n");
+	printf("    cfg <rom> [--dot|--json]      Exports the control-flow graph with its "
+	       "dominators and loops\n");
 	printf("    decompile <rom>               Decompiles the ROM into readable "
 	       "source code\n");
 	printf("    assessmble <asm> <rom>        Assessmbles the given assembly "
 	       "code into a CHIP-8 ROM\n");
 	printf("    compile <source> <rom>        Compiles the given source code "
 	       "into a CHIP-8 ROM\n");
-	printf("    emulate <rom> [--debug]       Emulates the ROM\n");
+	printf("    recompile <rom> <out.c>       Recompiles the ROM ahead-of-time into C "
+	       "source\n");
+	printf("    pairs <rom> [frames]          Profiles which instruction pairs run most "
+	       "often\n");
+	printf("    lockstep <rom> [lanes] [frames]\n");
+	printf("                                  Runs many instances of the ROM in "
+	       "lockstep\n");
+	printf("    profile <rom> [--frames N] [--memory <csv>] [--collapsed <file>]\n");
+	printf("                                  Reports where the ROM spends its time, its "
+	       "calls\n");
+	printf("                                  and which memory it uses (default 600 "
+	       "frames)\n");
+	printf("    trace record <rom> <trace> [frames]\n");
+	printf("                                  Runs the ROM headless, recording a binary "
+	       "execution trace\n");
+	printf("    trace decode <trace>          Prints a recorded trace\n");
+	printf("    dap                           Serves the Debug Adapter Protocol on "
+	       "stdin/stdout\n");
+	printf("    emulate <rom> [--debug] [--gdb <port>]\n");
+	printf("                                  Emulates the ROM\n");
 	printf("                                    --debug    Enables debug mode\n");
+	printf("                                    --gdb      Runs headless, serving GDB on "
+	       "a\n");
+	printf("                                               localhost port or Unix socket "
+	       "path\n");
 }
 
 int main(int argc, char *argv[]) {
@@ -46,41 +97,82 @@ int main(int argc, char *argv[]) {
 			return EXIT_FAILURE;
 		}
 		buffer = read_rom(argv[2], &buffer_size);
-		sds dump = hexdump(buffer, buffer_size, 0);
-		printf("%s", dump);
-		sdsfree(dump);
+		Output *output = malloc(sizeof(Output));
+		output_open_fd(output, STDOUT_FILENO);
+		write_hexdump(output, buffer, buffer_size, 0);
+		output_flush(output);
+		free(output);
 		free(buffer);
 	} else if (strcmp(argv[1], "disassemble") == 0) {
-		if (argc != 4) {
+		DisassemblyFormat format = DISASM_TEXT;
+		if ((argc != 4 && argc != 6) ||
+		    (argc == 6 && (strcmp(argv[4], "--format") ||
+				   !parse_disassembly_format(argv[5], &format)))) {
 			print_usage();
 			return EXIT_FAILURE;
 		}
+		Disassembly disassembly;
 		if (strcmp(argv[2], "linear") == 0) {
 			buffer = read_rom(argv[3], &buffer_size);
-			Disassembly disassembly =
-				disassemble_linear(buffer, buffer_size, PROG_BASE);
-			sds disasm_str = disassembly2str(&disassembly);
-			printf("%s\n", disasm_str);
-			sdsfree(disasm_str);
-			free_disassembly(&disassembly);
-			free(buffer);
+			disassembly = disassemble_linear(buffer, buffer_size, PROG_BASE);
 		} else if (strcmp(argv[2], "recursive") == 0) {
 			buffer = read_rom(argv[3], &buffer_size);
-			Disassembly disassembly = disassemble_rd(buffer, buffer_size, PROG_BASE, 0);
-			sds disasm_str = disassembly2str(&disassembly);
-			printf("%s\n", disasm_str);
-			sdsfree(disasm_str);
-			free_disassembly(&disassembly);
-			free(buffer);
+			disassembly =
+				disassemble_rd(buffer, buffer_size, buffer_size, PROG_BASE, 0);
+		} else {
+			print_usage();
+			return EXIT_FAILURE;
+		}
+		// Straight to stdout as it's formatted, rather than built up first
+		Output *output = malloc(sizeof(Output));
+		output_open_fd(output, STDOUT_FILENO);
+		write_disassembly(output, &disassembly, format);
+		bool written = output_flush(output);
+		free(output);
+		free_disassembly(&disassembly);
+		free(buffer);
+		if (!written) {
+			fprintf(stderr, "[!] Failed to write the disassembly\n");
+			return EXIT_FAILURE;
+		}
+	} else if (strcmp(argv[1], "analyze") == 0) {
+		if ((argc != 4 && argc != 6) || (argc == 6 && strcmp(argv[4], "--threads"))) {
+			print_usage();
+			return EXIT_FAILURE;
+		}
+		int threads = argc == 6 ? atoi(argv[5]) : 0;
+		return analyze_directory(argv[2], argv[3], threads) ? EXIT_SUCCESS : EXIT_FAILURE;
+	} else if (strcmp(argv[1], "cfg") == 0) {
+		bool json = argc == 4 && strcmp(argv[3], "--json") == 0;
+		if ((argc != 3 && argc != 4) || (argc == 4 && !json && strcmp(argv[3], "--dot"))) {
+			print_usage();
+			return EXIT_FAILURE;
 		}
+		buffer = read_rom(argv[2], &buffer_size);
+		Disassembly disassembly =
+			disassemble_rd(buffer, buffer_size, buffer_size, PROG_BASE, 0);
+		ControlFlowGraph cfg = cfg_build(&disassembly, buffer, buffer_size);
+		sds graph = json ? cfg2json(&cfg) : cfg2dot(&cfg);
+		printf("%s", graph);
+		sdsfree(graph);
+		free_cfg(&cfg);
+		free_disassembly(&disassembly);
+		free(buffer);
 	} else if (strcmp(argv[1], "decompile") == 0) {
 		if (argc != 3) {
 			print_usage();
 			return EXIT_FAILURE;
 		}
-		// TODO: Implement decompiler
-		fprintf(stderr, "!!! NOT IMPLEMENTED !!!\n");
-		return EXIT_FAILURE;
+		buffer = read_rom(argv[2], &buffer_size);
+		Disassembly disassembly =
+			disassemble_rd(buffer, buffer_size, buffer_size, PROG_BASE, 0);
+		Decompilation decompilation = decompile(&disassembly, buffer, buffer_size);
+		sds source = decompilation2str(&decompilation);
+		printf("%s", source);
+		sdsfree(source);
+		free_decompilation(&decompilation);
+		free_disassembly(&disassembly);
+		free(buffer);
 	} else if (strcmp(argv[1], "assemble") == 0) {
 		if (argc != 4) {
 			print_usage();
@@ -97,27 +189,233 @@ int main(int argc, char *argv[]) {
 			print_usage();
 			return EXIT_FAILURE;
 		}
-		// TODO: Implement compiler
-		fprintf(stderr, "!!! NOT IMPLEMENTED !!!\n");
-		return EXIT_FAILURE;
-	} else if (strcmp(argv[1], "emulate") == 0) {
+
+		uint8_t *rom = compile(argv[2]);
+		if (rom == NULL) {
+			return EXIT_FAILURE;
+		}
+		FILE *output = fopen(argv[3], "wb");
+		if (output == NULL) {
+			fprintf(stderr, "[!] Failed to open %s\n", argv[3]);
+			arrfree(rom);
+			return EXIT_FAILURE;
+		}
+		fwrite(rom, sizeof(uint8_t), arrlen(rom), output);
+		fclose(output);
+		arrfree(rom);
+	} else if (strcmp(argv[1], "recompile") == 0) {
+		if (argc != 4) {
+			print_usage();
+			return EXIT_FAILURE;
+		}
+
+		buffer = read_rom(argv[2], &buffer_size);
+		sds source = recompile(buffer, buffer_size, argv[2]);
+		FILE *output = fopen(argv[3], "w");
+		if (output == NULL) {
+			fprintf(stderr, "Error opening output file\n");
+			return EXIT_FAILURE;
+		}
+		fwrite(source, sizeof(char), sdslen(source), output);
+		fclose(output);
+		sdsfree(source);
+		free(buffer);
+	} else if (strcmp(argv[1], "pairs") == 0) {
 		if (argc != 3 && argc != 4) {
 			print_usage();
 			return EXIT_FAILURE;
 		}
 
-		int rom_idx = 2;
+		int frames = argc == 4 ? atoi(argv[3]) : 600;
+		buffer = read_rom(argv[2], &buffer_size);
+		PairProfile *profile = malloc(sizeof(PairProfile));
+		profile_pairs(profile, buffer, buffer_size, frames);
+		sds report = pair_profile2str(profile, 20);
+		printf("%s", report);
+		sdsfree(report);
+		free(profile);
+		free(buffer);
+	} else if (strcmp(argv[1], "lockstep") == 0) {
+		if (argc < 3 || argc > 5) {
+			print_usage();
+			return EXIT_FAILURE;
+		}
+
+		int lanes = argc >= 4 ? atoi(argv[3]) : LOCKSTEP_MAX_LANES;
+		int frames = argc == 5 ? atoi(argv[4]) : 600;
+		buffer = read_rom(argv[2], &buffer_size);
+		uint32_t seed = (uint32_t)time(NULL);
+		LockstepState *state = lockstep_create(buffer, buffer_size, lanes, seed);
+		if (state == NULL) {
+			fprintf(stderr, "[!] Lanes must be between 1 and %d\n", LOCKSTEP_MAX_LANES);
+			free(buffer);
+			return EXIT_FAILURE;
+		}
+
+		clock_t start = clock();
+		for (int frame = 0; frame < frames; ++frame) {
+			lockstep_run_frame(state);
+		}
+		double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+		for (int lane = 0; lane < state->lanes; ++lane) {
+			printf("Lane %2d: PC 0x%03hx, %" PRIu64 " cycles%s\n", lane,
+			       state->pc[lane], state->cycle_count[lane],
+			       state->halted[lane] ? " (halted)" : "");
+		}
+		double lanes_per_dispatch = 0;
+		if (state->dispatches) {
+			lanes_per_dispatch = (double)state->lane_instructions / state->dispatches;
+		}
+		printf("\nInstructions executed: %" PRIu64 "\n"
+		       "Dispatches: %" PRIu64 " (%.2f lanes each)\n"
+		       "Time: %.3fs (%.0f frames/s across all lanes)\n",
+		       state->lane_instructions, state->dispatches, lanes_per_dispatch, seconds,
+		       seconds > 0 ? frames / seconds * state->lanes : 0.0);
+		lockstep_free(state);
+		free(buffer);
+	} else if (strcmp(argv[1], "profile") == 0) {
+		if (argc < 3 || argc % 2 == 0) {
+			print_usage();
+			return EXIT_FAILURE;
+		}
+
+		int frames = 600;
+		char *csv_path = NULL;
+		char *collapsed_path = NULL;
+		for (int i = 3; i < argc; i += 2) {
+			if (strcmp(argv[i], "--frames") == 0) {
+				frames = atoi(argv[i + 1]);
+			} else if (strcmp(argv[i], "--memory") == 0) {
+				csv_path = argv[i + 1];
+			} else if (strcmp(argv[i], "--collapsed") == 0) {
+				collapsed_path = argv[i + 1];
+			} else {
+				print_usage();
+				return EXIT_FAILURE;
+			}
+		}
+
+		buffer = read_rom(argv[2], &buffer_size);
+		EmulatorState *emulator = calloc(1, sizeof(EmulatorState));
+		emulator->configuration = CONFIG_CHIP8;
+		emulator->cycles_per_frame = DEFAULT_CYCLES_PER_FRAME;
+		emulator->debug_state.profiling = true;
+		load_rom(emulator, buffer, buffer_size, NULL);
+
+		for (int frame = 0; frame < frames && !emulator->debug_state.debug_mode; ++frame) {
+			run_frame(emulator);
+		}
+
+		CallGraph *call_graph = &emulator->debug_state.call_graph;
+		sds report = execution_profile2str(emulator, 20);
+		sds calls = call_graph2str(call_graph, emulator->cycle_count);
+		sds working_set = working_set2str(emulator);
+		printf("%s\n%s\n%s", report, calls, working_set);
+		sdsfree(report);
+		sdsfree(calls);
+		sdsfree(working_set);
+
+		if (csv_path) {
+			FILE *output = fopen(csv_path, "w");
+			if (output == NULL) {
+				fprintf(stderr, "[!] Failed to open %s\n", csv_path);
+				return EXIT_FAILURE;
+			}
+			sds csv = memory_profile2csv(emulator);
+			fwrite(csv, sizeof(char), sdslen(csv), output);
+			fclose(output);
+			sdsfree(csv);
+		}
+		if (collapsed_path) {
+			FILE *output = fopen(collapsed_path, "w");
+			if (output == NULL) {
+				fprintf(stderr, "[!] Failed to open %s\n", collapsed_path);
+				return EXIT_FAILURE;
+			}
+			sds stacks = call_graph2collapsed(call_graph, emulator->cycle_count);
+			fwrite(stacks, sizeof(char), sdslen(stacks), output);
+			fclose(output);
+			sdsfree(stacks);
+		}
+		free_emulator(emulator);
+		free(emulator);
+	} else if (strcmp(argv[1], "trace") == 0) {
+		if (argc == 4 && strcmp(argv[2], "decode") == 0) {
+			FILE *input = fopen(argv[3], "rb");
+			if (input == NULL) {
+				fprintf(stderr, "[!] Failed to open trace file %s\n", argv[3]);
+				return EXIT_FAILURE;
+			}
+			bool decoded = trace_decode(input, stdout);
+			fclose(input);
+			return decoded ? EXIT_SUCCESS : EXIT_FAILURE;
+		} else if ((argc != 5 && argc != 6) || strcmp(argv[2], "record") != 0) {
+			print_usage();
+			return EXIT_FAILURE;
+		}
+
+		int frames = argc == 6 ? atoi(argv[5]) : 600;
+		TraceRecorder *trace = trace_open(argv[4]);
+		if (trace == NULL) {
+			return EXIT_FAILURE;
+		}
+		buffer = read_rom(argv[3], &buffer_size);
+		EmulatorState *emulator = calloc(1, sizeof(EmulatorState));
+		emulator->configuration = CONFIG_CHIP8;
+		emulator->cycles_per_frame = DEFAULT_CYCLES_PER_FRAME;
+		emulator->trace = trace;
+		load_rom(emulator, buffer, buffer_size, NULL);
+
+		clock_t start = clock();
+		for (int frame = 0; frame < frames && !emulator->debug_state.debug_mode; ++frame) {
+			run_frame(emulator);
+		}
+		double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+		uint64_t records = trace->records;
+		trace_close(trace);
+		printf("Recorded %" PRIu64 " instructions in %.3fs\n", records, seconds);
+		free_emulator(emulator);
+		free(emulator);
+	} else if (strcmp(argv[1], "dap") == 0) {
+		if (argc != 2) {
+			print_usage();
+			return EXIT_FAILURE;
+		}
+		return dap_serve() ? EXIT_SUCCESS : EXIT_FAILURE;
+	} else if (strcmp(argv[1], "emulate") == 0) {
+		char *rom_path = NULL;
+		char *gdb_address = NULL;
 		bool debug = false;
-		if (argc == 4) {
-			if (strcmp("--debug", argv[2]) == 0) {
-				debug = true;
-				rom_idx = 3;
-			} else if (strcmp("--debug", argv[3]) == 0) {
+		for (int i = 2; i < argc; ++i) {
+			if (strcmp("--debug", argv[i]) == 0) {
 				debug = true;
+			} else if (strcmp("--gdb", argv[i]) == 0 && i + 1 < argc) {
+				gdb_address = argv[++i];
+			} else if (!rom_path) {
+				rom_path = argv[i];
+			} else {
+				print_usage();
+				return EXIT_FAILURE;
 			}
 		}
+		if (!rom_path) {
+			print_usage();
+			return EXIT_FAILURE;
+		}
 
-		emulate_file(argv[rom_idx], debug);
+		if (gdb_address) {
+			// Headless, starting paused until the debugger resumes it
+			buffer = read_rom(rom_path, &buffer_size);
+			EmulationThread *emulation = calloc(1, sizeof(EmulationThread));
+			emulation_thread_start(emulation, buffer, buffer_size, rom_path, true);
+			bool served = gdb_serve(emulation, gdb_address);
+			emulation_thread_stop(emulation);
+			free(emulation);
+			return served ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+		emulate_file(rom_path, debug);
 	} else {
 		print_usage();
 		return EXIT_FAILURE;
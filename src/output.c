@@ -0,0 +1,124 @@
+#include "output.h"
+#include "sds.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char hex_digits[] = "0123456789abcdef";
+
+void output_open_fd(Output *output, int fd) {
+	output->fd = fd;
+	output->string = NULL;
+	output->failed = false;
+	output->length = 0;
+}
+
+void output_open_string(Output *output) {
+	output_open_fd(output, -1);
+	output->string = sdsempty();
+}
+
+// Empties the buffer, returning whether everything so far was written
+bool output_flush(Output *output) {
+	if (output->fd < 0) {
+		output->string = sdscatlen(output->string, output->buffer, output->length);
+		output->length = 0;
+		return true;
+	}
+
+	size_t written = 0;
+	while (!output->failed && written < output->length) {
+		ssize_t result =
+			write(output->fd, output->buffer + written, output->length - written);
+		if (result < 0 && errno != EINTR) {
+			output->failed = true;
+		} else if (result > 0) {
+			written += result;
+		}
+	}
+	output->length = 0;
+	return !output->failed;
+}
+
+// The collected string, which the caller then owns
+sds output_take_string(Output *output) {
+	output_flush(output);
+	sds string = output->string;
+	output->string = NULL;
+	return string;
+}
+
+void output_write(Output *output, const void *data, size_t length) {
+	const char *bytes = data;
+	while (length > 0) {
+		if (output->length == OUTPUT_BUFFER_SIZE) {
+			output_flush(output);
+		}
+		size_t space = OUTPUT_BUFFER_SIZE - output->length;
+		size_t chunk = length < space ? length : space;
+		memcpy(output->buffer + output->length, bytes, chunk);
+		output->length += chunk;
+		bytes += chunk;
+		length -= chunk;
+	}
+}
+
+void output_str(Output *output, const char *string) {
+	output_write(output, string, strlen(string));
+}
+
+// The lowest `digits` hex digits of `value`, zero-padded
+void output_hex(Output *output, uint32_t value, int digits) {
+	char text[8];
+	for (int i = digits; i-- > 0;) {
+		text[i] = hex_digits[value & 0xF];
+		value >>= 4;
+	}
+	output_write(output, text, digits);
+}
+
+void output_dec(Output *output, uint64_t value) {
+	char text[20];
+	int start = sizeof(text);
+	do {
+		text[--start] = '0' + value % 10;
+		value /= 10;
+	} while (value);
+	output_write(output, text + start, sizeof(text) - start);
+}
+
+// Quoted and escaped, as json_cat_string() does
+void output_json_string(Output *output, const char *string) {
+	output_char(output, '"');
+	for (const char *c = string; *c; ++c) {
+		switch (*c) {
+		case '"':
+			output_str(output, "\\\"");
+			break;
+		case '\\':
+			output_str(output, "\\\\");
+			break;
+		case '\n':
+			output_str(output, "\\n");
+			break;
+		case '\r':
+			output_str(output, "\\r");
+			break;
+		case '\t':
+			output_str(output, "\\t");
+			break;
+		default:
+			if ((unsigned char)*c < 0x20) {
+				output_str(output, "\\u00");
+				output_hex(output, (unsigned char)*c, 2);
+			} else {
+				output_char(output, *c);
+			}
+			break;
+		}
+	}
+	output_char(output, '"');
+}
@@ -0,0 +1,42 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include "sds.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Buffered output for listings too big to build in memory first. Writes go
+// into a fixed buffer, which is flushed to a file descriptor when full, or
+// appended to an sds string for callers that want the text itself.
+
+#define OUTPUT_BUFFER_SIZE 65536
+
+typedef struct Output {
+	int fd; // -1 when collecting into `string`
+	sds string;
+	bool failed; // A write to `fd` failed, so the rest is dropped
+	size_t length;
+	char buffer[OUTPUT_BUFFER_SIZE];
+} Output;
+
+void output_open_fd(Output *output, int fd);
+void output_open_string(Output *output);
+bool output_flush(Output *output);
+sds output_take_string(Output *output);
+
+void output_write(Output *output, const void *data, size_t length);
+void output_str(Output *output, const char *string);
+void output_hex(Output *output, uint32_t value, int digits);
+void output_dec(Output *output, uint64_t value);
+void output_json_string(Output *output, const char *string);
+
+static inline void output_char(Output *output, char c) {
+	if (output->length == OUTPUT_BUFFER_SIZE) {
+		output_flush(output);
+	}
+	output->buffer[output->length++] = c;
+}
+
+#endif // !OUTPUT_H
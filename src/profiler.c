@@ -0,0 +1,188 @@
+#include "profiler.h"
+#include "core.h"
+#include "disassembler.h"
+#include "instructions.h"
+#include "sds.h"
+#include "stb_ds.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef struct AddressCount {
+	uint64_t count;
+	uint16_t start;
+	uint16_t end; // Last instruction, for blocks
+	size_t length;
+} AddressCount;
+
+static int compare_address_counts(const void *a, const void *b) {
+	uint64_t count_a = ((AddressCount *)a)->count;
+	uint64_t count_b = ((AddressCount *)b)->count;
+	return count_a < count_b ? 1 : count_a > count_b ? -1 : 0;
+}
+
+uint64_t max_execution_count(DebugState *debug_state) {
+	uint64_t max = 0;
+	for (int addr = 0; addr < EMULATOR_MEMORY_SIZE; ++addr) {
+		if (debug_state->execution_counts[addr] > max) {
+			max = debug_state->execution_counts[addr];
+		}
+	}
+	return max;
+}
+
+// Hottest addresses, then each instruction block's share of the instructions run
+sds execution_profile2str(EmulatorState *emulator, size_t max_rows) {
+	DebugState *debug_state = &emulator->debug_state;
+	Disassembly *disassembly = &debug_state->disassembly;
+
+	AddressCount *addresses = NULL;
+	uint64_t total = 0;
+	for (int addr = 0; addr < EMULATOR_MEMORY_SIZE; ++addr) {
+		if (debug_state->execution_counts[addr]) {
+			AddressCount count = { debug_state->execution_counts[addr], addr, addr, 1 };
+			arrput(addresses, count);
+			total += count.count;
+		}
+	}
+	qsort(addresses, arrlen(addresses), sizeof(AddressCount), compare_address_counts);
+
+	AddressCount *blocks = NULL;
+	for (size_t i = 0; i < disassembly->iblock_length; ++i) {
+		InstructionBlock *block = &disassembly->instruction_blocks[i];
+		if (!block->length) {
+			continue;
+		}
+		AddressCount count = {
+			.start = disassembly->base + block->instructions[0].address,
+			.end = disassembly->base + block->instructions[block->length - 1].address,
+			.length = block->length,
+		};
+		for (size_t j = 0; j < block->length; ++j) {
+			uint16_t addr = disassembly->base + block->instructions[j].address;
+			count.count += debug_state->execution_counts[addr & EMULATOR_ADDR_MASK];
+		}
+		if (count.count) {
+			arrput(blocks, count);
+		}
+	}
+	qsort(blocks, arrlen(blocks), sizeof(AddressCount), compare_address_counts);
+
+	sds out = sdscatprintf(sdsempty(),
+			       "Instructions executed: %" PRIu64 "\n\n"
+			       "     Count   Share  Address  Instruction\n",
+			       total);
+	for (size_t i = 0; i < (size_t)arrlen(addresses) && i < max_rows; ++i) {
+		uint16_t addr = addresses[i].start;
+		char text[INST_TEXT_SIZE];
+		out = sdscatprintf(out, "%10" PRIu64 "  %5.2f%%  0x%03hx    %s\n",
+				   addresses[i].count, 100.0 * addresses[i].count / total, addr,
+				   inst2text(opcode_at(emulator->memory, addr), text));
+	}
+
+	out = sdscat(out, "\n     Count   Share  Block          Instructions\n");
+	for (size_t i = 0; i < (size_t)arrlen(blocks) && i < max_rows; ++i) {
+		out = sdscatprintf(out, "%10" PRIu64 "  %5.2f%%  0x%03hx-0x%03hx  %zu\n",
+				   blocks[i].count, 100.0 * blocks[i].count / total,
+				   blocks[i].start, blocks[i].end, blocks[i].length);
+	}
+
+	arrfree(addresses);
+	arrfree(blocks);
+	return out;
+}
+
+uint64_t max_memory_access_count(DebugState *debug_state) {
+	uint64_t max = 0;
+	for (int addr = 0; addr < EMULATOR_MEMORY_SIZE; ++addr) {
+		uint64_t count = debug_state->memory_reads[addr] + debug_state->sprite_reads[addr] +
+				 debug_state->memory_writes[addr];
+		if (count > max) {
+			max = count;
+		}
+	}
+	return max;
+}
+
+// Appends the ranges of set bytes in `bytes`, e.g. " 0x2a0-0x2a3 0x300"
+static sds ranges2str(sds out, bool *bytes) {
+	for (int addr = 0; addr < EMULATOR_MEMORY_SIZE; ++addr) {
+		if (!bytes[addr]) {
+			continue;
+		}
+		int end = addr;
+		while (end + 1 < EMULATOR_MEMORY_SIZE && bytes[end + 1]) {
+			end++;
+		}
+		out = end == addr ? sdscatprintf(out, " 0x%03x", addr) :
+				    sdscatprintf(out, " 0x%03x-0x%03x", addr, end);
+		addr = end;
+	}
+	return out;
+}
+
+// Sizes of the code, sprites and scratch memory the ROM has, and actually uses
+sds working_set2str(EmulatorState *emulator) {
+	DebugState *debug_state = &emulator->debug_state;
+	Disassembly *disassembly = &debug_state->disassembly;
+
+	size_t static_code = 0;
+	for (size_t i = 0; i < disassembly->abook_length; ++i) {
+		AddressType type = disassembly->addressbook[i].type;
+		static_code += type == ADDR_INSTRUCTION || type == ADDR_INST_HALF;
+	}
+	size_t rom_size = emulator->rom_size;
+
+	bool executed[EMULATOR_MEMORY_SIZE] = { 0 };
+	for (int addr = 0; addr < EMULATOR_MEMORY_SIZE; ++addr) {
+		if (debug_state->execution_counts[addr]) {
+			executed[addr] = true;
+			executed[(addr + 1) & EMULATOR_ADDR_MASK] = true;
+		}
+	}
+
+	size_t code = 0, sprites = 0, scratch = 0, modified = 0;
+	bool self_modifying[EMULATOR_MEMORY_SIZE] = { 0 };
+	for (int addr = 0; addr < EMULATOR_MEMORY_SIZE; ++addr) {
+		bool written = debug_state->memory_writes[addr] > 0;
+		code += executed[addr];
+		sprites += debug_state->sprite_reads[addr] > 0;
+		scratch += written || debug_state->memory_reads[addr] > 0;
+		self_modifying[addr] = executed[addr] && written;
+		modified += self_modifying[addr];
+	}
+
+	sds out = sdscatprintf(sdsempty(),
+			       "Static working set (recursive disassembly of the ROM):\n"
+			       "  Code bytes:     %zu\n"
+			       "  Data bytes:     %zu\n"
+			       "Dynamic working set (bytes touched while running):\n"
+			       "  Code bytes:     %zu (executed)\n"
+			       "  Sprite bytes:   %zu (read by DRW)\n"
+			       "  Scratch bytes:  %zu (read by LD Vx, [I] or written)\n"
+			       "  Self-modifying: %zu (executed and written)",
+			       static_code, rom_size > static_code ? rom_size - static_code : 0,
+			       code, sprites, scratch, modified);
+	out = ranges2str(out, self_modifying);
+	return sdscat(out, "\n");
+}
+
+// One row per address that was accessed at all
+sds memory_profile2csv(EmulatorState *emulator) {
+	DebugState *debug_state = &emulator->debug_state;
+	sds out = sdsnew("address,executions,reads,sprite_reads,writes\n");
+	for (int addr = 0; addr < EMULATOR_MEMORY_SIZE; ++addr) {
+		uint64_t executions = debug_state->execution_counts[addr];
+		uint64_t reads = debug_state->memory_reads[addr];
+		uint64_t sprite_reads = debug_state->sprite_reads[addr];
+		uint64_t writes = debug_state->memory_writes[addr];
+		if (executions || reads || sprite_reads || writes) {
+			out = sdscatprintf(out, "0x%03x,%" PRIu64 ",%" PRIu64 ",%" PRIu64
+					   ",%" PRIu64 "\n",
+					   addr, executions, reads, sprite_reads, writes);
+		}
+	}
+	return out;
+}
@@ -0,0 +1,18 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "core.h"
+#include "sds.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Reports on the per-address counts collected while DebugState.profiling is set
+
+uint64_t max_execution_count(DebugState *debug_state);
+uint64_t max_memory_access_count(DebugState *debug_state);
+sds execution_profile2str(EmulatorState *emulator, size_t max_rows);
+sds working_set2str(EmulatorState *emulator);
+sds memory_profile2csv(EmulatorState *emulator);
+
+#endif // !PROFILER_H
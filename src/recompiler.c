@@ -0,0 +1,609 @@
+#include "recompiler.h"
+#include "common.h"
+#include "core.h"
+#include "disassembler.h"
+#include "instructions.h"
+#include "ir.h"
+
+#include "sds.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Ahead-of-time recompiler
+//
+// Translates every block found by the recursive descent disassembler into a C
+// function that keeps V0-VF in locals, after running it through the IR's
+// optimisation passes. A function is entered fresh at IR leaders only; other
+// instructions are entered only to resume where the block itself stopped
+// (end of frame, or after handing an instruction to the interpreter), since
+// the optimisations assume the straight-line path that led there. Anything
+// that can't be known statically (JMP V0 targets, code that has been
+// overwritten at runtime, bytes the disassembler never reached) falls back to
+// the core's interpreter.
+
+static const char *RUNTIME_PRELUDE =
+	"#include \"core.h\"\n"
+	"#include \"instructions.h\"\n"
+	"\n"
+	"#include <stdbool.h>\n"
+	"#include <stdint.h>\n"
+	"#include <stdio.h>\n"
+	"#include <stdlib.h>\n"
+	"#include <string.h>\n"
+	"\n"
+	"#define RC_CONTINUE 0 // PC updated, keep dispatching\n"
+	"#define RC_YIELD 1 // Out of cycles for this frame\n"
+	"#define RC_INTERPRET 2 // Let the interpreter execute the instruction at PC\n"
+	"#define RC_NO_ADDRESS 0xFFFF\n"
+	"\n"
+	"#define LOAD_REGISTERS() \\\n"
+	"\tv0 = emulator->registers[0x0], v1 = emulator->registers[0x1], \\\n"
+	"\tv2 = emulator->registers[0x2], v3 = emulator->registers[0x3], \\\n"
+	"\tv4 = emulator->registers[0x4], v5 = emulator->registers[0x5], \\\n"
+	"\tv6 = emulator->registers[0x6], v7 = emulator->registers[0x7], \\\n"
+	"\tv8 = emulator->registers[0x8], v9 = emulator->registers[0x9], \\\n"
+	"\tva = emulator->registers[0xA], vb = emulator->registers[0xB], \\\n"
+	"\tvc = emulator->registers[0xC], vd = emulator->registers[0xD], \\\n"
+	"\tve = emulator->registers[0xE], vf = emulator->registers[0xF]\n"
+	"#define STORE_REGISTERS() \\\n"
+	"\temulator->registers[0x0] = v0, emulator->registers[0x1] = v1, \\\n"
+	"\temulator->registers[0x2] = v2, emulator->registers[0x3] = v3, \\\n"
+	"\temulator->registers[0x4] = v4, emulator->registers[0x5] = v5, \\\n"
+	"\temulator->registers[0x6] = v6, emulator->registers[0x7] = v7, \\\n"
+	"\temulator->registers[0x8] = v8, emulator->registers[0x9] = v9, \\\n"
+	"\temulator->registers[0xA] = va, emulator->registers[0xB] = vb, \\\n"
+	"\temulator->registers[0xC] = vc, emulator->registers[0xD] = vd, \\\n"
+	"\temulator->registers[0xE] = ve, emulator->registers[0xF] = vf\n"
+	"\n"
+	"#define TICK(addr) \\\n"
+	"\tif (*budget <= 0) { \\\n"
+	"\t\temulator->pc = (addr); \\\n"
+	"\t\tSTORE_REGISTERS(); \\\n"
+	"\t\trc_resume_pc = (addr); \\\n"
+	"\t\treturn RC_YIELD; \\\n"
+	"\t} \\\n"
+	"\t--*budget; \\\n"
+	"\temulator->cycle_count++\n"
+	"#define EXIT(addr) \\\n"
+	"\tdo { \\\n"
+	"\t\temulator->pc = (addr); \\\n"
+	"\t\tSTORE_REGISTERS(); \\\n"
+	"\t\treturn RC_CONTINUE; \\\n"
+	"\t} while (0)\n"
+	"#define CHAIN(addr, block) \\\n"
+	"\tdo { \\\n"
+	"\t\temulator->pc = (addr); \\\n"
+	"\t\tSTORE_REGISTERS(); \\\n"
+	"\t\tif (rc_invalid[block]) { \\\n"
+	"\t\t\treturn RC_CONTINUE; \\\n"
+	"\t\t} \\\n"
+	"\t\treturn rc_blocks[block].function(emulator, budget, false); \\\n"
+	"\t} while (0)\n"
+	"#define INTERPRET(addr) \\\n"
+	"\tdo { \\\n"
+	"\t\temulator->pc = (addr); \\\n"
+	"\t\tSTORE_REGISTERS(); \\\n"
+	"\t\trc_handover = (addr); \\\n"
+	"\t\treturn RC_INTERPRET; \\\n"
+	"\t} while (0)\n"
+	"\n"
+	"// `resume` allows entering mid-block, where the block last stopped\n"
+	"typedef int (*RecompiledFunction)(EmulatorState *, int *budget, bool resume);\n"
+	"\n"
+	"typedef struct RecompiledBlock {\n"
+	"\tRecompiledFunction function;\n"
+	"\tuint16_t start;\n"
+	"\tuint16_t end;\n"
+	"} RecompiledBlock;\n"
+	"\n"
+	"static uint16_t rc_resume_pc = RC_NO_ADDRESS; // Where a block yielded\n"
+	"static uint16_t rc_handover = RC_NO_ADDRESS; // Instruction handed to the interpreter\n"
+	"\n";
+
+static const char *RUNTIME_DISPATCHER =
+	"static int16_t rc_block_of[EMULATOR_MEMORY_SIZE];\n"
+	"static bool rc_ready = false;\n"
+	"\n"
+	"static uint8_t rc_original(uint16_t addr) {\n"
+	"\tif (addr < PROG_BASE || addr - PROG_BASE >= sizeof(rc_rom)) {\n"
+	"\t\treturn 0;\n"
+	"\t}\n"
+	"\treturn rc_rom[addr - PROG_BASE];\n"
+	"}\n"
+	"\n"
+	"// Drops native blocks whose code has been overwritten\n"
+	"static void rc_check_store(EmulatorState *emulator, Chip8Instruction instruction,\n"
+	"\t\t\t   uint16_t vi) {\n"
+	"\tint length = 0;\n"
+	"\tswitch (instruction_type(instruction)) {\n"
+	"\tcase CHIP8_LD_B_VX:\n"
+	"\t\tlength = 3;\n"
+	"\t\tbreak;\n"
+	"\tcase CHIP8_LD_I_VX:\n"
+	"\t\tlength = instruction.iformat.reg + 1;\n"
+	"\t\tbreak;\n"
+	"\tdefault:\n"
+	"\t\treturn;\n"
+	"\t}\n"
+	"\n"
+	"\tfor (int i = 0; i < length; ++i) {\n"
+	"\t\tuint16_t addr = (vi + i) & EMULATOR_ADDR_MASK;\n"
+	"\t\tint16_t block = rc_block_of[addr];\n"
+	"\t\tif (block >= 0 && emulator->memory[addr] != rc_original(addr)) {\n"
+	"\t\t\trc_invalid[block] = true;\n"
+	"\t\t}\n"
+	"\t}\n"
+	"}\n"
+	"\n"
+	"void recompiled_reset(void) {\n"
+	"\tmemset(rc_block_of, 0xFF, sizeof(rc_block_of));\n"
+	"\tmemset(rc_invalid, 0, sizeof(rc_invalid));\n"
+	"\trc_resume_pc = RC_NO_ADDRESS;\n"
+	"\trc_handover = RC_NO_ADDRESS;\n"
+	"\tfor (int16_t block = 0; block < (int16_t)ARRAY_SIZE(rc_blocks); ++block) {\n"
+	"\t\tfor (uint16_t addr = rc_blocks[block].start; addr < rc_blocks[block].end; ++addr) {\n"
+	"\t\t\trc_block_of[addr] = block;\n"
+	"\t\t}\n"
+	"\t}\n"
+	"\trc_ready = true;\n"
+	"}\n"
+	"\n"
+	"// Executes a single instruction with the core's interpreter. Returns false\n"
+	"// once the frame is over.\n"
+	"static bool rc_interpret(EmulatorState *emulator, int *budget) {\n"
+	"\t--*budget;\n"
+	"\tuint16_t vi = emulator->vi;\n"
+	"\tChip8Instruction instruction = fetch_next(emulator, false);\n"
+	"\tif (!execute(emulator, instruction)) {\n"
+	"\t\tfprintf(stderr, \"[!] Something went wrong @ 0x%03hx\\n\", emulator->pc - 2);\n"
+	"\t\temulator->debug_state.debug_mode = true;\n"
+	"\t\treturn false;\n"
+	"\t}\n"
+	"\trc_check_store(emulator, instruction, vi);\n"
+	"\treturn !(emulator->display_interrupted ||\n"
+	"\t\t emulator->debug_state.memory_breakpoint_hit);\n"
+	"}\n"
+	"\n"
+	"// Runs up to `cycles` instructions, preferring native blocks\n"
+	"void recompiled_run(EmulatorState *emulator, int cycles) {\n"
+	"\tif (!rc_ready) {\n"
+	"\t\trecompiled_reset();\n"
+	"\t}\n"
+	"\n"
+	"\tint budget = cycles;\n"
+	"\twhile (budget > 0) {\n"
+	"\t\temulator->pc &= EMULATOR_ADDR_MASK;\n"
+	"\t\tbool resume = emulator->pc == rc_resume_pc;\n"
+	"\t\trc_resume_pc = RC_NO_ADDRESS;\n"
+	"\t\trc_handover = RC_NO_ADDRESS;\n"
+	"\n"
+	"\t\tint16_t block = rc_block_of[emulator->pc];\n"
+	"\t\tif (block >= 0 && !rc_invalid[block]) {\n"
+	"\t\t\tint status = rc_blocks[block].function(emulator, &budget, resume);\n"
+	"\t\t\tif (status == RC_YIELD || budget <= 0) {\n"
+	"\t\t\t\tbreak;\n"
+	"\t\t\t} else if (status == RC_CONTINUE) {\n"
+	"\t\t\t\tcontinue;\n"
+	"\t\t\t}\n"
+	"\t\t}\n"
+	"\n"
+	"\t\t// Instructions that stall (e.g. LD Vx, K) re-execute in place, so\n"
+	"\t\t// stay in the interpreter until PC moves on\n"
+	"\t\tuint16_t addr = emulator->pc;\n"
+	"\t\tdo {\n"
+	"\t\t\tif (!rc_interpret(emulator, &budget)) {\n"
+	"\t\t\t\treturn;\n"
+	"\t\t\t}\n"
+	"\t\t} while (emulator->pc == addr && budget > 0);\n"
+	"\n"
+	"\t\t// The block can carry on after an instruction it handed over\n"
+	"\t\tif (addr == rc_handover && emulator->pc == ((addr + 2) & EMULATOR_ADDR_MASK)) {\n"
+	"\t\t\trc_resume_pc = emulator->pc;\n"
+	"\t\t}\n"
+	"\t}\n"
+	"}\n"
+	"\n"
+	"void recompiled_run_frame(EmulatorState *emulator) {\n"
+	"\trecompiled_run(emulator, CYCLES_PER_FRAME[emulator->cycles_per_frame]);\n"
+	"\tif (!emulator->debug_state.memory_breakpoint_hit) {\n"
+	"\t\thandle_timers(emulator);\n"
+	"\t}\n"
+	"}\n"
+	"\n"
+	"#ifdef RECOMPILED_MAIN\n"
+	"// Headless runner: executes N frames, then prints the display and state\n"
+	"int main(int argc, char *argv[]) {\n"
+	"\tint frames = argc > 1 ? atoi(argv[1]) : 60;\n"
+	"\n"
+	"\tstatic EmulatorState emulator = { 0 };\n"
+	"\temulator.configuration = CONFIG_CHIP8;\n"
+	"\temulator.cycles_per_frame = DEFAULT_CYCLES_PER_FRAME;\n"
+	"\n"
+	"\tuint8_t *rom = malloc(sizeof(rc_rom));\n"
+	"\tmemcpy(rom, rc_rom, sizeof(rc_rom));\n"
+	"\tload_rom(&emulator, rom, sizeof(rc_rom), NULL);\n"
+	"\trecompiled_reset();\n"
+	"\n"
+	"\tfor (int frame = 0; frame < frames && !emulator.debug_state.debug_mode; ++frame) {\n"
+	"\t\trecompiled_run_frame(&emulator);\n"
+	"\t}\n"
+	"\n"
+	"\tfor (int y = 0; y < TARGET_HEIGHT; ++y) {\n"
+	"\t\tfor (int x = 0; x < TARGET_WIDTH; ++x) {\n"
+	"\t\t\tputchar(pixel(&emulator, x, y) ? '#' : ' ');\n"
+	"\t\t}\n"
+	"\t\tputchar('\\n');\n"
+	"\t}\n"
+	"\tdump_state(&emulator);\n"
+	"\n"
+	"\tfree_emulator(&emulator);\n"
+	"\treturn EXIT_SUCCESS;\n"
+	"}\n"
+	"#endif // RECOMPILED_MAIN\n";
+
+typedef struct RecompilerContext {
+	Disassembly *disassembly;
+	IRProgram *program;
+	size_t block_index;
+} RecompilerContext;
+
+// Block index containing the instruction at `addr`, or -1 if it isn't code
+static long block_of(RecompilerContext *ctx, uint16_t addr) {
+	Disassembly *disassembly = ctx->disassembly;
+	if (addr < disassembly->base || addr - disassembly->base >= disassembly->abook_length) {
+		return -1;
+	}
+
+	AddressLookup *lookup = &disassembly->addressbook[addr - disassembly->base];
+	if (lookup->type != ADDR_INSTRUCTION) {
+		return -1;
+	}
+	return lookup->block_offset;
+}
+
+// Emits the cheapest way of continuing execution at `target`
+static sds emit_transfer(sds out, RecompilerContext *ctx, uint16_t target) {
+	long block = block_of(ctx, target);
+	if (block == (long)ctx->block_index) {
+		return sdscatprintf(out, "goto L_0x%03hx;", target);
+	} else if (block >= 0) {
+		return sdscatprintf(out, "CHAIN(0x%03hx, %ld);", target, block);
+	}
+	return sdscatprintf(out, "EXIT(0x%03hx);", target);
+}
+
+// Needs runtime state, may stall the frame or may overwrite code
+static bool is_interpreted(Chip8InstructionType type) {
+	switch (type) {
+	case CHIP8_SYS_ADDR:
+	case CHIP8_JMP_V0_ADDR:
+	case CHIP8_DRW_VX_VY_NIBBLE:
+	case CHIP8_LD_VX_K:
+	case CHIP8_LD_B_VX:
+	case CHIP8_LD_I_VX:
+	case CHIP8_UNKNOWN:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static sds emit_skip(sds out, RecompilerContext *ctx, const char *condition, uint16_t addr) {
+	out = sdscatprintf(out, "\tif (%s) {\n\t\t", condition);
+	out = emit_transfer(out, ctx, addr + 4);
+	return sdscat(out, "\n\t}\n");
+}
+
+// Returns true if control never falls through to the next instruction
+static bool emit_instruction(sds *out, RecompilerContext *ctx, size_t index) {
+	DisassembledInstruction *disasm =
+		&ctx->disassembly->instruction_blocks[ctx->block_index].instructions[index];
+	IRInstruction *ir = &ctx->program->blocks[ctx->block_index].instructions[index];
+	Chip8Instruction instruction = ir->instruction;
+	uint16_t addr = ir->address + ctx->disassembly->base;
+	uint8_t x = instruction.rformat.rx;
+	uint8_t y = instruction.rformat.ry;
+	uint8_t kk = instruction.iformat.imm;
+	uint16_t nnn = instruction.aformat.addr;
+	bool vf_dead = ir->flags & IR_VF_DEAD;
+	char condition[64];
+
+	char text[INST_TEXT_SIZE];
+	*out = sdscatprintf(*out, "L_0x%03hx: // %s", addr, inst2text(disasm->instruction, text));
+	if (ir->flags & IR_DEAD) {
+		*out = sdscat(*out, " (dead)");
+	} else if (ir->flags & IR_FOLDED) {
+		*out = sdscatprintf(*out, " (folded: %s)", inst2text(instruction, text));
+	} else if (vf_dead) {
+		*out = sdscat(*out, " (VF unused)");
+	}
+	*out = sdscat(*out, "\n");
+
+	Chip8InstructionType type = ir->type;
+	if (is_interpreted(type)) {
+		*out = sdscatprintf(*out, "\tINTERPRET(0x%03hx);\n", addr);
+		return true;
+	}
+
+	*out = sdscatprintf(*out, "\tTICK(0x%03hx);\n", addr);
+	if (ir->flags & IR_DEAD) {
+		return false;
+	}
+
+	switch (type) {
+	case CHIP8_CLS:
+		*out = sdscat(*out, "\tmemset(emulator->display, 0, sizeof(emulator->display));\n");
+		break;
+	case CHIP8_RET:
+		*out = sdscat(*out, "\temulator->sp = (emulator->sp - 1) & EMULATOR_STACK_MASK;\n"
+				    "\tEXIT(emulator->stack[emulator->sp]);\n");
+		return true;
+	case CHIP8_JMP_ADDR:
+		*out = sdscat(*out, "\t");
+		*out = emit_transfer(*out, ctx, nnn);
+		*out = sdscat(*out, "\n");
+		return true;
+	case CHIP8_CALL_ADDR:
+		*out = sdscatprintf(*out,
+				    "\temulator->stack[emulator->sp] = 0x%03hx;\n"
+				    "\temulator->sp = (emulator->sp + 1) & EMULATOR_STACK_MASK;\n\t",
+				    addr + 2);
+		*out = emit_transfer(*out, ctx, nnn);
+		*out = sdscat(*out, "\n");
+		return true;
+	case CHIP8_SE_VX_BYTE:
+		snprintf(condition, sizeof(condition), "v%x == 0x%02x", x, kk);
+		*out = emit_skip(*out, ctx, condition, addr);
+		break;
+	case CHIP8_SNE_VX_BYTE:
+		snprintf(condition, sizeof(condition), "v%x != 0x%02x", x, kk);
+		*out = emit_skip(*out, ctx, condition, addr);
+		break;
+	case CHIP8_SE_VX_VY:
+		snprintf(condition, sizeof(condition), "v%x == v%x", x, y);
+		*out = emit_skip(*out, ctx, condition, addr);
+		break;
+	case CHIP8_SNE_VX_VY:
+		snprintf(condition, sizeof(condition), "v%x != v%x", x, y);
+		*out = emit_skip(*out, ctx, condition, addr);
+		break;
+	case CHIP8_SKP_VX:
+		snprintf(condition, sizeof(condition), "emulator->keyboard[v%x & 0xF]", x);
+		*out = emit_skip(*out, ctx, condition, addr);
+		break;
+	case CHIP8_SKNP_VX:
+		snprintf(condition, sizeof(condition), "emulator->keyboard[v%x & 0xF] == 0", x);
+		*out = emit_skip(*out, ctx, condition, addr);
+		break;
+	case CHIP8_LD_VX_BYTE:
+		*out = sdscatprintf(*out, "\tv%x = 0x%02x;\n", x, kk);
+		break;
+	case CHIP8_ADD_VX_BYTE:
+		*out = sdscatprintf(*out, "\tv%x += 0x%02x;\n", x, kk);
+		break;
+	case CHIP8_LD_VX_VY:
+		*out = sdscatprintf(*out, "\tv%x = v%x;\n", x, y);
+		break;
+	case CHIP8_OR_VX_VY:
+	case CHIP8_AND_VX_VY:
+	case CHIP8_XOR_VX_VY: {
+		char op = type == CHIP8_OR_VX_VY ? '|' : type == CHIP8_AND_VX_VY ? '&' : '^';
+		*out = sdscatprintf(*out, "\tv%x %c= v%x;\n", x, op, y);
+		if (!vf_dead) {
+			*out = sdscat(*out, "\tif (emulator->configuration & CONFIG_CHIP8_VF_RESET) {\n"
+					    "\t\tvf = 0;\n"
+					    "\t}\n");
+		}
+		break;
+	}
+	case CHIP8_ADD_VX_VY:
+		if (vf_dead) {
+			*out = sdscatprintf(*out, "\tv%x += v%x;\n", x, y);
+			break;
+		}
+		*out = sdscatprintf(*out,
+				    "\t{\n"
+				    "\t\tuint16_t result = v%x + v%x;\n"
+				    "\t\tv%x = (uint8_t)result;\n"
+				    "\t\tvf = result > 0xFF;\n"
+				    "\t}\n",
+				    x, y, x);
+		break;
+	case CHIP8_SUB_VX_VY:
+		if (vf_dead) {
+			*out = sdscatprintf(*out, "\tv%x -= v%x;\n", x, y);
+			break;
+		}
+		*out = sdscatprintf(*out,
+				    "\t{\n"
+				    "\t\tbool flag = v%x >= v%x;\n"
+				    "\t\tv%x -= v%x;\n"
+				    "\t\tvf = flag;\n"
+				    "\t}\n",
+				    x, y, x, y);
+		break;
+	case CHIP8_SUBN_VX_VY:
+		if (vf_dead) {
+			*out = sdscatprintf(*out, "\tv%x = v%x - v%x;\n", x, y, x);
+			break;
+		}
+		*out = sdscatprintf(*out,
+				    "\t{\n"
+				    "\t\tbool flag = v%x >= v%x;\n"
+				    "\t\tv%x = v%x - v%x;\n"
+				    "\t\tvf = flag;\n"
+				    "\t}\n",
+				    y, x, x, y, x);
+		break;
+	case CHIP8_SHR_VX:
+	case CHIP8_SHL_VX:
+		*out = sdscatprintf(*out,
+				    "\t{\n"
+				    "\t\tif (emulator->configuration & CONFIG_CHIP8_SHIFTING) {\n"
+				    "\t\t\tv%x = v%x;\n"
+				    "\t\t}\n",
+				    x, y);
+		if (vf_dead) {
+			*out = sdscatprintf(*out, "\t\tv%x %s= 1;\n", x,
+					    type == CHIP8_SHR_VX ? ">>" : "<<");
+			*out = sdscat(*out, "\t}\n");
+			break;
+		}
+		if (type == CHIP8_SHR_VX) {
+			*out = sdscatprintf(*out,
+					    "\t\tbool flag = v%x & 1;\n"
+					    "\t\tv%x >>= 1;\n",
+					    x, x);
+		} else {
+			*out = sdscatprintf(*out,
+					    "\t\tbool flag = (v%x & 0x80) > 0;\n"
+					    "\t\tv%x <<= 1;\n",
+					    x, x);
+		}
+		*out = sdscat(*out, "\t\tvf = flag;\n"
+				    "\t}\n");
+		break;
+	case CHIP8_LD_I_ADDR:
+		*out = sdscatprintf(*out, "\temulator->vi = 0x%03hx;\n", nnn);
+		break;
+	case CHIP8_RND_VX_BYTE:
+		*out = sdscatprintf(*out, "\tv%x = (rand() %% 256) & 0x%02x;\n", x, kk);
+		break;
+	case CHIP8_LD_VX_DT:
+		*out = sdscatprintf(*out, "\tv%x = emulator->dt;\n", x);
+		break;
+	case CHIP8_LD_DT_VX:
+		*out = sdscatprintf(*out, "\temulator->dt = v%x;\n", x);
+		break;
+	case CHIP8_LD_ST_VX:
+		*out = sdscatprintf(*out, "\temulator->st = v%x;\n", x);
+		break;
+	case CHIP8_ADD_I_VX:
+		*out = sdscatprintf(*out, "\temulator->vi = (emulator->vi + v%x) & EMULATOR_ADDR_MASK;\n",
+				    x);
+		break;
+	case CHIP8_LD_F_VX:
+		*out = sdscatprintf(*out, "\temulator->vi = FONT_BASE_ADDR + (v%x & 0xF) * 5;\n", x);
+		break;
+	case CHIP8_LD_VX_I:
+		for (uint8_t i = 0; i <= x; ++i) {
+			*out = sdscatprintf(*out, "\tv%x = memory_at(emulator, emulator->vi + %d);\n", i,
+					    i);
+		}
+		*out = sdscatprintf(*out,
+				    "\tif (emulator->configuration & CONFIG_CHIP8_MEMORY) {\n"
+				    "\t\temulator->vi = %d;\n"
+				    "\t}\n",
+				    x + 1);
+		break;
+	default:
+		break;
+	}
+
+	return false;
+}
+
+static sds emit_block(sds out, RecompilerContext *ctx) {
+	IRBlock *block = &ctx->program->blocks[ctx->block_index];
+	uint16_t base = ctx->disassembly->base;
+	uint16_t start = block->instructions[0].address + base;
+
+	out = sdscatprintf(out,
+			   "static int block_0x%03hx(EmulatorState *emulator, int *budget, bool resume) {\n"
+			   "\tuint8_t v0, v1, v2, v3, v4, v5, v6, v7, v8, v9, va, vb, vc, vd, ve, vf;\n"
+			   "\tLOAD_REGISTERS();\n"
+			   "\n"
+			   "\tswitch (emulator->pc) {\n",
+			   start);
+	for (size_t i = 0; i < block->length; ++i) {
+		IRInstruction *ir = &block->instructions[i];
+		uint16_t addr = ir->address + base;
+		out = sdscatprintf(out, "\tcase 0x%03hx:\n", addr);
+		if (!(ir->flags & IR_LEADER) && !is_interpreted(ir->type)) {
+			out = sdscat(out, "\t\tif (!resume) {\n"
+					  "\t\t\treturn RC_INTERPRET;\n"
+					  "\t\t}\n");
+		}
+		out = sdscatprintf(out, "\t\tgoto L_0x%03hx;\n", addr);
+	}
+	out = sdscat(out, "\tdefault:\n"
+			  "\t\treturn RC_INTERPRET;\n"
+			  "\t}\n"
+			  "\n");
+
+	bool terminated = false;
+	for (size_t i = 0; i < block->length; ++i) {
+		terminated = emit_instruction(&out, ctx, i);
+	}
+
+	if (!terminated) {
+		IRInstruction *last = &block->instructions[block->length - 1];
+		out = sdscat(out, "\t");
+		out = emit_transfer(out, ctx, last->address + base + 2);
+		out = sdscat(out, "\n");
+	}
+
+	return sdscat(out, "}\n\n");
+}
+
+sds recompile(uint8_t *rom, size_t rom_size, char *rom_name) {
+	if (rom_size > EMULATOR_MAX_ROM_SIZE) {
+		rom_size = EMULATOR_MAX_ROM_SIZE;
+	}
+
+	Disassembly disassembly = disassemble_rd(rom, rom_size, rom_size, PROG_BASE, 0);
+	IRProgram program = ir_build(&disassembly);
+	ir_optimise(&program);
+	RecompilerContext ctx = { .disassembly = &disassembly, .program = &program };
+
+	sds out = sdscatprintf(sdsempty(),
+			       "// Generated by `eo8 recompile` from %s\n"
+			       "//\n"
+			       "// Build against the headless core, e.g.\n"
+			       "//   cc -O2 -DRECOMPILED_MAIN -I<eo8>/src -I<eo8>/include <this file>\n"
+			       "//      <eo8 build>/libeo8core.a -lm -pthread\n"
+			       "//\n"
+			       "// recompiled_run_frame() is a drop-in for the core's run_frame(). Native\n"
+			       "// blocks skip breakpoint checks; everything else goes to the interpreter.\n"
+			       "\n",
+			       rom_name ? rom_name : "<unknown>");
+	out = sdscat(out, RUNTIME_PRELUDE);
+
+	out = sdscatprintf(out, "static const uint8_t rc_rom[%zu] = {", rom_size);
+	for (size_t i = 0; i < rom_size; ++i) {
+		out = sdscatprintf(out, "%s0x%02x,", i % 12 == 0 ? "\n\t" : " ", rom[i]);
+	}
+	out = sdscat(out, "\n};\n\n");
+
+	for (size_t i = 0; i < disassembly.iblock_length; ++i) {
+		uint16_t start =
+			disassembly.instruction_blocks[i].instructions[0].address + PROG_BASE;
+		out = sdscatprintf(out, "static int block_0x%03hx(EmulatorState *, int *, bool);\n",
+				   start);
+	}
+
+	out = sdscat(out, "\nstatic const RecompiledBlock rc_blocks[] = {\n");
+	for (size_t i = 0; i < disassembly.iblock_length; ++i) {
+		InstructionBlock *block = &disassembly.instruction_blocks[i];
+		uint16_t start = block->instructions[0].address + PROG_BASE;
+		uint16_t end = block->instructions[block->length - 1].address + PROG_BASE + 2;
+		out = sdscatprintf(out, "\t{ block_0x%03hx, 0x%03hx, 0x%03hx },\n", start, start,
+				   end);
+	}
+	out = sdscatprintf(out, "};\nstatic bool rc_invalid[%zu];\n\n",
+			   disassembly.iblock_length ? disassembly.iblock_length : 1);
+
+	for (ctx.block_index = 0; ctx.block_index < disassembly.iblock_length; ++ctx.block_index) {
+		out = emit_block(out, &ctx);
+	}
+
+	out = sdscat(out, RUNTIME_DISPATCHER);
+
+	free_ir(&program);
+	free_disassembly(&disassembly);
+	return out;
+}
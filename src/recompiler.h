@@ -0,0 +1,11 @@
+#ifndef RECOMPILER_H
+#define RECOMPILER_H
+
+#include "sds.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+sds recompile(uint8_t *rom, size_t rom_size, char *rom_name);
+
+#endif // !RECOMPILER_H
@@ -0,0 +1,86 @@
+#include "sha1.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+static uint32_t rotate_left(uint32_t value, int bits) {
+	return value << bits | value >> (32 - bits);
+}
+
+static void sha1_block(uint32_t state[5], const uint8_t *block) {
+	uint32_t w[80];
+	for (int i = 0; i < 16; ++i) {
+		w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 |
+		       (uint32_t)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+	}
+	for (int i = 16; i < 80; ++i) {
+		w[i] = rotate_left(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+	}
+
+	uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+	for (int i = 0; i < 80; ++i) {
+		uint32_t f, k;
+		if (i < 20) {
+			f = (b & c) | (~b & d);
+			k = 0x5A827999;
+		} else if (i < 40) {
+			f = b ^ c ^ d;
+			k = 0x6ED9EBA1;
+		} else if (i < 60) {
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8F1BBCDC;
+		} else {
+			f = b ^ c ^ d;
+			k = 0xCA62C1D6;
+		}
+		uint32_t temp = rotate_left(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = rotate_left(b, 30);
+		b = a;
+		a = temp;
+	}
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+}
+
+void sha1(const uint8_t *data, size_t length, uint8_t digest[SHA1_SIZE]) {
+	uint32_t state[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+	size_t whole = length - length % 64;
+	for (size_t i = 0; i < whole; i += 64) {
+		sha1_block(state, data + i);
+	}
+
+	// The rest, a 1 bit, zeroes and the length in bits fill one or two blocks
+	uint8_t tail[128] = { 0 };
+	size_t rest = length - whole;
+	memcpy(tail, data + whole, rest);
+	tail[rest] = 0x80;
+	size_t tail_length = rest < 56 ? 64 : 128;
+	uint64_t bits = (uint64_t)length * 8;
+	for (int i = 0; i < 8; ++i) {
+		tail[tail_length - 1 - i] = bits >> (i * 8);
+	}
+	for (size_t i = 0; i < tail_length; i += 64) {
+		sha1_block(state, tail + i);
+	}
+
+	for (int i = 0; i < SHA1_SIZE; ++i) {
+		digest[i] = state[i / 4] >> (24 - i % 4 * 8);
+	}
+}
+
+void sha1_hex(const uint8_t digest[SHA1_SIZE], char hex[SHA1_HEX_SIZE]) {
+	static const char digits[] = "0123456789abcdef";
+	for (int i = 0; i < SHA1_SIZE; ++i) {
+		hex[i * 2] = digits[digest[i] >> 4];
+		hex[i * 2 + 1] = digits[digest[i] & 0xF];
+	}
+	hex[SHA1_SIZE * 2] = '\0';
+}
@@ -0,0 +1,16 @@
+#ifndef SHA1_H
+#define SHA1_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// SHA-1 of whole ROMs, the key CHIP-8 ROM databases identify them by. It's
+// only used to tell files apart, not for anything security related.
+
+#define SHA1_SIZE 20
+#define SHA1_HEX_SIZE (SHA1_SIZE * 2 + 1)
+
+void sha1(const uint8_t *data, size_t length, uint8_t digest[SHA1_SIZE]);
+void sha1_hex(const uint8_t digest[SHA1_SIZE], char hex[SHA1_HEX_SIZE]);
+
+#endif // !SHA1_H
@@ -0,0 +1,163 @@
+#include "superinstructions.h"
+#include "core.h"
+#include "instructions.h"
+
+#include "sds.h"
+#include "stb_ds.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Decoded straight from the opcode bits, since this runs on every dispatch
+FusedPair fused_pair(Chip8Instruction first, Chip8Instruction second) {
+	switch (first.aformat.opcode) {
+	case OP_SE_VX_BYTE:
+	case OP_SNE_VX_BYTE:
+		return second.aformat.opcode == OP_JMP_ADDR ? FUSED_SKIP_JMP : FUSED_NONE;
+	case OP_SE_VX_VY:
+	case OP_SNE_VX_VY:
+		return first.rformat.imm == IMM_SE_VX_VY && second.aformat.opcode == OP_JMP_ADDR ?
+			       FUSED_SKIP_JMP :
+			       FUSED_NONE;
+	case OP_LD_I_ADDR:
+		return second.aformat.opcode == OP_DRW_VX_VY_NIBBLE ? FUSED_LD_I_DRW : FUSED_NONE;
+	case OP_ADD_I_VX: // Also LD Vx, DT
+		if (first.iformat.imm == IMM_ADD_I_VX && second.iformat.opcode == OP_LD_VX_I &&
+		    second.iformat.imm == IMM_LD_VX_I) {
+			return FUSED_ADD_I_LD_VX_I;
+		}
+		if (first.iformat.imm == IMM_LD_VX_DT &&
+		    (second.iformat.opcode == OP_SE_VX_BYTE ||
+		     second.iformat.opcode == OP_SNE_VX_BYTE) &&
+		    second.iformat.reg == first.iformat.reg) {
+			return FUSED_LD_DT_SKIP;
+		}
+		return FUSED_NONE;
+	default:
+		return FUSED_NONE;
+	}
+}
+
+// Type-level view of fused_pair(), for reporting
+static bool is_fused_idiom(Chip8InstructionType first, Chip8InstructionType second) {
+	switch (first) {
+	case CHIP8_SE_VX_BYTE:
+	case CHIP8_SNE_VX_BYTE:
+	case CHIP8_SE_VX_VY:
+	case CHIP8_SNE_VX_VY:
+		return second == CHIP8_JMP_ADDR;
+	case CHIP8_LD_I_ADDR:
+		return second == CHIP8_DRW_VX_VY_NIBBLE;
+	case CHIP8_ADD_I_VX:
+		return second == CHIP8_LD_VX_I;
+	case CHIP8_LD_VX_DT:
+		return second == CHIP8_SE_VX_BYTE || second == CHIP8_SNE_VX_BYTE;
+	default:
+		return false;
+	}
+}
+
+// Runs the ROM headless, with no keys pressed, counting every pair of
+// consecutively executed instructions
+void profile_pairs(PairProfile *profile, uint8_t *rom, size_t rom_size, int frames) {
+	memset(profile, 0, sizeof(*profile));
+
+	EmulatorState *emulator = calloc(1, sizeof(EmulatorState));
+	emulator->configuration = CONFIG_CHIP8;
+	emulator->cycles_per_frame = DEFAULT_CYCLES_PER_FRAME;
+
+	uint8_t *copy = malloc(rom_size);
+	memcpy(copy, rom, rom_size);
+	load_rom(emulator, copy, rom_size, NULL);
+
+	bool has_previous = false;
+	Chip8InstructionType previous = CHIP8_UNKNOWN;
+	bool absorbed = false; // Would run as the second half of a fused pair
+
+	for (int frame = 0; frame < frames; ++frame) {
+		for (int cycle = 0; cycle < CYCLES_PER_FRAME[emulator->cycles_per_frame]; ++cycle) {
+			uint16_t addr = emulator->pc & EMULATOR_ADDR_MASK;
+			Chip8Instruction instruction = fetch_next(emulator, false);
+			Chip8InstructionType type = instruction_type(instruction);
+
+			profile->instructions++;
+			if (has_previous) {
+				profile->counts[previous][type]++;
+			}
+			has_previous = true;
+			previous = type;
+
+			bool fusable = false;
+			if (absorbed) {
+				profile->fused++;
+			} else {
+				Chip8Instruction next = opcode_at(emulator->memory, emulator->pc);
+				fusable = fused_pair(instruction, next) != FUSED_NONE;
+			}
+
+			if (!execute(emulator, instruction)) {
+				goto done;
+			}
+			absorbed = fusable && emulator->pc == ((addr + 2) & EMULATOR_ADDR_MASK);
+			if (emulator->display_interrupted) {
+				break;
+			}
+		}
+		handle_timers(emulator);
+	}
+
+done:
+	free_emulator(emulator);
+	free(emulator);
+}
+
+typedef struct PairCount {
+	uint64_t count;
+	Chip8InstructionType first;
+	Chip8InstructionType second;
+} PairCount;
+
+static int compare_pair_counts(const void *a, const void *b) {
+	uint64_t count_a = ((PairCount *)a)->count;
+	uint64_t count_b = ((PairCount *)b)->count;
+	return count_a < count_b ? 1 : count_a > count_b ? -1 : 0;
+}
+
+sds pair_profile2str(PairProfile *profile, size_t max_pairs) {
+	PairCount *pairs = NULL;
+	uint64_t total = 0;
+	for (int first = 0; first <= CHIP8_UNKNOWN; ++first) {
+		for (int second = 0; second <= CHIP8_UNKNOWN; ++second) {
+			if (profile->counts[first][second]) {
+				PairCount pair = { profile->counts[first][second], first, second };
+				arrput(pairs, pair);
+				total += pair.count;
+			}
+		}
+	}
+	qsort(pairs, arrlen(pairs), sizeof(PairCount), compare_pair_counts);
+
+	uint64_t dispatches = profile->instructions - profile->fused;
+	sds out = sdscatprintf(sdsempty(),
+			       "Instructions executed: %" PRIu64 "\n"
+			       "Dispatches with fusion: %" PRIu64 " (%.2f%% fewer)\n\n"
+			       "     Count   Share  Pair (* = fused)\n",
+			       profile->instructions, dispatches,
+			       profile->instructions ?
+				       100.0 * profile->fused / profile->instructions :
+				       0.0);
+
+	for (size_t i = 0; i < (size_t)arrlen(pairs) && i < max_pairs; ++i) {
+		out = sdscatprintf(out, "%10" PRIu64 "  %5.2f%%  %c %s -> %s\n", pairs[i].count,
+				   100.0 * pairs[i].count / total,
+				   is_fused_idiom(pairs[i].first, pairs[i].second) ? '*' : ' ',
+				   instruction_form(pairs[i].first),
+				   instruction_form(pairs[i].second));
+	}
+
+	arrfree(pairs);
+	return out;
+}
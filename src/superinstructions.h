@@ -0,0 +1,30 @@
+#ifndef SUPERINSTRUCTIONS_H
+#define SUPERINSTRUCTIONS_H
+
+#include "instructions.h"
+#include "sds.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Instruction pairs the interpreter executes in a single dispatch
+typedef enum FusedPair {
+	FUSED_NONE = 0,
+	FUSED_SKIP_JMP, // SE/SNE + JMP addr
+	FUSED_LD_I_DRW, // LD I, addr + DRW Vx, Vy, nibble
+	FUSED_ADD_I_LD_VX_I, // ADD I, Vx + LD Vx, [I]
+	FUSED_LD_DT_SKIP, // LD Vx, DT + SE/SNE Vx, byte
+} FusedPair;
+
+typedef struct PairProfile {
+	// Dynamic counts of [previous][next] instruction types
+	uint64_t counts[CHIP8_UNKNOWN + 1][CHIP8_UNKNOWN + 1];
+	uint64_t instructions;
+	uint64_t fused;
+} PairProfile;
+
+FusedPair fused_pair(Chip8Instruction first, Chip8Instruction second);
+void profile_pairs(PairProfile *profile, uint8_t *rom, size_t rom_size, int frames);
+sds pair_profile2str(PairProfile *profile, size_t max_pairs);
+
+#endif // !SUPERINSTRUCTIONS_H
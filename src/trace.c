@@ -0,0 +1,209 @@
+#include "trace.h"
+#include "core.h"
+#include "instructions.h"
+#include "sds.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static inline void put16(uint8_t *out, uint16_t value) {
+	out[0] = value & 0xFF;
+	out[1] = value >> 8;
+}
+
+static inline uint16_t get16(uint8_t *in) {
+	return in[0] | in[1] << 8;
+}
+
+static void flush_buffer(TraceRecorder *recorder) {
+	if (recorder->length) {
+		fwrite(recorder->buffer, 1, recorder->length, recorder->file);
+		recorder->bytes += recorder->length;
+		recorder->length = 0;
+	}
+}
+
+TraceRecorder *trace_open(const char *path) {
+	FILE *file = fopen(path, "wb");
+	if (!file) {
+		fprintf(stderr, "[!] Failed to open trace file %s\n", path);
+		return NULL;
+	}
+
+	TraceRecorder *recorder = calloc(1, sizeof(TraceRecorder));
+	recorder->file = file;
+	memcpy(recorder->buffer, TRACE_MAGIC, 4);
+	recorder->buffer[4] = TRACE_VERSION;
+	recorder->length = 5;
+	return recorder;
+}
+
+// Remembers the state an instruction starts from. Call after fetch_next().
+void trace_begin(TraceRecorder *recorder, EmulatorState *emulator) {
+	recorder->pc = (emulator->pc - 2) & EMULATOR_ADDR_MASK;
+	recorder->vi = emulator->vi;
+	memcpy(recorder->registers, emulator->registers, sizeof(recorder->registers));
+	recorder->cycle_count = emulator->cycle_count;
+}
+
+// Records what the instruction since trace_begin() changed
+void trace_instruction(TraceRecorder *recorder, EmulatorState *emulator,
+		       Chip8Instruction instruction) {
+	// DRW waiting for the display doesn't count as executing
+	if (emulator->cycle_count == recorder->cycle_count) {
+		return;
+	}
+
+	if (recorder->length + TRACE_MAX_RECORD > TRACE_BUFFER_SIZE) {
+		flush_buffer(recorder);
+	}
+	uint8_t *record = recorder->buffer + recorder->length;
+	uint8_t *out = record + 8;
+
+	uint16_t changed = 0;
+	for (int i = 0; i < 16; ++i) {
+		if (emulator->registers[i] != recorder->registers[i]) {
+			changed |= 1 << i;
+			*out++ = emulator->registers[i];
+		}
+	}
+
+	uint8_t flags = 0;
+	if (emulator->vi != recorder->vi) {
+		flags |= TRACE_SET_I;
+		put16(out, emulator->vi);
+		out += 2;
+	}
+
+	int written = 0;
+	switch (instruction_type(instruction)) {
+	case CHIP8_LD_B_VX:
+		written = 3;
+		break;
+	case CHIP8_LD_I_VX:
+		written = instruction.iformat.reg + 1;
+		break;
+	default:
+		break;
+	}
+	if (written) {
+		flags |= TRACE_WRITE;
+		put16(out, recorder->vi & EMULATOR_ADDR_MASK);
+		out[2] = written;
+		out += 3;
+		for (int i = 0; i < written; ++i) {
+			*out++ = memory_at(emulator, recorder->vi + i);
+		}
+	}
+
+	uint64_t delta = emulator->cycle_count - recorder->last_cycle;
+	record[0] = flags;
+	record[1] = delta > UINT8_MAX ? UINT8_MAX : delta;
+	put16(record + 2, recorder->pc);
+	put16(record + 4, instruction.raw);
+	put16(record + 6, changed);
+
+	recorder->length += out - record;
+	recorder->last_cycle = emulator->cycle_count;
+	recorder->records++;
+}
+
+void trace_frame(TraceRecorder *recorder) {
+	if (recorder->length + 1 > TRACE_BUFFER_SIZE) {
+		flush_buffer(recorder);
+	}
+	recorder->buffer[recorder->length++] = TRACE_FRAME;
+}
+
+void trace_close(TraceRecorder *recorder) {
+	flush_buffer(recorder);
+	fclose(recorder->file);
+	free(recorder);
+}
+
+static bool read_exact(FILE *input, uint8_t *out, size_t length) {
+	if (fread(out, 1, length, input) != length) {
+		fprintf(stderr, "[!] Trace ends in the middle of a record\n");
+		return false;
+	}
+	return true;
+}
+
+// Renders a trace as one line per instruction, with the changes it made
+bool trace_decode(FILE *input, FILE *output) {
+	uint8_t header[5];
+	if (fread(header, 1, sizeof(header), input) != sizeof(header) ||
+	    memcmp(header, TRACE_MAGIC, 4) != 0) {
+		fprintf(stderr, "[!] Not an eo8 trace\n");
+		return false;
+	}
+	if (header[4] != TRACE_VERSION) {
+		fprintf(stderr, "[!] Unsupported trace version %hhu\n", header[4]);
+		return false;
+	}
+
+	uint64_t cycle = 0;
+	uint64_t frame = 0;
+	sds effects = sdsempty();
+	int flags;
+	while ((flags = fgetc(input)) != EOF) {
+		if (flags & TRACE_FRAME) {
+			fprintf(output, "---- frame %llu ----\n", (unsigned long long)++frame);
+			continue;
+		}
+
+		uint8_t fixed[7];
+		if (!read_exact(input, fixed, sizeof(fixed))) {
+			sdsfree(effects);
+			return false;
+		}
+		cycle += fixed[0];
+		uint16_t pc = get16(fixed + 1);
+		Chip8Instruction instruction = { .raw = get16(fixed + 3) };
+		uint16_t changed = get16(fixed + 5);
+
+		sdsclear(effects);
+		for (int i = 0; i < 16; ++i) {
+			uint8_t value;
+			if (changed & 1 << i) {
+				if (!read_exact(input, &value, 1)) {
+					sdsfree(effects);
+					return false;
+				}
+				effects = sdscatprintf(effects, " V%X = 0x%02hhx", i, value);
+			}
+		}
+
+		uint8_t extra[3];
+		if (flags & TRACE_SET_I) {
+			if (!read_exact(input, extra, 2)) {
+				sdsfree(effects);
+				return false;
+			}
+			effects = sdscatprintf(effects, " I = 0x%03hx", get16(extra));
+		}
+		if (flags & TRACE_WRITE) {
+			uint8_t bytes[16];
+			if (!read_exact(input, extra, 3) || extra[2] > sizeof(bytes) ||
+			    !read_exact(input, bytes, extra[2])) {
+				sdsfree(effects);
+				return false;
+			}
+			effects = sdscatprintf(effects, " [0x%03hx] =", get16(extra));
+			for (int i = 0; i < extra[2]; ++i) {
+				effects = sdscatprintf(effects, " %02hhx", bytes[i]);
+			}
+		}
+
+		char text[INST_TEXT_SIZE];
+		fprintf(output, "%10llu  0x%03hx  %04hx  %-*s%s\n", (unsigned long long)cycle, pc,
+			instruction.raw, sdslen(effects) ? 20 : 0, inst2text(instruction, text),
+			effects);
+	}
+
+	sdsfree(effects);
+	return true;
+}
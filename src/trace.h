@@ -0,0 +1,64 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "core.h"
+#include "instructions.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Compact binary execution traces. After a short header, each executed
+// instruction is stored as (all values little endian):
+//
+//   u8  flags         TRACE_SET_I / TRACE_WRITE
+//   u8  cycle delta   Cycles since the previous record, saturating
+//   u16 pc
+//   u16 opcode
+//   u16 changed       Bit n set if Vn changed
+//   u8  value         New value for each changed register, V0 first
+//   u16 vi            If TRACE_SET_I
+//   u16 address       If TRACE_WRITE, followed by
+//   u8  length          the number of bytes written and
+//   u8  byte            the bytes themselves
+//
+// and every timer tick as a single TRACE_FRAME byte.
+
+#define TRACE_MAGIC "EO8T"
+#define TRACE_VERSION 1
+
+#define TRACE_FRAME 0b1
+#define TRACE_SET_I 0b10
+#define TRACE_WRITE 0b100
+
+#define TRACE_BUFFER_SIZE 65536
+// Flags, delta, pc, opcode, mask, 16 registers, I, address, length, 16 bytes
+#define TRACE_MAX_RECORD (1 + 1 + 2 + 2 + 2 + 16 + 2 + 2 + 1 + 16)
+
+typedef struct TraceRecorder {
+	FILE *file;
+	uint8_t buffer[TRACE_BUFFER_SIZE];
+	size_t length;
+
+	// State before the instruction being recorded, see trace_begin()
+	uint16_t pc;
+	uint16_t vi;
+	uint8_t registers[16];
+	uint64_t cycle_count;
+
+	uint64_t last_cycle; // Cycle count at the previous record
+
+	uint64_t records;
+	uint64_t bytes;
+} TraceRecorder;
+
+TraceRecorder *trace_open(const char *path);
+void trace_begin(TraceRecorder *recorder, EmulatorState *emulator);
+void trace_instruction(TraceRecorder *recorder, EmulatorState *emulator,
+		       Chip8Instruction instruction);
+void trace_frame(TraceRecorder *recorder);
+void trace_close(TraceRecorder *recorder);
+
+bool trace_decode(FILE *input, FILE *output);
+
+#endif // !TRACE_H
@@ -0,0 +1,291 @@
+#include "value_set.h"
+#include "disassembler.h"
+#include "instructions.h"
+
+#include "stb_ds.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// Bitset of the values a byte register may hold
+typedef struct ByteSet {
+	uint64_t bits[4];
+} ByteSet;
+
+typedef struct ValueSets {
+	ByteSet registers[16];
+	bool i_known;
+	uint16_t i_low;
+	uint16_t i_high;
+	bool stores; // The run writes memory, so what it reads back isn't the ROM's
+} ValueSets;
+
+static ByteSet byte_set_all(void) {
+	ByteSet set;
+	memset(set.bits, 0xFF, sizeof(set.bits));
+	return set;
+}
+
+static void byte_set_add(ByteSet *set, uint8_t value) {
+	set->bits[value >> 6] |= 1ull << (value & 63);
+}
+
+static bool byte_set_has(const ByteSet *set, unsigned value) {
+	return set->bits[value >> 6] >> (value & 63) & 1;
+}
+
+static ByteSet byte_set_of(uint8_t value) {
+	ByteSet set = { 0 };
+	byte_set_add(&set, value);
+	return set;
+}
+
+static size_t byte_set_count(const ByteSet *set) {
+	size_t count = 0;
+	for (size_t i = 0; i < 4; ++i) {
+		count += __builtin_popcountll(set->bits[i]);
+	}
+	return count;
+}
+
+static ByteSet byte_set_union(ByteSet a, ByteSet b) {
+	for (size_t i = 0; i < 4; ++i) {
+		a.bits[i] |= b.bits[i];
+	}
+	return a;
+}
+
+// Every result of `type` applied to a value from `x` and one from `y`. When both
+// are the same register, so are the values.
+static ByteSet combine(Chip8InstructionType type, const ByteSet *x, const ByteSet *y) {
+	ByteSet result = { 0 };
+	for (unsigned a = 0; a < 256; ++a) {
+		if (!byte_set_has(x, a)) {
+			continue;
+		}
+		for (unsigned b = x == y ? a : 0; b < (x == y ? a + 1 : 256); ++b) {
+			if (!byte_set_has(y, b)) {
+				continue;
+			}
+			switch (type) {
+			case CHIP8_OR_VX_VY:
+				byte_set_add(&result, a | b);
+				break;
+			case CHIP8_AND_VX_VY:
+				byte_set_add(&result, a & b);
+				break;
+			case CHIP8_XOR_VX_VY:
+				byte_set_add(&result, a ^ b);
+				break;
+			case CHIP8_ADD_VX_VY:
+				byte_set_add(&result, a + b);
+				break;
+			case CHIP8_SUB_VX_VY:
+				byte_set_add(&result, a - b);
+				break;
+			case CHIP8_SUBN_VX_VY:
+				byte_set_add(&result, b - a);
+				break;
+			default:
+				return byte_set_all();
+			}
+		}
+		if (byte_set_count(&result) == 256) {
+			break;
+		}
+	}
+	return result;
+}
+
+static ByteSet shift(const ByteSet *set, bool left) {
+	ByteSet result = { 0 };
+	for (unsigned value = 0; value < 256; ++value) {
+		if (byte_set_has(set, value)) {
+			byte_set_add(&result, left ? value << 1 : value >> 1);
+		}
+	}
+	return result;
+}
+
+static void forget_all(ValueSets *sets) {
+	for (size_t i = 0; i < 16; ++i) {
+		sets->registers[i] = byte_set_all();
+	}
+	sets->i_known = false;
+}
+
+static void join(ValueSets *sets, const ValueSets *other) {
+	for (size_t i = 0; i < 16; ++i) {
+		sets->registers[i] = byte_set_union(sets->registers[i], other->registers[i]);
+	}
+	if (sets->i_known && other->i_known) {
+		sets->i_low = sets->i_low < other->i_low ? sets->i_low : other->i_low;
+		sets->i_high = sets->i_high > other->i_high ? sets->i_high : other->i_high;
+	} else {
+		sets->i_known = false;
+	}
+}
+
+// LD Vx, [I] from ROM bytes, if I is narrow enough and points into the ROM image
+static void load_from_rom(ValueSets *sets, uint8_t x, uint8_t *code, size_t length,
+			  uint16_t base) {
+	bool readable = !sets->stores && sets->i_known && sets->i_high - sets->i_low < 256 &&
+			sets->i_low >= base && sets->i_high + x - base < length;
+	for (uint8_t r = 0; r <= x; ++r) {
+		if (!readable) {
+			sets->registers[r] = byte_set_all();
+			continue;
+		}
+		ByteSet loaded = { 0 };
+		for (uint16_t addr = sets->i_low; addr <= sets->i_high; ++addr) {
+			byte_set_add(&loaded, code[addr + r - base]);
+		}
+		sets->registers[r] = loaded;
+	}
+	sets->i_known = false; // Some interpreters advance I
+}
+
+static void step(ValueSets *sets, Chip8Instruction instruction, uint8_t *code, size_t length,
+		 uint16_t base) {
+	uint8_t x = instruction.rformat.rx;
+	uint8_t y = instruction.rformat.ry;
+	uint8_t kk = instruction.iformat.imm;
+	ByteSet *vx = &sets->registers[x];
+	ByteSet *vf = &sets->registers[0xF];
+
+	Chip8InstructionType type = instruction_type(instruction);
+	switch (type) {
+	case CHIP8_LD_VX_BYTE:
+		*vx = byte_set_of(kk);
+		break;
+	case CHIP8_ADD_VX_BYTE: {
+		ByteSet result = { 0 };
+		for (unsigned value = 0; value < 256; ++value) {
+			if (byte_set_has(vx, value)) {
+				byte_set_add(&result, value + kk);
+			}
+		}
+		*vx = result;
+		break;
+	}
+	case CHIP8_LD_VX_VY:
+		*vx = sets->registers[y];
+		break;
+	case CHIP8_OR_VX_VY:
+	case CHIP8_AND_VX_VY:
+	case CHIP8_XOR_VX_VY:
+	case CHIP8_ADD_VX_VY:
+	case CHIP8_SUB_VX_VY:
+	case CHIP8_SUBN_VX_VY:
+		*vx = combine(type, vx, &sets->registers[y]);
+		*vf = byte_set_all();
+		break;
+	case CHIP8_SHR_VX:
+	case CHIP8_SHL_VX: {
+		// Depending on the interpreter, Vy is shifted into Vx or Vx is shifted in place
+		ByteSet shifted = byte_set_union(*vx, sets->registers[y]);
+		*vx = shift(&shifted, type == CHIP8_SHL_VX);
+		*vf = byte_set_all();
+		break;
+	}
+	case CHIP8_RND_VX_BYTE: {
+		ByteSet result = { 0 };
+		for (unsigned value = 0; value < 256; ++value) {
+			byte_set_add(&result, value & kk);
+		}
+		*vx = result;
+		break;
+	}
+	case CHIP8_DRW_VX_VY_NIBBLE:
+		*vf = byte_set_all();
+		break;
+	case CHIP8_LD_VX_DT:
+	case CHIP8_LD_VX_K:
+		*vx = byte_set_all();
+		break;
+	case CHIP8_LD_I_ADDR:
+		sets->i_known = true;
+		sets->i_low = sets->i_high = instruction.aformat.addr;
+		break;
+	case CHIP8_ADD_I_VX: {
+		int low = -1;
+		int high = -1;
+		for (int value = 0; value < 256; ++value) {
+			if (byte_set_has(vx, value)) {
+				low = low < 0 ? value : low;
+				high = value;
+			}
+		}
+		sets->i_known = sets->i_known && low >= 0 && sets->i_high + high <= 0xFFF;
+		sets->i_low += low;
+		sets->i_high += high;
+		break;
+	}
+	case CHIP8_LD_F_VX:
+	case CHIP8_LD_I_VX:
+		sets->i_known = false;
+		break;
+	case CHIP8_LD_VX_I:
+		load_from_rom(sets, x, code, length, base);
+		break;
+	case CHIP8_CALL_ADDR:
+	case CHIP8_SYS_ADDR:
+	case CHIP8_UNKNOWN:
+		forget_all(sets);
+		break;
+	default:
+		break;
+	}
+}
+
+static bool is_skip(Chip8InstructionType type) {
+	switch (type) {
+	case CHIP8_SE_VX_BYTE:
+	case CHIP8_SNE_VX_BYTE:
+	case CHIP8_SE_VX_VY:
+	case CHIP8_SNE_VX_VY:
+	case CHIP8_SKP_VX:
+	case CHIP8_SKNP_VX:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Absolute targets of the JMP V0 ending `instructions`, as an stb_ds array. NULL
+// if its offset could take more than VALUE_SET_MAX_TARGETS values.
+uint16_t *resolve_jump_table(DisassembledInstruction *instructions, size_t count, uint8_t *code,
+			     size_t length, uint16_t base) {
+	ValueSets sets;
+	forget_all(&sets);
+	sets.stores = false;
+	for (size_t i = 0; i + 1 < count; ++i) {
+		Chip8InstructionType type = instruction_type(instructions[i].instruction);
+		sets.stores = sets.stores || type == CHIP8_LD_I_VX || type == CHIP8_LD_B_VX;
+	}
+	for (size_t i = 0; i + 1 < count; ++i) {
+		bool skippable = i && is_skip(instruction_type(instructions[i - 1].instruction));
+		ValueSets before = sets;
+		step(&sets, instructions[i].instruction, code, length, base);
+		if (skippable) {
+			join(&sets, &before);
+		}
+	}
+
+	// Without the jumping quirk the core adds Vx (BXNN) instead. Those targets
+	// are left to be found at runtime.
+	Chip8Instruction jump = instructions[count - 1].instruction;
+	ByteSet offsets = sets.registers[0];
+	if (byte_set_count(&offsets) > VALUE_SET_MAX_TARGETS) {
+		return NULL;
+	}
+
+	uint16_t *targets = NULL;
+	for (unsigned offset = 0; offset < 256; ++offset) {
+		if (byte_set_has(&offsets, offset)) {
+			arrput(targets, jump.aformat.addr + offset);
+		}
+	}
+	return targets;
+}
@@ -0,0 +1,26 @@
+#ifndef VALUE_SET_H
+#define VALUE_SET_H
+
+#include "disassembler.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Value-set analysis over a single straight-line block, used to resolve where a
+// JMP V0 can go without running the ROM. Every register is tracked as the set
+// of bytes it may hold and I as a range, starting from "anything" at the top of
+// the block. Skipped instructions count as both run and not run. LD Vx, [I] only
+// reads the `length` bytes of the ROM image at `code`, and not at all if the
+// block stores to memory anywhere.
+//
+// It's best effort: control entering partway through the block, or data the
+// ROM rewrites at runtime, can make the sets wrong. Targets found this way
+// only add code to the disassembly, while the emulator still computes the real
+// jump at runtime.
+
+#define VALUE_SET_MAX_TARGETS 64
+
+uint16_t *resolve_jump_table(DisassembledInstruction *instructions, size_t count, uint8_t *code,
+			     size_t length, uint16_t base);
+
+#endif // !VALUE_SET_H